@@ -3,11 +3,32 @@
 layout(location = 0) in vec3 aPos;
 
 
+// the light camera during the shadow pass, see uniform_blocks.h.
+layout(std140, binding = 2) uniform PassBlock
+{
+    mat4 viewProjection;
+};
+
+#ifdef INSTANCED
+// transforms of the instances, see shadow.vert.
+layout(std430, binding = 0) readonly buffer InstanceBlock
+{
+    mat4 instances[];
+};
+uniform int firstInstance;
+#else
 uniform mat4 model;
+#endif
 
-uniform mat4 lightSpaceMatrix;
+// dequantization of the positions, see shadow.vert.
+uniform vec3 positionScale;
+uniform vec3 positionOffset;
 
 void main()
 {
-   gl_Position = lightSpaceMatrix * model * vec4(aPos, 1.0);
-}
\ No newline at end of file
+#ifdef INSTANCED
+   mat4 model = instances[firstInstance + gl_InstanceID];
+#endif
+   vec3 position = aPos * positionScale + positionOffset;
+   gl_Position = viewProjection * model * vec4(position, 1.0);
+}
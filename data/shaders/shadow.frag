@@ -6,12 +6,48 @@ in vec2 TexCoords;
 in vec3 FragPos;
 in vec3 Normal;
 in vec4 FragPosLightSpace;
+flat in uvec4 MaterialLayers;
+#ifdef NORMAL_MAPPING
+in mat3 TBN;
+#endif
 
 uniform sampler2D texture_diffuse1;
+// used instead of texture_diffuse1 when materialArrays is set.
+uniform sampler2DArray texture_diffuse_array;
+uniform bool materialArrays;
 uniform sampler2D shadowMap;
+#ifdef NORMAL_MAPPING
+uniform sampler2D texture_normal1;
+uniform sampler2DArray texture_normal_array;
+#endif
 
-uniform vec3 lightDir;
-uniform vec3 viewPos;
+// per frame data, see uniform_blocks.h.
+layout(std140, binding = 0) uniform FrameBlock
+{
+    mat4 view;
+    mat4 projection;
+    vec4 viewPos;
+};
+
+layout(std140, binding = 1) uniform LightBlock
+{
+    mat4 lightSpaceMatrix;
+    vec4 lightDir;
+};
+
+// the normal maps may be two channel BC5, z is rebuilt from x and y.
+vec3 SurfaceNormal()
+{
+#ifdef NORMAL_MAPPING
+    vec2 xy = (materialArrays ?
+        texture(texture_normal_array, vec3(TexCoords, MaterialLayers.z)).rg :
+        texture(texture_normal1, TexCoords).rg) * 2.0 - 1.0;
+    vec3 tangentNormal = vec3(xy, sqrt(max(1.0 - dot(xy, xy), 0.0)));
+    return normalize(TBN * tangentNormal);
+#else
+    return normalize(Normal);
+#endif
+}
 
 float ShadowCalculation(vec4 fragPosLightSpace)
 {
@@ -23,17 +59,19 @@ float ShadowCalculation(vec4 fragPosLightSpace)
     float currentDepth = projCoords.z;
 
     vec3 normal = normalize(Normal);
-    vec3 lightDir = normalize(lightDir);
+    vec3 lightDir = normalize(lightDir.xyz);
 
     float bias = max(0.05 * (1.0 - dot(normal, - lightDir)), 0.005);
 
+#ifdef SOFT_SHADOWS
+    // 3x3 percentage closer filtering.
     float shadow = 0.0;
 
     vec2 texelSize = 1.0 / textureSize(shadowMap, 0);
 
-    for(int x = -1; x < 1; ++x)
+    for(int x = -1; x <= 1; ++x)
     {
-        for(int y = -1; y < 1; ++y)
+        for(int y = -1; y <= 1; ++y)
         {
             float pcfDepth = texture(shadowMap, projCoords.xy + vec2(x, y) * texelSize).r;
             shadow += currentDepth - bias > pcfDepth ? 1.0 : 0.0;
@@ -41,6 +79,9 @@ float ShadowCalculation(vec4 fragPosLightSpace)
     }
     
     shadow /= 9.0;
+#else
+    float shadow = currentDepth - bias > closestDepth ? 1.0 : 0.0;
+#endif
 
     if(projCoords.z > 1.0)
     {
@@ -52,17 +93,19 @@ float ShadowCalculation(vec4 fragPosLightSpace)
 
 void main()
 {
-    vec3 color = texture(texture_diffuse1, TexCoords).rgb;
-    vec3 normal = normalize(Normal);
+    vec3 color = materialArrays ?
+        texture(texture_diffuse_array, vec3(TexCoords, MaterialLayers.x)).rgb :
+        texture(texture_diffuse1, TexCoords).rgb;
+    vec3 normal = SurfaceNormal();
     vec3 lightColor = vec3(0.3);
     //ambient
     vec3 ambient = 0.3 * color;
     //diffuse
-    vec3 lightDir = normalize(lightDir);
+    vec3 lightDir = normalize(lightDir.xyz);
     float diff = max(dot(- lightDir, normal), 0.0);
     vec3 diffuse = diff * lightColor;
     //specular
-    vec3 viewdir = normalize(viewPos - FragPos);
+    vec3 viewdir = normalize(viewPos.xyz - FragPos);
     vec3 reflectDir = reflect(lightDir, normal);
     float spec = 0.0;
     vec3 halfwayDir = normalize(- lightDir + viewdir);
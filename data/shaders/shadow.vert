@@ -3,23 +3,86 @@
 layout(location = 0) in vec3 aPos;
 layout(location = 1) in vec3 aNormal;
 layout(location = 2) in vec2 aTexCoords;
+#ifdef NORMAL_MAPPING
 layout(location = 3) in vec3 aTangeant;
+#endif
+// layers of the diffuse, specular, normal and emission textures when the
+// model packs its materials in texture arrays.
+layout(location = 4) in uvec4 aMaterialLayers;
 
 out vec2 TexCoords;
 out vec3 Normal;
 out vec3 FragPos;
 out vec4 FragPosLightSpace;
+flat out uvec4 MaterialLayers;
+#ifdef NORMAL_MAPPING
+// tangent space to world space.
+out mat3 TBN;
+#endif
 
+// per pass and light data, see uniform_blocks.h.
+layout(std140, binding = 2) uniform PassBlock
+{
+    mat4 viewProjection;
+};
+
+layout(std140, binding = 1) uniform LightBlock
+{
+    mat4 lightSpaceMatrix;
+    vec4 lightDir;
+};
+
+#ifdef INSTANCED
+// world transforms of the instances, see instance_buffer.h. The instances
+// of a draw start at firstInstance.
+layout(std430, binding = 0) readonly buffer InstanceBlock
+{
+    mat4 instances[];
+};
+uniform int firstInstance;
+#else
 uniform mat4 model;
-uniform mat4 projection;
-uniform mat4 view;
-uniform mat4 lightSpaceMatrix;
+// transpose(inverse(mat3(model))), computed once per object on the CPU, see
+// transform_store.h.
+uniform mat3 normalMatrix;
+#endif
+
+// quantized vertices store positions in [-1, 1] inside the mesh bounds and
+// octahedral normals, full float vertices use a scale of 1 and an offset of 0.
+uniform vec3 positionScale;
+uniform vec3 positionOffset;
+uniform bool octahedralNormals;
+
+vec3 OctahedralDecode(vec2 e)
+{
+    vec3 n = vec3(e.xy, 1.0 - abs(e.x) - abs(e.y));
+    float t = max(-n.z, 0.0);
+    n.x += n.x >= 0.0 ? -t : t;
+    n.y += n.y >= 0.0 ? -t : t;
+    return normalize(n);
+}
 
 void main()
 {
-    FragPos = vec3(model * vec4(aPos, 1.0f));
-    Normal = transpose(inverse(mat3(model))) * aNormal;
+#ifdef INSTANCED
+    mat4 model = instances[firstInstance + gl_InstanceID];
+    // the scattered instances are only rotated and uniformly scaled, the
+    // scale of their normals is removed by normalize.
+    mat3 normalMatrix = mat3(model);
+#endif
+    vec3 position = aPos * positionScale + positionOffset;
+    vec3 normal = octahedralNormals ? OctahedralDecode(aNormal.xy) : aNormal;
+    FragPos = vec3(model * vec4(position, 1.0f));
+    Normal = normalMatrix * normal;
+#ifdef NORMAL_MAPPING
+    vec3 tangent = octahedralNormals ? OctahedralDecode(aTangeant.xy) : aTangeant;
+    vec3 N = normalize(Normal);
+    vec3 T = normalize(mat3(model) * tangent);
+    T = normalize(T - dot(T, N) * N);
+    TBN = mat3(T, cross(N, T), N);
+#endif
     TexCoords = aTexCoords;
+    MaterialLayers = aMaterialLayers;
     FragPosLightSpace = lightSpaceMatrix * vec4(FragPos, 1.0f);
-    gl_Position = projection * view * model * vec4(aPos, 1.0f);
-}
\ No newline at end of file
+    gl_Position = viewProjection * model * vec4(position, 1.0f);
+}
@@ -6,13 +6,18 @@ out vec3 TexCoords;
 out vec3 Normal;
 out vec3 Position;
 
-uniform mat4 model;
-uniform mat4 projection;
-uniform mat4 view;
+// per frame data, see uniform_blocks.h.
+layout(std140, binding = 0) uniform FrameBlock
+{
+    mat4 view;
+    mat4 projection;
+    vec4 viewPos;
+};
 
 void main()
 {
     TexCoords = aPos;
-    vec4 pos = projection * view * vec4(aPos, 1.0f);
+    // the sky follows the camera, only the rotation of the view is kept.
+    vec4 pos = projection * mat4(mat3(view)) * vec4(aPos, 1.0f);
     gl_Position = pos.xyww;
 }
\ No newline at end of file
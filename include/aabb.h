@@ -0,0 +1,124 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <glm/glm.hpp>
+
+namespace gl {
+
+	// Axis aligned bounding box. The default box is empty, growing it by a
+	// point or a box makes it the smallest box containing both.
+	struct Aabb
+	{
+		glm::vec3 min = glm::vec3(std::numeric_limits<float>::max());
+		glm::vec3 max = glm::vec3(std::numeric_limits<float>::lowest());
+
+		static Aabb FromCenterExtent(const glm::vec3& center, const glm::vec3& extent)
+		{
+			return { center - extent, center + extent };
+		}
+
+		bool Empty() const
+		{
+			return min.x > max.x || min.y > max.y || min.z > max.z;
+		}
+
+		void Grow(const glm::vec3& point)
+		{
+			min = glm::min(min, point);
+			max = glm::max(max, point);
+		}
+
+		void Grow(const Aabb& box)
+		{
+			min = glm::min(min, box.min);
+			max = glm::max(max, box.max);
+		}
+
+		glm::vec3 Center() const
+		{
+			return (min + max) * 0.5f;
+		}
+
+		glm::vec3 Extent() const
+		{
+			return (max - min) * 0.5f;
+		}
+
+		// 0 for an empty box, the SAH weights the children with it.
+		float SurfaceArea() const
+		{
+			if (Empty())
+			{
+				return 0.0f;
+			}
+			const glm::vec3 size = max - min;
+			return 2.0f * (size.x * size.y + size.y * size.z + size.z * size.x);
+		}
+
+		bool Intersects(const Aabb& box) const
+		{
+			return min.x <= box.max.x && box.min.x <= max.x &&
+				min.y <= box.max.y && box.min.y <= max.y &&
+				min.z <= box.max.z && box.min.z <= max.z;
+		}
+
+		bool IntersectsSphere(const glm::vec3& center, float radius) const
+		{
+			const glm::vec3 closest = glm::clamp(center, min, max);
+			const glm::vec3 offset = center - closest;
+			return glm::dot(offset, offset) <= radius * radius;
+		}
+
+		// slab test, distance is where the ray enters the box, 0 when it
+		// starts inside. inverseDirection is 1 / direction per axis.
+		bool IntersectsRay(
+			const glm::vec3& origin,
+			const glm::vec3& inverseDirection,
+			float maxDistance,
+			float& distance) const
+		{
+			float enter = 0.0f;
+			float leave = maxDistance;
+			for (int axis = 0; axis < 3; ++axis)
+			{
+				float t0 = (min[axis] - origin[axis]) * inverseDirection[axis];
+				float t1 = (max[axis] - origin[axis]) * inverseDirection[axis];
+				if (t0 > t1)
+				{
+					std::swap(t0, t1);
+				}
+				// a NaN from 0 * inf keeps the previous bounds.
+				enter = t0 > enter ? t0 : enter;
+				leave = t1 < leave ? t1 : leave;
+				if (enter > leave)
+				{
+					return false;
+				}
+			}
+			distance = enter;
+			return true;
+		}
+
+		// the box around this one placed with transform.
+		Aabb Transformed(const glm::mat4& transform) const
+		{
+			if (Empty())
+			{
+				return {};
+			}
+			const glm::vec3 center(transform * glm::vec4(Center(), 1.0f));
+			const glm::vec3 extent = Extent();
+			glm::vec3 worldExtent(0.0f);
+			for (int column = 0; column < 3; ++column)
+			{
+				worldExtent += glm::abs(glm::vec3(transform[column])) * extent[column];
+			}
+			return FromCenterExtent(center, worldExtent);
+		}
+
+		bool operator==(const Aabb&) const = default;
+	};
+
+} // End namespace gl.
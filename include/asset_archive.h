@@ -0,0 +1,377 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <span>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "hash.h"
+#include "mapped_file.h"
+
+namespace gl {
+
+	// Every file under a directory packed into one file, mapped once and
+	// read through spans into the mapping. Paths are stored relative to the
+	// directory containing the archive, "data/shaders/shadow.vert" for an
+	// archive built from data/ into data.pak.
+	//
+	// Layout:
+	//     Header
+	//     Entry[entryCount], sorted by path hash then path
+	//     paths
+	//     file contents, each aligned on DATA_ALIGNMENT
+	class AssetArchive
+	{
+	public:
+		static constexpr std::uint32_t VERSION = 1;
+
+		bool Open(const std::string& archivePath)
+		{
+			entries_ = {};
+			if (!file_.Open(archivePath))
+			{
+				return false;
+			}
+			if (!Parse())
+			{
+				entries_ = {};
+				file_.Close();
+				return false;
+			}
+			return true;
+		}
+
+		// path relative to the archive directory, in normalized generic
+		// form. contents points into the mapping.
+		bool Find(std::string_view path, std::span<const std::byte>& contents) const
+		{
+			const std::uint64_t hash = Fnv1a64(path);
+			auto entry = std::lower_bound(
+				entries_.begin(),
+				entries_.end(),
+				hash,
+				[](const Entry& entry, std::uint64_t hash)
+				{
+					return entry.pathHash < hash;
+				});
+			for (; entry != entries_.end() && entry->pathHash == hash; ++entry)
+			{
+				if (EntryPath(*entry) == path)
+				{
+					contents = { file_.Data() + entry->dataOffset, entry->size };
+					return true;
+				}
+			}
+			return false;
+		}
+
+		std::size_t FileCount() const
+		{
+			return entries_.size();
+		}
+
+		// packs every regular file under directory, except the temporary
+		// files of the caches, into archivePath.
+		static bool Build(const std::string& directory, const std::string& archivePath)
+		{
+			namespace fs = std::filesystem;
+			const fs::path root = fs::path(archivePath).parent_path();
+			std::error_code error;
+			std::error_code canonicalError;
+			const fs::path archiveFile = fs::weakly_canonical(archivePath, canonicalError);
+
+			struct Source
+			{
+				fs::path file;
+				std::string path;
+				std::uint64_t size = 0;
+			};
+			std::vector<Source> sources;
+			for (const auto& entry : fs::recursive_directory_iterator(directory, error))
+			{
+				if (!entry.is_regular_file() ||
+					entry.path().extension() == ".tmp" ||
+					fs::weakly_canonical(entry.path(), canonicalError) == archiveFile)
+				{
+					continue;
+				}
+				sources.push_back({
+					entry.path(),
+					NormalizePath(entry.path().lexically_relative(root.empty() ? fs::path(".") : root)),
+					entry.file_size() });
+			}
+			if (error)
+			{
+				return false;
+			}
+			std::sort(sources.begin(), sources.end(), [](const Source& a, const Source& b)
+			{
+				const std::uint64_t hashA = Fnv1a64(a.path);
+				const std::uint64_t hashB = Fnv1a64(b.path);
+				return hashA != hashB ? hashA < hashB : a.path < b.path;
+			});
+
+			Header header{};
+			std::memcpy(header.magic, MAGIC, sizeof(header.magic));
+			header.version = VERSION;
+			header.entryCount = static_cast<std::uint32_t>(sources.size());
+
+			std::vector<Entry> entries(sources.size());
+			std::string paths;
+			for (std::size_t i = 0; i < sources.size(); ++i)
+			{
+				entries[i].pathHash = Fnv1a64(sources[i].path);
+				entries[i].pathOffset = paths.size();
+				entries[i].pathLength = static_cast<std::uint32_t>(sources[i].path.size());
+				paths += sources[i].path;
+			}
+			const std::uint64_t pathStart = sizeof(Header) + entries.size() * sizeof(Entry);
+			std::uint64_t offset = pathStart + paths.size();
+			for (std::size_t i = 0; i < sources.size(); ++i)
+			{
+				entries[i].pathOffset += pathStart;
+				offset = Align(offset);
+				entries[i].dataOffset = offset;
+				entries[i].size = sources[i].size;
+				offset += sources[i].size;
+			}
+
+			return WriteFileAtomically(archivePath, [&](FileWriter& writer)
+			{
+				writer.Write(&header, sizeof(header));
+				writer.Write(entries.data(), entries.size() * sizeof(Entry));
+				writer.Write(paths.data(), paths.size());
+				for (std::size_t i = 0; i < sources.size(); ++i)
+				{
+					writer.PadTo(entries[i].dataOffset);
+					MappedFile source(sources[i].file.string());
+					if (!source.IsOpen() || source.Size() != sources[i].size)
+					{
+						return false;
+					}
+					writer.Write(source.Data(), source.Size());
+				}
+				return true;
+			});
+		}
+
+		static std::string NormalizePath(const std::filesystem::path& path)
+		{
+			return path.lexically_normal().generic_string();
+		}
+
+	private:
+		static constexpr char MAGIC[4] = { 'G', 'P', 'A', 'K' };
+		static constexpr std::uint64_t DATA_ALIGNMENT = 16;
+
+		struct Header
+		{
+			char magic[4];
+			std::uint32_t version;
+			std::uint32_t entryCount;
+			std::uint32_t reserved;
+		};
+
+		struct Entry
+		{
+			std::uint64_t pathHash = 0;
+			std::uint64_t pathOffset = 0;
+			std::uint64_t dataOffset = 0;
+			std::uint64_t size = 0;
+			std::uint32_t pathLength = 0;
+			std::uint32_t reserved = 0;
+		};
+
+		static std::uint64_t Align(std::uint64_t offset)
+		{
+			return (offset + DATA_ALIGNMENT - 1) & ~(DATA_ALIGNMENT - 1);
+		}
+
+		bool InBounds(std::uint64_t offset, std::uint64_t size) const
+		{
+			return offset <= file_.Size() && size <= file_.Size() - offset;
+		}
+
+		std::string_view EntryPath(const Entry& entry) const
+		{
+			return {
+				reinterpret_cast<const char*>(file_.Data() + entry.pathOffset),
+				entry.pathLength };
+		}
+
+		bool Parse()
+		{
+			if (!InBounds(0, sizeof(Header)))
+			{
+				return false;
+			}
+			Header header;
+			std::memcpy(&header, file_.Data(), sizeof(header));
+			if (std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 ||
+				header.version != VERSION ||
+				!InBounds(sizeof(Header), std::uint64_t(header.entryCount) * sizeof(Entry)))
+			{
+				return false;
+			}
+
+			// the index is used in place, the mapping is page aligned and
+			// the entries follow the 16 byte header.
+			entries_ = {
+				reinterpret_cast<const Entry*>(file_.Data() + sizeof(Header)),
+				header.entryCount };
+			for (const Entry& entry : entries_)
+			{
+				if (!InBounds(entry.pathOffset, entry.pathLength) ||
+					!InBounds(entry.dataOffset, entry.size))
+				{
+					return false;
+				}
+			}
+			return true;
+		}
+
+		MappedFile file_;
+		std::span<const Entry> entries_;
+	};
+
+	// Contents of one asset, either a view into a mounted archive or a
+	// loose file mapped on its own. Keeps the archive alive.
+	class AssetFile
+	{
+	public:
+		AssetFile() = default;
+
+		bool IsOpen() const { return isOpen_; }
+		explicit operator bool() const { return isOpen_; }
+		const std::byte* Data() const { return bytes_.data(); }
+		std::size_t Size() const { return bytes_.size(); }
+		std::span<const std::byte> Bytes() const { return bytes_; }
+		std::string_view Text() const
+		{
+			return { reinterpret_cast<const char*>(bytes_.data()), bytes_.size() };
+		}
+
+	private:
+		friend class AssetFileSystem;
+
+		std::shared_ptr<const AssetArchive> archive_;
+		MappedFile looseFile_;
+		std::span<const std::byte> bytes_;
+		bool isOpen_ = false;
+	};
+
+	// Process wide virtual file system: the mounted archives are searched
+	// first, in mount order, then the disk. Safe to use from the worker
+	// threads.
+	class AssetFileSystem
+	{
+	public:
+		static AssetFileSystem& Global()
+		{
+			static AssetFileSystem fileSystem;
+			return fileSystem;
+		}
+
+		// paths are looked up relative to the directory of the archive,
+		// the same way they are stored by AssetArchive::Build.
+		bool Mount(const std::string& archivePath)
+		{
+			auto archive = std::make_shared<AssetArchive>();
+			if (!archive->Open(archivePath))
+			{
+				return false;
+			}
+			std::filesystem::path root = std::filesystem::path(archivePath).parent_path();
+			std::unique_lock lock(mutex_);
+			mounts_.push_back({ root.empty() ? std::filesystem::path(".") : root, std::move(archive) });
+			return true;
+		}
+
+		// files already opened keep their archive mapped.
+		void UnmountAll()
+		{
+			std::unique_lock lock(mutex_);
+			mounts_.clear();
+		}
+
+		AssetFile Open(const std::string& path) const
+		{
+			AssetFile file;
+			if (FindInArchives(path, file))
+			{
+				return file;
+			}
+			return OpenLoose(path);
+		}
+
+		// the file on the disk even when an archive has one at that path,
+		// for the caches the program writes itself.
+		AssetFile OpenLoose(const std::string& path) const
+		{
+			AssetFile file;
+			if (file.looseFile_.Open(path))
+			{
+				file.bytes_ = file.looseFile_.Bytes();
+				file.isOpen_ = true;
+			}
+			return file;
+		}
+
+		// the file comes from a mounted archive rather than the disk.
+		bool IsArchived(const std::string& path) const
+		{
+			AssetFile file;
+			return FindInArchives(path, file);
+		}
+
+		bool Exists(const std::string& path) const
+		{
+			std::error_code error;
+			return IsArchived(path) || std::filesystem::is_regular_file(path, error);
+		}
+
+	private:
+		struct MountedArchive
+		{
+			std::filesystem::path root;
+			std::shared_ptr<const AssetArchive> archive;
+		};
+
+		AssetFileSystem() = default;
+
+		bool FindInArchives(const std::string& path, AssetFile& file) const
+		{
+			std::shared_lock lock(mutex_);
+			for (const MountedArchive& mount : mounts_)
+			{
+				const std::string relative = AssetArchive::NormalizePath(
+					std::filesystem::path(path).lexically_normal().lexically_relative(mount.root));
+				if (relative.empty() || relative.starts_with(".."))
+				{
+					continue;
+				}
+				std::span<const std::byte> contents;
+				if (mount.archive->Find(relative, contents))
+				{
+					file.archive_ = mount.archive;
+					file.bytes_ = contents;
+					file.isOpen_ = true;
+					return true;
+				}
+			}
+			return false;
+		}
+
+		mutable std::shared_mutex mutex_;
+		std::vector<MountedArchive> mounts_;
+	};
+
+} // End namespace gl.
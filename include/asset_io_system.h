@@ -0,0 +1,126 @@
+#pragma once
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <utility>
+#include <assimp/IOStream.hpp>
+#include <assimp/IOSystem.hpp>
+
+#include "asset_archive.h"
+
+namespace gl {
+
+	// Read only Assimp stream over an AssetFile, reads are copies straight
+	// out of the mapping.
+	class AssetIOStream : public Assimp::IOStream
+	{
+	public:
+		explicit AssetIOStream(AssetFile file) :
+			file_(std::move(file))
+		{
+		}
+
+		size_t Read(void* buffer, size_t size, size_t count) override
+		{
+			if (size == 0)
+			{
+				return 0;
+			}
+			count = std::min(count, (file_.Size() - position_) / size);
+			std::memcpy(buffer, file_.Data() + position_, size * count);
+			position_ += size * count;
+			return count;
+		}
+
+		size_t Write(const void*, size_t, size_t) override
+		{
+			return 0;
+		}
+
+		aiReturn Seek(size_t offset, aiOrigin origin) override
+		{
+			std::size_t position = offset;
+			if (origin == aiOrigin_CUR)
+			{
+				position += position_;
+			}
+			else if (origin == aiOrigin_END)
+			{
+				if (offset > file_.Size())
+				{
+					return aiReturn_FAILURE;
+				}
+				position = file_.Size() - offset;
+			}
+			if (position > file_.Size())
+			{
+				return aiReturn_FAILURE;
+			}
+			position_ = position;
+			return aiReturn_SUCCESS;
+		}
+
+		size_t Tell() const override
+		{
+			return position_;
+		}
+
+		size_t FileSize() const override
+		{
+			return file_.Size();
+		}
+
+		void Flush() override
+		{
+		}
+
+	private:
+		AssetFile file_;
+		std::size_t position_ = 0;
+	};
+
+	// Lets Assimp open the model and the files it references (materials,
+	// embedded buffers) through the AssetFileSystem.
+	class AssetIOSystem : public Assimp::IOSystem
+	{
+	public:
+		explicit AssetIOSystem(const AssetFileSystem& fileSystem = AssetFileSystem::Global()) :
+			fileSystem_(fileSystem)
+		{
+		}
+
+		bool Exists(const char* path) const override
+		{
+			return fileSystem_.Exists(path);
+		}
+
+		char getOsSeparator() const override
+		{
+			return '/';
+		}
+
+		Assimp::IOStream* Open(const char* path, const char* mode = "rb") override
+		{
+			if (std::strchr(mode, 'w') || std::strchr(mode, 'a'))
+			{
+				return nullptr;
+			}
+			AssetFile file = fileSystem_.Open(path);
+			if (!file)
+			{
+				return nullptr;
+			}
+			return new AssetIOStream(std::move(file));
+		}
+
+		void Close(Assimp::IOStream* stream) override
+		{
+			delete stream;
+		}
+
+	private:
+		const AssetFileSystem& fileSystem_;
+	};
+
+} // End namespace gl.
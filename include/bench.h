@@ -0,0 +1,63 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <vector>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "frustum.h"
+
+namespace gl {
+
+	// Median time of a function over a number of runs, for the benches of
+	// main that need no GL context.
+	class BenchTimer
+	{
+	public:
+		explicit BenchTimer(int iterations) :
+			iterations_(std::max(iterations, 1))
+		{
+		}
+
+		// in milliseconds.
+		template<typename Function>
+		double Time(Function&& function) const
+		{
+			std::vector<double> timings;
+			for (int i = 0; i < iterations_; ++i)
+			{
+				const auto start = clock::now();
+				function();
+				timings.push_back(std::chrono::duration<double, std::milli>(clock::now() - start).count());
+			}
+			std::sort(timings.begin(), timings.end());
+			return timings[timings.size() / 2];
+		}
+
+	private:
+		using clock = std::chrono::high_resolution_clock;
+
+		int iterations_;
+	};
+
+	// the camera of the culling benches, looking at the origin from
+	// above the boxes.
+	inline Frustum BenchCameraFrustum()
+	{
+		const glm::vec3 eye(0.0f, 10.0f, 50.0f);
+		return Frustum(
+			glm::perspective(glm::radians(45.0f), 16.0f / 9.0f, 0.1f, 300.0f) *
+			glm::lookAt(eye, glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f)));
+	}
+
+	// the directional light of the culling benches, a small ortho box.
+	inline Frustum BenchLightFrustum()
+	{
+		const glm::vec3 lightDir = glm::normalize(glm::vec3(-1.0f, -1.0f, 1.0f));
+		return Frustum(
+			glm::ortho(-50.0f, 50.0f, -50.0f, 50.0f, 1.0f, 100.0f) *
+			glm::lookAt(-50.0f * lightDir, glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f)));
+	}
+
+} // End namespace gl.
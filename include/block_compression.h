@@ -0,0 +1,516 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+
+namespace gl {
+
+	// CPU encoders for the BCn block formats, used by texcook. Every
+	// encoder takes a 4x4 block of RGBA8 texels in row order and writes one
+	// compressed block. They aim for a good quality in a single fast pass
+	// (principal axis fit plus one least squares refinement) rather than an
+	// exhaustive search.
+	namespace bc {
+
+		using Block = std::array<std::array<std::uint8_t, 4>, 16>;
+
+		constexpr std::size_t BC1_BLOCK_SIZE = 8;
+		constexpr std::size_t BC3_BLOCK_SIZE = 16;
+		constexpr std::size_t BC4_BLOCK_SIZE = 8;
+		constexpr std::size_t BC5_BLOCK_SIZE = 16;
+		constexpr std::size_t BC7_BLOCK_SIZE = 16;
+
+		namespace detail {
+
+			struct Vec4
+			{
+				float v[4] = {};
+
+				float& operator[](int i) { return v[i]; }
+				float operator[](int i) const { return v[i]; }
+			};
+
+			inline float Dot(const Vec4& a, const Vec4& b, int channels)
+			{
+				float sum = 0.0f;
+				for (int c = 0; c < channels; ++c)
+				{
+					sum += a[c] * b[c];
+				}
+				return sum;
+			}
+
+			// endpoints along the principal axis of the first channels of the
+			// block, found by power iteration on the covariance matrix.
+			inline void PrincipalEndpoints(
+				const Block& block,
+				int channels,
+				Vec4& minPoint,
+				Vec4& maxPoint)
+			{
+				Vec4 mean;
+				for (const auto& texel : block)
+				{
+					for (int c = 0; c < channels; ++c)
+					{
+						mean[c] += texel[c];
+					}
+				}
+				for (int c = 0; c < channels; ++c)
+				{
+					mean[c] /= 16.0f;
+				}
+
+				float covariance[4][4] = {};
+				for (const auto& texel : block)
+				{
+					for (int i = 0; i < channels; ++i)
+					{
+						for (int j = 0; j < channels; ++j)
+						{
+							covariance[i][j] += (texel[i] - mean[i]) * (texel[j] - mean[j]);
+						}
+					}
+				}
+
+				Vec4 axis;
+				for (int c = 0; c < channels; ++c)
+				{
+					axis[c] = 1.0f;
+				}
+				for (int iteration = 0; iteration < 8; ++iteration)
+				{
+					Vec4 next;
+					for (int i = 0; i < channels; ++i)
+					{
+						for (int j = 0; j < channels; ++j)
+						{
+							next[i] += covariance[i][j] * axis[j];
+						}
+					}
+					const float length = std::sqrt(Dot(next, next, channels));
+					if (length < 1e-6f)
+					{
+						break;
+					}
+					for (int c = 0; c < channels; ++c)
+					{
+						axis[c] = next[c] / length;
+					}
+				}
+
+				float minProjection = std::numeric_limits<float>::max();
+				float maxProjection = std::numeric_limits<float>::lowest();
+				for (const auto& texel : block)
+				{
+					Vec4 offset;
+					for (int c = 0; c < channels; ++c)
+					{
+						offset[c] = texel[c] - mean[c];
+					}
+					const float projection = Dot(offset, axis, channels);
+					minProjection = std::min(minProjection, projection);
+					maxProjection = std::max(maxProjection, projection);
+				}
+				for (int c = 0; c < channels; ++c)
+				{
+					minPoint[c] = std::clamp(mean[c] + axis[c] * minProjection, 0.0f, 255.0f);
+					maxPoint[c] = std::clamp(mean[c] + axis[c] * maxProjection, 0.0f, 255.0f);
+				}
+			}
+
+			// least squares endpoints for fixed interpolation weights in
+			// [0, 1], keeps the input endpoints when the system is singular.
+			inline void RefineEndpoints(
+				const Block& block,
+				int channels,
+				const float* weights,
+				Vec4& e0,
+				Vec4& e1)
+			{
+				float aa = 0.0f;
+				float ab = 0.0f;
+				float bb = 0.0f;
+				Vec4 ax;
+				Vec4 bx;
+				for (std::size_t i = 0; i < 16; ++i)
+				{
+					const float b = weights[i];
+					const float a = 1.0f - b;
+					aa += a * a;
+					ab += a * b;
+					bb += b * b;
+					for (int c = 0; c < channels; ++c)
+					{
+						ax[c] += a * block[i][c];
+						bx[c] += b * block[i][c];
+					}
+				}
+				const float determinant = aa * bb - ab * ab;
+				if (std::abs(determinant) < 1e-6f)
+				{
+					return;
+				}
+				for (int c = 0; c < channels; ++c)
+				{
+					e0[c] = std::clamp((bb * ax[c] - ab * bx[c]) / determinant, 0.0f, 255.0f);
+					e1[c] = std::clamp((aa * bx[c] - ab * ax[c]) / determinant, 0.0f, 255.0f);
+				}
+			}
+
+			inline std::uint16_t PackRgb565(const Vec4& colour)
+			{
+				const int r = static_cast<int>(std::lround(colour[0] * 31.0f / 255.0f));
+				const int g = static_cast<int>(std::lround(colour[1] * 63.0f / 255.0f));
+				const int b = static_cast<int>(std::lround(colour[2] * 31.0f / 255.0f));
+				return static_cast<std::uint16_t>((r << 11) | (g << 5) | b);
+			}
+
+			inline Vec4 UnpackRgb565(std::uint16_t packed)
+			{
+				const int r = (packed >> 11) & 31;
+				const int g = (packed >> 5) & 63;
+				const int b = packed & 31;
+				Vec4 colour;
+				colour[0] = static_cast<float>((r << 3) | (r >> 2));
+				colour[1] = static_cast<float>((g << 2) | (g >> 4));
+				colour[2] = static_cast<float>((b << 3) | (b >> 2));
+				return colour;
+			}
+
+			inline float Distance(const Vec4& a, const std::array<std::uint8_t, 4>& texel, int channels)
+			{
+				float sum = 0.0f;
+				for (int c = 0; c < channels; ++c)
+				{
+					const float delta = a[c] - texel[c];
+					sum += delta * delta;
+				}
+				return sum;
+			}
+
+			// four colour BC1 block for the given endpoints, returns the
+			// squared error.
+			inline float EncodeColour(
+				const Block& block,
+				std::uint16_t colour0,
+				std::uint16_t colour1,
+				std::uint8_t* out)
+			{
+				if (colour0 < colour1)
+				{
+					std::swap(colour0, colour1);
+				}
+				std::uint32_t indices = 0;
+				float error = 0.0f;
+				if (colour0 != colour1)
+				{
+					const Vec4 e0 = UnpackRgb565(colour0);
+					const Vec4 e1 = UnpackRgb565(colour1);
+					Vec4 palette[4] = { e0, e1 };
+					for (int c = 0; c < 3; ++c)
+					{
+						palette[2][c] = (2.0f * e0[c] + e1[c]) / 3.0f;
+						palette[3][c] = (e0[c] + 2.0f * e1[c]) / 3.0f;
+					}
+					for (std::size_t i = 0; i < 16; ++i)
+					{
+						std::uint32_t best = 0;
+						float bestError = std::numeric_limits<float>::max();
+						for (std::uint32_t p = 0; p < 4; ++p)
+						{
+							const float distance = Distance(palette[p], block[i], 3);
+							if (distance < bestError)
+							{
+								bestError = distance;
+								best = p;
+							}
+						}
+						indices |= best << (2 * i);
+						error += bestError;
+					}
+				}
+				else
+				{
+					const Vec4 e0 = UnpackRgb565(colour0);
+					for (std::size_t i = 0; i < 16; ++i)
+					{
+						error += Distance(e0, block[i], 3);
+					}
+				}
+				out[0] = static_cast<std::uint8_t>(colour0 & 0xff);
+				out[1] = static_cast<std::uint8_t>(colour0 >> 8);
+				out[2] = static_cast<std::uint8_t>(colour1 & 0xff);
+				out[3] = static_cast<std::uint8_t>(colour1 >> 8);
+				std::memcpy(out + 4, &indices, sizeof(indices));
+				return error;
+			}
+
+			// weights of the BC1 four colour palette entries.
+			inline float ColourWeight(std::uint32_t index)
+			{
+				constexpr float weights[4] = { 0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f };
+				return weights[index];
+			}
+
+		} // End namespace detail.
+
+		// opaque BC1, four colour mode only so it can also be used as the
+		// colour half of BC3.
+		inline void EncodeBc1(const Block& block, std::uint8_t* out)
+		{
+			detail::Vec4 minPoint;
+			detail::Vec4 maxPoint;
+			detail::PrincipalEndpoints(block, 3, minPoint, maxPoint);
+			std::uint8_t candidate[BC1_BLOCK_SIZE];
+			float error = detail::EncodeColour(
+				block,
+				detail::PackRgb565(maxPoint),
+				detail::PackRgb565(minPoint),
+				out);
+
+			// refit the endpoints to the chosen indices once.
+			std::uint32_t indices;
+			std::memcpy(&indices, out + 4, sizeof(indices));
+			const std::uint16_t colour0 = static_cast<std::uint16_t>(out[0] | (out[1] << 8));
+			const std::uint16_t colour1 = static_cast<std::uint16_t>(out[2] | (out[3] << 8));
+			if (colour0 == colour1)
+			{
+				return;
+			}
+			float weights[16];
+			for (std::size_t i = 0; i < 16; ++i)
+			{
+				weights[i] = detail::ColourWeight((indices >> (2 * i)) & 3);
+			}
+			detail::Vec4 e0 = detail::UnpackRgb565(colour0);
+			detail::Vec4 e1 = detail::UnpackRgb565(colour1);
+			detail::RefineEndpoints(block, 3, weights, e0, e1);
+			const float refinedError = detail::EncodeColour(
+				block,
+				detail::PackRgb565(e0),
+				detail::PackRgb565(e1),
+				candidate);
+			if (refinedError < error)
+			{
+				std::memcpy(out, candidate, BC1_BLOCK_SIZE);
+			}
+		}
+
+		// single channel block, eight value mode.
+		inline void EncodeBc4(const Block& block, int channel, std::uint8_t* out)
+		{
+			std::uint8_t minValue = 255;
+			std::uint8_t maxValue = 0;
+			for (const auto& texel : block)
+			{
+				minValue = std::min(minValue, texel[channel]);
+				maxValue = std::max(maxValue, texel[channel]);
+			}
+			out[0] = maxValue;
+			out[1] = minValue;
+			std::uint64_t indices = 0;
+			if (maxValue != minValue)
+			{
+				float palette[8];
+				palette[0] = maxValue;
+				palette[1] = minValue;
+				for (int p = 1; p < 7; ++p)
+				{
+					palette[p + 1] = ((7 - p) * maxValue + p * minValue) / 7.0f;
+				}
+				for (std::size_t i = 0; i < 16; ++i)
+				{
+					std::uint64_t best = 0;
+					float bestError = std::numeric_limits<float>::max();
+					for (std::uint64_t p = 0; p < 8; ++p)
+					{
+						const float error = std::abs(palette[p] - block[i][channel]);
+						if (error < bestError)
+						{
+							bestError = error;
+							best = p;
+						}
+					}
+					indices |= best << (3 * i);
+				}
+			}
+			for (int byte = 0; byte < 6; ++byte)
+			{
+				out[2 + byte] = static_cast<std::uint8_t>(indices >> (8 * byte));
+			}
+		}
+
+		// BC4 alpha followed by a BC1 colour block.
+		inline void EncodeBc3(const Block& block, std::uint8_t* out)
+		{
+			EncodeBc4(block, 3, out);
+			EncodeBc1(block, out + BC4_BLOCK_SIZE);
+		}
+
+		// two BC4 blocks for red and green, used for tangent space normal
+		// maps whose z is rebuilt in the shader.
+		inline void EncodeBc5(const Block& block, std::uint8_t* out)
+		{
+			EncodeBc4(block, 0, out);
+			EncodeBc4(block, 1, out + BC4_BLOCK_SIZE);
+		}
+
+		// BC7 mode 6: one subset, RGBA endpoints of 7 bits plus a p bit
+		// each and 4 bit indices.
+		inline void EncodeBc7(const Block& block, std::uint8_t* out)
+		{
+			constexpr int weights[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+			struct Endpoint
+			{
+				int value[4];
+				int pbit;
+			};
+			// best 7 bit value and p bit shared by the four channels.
+			auto quantize = [](const detail::Vec4& point)
+			{
+				Endpoint best{};
+				float bestError = std::numeric_limits<float>::max();
+				for (int pbit = 0; pbit < 2; ++pbit)
+				{
+					Endpoint endpoint{};
+					endpoint.pbit = pbit;
+					float error = 0.0f;
+					for (int c = 0; c < 4; ++c)
+					{
+						const int value = std::clamp(
+							static_cast<int>(std::lround((point[c] - pbit) / 2.0f)),
+							0,
+							127);
+						endpoint.value[c] = value;
+						const float delta = static_cast<float>((value << 1) | pbit) - point[c];
+						error += delta * delta;
+					}
+					if (error < bestError)
+					{
+						bestError = error;
+						best = endpoint;
+					}
+				}
+				return best;
+			};
+			auto expand = [](const Endpoint& endpoint, int c)
+			{
+				return (endpoint.value[c] << 1) | endpoint.pbit;
+			};
+
+			auto encode = [&](const detail::Vec4& point0, const detail::Vec4& point1, std::uint8_t* block7, int* chosen)
+			{
+				Endpoint e0 = quantize(point0);
+				Endpoint e1 = quantize(point1);
+				float error = 0.0f;
+				for (std::size_t i = 0; i < 16; ++i)
+				{
+					int best = 0;
+					float bestError = std::numeric_limits<float>::max();
+					for (int w = 0; w < 16; ++w)
+					{
+						float distance = 0.0f;
+						for (int c = 0; c < 4; ++c)
+						{
+							const int value =
+								((64 - weights[w]) * expand(e0, c) + weights[w] * expand(e1, c) + 32) >> 6;
+							const float delta = static_cast<float>(value - block[i][c]);
+							distance += delta * delta;
+						}
+						if (distance < bestError)
+						{
+							bestError = distance;
+							best = w;
+						}
+					}
+					chosen[i] = best;
+					error += bestError;
+				}
+				// the anchor index is stored without its top bit.
+				if (chosen[0] >= 8)
+				{
+					std::swap(e0, e1);
+					for (std::size_t i = 0; i < 16; ++i)
+					{
+						chosen[i] = 15 - chosen[i];
+					}
+				}
+
+				std::memset(block7, 0, BC7_BLOCK_SIZE);
+				int bit = 0;
+				auto write = [block7, &bit](std::uint32_t value, int count)
+				{
+					for (int b = 0; b < count; ++b, ++bit)
+					{
+						block7[bit >> 3] |= static_cast<std::uint8_t>(((value >> b) & 1u) << (bit & 7));
+					}
+				};
+				write(1u << 6, 7);
+				for (int c = 0; c < 4; ++c)
+				{
+					write(static_cast<std::uint32_t>(e0.value[c]), 7);
+					write(static_cast<std::uint32_t>(e1.value[c]), 7);
+				}
+				write(static_cast<std::uint32_t>(e0.pbit), 1);
+				write(static_cast<std::uint32_t>(e1.pbit), 1);
+				for (std::size_t i = 0; i < 16; ++i)
+				{
+					write(static_cast<std::uint32_t>(chosen[i]), i == 0 ? 3 : 4);
+				}
+				return error;
+			};
+
+			detail::Vec4 minPoint;
+			detail::Vec4 maxPoint;
+			detail::PrincipalEndpoints(block, 4, minPoint, maxPoint);
+			int chosen[16];
+			const float error = encode(minPoint, maxPoint, out, chosen);
+
+			// refit once, the swap above may have exchanged the endpoints
+			// so the weights are taken from the encoded order.
+			float fit[16];
+			for (std::size_t i = 0; i < 16; ++i)
+			{
+				fit[i] = weights[chosen[i]] / 64.0f;
+			}
+			// read the endpoints back from the block for the refit.
+			detail::Vec4 e0;
+			detail::Vec4 e1;
+			{
+				auto read = [out](int first, int count)
+				{
+					std::uint32_t value = 0;
+					for (int b = 0; b < count; ++b)
+					{
+						const int bit = first + b;
+						value |= static_cast<std::uint32_t>((out[bit >> 3] >> (bit & 7)) & 1u) << b;
+					}
+					return value;
+				};
+				const std::uint32_t pbit0 = read(63, 1);
+				const std::uint32_t pbit1 = read(64, 1);
+				for (int c = 0; c < 4; ++c)
+				{
+					e0[c] = static_cast<float>((read(7 + c * 14, 7) << 1) | pbit0);
+					e1[c] = static_cast<float>((read(14 + c * 14, 7) << 1) | pbit1);
+				}
+			}
+			detail::RefineEndpoints(block, 4, fit, e0, e1);
+			std::uint8_t candidate[BC7_BLOCK_SIZE];
+			int refinedChosen[16];
+			if (encode(e0, e1, candidate, refinedChosen) < error)
+			{
+				std::memcpy(out, candidate, BC7_BLOCK_SIZE);
+			}
+		}
+
+	} // End namespace bc.
+
+} // End namespace gl.
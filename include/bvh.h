@@ -0,0 +1,470 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <numeric>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "aabb.h"
+#include "frustum.h"
+
+namespace gl {
+
+	// Bounding volume hierarchy over the boxes of a fixed set of objects,
+	// identified by their index in the span given to Build. It is built
+	// top down with a binned surface area heuristic. Moving an object
+	// refits the boxes on the path to the root only, which keeps the
+	// queries correct but lets the tree degrade as objects travel.
+	// NeedsRebuild compares the current SAH cost with the cost after the
+	// build.
+	class Bvh
+	{
+	public:
+		static constexpr std::uint32_t NO_OBJECT = ~0u;
+		// a leaf never holds more objects.
+		static constexpr std::uint32_t MAX_LEAF_SIZE = 4;
+
+		struct RayHit
+		{
+			std::uint32_t object = NO_OBJECT;
+			float distance = std::numeric_limits<float>::max();
+
+			explicit operator bool() const { return object != NO_OBJECT; }
+		};
+
+		// SAH cost growth since the last build after which NeedsRebuild
+		// is true.
+		float rebuildRatio = 1.5f;
+
+		void Build(std::span<const Aabb> bounds)
+		{
+			bounds_.assign(bounds.begin(), bounds.end());
+			Rebuild();
+		}
+
+		// new tree over the current bounds.
+		void Rebuild()
+		{
+			nodes_.clear();
+			objects_.resize(bounds_.size());
+			std::iota(objects_.begin(), objects_.end(), 0u);
+			leafOf_.assign(bounds_.size(), NO_NODE);
+			buildCost_ = 0.0f;
+			if (bounds_.empty())
+			{
+				return;
+			}
+
+			std::vector<glm::vec3> centroids(bounds_.size());
+			for (std::size_t i = 0; i < bounds_.size(); ++i)
+			{
+				centroids[i] = bounds_[i].Center();
+			}
+			nodes_.reserve(2 * bounds_.size());
+			nodes_.push_back({ {}, 0, static_cast<std::uint32_t>(bounds_.size()), NO_NODE });
+			std::vector<std::uint32_t> pending = { 0 };
+			while (!pending.empty())
+			{
+				const std::uint32_t node = pending.back();
+				pending.pop_back();
+				Split(node, centroids, pending);
+			}
+			buildCost_ = Cost();
+		}
+
+		// moves an object and refits the boxes above it, up to the first
+		// one that does not change.
+		void Update(std::uint32_t object, const Aabb& bounds)
+		{
+			if (object >= bounds_.size())
+			{
+				throw std::out_of_range("No BVH object " + std::to_string(object));
+			}
+			bounds_[object] = bounds;
+			for (std::uint32_t node = leafOf_[object]; node != NO_NODE; node = nodes_[node].parent)
+			{
+				const Aabb refit = NodeBounds(nodes_[node]);
+				if (refit == nodes_[node].bounds)
+				{
+					break;
+				}
+				nodes_[node].bounds = refit;
+			}
+		}
+
+		// expected cost of a query relative to testing the root box, one
+		// pass over the nodes.
+		float Cost() const
+		{
+			if (nodes_.empty() || nodes_[0].bounds.SurfaceArea() <= 0.0f)
+			{
+				return 0.0f;
+			}
+			float cost = 0.0f;
+			for (const Node& node : nodes_)
+			{
+				cost += node.bounds.SurfaceArea() * (node.IsLeaf() ? node.count : TRAVERSAL_COST);
+			}
+			return cost / nodes_[0].bounds.SurfaceArea();
+		}
+
+		bool NeedsRebuild() const
+		{
+			return Cost() > buildCost_ * rebuildRatio;
+		}
+
+		std::size_t ObjectCount() const { return bounds_.size(); }
+		std::size_t NodeCount() const { return nodes_.size(); }
+		const Aabb& Bounds(std::uint32_t object) const { return bounds_[object]; }
+
+		// visit(object) for every object whose box intersects the frustum,
+		// the subtrees fully inside it are reported without more tests.
+		template<typename Visit>
+		void QueryFrustum(const Frustum& frustum, Visit&& visit) const
+		{
+			if (nodes_.empty())
+			{
+				return;
+			}
+			// the second member is set when the node is inside the frustum.
+			std::vector<std::pair<std::uint32_t, bool>> stack = { { 0, false } };
+			while (!stack.empty())
+			{
+				const auto [index, inside] = stack.back();
+				stack.pop_back();
+				const Node& node = nodes_[index];
+				bool nodeInside = inside;
+				if (!inside)
+				{
+					const glm::vec3 center = node.bounds.Center();
+					const glm::vec3 extent = node.bounds.Extent();
+					if (!frustum.IntersectsBox(center, extent))
+					{
+						continue;
+					}
+					nodeInside = frustum.ContainsBox(center, extent);
+				}
+				if (!node.IsLeaf())
+				{
+					stack.push_back({ node.first, nodeInside });
+					stack.push_back({ node.first + 1, nodeInside });
+					continue;
+				}
+				for (std::uint32_t i = node.first; i < node.first + node.count; ++i)
+				{
+					const Aabb& bounds = bounds_[objects_[i]];
+					if (nodeInside || frustum.IntersectsBox(bounds.Center(), bounds.Extent()))
+					{
+						visit(objects_[i]);
+					}
+				}
+			}
+		}
+
+		template<typename Visit>
+		void QuerySphere(const glm::vec3& center, float radius, Visit&& visit) const
+		{
+			Query(
+				[&](const Aabb& bounds) { return bounds.IntersectsSphere(center, radius); },
+				visit);
+		}
+
+		template<typename Visit>
+		void QueryBox(const Aabb& box, Visit&& visit) const
+		{
+			Query(
+				[&](const Aabb& bounds) { return bounds.Intersects(box); },
+				visit);
+		}
+
+		// closest object along the ray, closer than maxDistance.
+		// intersect(object, maxDistance) returns the distance of the hit on
+		// the object, or a negative value when the ray misses it. The
+		// children closer to the origin are visited first so the far ones
+		// are mostly skipped.
+		template<typename Intersect>
+		RayHit Raycast(
+			const glm::vec3& origin,
+			const glm::vec3& direction,
+			float maxDistance,
+			Intersect&& intersect) const
+		{
+			RayHit hit;
+			hit.distance = maxDistance;
+			if (nodes_.empty())
+			{
+				return hit;
+			}
+			const glm::vec3 inverseDirection = 1.0f / direction;
+			float distance = 0.0f;
+			if (!nodes_[0].bounds.IntersectsRay(origin, inverseDirection, hit.distance, distance))
+			{
+				return hit;
+			}
+			std::vector<std::pair<std::uint32_t, float>> stack = { { 0, distance } };
+			while (!stack.empty())
+			{
+				const auto [index, entry] = stack.back();
+				stack.pop_back();
+				if (entry > hit.distance)
+				{
+					continue;
+				}
+				const Node& node = nodes_[index];
+				if (node.IsLeaf())
+				{
+					for (std::uint32_t i = node.first; i < node.first + node.count; ++i)
+					{
+						const std::uint32_t object = objects_[i];
+						if (!bounds_[object].IntersectsRay(origin, inverseDirection, hit.distance, distance))
+						{
+							continue;
+						}
+						const float objectDistance = intersect(object, hit.distance);
+						if (objectDistance >= 0.0f && objectDistance <= hit.distance)
+						{
+							hit.object = object;
+							hit.distance = objectDistance;
+						}
+					}
+					continue;
+				}
+				float leftEntry = 0.0f;
+				float rightEntry = 0.0f;
+				const bool left = nodes_[node.first].bounds.IntersectsRay(
+					origin, inverseDirection, hit.distance, leftEntry);
+				const bool right = nodes_[node.first + 1].bounds.IntersectsRay(
+					origin, inverseDirection, hit.distance, rightEntry);
+				// the closer child goes on top of the stack.
+				if (left && right && leftEntry < rightEntry)
+				{
+					stack.push_back({ node.first + 1, rightEntry });
+					stack.push_back({ node.first, leftEntry });
+				}
+				else
+				{
+					if (left)
+					{
+						stack.push_back({ node.first, leftEntry });
+					}
+					if (right)
+					{
+						stack.push_back({ node.first + 1, rightEntry });
+					}
+				}
+			}
+			return hit;
+		}
+
+		// the object boxes are the hits.
+		RayHit Raycast(const glm::vec3& origin, const glm::vec3& direction, float maxDistance) const
+		{
+			const glm::vec3 inverseDirection = 1.0f / direction;
+			return Raycast(origin, direction, maxDistance, [&](std::uint32_t object, float distance)
+			{
+				float entry = 0.0f;
+				return bounds_[object].IntersectsRay(origin, inverseDirection, distance, entry) ? entry : -1.0f;
+			});
+		}
+
+	private:
+		static constexpr std::uint32_t NO_NODE = ~0u;
+		static constexpr std::size_t BIN_COUNT = 16;
+		// cost of visiting an inner node relative to testing an object.
+		static constexpr float TRAVERSAL_COST = 1.0f;
+
+		struct Node
+		{
+			Aabb bounds;
+			// inner nodes: first child, the second one follows it. Leaves:
+			// first of their objects in objects_.
+			std::uint32_t first = 0;
+			// objects of a leaf, 0 for an inner node.
+			std::uint32_t count = 0;
+			std::uint32_t parent = NO_NODE;
+
+			bool IsLeaf() const { return count > 0; }
+		};
+
+		struct Bin
+		{
+			Aabb bounds;
+			std::uint32_t count = 0;
+		};
+
+		Aabb NodeBounds(const Node& node) const
+		{
+			Aabb bounds;
+			if (node.IsLeaf())
+			{
+				for (std::uint32_t i = node.first; i < node.first + node.count; ++i)
+				{
+					bounds.Grow(bounds_[objects_[i]]);
+				}
+				return bounds;
+			}
+			bounds.Grow(nodes_[node.first].bounds);
+			bounds.Grow(nodes_[node.first + 1].bounds);
+			return bounds;
+		}
+
+		// visit(object) for every object whose box passes test, below
+		// every node passing it.
+		template<typename Test, typename Visit>
+		void Query(Test&& test, Visit&& visit) const
+		{
+			if (nodes_.empty())
+			{
+				return;
+			}
+			std::vector<std::uint32_t> stack = { 0 };
+			while (!stack.empty())
+			{
+				const Node& node = nodes_[stack.back()];
+				stack.pop_back();
+				if (!test(node.bounds))
+				{
+					continue;
+				}
+				if (!node.IsLeaf())
+				{
+					stack.push_back(node.first);
+					stack.push_back(node.first + 1);
+					continue;
+				}
+				for (std::uint32_t i = node.first; i < node.first + node.count; ++i)
+				{
+					if (test(bounds_[objects_[i]]))
+					{
+						visit(objects_[i]);
+					}
+				}
+			}
+		}
+
+		// the node holds objects_[first, first + count) when called, it is
+		// turned into an inner node when a split is cheaper than the leaf
+		// or the leaf would be too big, its children are then pending.
+		void Split(
+			std::uint32_t index,
+			const std::vector<glm::vec3>& centroids,
+			std::vector<std::uint32_t>& pending)
+		{
+			const std::uint32_t first = nodes_[index].first;
+			const std::uint32_t count = nodes_[index].count;
+			Aabb nodeBounds;
+			Aabb centroidBounds;
+			for (std::uint32_t i = first; i < first + count; ++i)
+			{
+				nodeBounds.Grow(bounds_[objects_[i]]);
+				centroidBounds.Grow(centroids[objects_[i]]);
+				leafOf_[objects_[i]] = index;
+			}
+			nodes_[index].bounds = nodeBounds;
+			if (count <= 1)
+			{
+				return;
+			}
+
+			const glm::vec3 size = centroidBounds.max - centroidBounds.min;
+			int axis = 0;
+			if (size.y > size[axis])
+			{
+				axis = 1;
+			}
+			if (size.z > size[axis])
+			{
+				axis = 2;
+			}
+
+			std::uint32_t middle = first + count / 2;
+			if (size[axis] > 0.0f)
+			{
+				const float binScale = BIN_COUNT / size[axis];
+				const auto binOf = [&](std::uint32_t object)
+				{
+					const float offset = centroids[object][axis] - centroidBounds.min[axis];
+					return std::min(static_cast<std::size_t>(offset * binScale), BIN_COUNT - 1);
+				};
+				std::array<Bin, BIN_COUNT> bins;
+				for (std::uint32_t i = first; i < first + count; ++i)
+				{
+					Bin& bin = bins[binOf(objects_[i])];
+					bin.bounds.Grow(bounds_[objects_[i]]);
+					++bin.count;
+				}
+
+				// cost of every split between two bins, from both sides.
+				std::array<float, BIN_COUNT - 1> leftCosts;
+				Aabb left;
+				std::uint32_t leftCount = 0;
+				for (std::size_t bin = 0; bin + 1 < BIN_COUNT; ++bin)
+				{
+					left.Grow(bins[bin].bounds);
+					leftCount += bins[bin].count;
+					leftCosts[bin] = left.SurfaceArea() * leftCount;
+				}
+				float bestCost = std::numeric_limits<float>::max();
+				std::size_t bestSplit = 0;
+				Aabb right;
+				std::uint32_t rightCount = 0;
+				for (std::size_t bin = BIN_COUNT - 1; bin > 0; --bin)
+				{
+					right.Grow(bins[bin].bounds);
+					rightCount += bins[bin].count;
+					const float cost = leftCosts[bin - 1] + right.SurfaceArea() * rightCount;
+					if (rightCount > 0 && rightCount < count && cost < bestCost)
+					{
+						bestCost = cost;
+						bestSplit = bin;
+					}
+				}
+
+				const float area = nodeBounds.SurfaceArea();
+				const float splitCost = TRAVERSAL_COST + (area > 0.0f ? bestCost / area : 0.0f);
+				if (count <= MAX_LEAF_SIZE && splitCost >= static_cast<float>(count))
+				{
+					return;
+				}
+				middle = static_cast<std::uint32_t>(std::partition(
+					objects_.begin() + first,
+					objects_.begin() + first + count,
+					[&](std::uint32_t object) { return binOf(object) < bestSplit; }) - objects_.begin());
+			}
+			else if (count <= MAX_LEAF_SIZE)
+			{
+				return;
+			}
+			// all the centroids in one point: halves by count.
+			if (middle == first || middle == first + count)
+			{
+				middle = first + count / 2;
+			}
+
+			const std::uint32_t child = static_cast<std::uint32_t>(nodes_.size());
+			nodes_[index].first = child;
+			nodes_[index].count = 0;
+			nodes_.push_back({ {}, first, middle - first, index });
+			nodes_.push_back({ {}, middle, first + count - middle, index });
+			pending.push_back(child);
+			pending.push_back(child + 1);
+		}
+
+		std::vector<Aabb> bounds_;
+		std::vector<Node> nodes_;
+		// object indices, the objects of a leaf are consecutive.
+		std::vector<std::uint32_t> objects_;
+		// leaf holding every object.
+		std::vector<std::uint32_t> leafOf_;
+		float buildCost_ = 0.0f;
+	};
+
+} // End namespace gl.
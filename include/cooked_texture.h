@@ -0,0 +1,383 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <span>
+#include <string>
+#include <vector>
+
+#include <glad/glad.h>
+
+#include "asset_archive.h"
+#include "block_compression.h"
+#include "mapped_file.h"
+#include "texture_cache.h"
+
+namespace gl {
+
+	enum class BlockFormat : std::uint32_t
+	{
+		// rgb, 1 bit alpha at most, 8 bytes per block.
+		BC1,
+		// rgb with interpolated alpha, 16 bytes per block.
+		BC3,
+		// two independent channels, for normal maps, 16 bytes per block.
+		BC5,
+		// high quality rgba, 16 bytes per block.
+		BC7
+	};
+
+	inline std::size_t BlockBytes(BlockFormat format)
+	{
+		return format == BlockFormat::BC1 ? bc::BC1_BLOCK_SIZE : bc::BC7_BLOCK_SIZE;
+	}
+
+	inline std::size_t CompressedLevelBytes(
+		BlockFormat format,
+		std::uint32_t width,
+		std::uint32_t height)
+	{
+		const std::size_t blocksX = (std::size_t(width) + 3) / 4;
+		const std::size_t blocksY = (std::size_t(height) + 3) / 4;
+		return blocksX * blocksY * BlockBytes(format);
+	}
+
+	// GL internal format of the blocks, sRGB decoding only exists for the
+	// colour formats.
+	inline GLenum CompressedInternalFormat(BlockFormat format, ColourSpace colourSpace)
+	{
+		// from EXT_texture_compression_s3tc(_srgb), ARB_texture_compression_rgtc
+		// and ARB_texture_compression_bptc, not all exposed by the loader.
+		constexpr GLenum RGBA_S3TC_DXT1 = 0x83F1;
+		constexpr GLenum SRGB_ALPHA_S3TC_DXT1 = 0x8C4D;
+		constexpr GLenum RGBA_S3TC_DXT5 = 0x83F3;
+		constexpr GLenum SRGB_ALPHA_S3TC_DXT5 = 0x8C4F;
+		constexpr GLenum RG_RGTC2 = 0x8DBD;
+		constexpr GLenum RGBA_BPTC_UNORM = 0x8E8C;
+		constexpr GLenum SRGB_ALPHA_BPTC_UNORM = 0x8E8D;
+
+		const bool srgb = colourSpace == ColourSpace::SRGB;
+		switch (format)
+		{
+		case BlockFormat::BC1:
+			return srgb ? SRGB_ALPHA_S3TC_DXT1 : RGBA_S3TC_DXT1;
+		case BlockFormat::BC3:
+			return srgb ? SRGB_ALPHA_S3TC_DXT5 : RGBA_S3TC_DXT5;
+		case BlockFormat::BC5:
+			return RG_RGTC2;
+		case BlockFormat::BC7:
+		default:
+			return srgb ? SRGB_ALPHA_BPTC_UNORM : RGBA_BPTC_UNORM;
+		}
+	}
+
+	// Block compressed texture with its full mip chain, written by texcook
+	// next to the source image and read through the asset file system at
+	// load time so the blocks go straight to glCompressedTexImage2D.
+	//
+	// Layout:
+	//     Header
+	//     LevelRecord[levelCount]
+	//     level blocks, each aligned on DATA_ALIGNMENT
+	class CookedTexture
+	{
+	public:
+		static constexpr std::uint32_t VERSION = 1;
+		static constexpr char EXTENSION[] = ".gtex";
+
+		static std::string CookedPath(const std::string& sourcePath)
+		{
+			return sourcePath + EXTENSION;
+		}
+
+		bool Open(const std::string& path)
+		{
+			levels_.clear();
+			file_ = AssetFileSystem::Global().Open(path);
+			if (!file_)
+			{
+				return false;
+			}
+			if (!Parse())
+			{
+				levels_.clear();
+				file_ = AssetFile();
+				return false;
+			}
+			return true;
+		}
+
+		BlockFormat Format() const { return format_; }
+		// the mips were filtered in linear space from sRGB data.
+		bool IsSrgb() const { return srgb_; }
+		// the source image had an alpha channel.
+		bool HasAlpha() const { return alpha_; }
+		std::uint32_t Width() const { return width_; }
+		std::uint32_t Height() const { return height_; }
+		std::size_t LevelCount() const { return levels_.size(); }
+		std::span<const std::byte> LevelData(std::size_t level) const
+		{
+			return levels_[level];
+		}
+
+		std::size_t ByteSize() const
+		{
+			std::size_t bytes = 0;
+			for (std::span<const std::byte> level : levels_)
+			{
+				bytes += level.size();
+			}
+			return bytes;
+		}
+
+		// levels[0] is width x height, every next level halves both sizes
+		// down to 1x1.
+		static bool Write(
+			const std::string& path,
+			BlockFormat format,
+			bool srgb,
+			bool alpha,
+			std::uint32_t width,
+			std::uint32_t height,
+			const std::vector<std::vector<std::uint8_t>>& levels)
+		{
+			Header header{};
+			std::memcpy(header.magic, MAGIC, sizeof(header.magic));
+			header.version = VERSION;
+			header.format = static_cast<std::uint32_t>(format);
+			header.width = width;
+			header.height = height;
+			header.levelCount = static_cast<std::uint32_t>(levels.size());
+			header.flags = (srgb ? FLAG_SRGB : 0) | (alpha ? FLAG_ALPHA : 0);
+
+			std::vector<LevelRecord> records(levels.size());
+			std::uint64_t offset = sizeof(Header) + records.size() * sizeof(LevelRecord);
+			for (std::size_t i = 0; i < levels.size(); ++i)
+			{
+				offset = Align(offset);
+				records[i].offset = offset;
+				records[i].size = levels[i].size();
+				offset += levels[i].size();
+			}
+
+			return WriteFileAtomically(path, [&](FileWriter& writer)
+			{
+				writer.Write(&header, sizeof(header));
+				writer.Write(records.data(), records.size() * sizeof(LevelRecord));
+				for (std::size_t i = 0; i < levels.size(); ++i)
+				{
+					writer.PadTo(records[i].offset);
+					writer.Write(levels[i].data(), levels[i].size());
+				}
+				return true;
+			});
+		}
+
+	private:
+		static constexpr char MAGIC[4] = { 'G', 'T', 'E', 'X' };
+		static constexpr std::uint64_t DATA_ALIGNMENT = 16;
+		static constexpr std::uint32_t FLAG_SRGB = 1;
+		static constexpr std::uint32_t FLAG_ALPHA = 2;
+
+		struct Header
+		{
+			char magic[4];
+			std::uint32_t version;
+			std::uint32_t format;
+			std::uint32_t width;
+			std::uint32_t height;
+			std::uint32_t levelCount;
+			std::uint32_t flags;
+			std::uint32_t reserved;
+		};
+
+		struct LevelRecord
+		{
+			std::uint64_t offset = 0;
+			std::uint64_t size = 0;
+		};
+
+		static std::uint64_t Align(std::uint64_t offset)
+		{
+			return (offset + DATA_ALIGNMENT - 1) & ~(DATA_ALIGNMENT - 1);
+		}
+
+		bool InBounds(std::uint64_t offset, std::uint64_t size) const
+		{
+			return offset <= file_.Size() && size <= file_.Size() - offset;
+		}
+
+		bool Parse()
+		{
+			if (!InBounds(0, sizeof(Header)))
+			{
+				return false;
+			}
+			Header header;
+			std::memcpy(&header, file_.Data(), sizeof(header));
+			if (std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 ||
+				header.version != VERSION ||
+				header.format > static_cast<std::uint32_t>(BlockFormat::BC7) ||
+				header.width == 0 ||
+				header.height == 0 ||
+				header.levelCount == 0 ||
+				header.levelCount > 32)
+			{
+				return false;
+			}
+			if (!InBounds(sizeof(Header), std::uint64_t(header.levelCount) * sizeof(LevelRecord)))
+			{
+				return false;
+			}
+
+			format_ = static_cast<BlockFormat>(header.format);
+			srgb_ = (header.flags & FLAG_SRGB) != 0;
+			alpha_ = (header.flags & FLAG_ALPHA) != 0;
+			width_ = header.width;
+			height_ = header.height;
+
+			const std::byte* base = file_.Data();
+			levels_.resize(header.levelCount);
+			for (std::uint32_t i = 0; i < header.levelCount; ++i)
+			{
+				LevelRecord record;
+				std::memcpy(
+					&record,
+					base + sizeof(Header) + i * sizeof(LevelRecord),
+					sizeof(record));
+				const std::uint64_t expected = CompressedLevelBytes(
+					format_,
+					std::max(width_ >> i, 1u),
+					std::max(height_ >> i, 1u));
+				if (record.size != expected || !InBounds(record.offset, record.size))
+				{
+					return false;
+				}
+				levels_[i] = { base + record.offset, record.size };
+			}
+			return true;
+		}
+
+		AssetFile file_;
+		BlockFormat format_ = BlockFormat::BC1;
+		bool srgb_ = false;
+		bool alpha_ = false;
+		std::uint32_t width_ = 0;
+		std::uint32_t height_ = 0;
+		std::vector<std::span<const std::byte>> levels_;
+	};
+
+	// the cooked version of an image is used unless it is older than the
+	// source and has to be cooked again. Archives are built from a cooked
+	// tree so their .gtex files are always used.
+	inline bool HasCookedTexture(const std::string& sourcePath)
+	{
+		const std::string cookedPath = CookedTexture::CookedPath(sourcePath);
+		if (AssetFileSystem::Global().IsArchived(cookedPath))
+		{
+			return true;
+		}
+		std::error_code error;
+		const auto cookedTime = std::filesystem::last_write_time(cookedPath, error);
+		if (error)
+		{
+			return false;
+		}
+		const auto sourceTime = std::filesystem::last_write_time(sourcePath, error);
+		return error || sourceTime <= cookedTime;
+	}
+
+	inline bool OpenCookedTexture(const std::string& sourcePath, CookedTexture& cooked)
+	{
+		return HasCookedTexture(sourcePath) &&
+			cooked.Open(CookedTexture::CookedPath(sourcePath));
+	}
+
+	// uploads every level of the chain to the currently bound texture, target
+	// is GL_TEXTURE_2D or a cube map face. Returns the uploaded size.
+	inline std::size_t UploadCookedLevels(
+		const CookedTexture& cooked,
+		ColourSpace colourSpace,
+		GLenum target)
+	{
+		const GLenum internalFormat = CompressedInternalFormat(cooked.Format(), colourSpace);
+		for (std::size_t level = 0; level < cooked.LevelCount(); ++level)
+		{
+			const std::span<const std::byte> data = cooked.LevelData(level);
+			glCompressedTexImage2D(
+				target,
+				static_cast<GLint>(level),
+				internalFormat,
+				static_cast<GLsizei>(std::max(cooked.Width() >> level, 1u)),
+				static_cast<GLsizei>(std::max(cooked.Height() >> level, 1u)),
+				0,
+				static_cast<GLsizei>(data.size()),
+				data.data());
+		}
+		return cooked.ByteSize();
+	}
+
+	// counterpart of UploadTexture for cooked images, no decode and no
+	// glGenerateMipmap. Must be called on the thread owning the GL context.
+	inline unsigned int UploadCookedTexture(const CookedTexture& cooked, ColourSpace colourSpace)
+	{
+		unsigned int textureID;
+		glGenTextures(1, &textureID);
+		GlState::Global().BindTexture(0, GL_TEXTURE_2D, textureID);
+
+		UploadCookedLevels(cooked, colourSpace, GL_TEXTURE_2D);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, static_cast<GLint>(cooked.LevelCount() - 1));
+
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+		return textureID;
+	}
+
+	// cube map from six cooked faces in the order of LoadCubeMap, returns 0
+	// unless every face is cooked and they all match.
+	inline unsigned int LoadCookedCubeMap(const std::vector<std::string>& faces)
+	{
+		std::vector<CookedTexture> cookedFaces(faces.size());
+		for (std::size_t i = 0; i < faces.size(); ++i)
+		{
+			if (!OpenCookedTexture(faces[i], cookedFaces[i]) ||
+				cookedFaces[i].Format() != cookedFaces[0].Format() ||
+				cookedFaces[i].Width() != cookedFaces[0].Width() ||
+				cookedFaces[i].Height() != cookedFaces[0].Height() ||
+				cookedFaces[i].LevelCount() != cookedFaces[0].LevelCount())
+			{
+				return 0;
+			}
+		}
+		if (cookedFaces.empty())
+		{
+			return 0;
+		}
+
+		unsigned int textureID;
+		glGenTextures(1, &textureID);
+		GlState::Global().BindTexture(0, GL_TEXTURE_CUBE_MAP, textureID);
+		for (std::size_t i = 0; i < cookedFaces.size(); ++i)
+		{
+			UploadCookedLevels(
+				cookedFaces[i],
+				ColourSpace::SRGB,
+				static_cast<GLenum>(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i));
+		}
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAX_LEVEL, static_cast<GLint>(cookedFaces[0].LevelCount() - 1));
+
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+
+		return textureID;
+	}
+
+} // End namespace gl.
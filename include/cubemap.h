@@ -8,6 +8,9 @@
 
 #include "shader.h"
 #include "camera.h"
+#include "cooked_texture.h"
+#include "gl_handle.h"
+#include "gl_state.h"
 #include "texture.h"
 
 namespace gl
@@ -18,41 +21,42 @@ namespace gl
 
 		Cubemap(std::vector<std::string>& faces)
 		{
-			texture_ = LoadCubeMap(faces);
-
-			glGenVertexArrays(1, &VAO_);
-			glGenBuffers(1, &VBO_);
-			glBindVertexArray(VAO_);
-			glBindBuffer(GL_ARRAY_BUFFER, VBO_);
+			texture_.Reset(LoadCookedCubeMap(faces));
+			if (!texture_)
+			{
+				texture_.Reset(LoadCubeMap(faces));
+			}
+
+			VAO_ = GlVertexArray::Create();
+			VBO_ = GlBuffer::Create();
+			GlState& state = GlState::Global();
+			state.BindVertexArray(VAO_.Get());
+			state.BindBuffer(GL_ARRAY_BUFFER, VBO_.Get());
 			glBufferData(GL_ARRAY_BUFFER, sizeof(skyboxVertices), &skyboxVertices, GL_STATIC_DRAW);
 			glEnableVertexAttribArray(0);
 			glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
+			state.BindVertexArray(0);
 		}
 
-		void Draw(std::unique_ptr<Shader>& cubemapShaders, glm::mat4& view, glm::mat4& projection, std::unique_ptr<Camera>& camera)
+		// the view and projection come from the frame uniform block.
+		void Draw(std::unique_ptr<Shader>& cubemapShaders)
 		{
-			glDepthFunc(GL_LEQUAL);
+			GlState& state = GlState::Global();
+			state.DepthFunc(GL_LEQUAL);
 
 			cubemapShaders->Use();
 
-			view = glm::mat4(glm::mat3(camera->GetViewMatrix()));
-
-			cubemapShaders->SetMat4("view", view);
-			cubemapShaders->SetMat4("projection", projection);
-
-			glBindVertexArray(VAO_);
-			glActiveTexture(GL_TEXTURE0);
-			glBindTexture(GL_TEXTURE_CUBE_MAP, texture_);
+			state.BindVertexArray(VAO_.Get());
+			state.BindTexture(0, GL_TEXTURE_CUBE_MAP, texture_.Get());
 			glDrawArrays(GL_TRIANGLES, 0, 36);
-			glBindVertexArray(0);
-			glDepthFunc(GL_LESS);
+			state.DepthFunc(GL_LESS);
 		}
 	
 	private:
 		std::vector<std::string> faces_;
-		unsigned int VAO_;
-		unsigned int VBO_;
-		unsigned int texture_;
+		GlVertexArray VAO_;
+		GlBuffer VBO_;
+		GlTexture texture_;
 
 		float skyboxVertices[108] = {
 			// positions          
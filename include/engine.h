@@ -19,6 +19,8 @@ namespace gl
         virtual void Destroy() = 0;
         virtual void OnEvent(SDL_Event& event) = 0;
         virtual void DrawImGui() = 0;
+        // true when Update renders the ImGui draw data itself.
+        virtual bool RendersImGui() const { return false; }
     };
 
     class Engine
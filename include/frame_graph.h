@@ -0,0 +1,720 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "gl_check.h"
+#include "gl_handle.h"
+#include "gl_state.h"
+
+namespace gl {
+
+	// Texture created by the frame graph for the passes of one frame.
+	struct RenderTargetDesc
+	{
+		GLsizei width = 0;
+		GLsizei height = 0;
+		GLenum internalFormat = GL_RGBA8;
+		GLenum filter = GL_LINEAR;
+		GLenum wrap = GL_CLAMP_TO_EDGE;
+		glm::vec4 borderColor = glm::vec4(0.0f);
+		// the first pass writing the target clears it, depth targets use
+		// the red channel.
+		glm::vec4 clearValue = glm::vec4(0.0f);
+
+		// two targets can share the same texture within a frame.
+		bool SameTexture(const RenderTargetDesc& other) const
+		{
+			return width == other.width &&
+				height == other.height &&
+				internalFormat == other.internalFormat &&
+				filter == other.filter &&
+				wrap == other.wrap &&
+				borderColor == other.borderColor;
+		}
+
+		bool IsDepth() const
+		{
+			return internalFormat == GL_DEPTH_COMPONENT16 ||
+				internalFormat == GL_DEPTH_COMPONENT24 ||
+				internalFormat == GL_DEPTH_COMPONENT32F ||
+				internalFormat == GL_DEPTH24_STENCIL8 ||
+				internalFormat == GL_DEPTH32F_STENCIL8;
+		}
+	};
+
+	// One version of a resource of the graph: every write gives a new
+	// version, so the order of the writers follows from the handles.
+	struct FrameGraphResource
+	{
+		static constexpr std::uint32_t INVALID = ~0u;
+
+		std::uint32_t version = INVALID;
+
+		bool IsValid() const
+		{
+			return version != INVALID;
+		}
+	};
+
+	// Render passes declared with the resources they read and write, built
+	// every frame. Compile keeps the passes contributing to an imported
+	// resource or marked with a side effect, orders them from their
+	// dependencies and gives each transient render target a texture, reusing
+	// the texture of a target whose last reader already ran. Execute binds
+	// the framebuffer of each pass, sets its viewport, clears the targets it
+	// writes first and calls it. The textures and framebuffers are kept from
+	// one frame to the next.
+	class FrameGraph
+	{
+	public:
+		class Resources;
+		using ExecuteFunction = std::function<void(const Resources&)>;
+
+		// given to the setup function of a pass.
+		class Builder
+		{
+		public:
+			FrameGraphResource Create(const std::string& name, const RenderTargetDesc& desc)
+			{
+				return graph_.AddResource(name, desc, false, false, 0);
+			}
+
+			FrameGraphResource Read(FrameGraphResource resource)
+			{
+				graph_.CheckHandle(resource);
+				graph_.passes_[pass_].reads.push_back(resource.version);
+				return resource;
+			}
+
+			// the pass renders into the resource on top of its current
+			// content, the returned version is what the later passes read.
+			FrameGraphResource Write(FrameGraphResource resource)
+			{
+				graph_.CheckHandle(resource);
+				Pass& pass = graph_.passes_[pass_];
+				pass.reads.push_back(resource.version);
+				const std::uint32_t version = static_cast<std::uint32_t>(graph_.versions_.size());
+				graph_.versions_.push_back(
+					{ graph_.versions_[resource.version].resource, pass_, resource.version });
+				pass.writes.push_back(version);
+				return { version };
+			}
+
+			// the pass is never culled, even if nothing reads what it writes.
+			void SetSideEffect()
+			{
+				graph_.passes_[pass_].sideEffect = true;
+			}
+
+		private:
+			friend class FrameGraph;
+
+			Builder(FrameGraph& graph, std::uint32_t pass) :
+				graph_(graph),
+				pass_(pass)
+			{
+			}
+
+			FrameGraph& graph_;
+			std::uint32_t pass_;
+		};
+
+		// given to the execute function of a pass.
+		class Resources
+		{
+		public:
+			GLuint Texture(FrameGraphResource resource) const
+			{
+				return graph_.TextureOf(resource);
+			}
+
+			const RenderTargetDesc& Desc(FrameGraphResource resource) const
+			{
+				return graph_.resources_[graph_.versions_[resource.version].resource].desc;
+			}
+
+		private:
+			friend class FrameGraph;
+
+			explicit Resources(const FrameGraph& graph) :
+				graph_(graph)
+			{
+			}
+
+			const FrameGraph& graph_;
+		};
+
+		struct Stats
+		{
+			std::size_t passes = 0;
+			std::size_t culledPasses = 0;
+			std::size_t transientTargets = 0;
+			// textures backing the transient targets, less than the targets
+			// when some are aliased.
+			std::size_t textures = 0;
+			std::size_t textureBytes = 0;
+		};
+
+		// forgets the passes and resources of the previous frame, the
+		// textures and framebuffers are kept for reuse.
+		void Reset()
+		{
+			passes_.clear();
+			resources_.clear();
+			versions_.clear();
+			order_.clear();
+			compiled_ = false;
+		}
+
+		// the default framebuffer, cleared by its first writer when clear
+		// is set.
+		FrameGraphResource ImportBackbuffer(
+			const std::string& name,
+			GLsizei width,
+			GLsizei height,
+			bool clear = true,
+			const glm::vec4& clearColor = glm::vec4(0.0f))
+		{
+			RenderTargetDesc desc;
+			desc.width = width;
+			desc.height = height;
+			desc.clearValue = clearColor;
+			FrameGraphResource resource = AddResource(name, desc, true, true, 0);
+			resources_.back().clear = clear;
+			return resource;
+		}
+
+		// a texture owned elsewhere, passes writing it are never culled and
+		// it is never cleared.
+		FrameGraphResource ImportTexture(const std::string& name, GLuint texture, const RenderTargetDesc& desc)
+		{
+			FrameGraphResource resource = AddResource(name, desc, true, false, texture);
+			resources_.back().clear = false;
+			return resource;
+		}
+
+		// setup runs right away and declares the resources of the pass,
+		// execute runs from Execute if the pass is not culled.
+		template<typename Setup>
+		void AddPass(const std::string& name, Setup&& setup, ExecuteFunction execute)
+		{
+			const std::uint32_t index = static_cast<std::uint32_t>(passes_.size());
+			Pass pass;
+			pass.name = name;
+			pass.execute = std::move(execute);
+			passes_.push_back(std::move(pass));
+			Builder builder(*this, index);
+			setup(builder);
+		}
+
+		void Compile()
+		{
+			Cull();
+			Sort();
+			AssignTextures();
+			compiled_ = true;
+		}
+
+		void Execute()
+		{
+			if (!compiled_)
+			{
+				Compile();
+			}
+			const Resources resources(*this);
+			for (const std::uint32_t index : order_)
+			{
+				Pass& pass = passes_[index];
+				BindTargets(pass);
+				pass.execute(resources);
+			}
+			GlState::Global().BindFramebuffer(GL_FRAMEBUFFER, 0);
+			GL_CHECK();
+		}
+
+		// names of the passes in execution order, after Compile.
+		std::vector<std::string> ExecutionOrder() const
+		{
+			std::vector<std::string> names;
+			for (const std::uint32_t index : order_)
+			{
+				names.push_back(passes_[index].name);
+			}
+			return names;
+		}
+
+		const Stats& GetStats() const
+		{
+			return stats_;
+		}
+
+	private:
+		static constexpr std::uint32_t NO_PASS = ~0u;
+		static constexpr std::uint32_t NO_TEXTURE = ~0u;
+
+		struct Pass
+		{
+			std::string name;
+			ExecuteFunction execute;
+			std::vector<std::uint32_t> reads;
+			std::vector<std::uint32_t> writes;
+			bool sideEffect = false;
+			bool culled = true;
+		};
+
+		struct Resource
+		{
+			std::string name;
+			RenderTargetDesc desc;
+			bool imported = false;
+			bool backbuffer = false;
+			bool clear = true;
+			GLuint importedTexture = 0;
+			// transient targets only, in execution order.
+			std::size_t firstUse = 0;
+			std::size_t lastUse = 0;
+			std::uint32_t texture = NO_TEXTURE;
+		};
+
+		struct Version
+		{
+			std::uint32_t resource;
+			std::uint32_t producer;
+			// the version written over, INVALID for the first one.
+			std::uint32_t previous = FrameGraphResource::INVALID;
+		};
+
+		struct PooledTexture
+		{
+			RenderTargetDesc desc;
+			GlTexture texture;
+			bool inUse = false;
+			// acquired by the last compile.
+			bool used = true;
+		};
+
+		FrameGraphResource AddResource(
+			const std::string& name,
+			const RenderTargetDesc& desc,
+			bool imported,
+			bool backbuffer,
+			GLuint texture)
+		{
+			const std::uint32_t resource = static_cast<std::uint32_t>(resources_.size());
+			Resource entry;
+			entry.name = name;
+			entry.desc = desc;
+			entry.imported = imported;
+			entry.backbuffer = backbuffer;
+			entry.importedTexture = texture;
+			resources_.push_back(std::move(entry));
+			const std::uint32_t version = static_cast<std::uint32_t>(versions_.size());
+			versions_.push_back({ resource, NO_PASS });
+			return { version };
+		}
+
+		void CheckHandle(FrameGraphResource resource) const
+		{
+			if (resource.version >= versions_.size())
+			{
+				throw std::runtime_error("Invalid frame graph resource");
+			}
+		}
+
+		// walks back from the passes that have to run through the passes
+		// producing what they read.
+		void Cull()
+		{
+			std::vector<std::uint32_t> stack;
+			for (std::uint32_t i = 0; i < passes_.size(); ++i)
+			{
+				Pass& pass = passes_[i];
+				pass.culled = true;
+				bool required = pass.sideEffect;
+				for (const std::uint32_t version : pass.writes)
+				{
+					required |= resources_[versions_[version].resource].imported;
+				}
+				if (required)
+				{
+					pass.culled = false;
+					stack.push_back(i);
+				}
+			}
+			while (!stack.empty())
+			{
+				const Pass& pass = passes_[stack.back()];
+				stack.pop_back();
+				for (const std::uint32_t version : pass.reads)
+				{
+					const std::uint32_t producer = versions_[version].producer;
+					if (producer != NO_PASS && passes_[producer].culled)
+					{
+						passes_[producer].culled = false;
+						stack.push_back(producer);
+					}
+				}
+			}
+		}
+
+		// topological order of the passes left, ties keep the order in
+		// which the passes were added. A pass runs after the producers of
+		// what it reads, and a pass writing over a version after the other
+		// readers of that version.
+		void Sort()
+		{
+			order_.clear();
+			std::vector<std::uint32_t> pending(passes_.size(), 0);
+			std::vector<std::vector<std::uint32_t>> dependents(passes_.size());
+			std::vector<std::vector<std::uint32_t>> readers(versions_.size());
+			const auto addEdge = [&](std::uint32_t before, std::uint32_t after)
+			{
+				if (before != NO_PASS && before != after)
+				{
+					dependents[before].push_back(after);
+					++pending[after];
+				}
+			};
+			for (std::uint32_t i = 0; i < passes_.size(); ++i)
+			{
+				if (passes_[i].culled)
+				{
+					continue;
+				}
+				for (const std::uint32_t version : passes_[i].reads)
+				{
+					addEdge(versions_[version].producer, i);
+					readers[version].push_back(i);
+				}
+			}
+			for (std::uint32_t i = 0; i < passes_.size(); ++i)
+			{
+				if (passes_[i].culled)
+				{
+					continue;
+				}
+				for (const std::uint32_t version : passes_[i].writes)
+				{
+					for (const std::uint32_t reader : readers[versions_[version].previous])
+					{
+						addEdge(reader, i);
+					}
+				}
+			}
+			std::vector<std::uint32_t> ready;
+			for (std::uint32_t i = 0; i < passes_.size(); ++i)
+			{
+				if (!passes_[i].culled && pending[i] == 0)
+				{
+					ready.push_back(i);
+				}
+			}
+			while (!ready.empty())
+			{
+				const auto next = std::min_element(ready.begin(), ready.end());
+				const std::uint32_t index = *next;
+				ready.erase(next);
+				order_.push_back(index);
+				for (const std::uint32_t dependent : dependents[index])
+				{
+					if (--pending[dependent] == 0)
+					{
+						ready.push_back(dependent);
+					}
+				}
+			}
+		}
+
+		// gives every transient target a pooled texture for the span of
+		// passes using it, a texture goes back to the pool after the last
+		// pass reading or writing its target.
+		void AssignTextures()
+		{
+			stats_ = {};
+			stats_.passes = order_.size();
+			stats_.culledPasses = passes_.size() - order_.size();
+
+			std::vector<bool> used(resources_.size(), false);
+			for (std::size_t position = 0; position < order_.size(); ++position)
+			{
+				const Pass& pass = passes_[order_[position]];
+				for (const auto* versions : { &pass.reads, &pass.writes })
+				{
+					for (const std::uint32_t version : *versions)
+					{
+						const std::uint32_t index = versions_[version].resource;
+						Resource& resource = resources_[index];
+						if (!used[index])
+						{
+							used[index] = true;
+							resource.firstUse = position;
+						}
+						resource.lastUse = position;
+					}
+				}
+			}
+
+			// textures the previous frame did not need go away, with the
+			// framebuffers using them, targets resized with the window do
+			// not pile up.
+			for (const PooledTexture& pooled : pool_)
+			{
+				if (!pooled.used)
+				{
+					std::erase_if(framebuffers_, [&pooled](const auto& framebuffer)
+					{
+						const std::vector<GLuint>& attachments = framebuffer.first;
+						return std::find(attachments.begin(), attachments.end(), pooled.texture.Get()) !=
+							attachments.end();
+					});
+				}
+			}
+			std::erase_if(pool_, [](const PooledTexture& pooled)
+			{
+				return !pooled.used;
+			});
+			for (PooledTexture& pooled : pool_)
+			{
+				pooled.inUse = false;
+				pooled.used = false;
+			}
+			for (std::size_t position = 0; position < order_.size(); ++position)
+			{
+				for (std::uint32_t index = 0; index < resources_.size(); ++index)
+				{
+					Resource& resource = resources_[index];
+					if (!resource.imported && used[index] && resource.firstUse == position)
+					{
+						resource.texture = Acquire(resource.desc);
+						++stats_.transientTargets;
+					}
+				}
+				for (std::uint32_t index = 0; index < resources_.size(); ++index)
+				{
+					const Resource& resource = resources_[index];
+					if (!resource.imported && used[index] && resource.lastUse == position)
+					{
+						pool_[resource.texture].inUse = false;
+					}
+				}
+			}
+
+			for (const PooledTexture& pooled : pool_)
+			{
+				stats_.textures += 1;
+				stats_.textureBytes += TextureBytes(pooled.desc);
+			}
+		}
+
+		std::uint32_t Acquire(const RenderTargetDesc& desc)
+		{
+			for (std::uint32_t i = 0; i < pool_.size(); ++i)
+			{
+				if (!pool_[i].inUse && pool_[i].desc.SameTexture(desc))
+				{
+					pool_[i].inUse = true;
+					pool_[i].used = true;
+					return i;
+				}
+			}
+
+			PooledTexture pooled;
+			pooled.desc = desc;
+			pooled.texture = GlTexture::Create();
+			GlState::Global().BindTexture(0, GL_TEXTURE_2D, pooled.texture.Get());
+			glTexStorage2D(GL_TEXTURE_2D, 1, desc.internalFormat, desc.width, desc.height);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, desc.filter);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, desc.filter);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, desc.wrap);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, desc.wrap);
+			glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, &desc.borderColor[0]);
+			GL_CHECK();
+			pooled.inUse = true;
+			pool_.push_back(std::move(pooled));
+			return static_cast<std::uint32_t>(pool_.size() - 1);
+		}
+
+		static std::size_t TextureBytes(const RenderTargetDesc& desc)
+		{
+			std::size_t texelBytes = 4;
+			switch (desc.internalFormat)
+			{
+			case GL_DEPTH_COMPONENT16:
+				texelBytes = 2;
+				break;
+			case GL_DEPTH32F_STENCIL8:
+			case GL_RGBA16F:
+				texelBytes = 8;
+				break;
+			case GL_RGBA32F:
+				texelBytes = 16;
+				break;
+			default:
+				break;
+			}
+			return texelBytes * desc.width * desc.height;
+		}
+
+		GLuint TextureOf(FrameGraphResource resource) const
+		{
+			const Resource& entry = resources_[versions_[resource.version].resource];
+			if (entry.imported)
+			{
+				return entry.importedTexture;
+			}
+			return entry.texture == NO_TEXTURE ? 0 : pool_[entry.texture].texture.Get();
+		}
+
+		// framebuffer of the targets written by the pass, its viewport and
+		// the clears of the targets written for the first time.
+		void BindTargets(const Pass& pass)
+		{
+			if (pass.writes.empty())
+			{
+				return;
+			}
+			std::vector<GLuint> colors;
+			GLuint depth = 0;
+			GLenum depthAttachment = GL_DEPTH_ATTACHMENT;
+			bool backbuffer = false;
+			const RenderTargetDesc* size = nullptr;
+			for (const std::uint32_t version : pass.writes)
+			{
+				const Resource& resource = resources_[versions_[version].resource];
+				size = &resource.desc;
+				if (resource.backbuffer)
+				{
+					backbuffer = true;
+				}
+				else if (resource.desc.IsDepth())
+				{
+					depth = TextureOf({ version });
+					depthAttachment =
+						resource.desc.internalFormat == GL_DEPTH24_STENCIL8 ||
+						resource.desc.internalFormat == GL_DEPTH32F_STENCIL8 ?
+						GL_DEPTH_STENCIL_ATTACHMENT : GL_DEPTH_ATTACHMENT;
+				}
+				else
+				{
+					colors.push_back(TextureOf({ version }));
+				}
+			}
+			if (backbuffer && (depth != 0 || !colors.empty()))
+			{
+				throw std::runtime_error(
+					"Frame graph pass " + pass.name + " writes the backbuffer and a texture");
+			}
+
+			GlState& state = GlState::Global();
+			state.BindFramebuffer(GL_FRAMEBUFFER, backbuffer ? 0 : Framebuffer(colors, depth, depthAttachment));
+			state.Viewport(0, 0, size->width, size->height);
+			GL_CHECK();
+
+			// a version produced from the first version of a resource is the
+			// first write of the frame.
+			GLint colorIndex = 0;
+			for (const std::uint32_t version : pass.writes)
+			{
+				const Resource& resource = resources_[versions_[version].resource];
+				const bool firstWrite = IsFirstWrite(version);
+				if (resource.backbuffer)
+				{
+					if (firstWrite && resource.clear)
+					{
+						const GLfloat clearDepth = 1.0f;
+						glClearBufferfv(GL_COLOR, 0, &resource.desc.clearValue[0]);
+						glClearBufferfv(GL_DEPTH, 0, &clearDepth);
+					}
+				}
+				else if (resource.desc.IsDepth())
+				{
+					if (firstWrite && resource.clear && !resource.imported)
+					{
+						glClearBufferfv(GL_DEPTH, 0, &resource.desc.clearValue[0]);
+					}
+				}
+				else
+				{
+					if (firstWrite && resource.clear && !resource.imported)
+					{
+						glClearBufferfv(GL_COLOR, colorIndex, &resource.desc.clearValue[0]);
+					}
+					++colorIndex;
+				}
+			}
+			GL_CHECK();
+		}
+
+		// true if version was written over the version the resource was
+		// created or imported with.
+		bool IsFirstWrite(std::uint32_t version) const
+		{
+			return versions_[versions_[version].previous].producer == NO_PASS;
+		}
+
+		GLuint Framebuffer(const std::vector<GLuint>& colors, GLuint depth, GLenum depthAttachment)
+		{
+			std::vector<GLuint> key = colors;
+			key.push_back(depth);
+			auto found = framebuffers_.find(key);
+			if (found != framebuffers_.end())
+			{
+				return found->second.Get();
+			}
+
+			GlFramebuffer framebuffer = GlFramebuffer::Create();
+			GlState::Global().BindFramebuffer(GL_FRAMEBUFFER, framebuffer.Get());
+			std::vector<GLenum> drawBuffers;
+			for (std::size_t i = 0; i < colors.size(); ++i)
+			{
+				glFramebufferTexture2D(
+					GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + GLenum(i), GL_TEXTURE_2D, colors[i], 0);
+				drawBuffers.push_back(GL_COLOR_ATTACHMENT0 + GLenum(i));
+			}
+			if (depth != 0)
+			{
+				glFramebufferTexture2D(GL_FRAMEBUFFER, depthAttachment, GL_TEXTURE_2D, depth, 0);
+			}
+			if (drawBuffers.empty())
+			{
+				// depth only.
+				const GLenum none = GL_NONE;
+				glDrawBuffers(1, &none);
+				glReadBuffer(GL_NONE);
+			}
+			else
+			{
+				glDrawBuffers(static_cast<GLsizei>(drawBuffers.size()), drawBuffers.data());
+			}
+			if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+			{
+				throw std::runtime_error("Incomplete frame graph framebuffer");
+			}
+			GL_CHECK();
+			const GLuint id = framebuffer.Get();
+			framebuffers_.emplace(std::move(key), std::move(framebuffer));
+			return id;
+		}
+
+		std::vector<Pass> passes_;
+		std::vector<Resource> resources_;
+		std::vector<Version> versions_;
+		std::vector<std::uint32_t> order_;
+		bool compiled_ = false;
+		Stats stats_;
+
+		// kept across frames.
+		std::vector<PooledTexture> pool_;
+		std::map<std::vector<GLuint>, GlFramebuffer> framebuffers_;
+	};
+
+} // End namespace gl.
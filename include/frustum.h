@@ -0,0 +1,347 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <stdexcept>
+#include <vector>
+#include <glm/glm.hpp>
+
+// AVX culls 8 boxes per iteration when the build enables it (USE_AVX),
+// SSE 4 boxes, which every x86-64 target has, other targets run the
+// scalar reference.
+#if defined(__AVX__)
+#include <immintrin.h>
+#define GL_CULL_AVX 1
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define GL_CULL_SSE 1
+#endif
+
+namespace gl {
+
+	// The six planes of a view projection matrix, normals pointing inside,
+	// for perspective and orthographic projections with a [-1, 1] clip
+	// depth. A default constructed frustum contains everything.
+	class Frustum
+	{
+	public:
+		Frustum() = default;
+
+		explicit Frustum(const glm::mat4& viewProjection)
+		{
+			// glm is column major, the planes are sums of its rows.
+			std::array<glm::vec4, 4> rows;
+			for (int row = 0; row < 4; ++row)
+			{
+				rows[row] = glm::vec4(
+					viewProjection[0][row],
+					viewProjection[1][row],
+					viewProjection[2][row],
+					viewProjection[3][row]);
+			}
+			for (int axis = 0; axis < 3; ++axis)
+			{
+				planes_[2 * axis] = rows[3] + rows[axis];
+				planes_[2 * axis + 1] = rows[3] - rows[axis];
+			}
+			for (glm::vec4& plane : planes_)
+			{
+				const float length = glm::length(glm::vec3(plane));
+				if (length > 0.0f)
+				{
+					plane /= length;
+				}
+			}
+		}
+
+		// left, right, bottom, top, near, far as (normal, distance).
+		const std::array<glm::vec4, 6>& Planes() const
+		{
+			return planes_;
+		}
+
+		// false when the box is fully outside one of the planes, boxes
+		// outside near a corner may still pass.
+		bool IntersectsBox(const glm::vec3& center, const glm::vec3& extent) const
+		{
+			for (const glm::vec4& plane : planes_)
+			{
+				// compared like the kernels do, a NaN box is outside.
+				if (!(PlaneTest(plane, center, extent) >= 0.0f))
+				{
+					return false;
+				}
+			}
+			return true;
+		}
+
+		// true when the box is inside every plane, everything in it is
+		// then inside too.
+		bool ContainsBox(const glm::vec3& center, const glm::vec3& extent) const
+		{
+			for (const glm::vec4& plane : planes_)
+			{
+				const float distance = plane.x * center.x + plane.y * center.y + plane.z * center.z + plane.w;
+				const float radius =
+					std::abs(plane.x) * extent.x + std::abs(plane.y) * extent.y + std::abs(plane.z) * extent.z;
+				if (!(distance - radius >= 0.0f))
+				{
+					return false;
+				}
+			}
+			return true;
+		}
+
+		// signed distance of the box center plus its projected radius, the
+		// kernels of FrustumCuller compute the same sums in the same order.
+		static float PlaneTest(const glm::vec4& plane, const glm::vec3& center, const glm::vec3& extent)
+		{
+			const float distance = plane.x * center.x + plane.y * center.y + plane.z * center.z + plane.w;
+			const float radius =
+				std::abs(plane.x) * extent.x + std::abs(plane.y) * extent.y + std::abs(plane.z) * extent.z;
+			return distance + radius;
+		}
+
+	private:
+		std::array<glm::vec4, 6> planes_ = {};
+	};
+
+	// Axis aligned boxes as a center and a half extent, one array per
+	// component so the culling kernels load a batch of boxes per
+	// instruction. The arrays are padded to a whole batch.
+	class BoxSet
+	{
+	public:
+		enum Component : std::size_t
+		{
+			CENTER_X,
+			CENTER_Y,
+			CENTER_Z,
+			EXTENT_X,
+			EXTENT_Y,
+			EXTENT_Z,
+			COMPONENT_COUNT,
+		};
+
+		void Clear()
+		{
+			size_ = 0;
+		}
+
+		std::size_t Size() const
+		{
+			return size_;
+		}
+
+		void Add(const glm::vec3& center, const glm::vec3& extent)
+		{
+			if (size_ == components_[0].size())
+			{
+				for (std::vector<float>& component : components_)
+				{
+					component.resize(size_ + BATCH, 0.0f);
+				}
+			}
+			components_[CENTER_X][size_] = center.x;
+			components_[CENTER_Y][size_] = center.y;
+			components_[CENTER_Z][size_] = center.z;
+			components_[EXTENT_X][size_] = extent.x;
+			components_[EXTENT_Y][size_] = extent.y;
+			components_[EXTENT_Z][size_] = extent.z;
+			++size_;
+		}
+
+		// the world box around an object space box placed with transform.
+		void AddTransformed(const glm::mat4& transform, const glm::vec3& center, const glm::vec3& extent)
+		{
+			const glm::vec3 worldCenter(transform * glm::vec4(center, 1.0f));
+			glm::vec3 worldExtent(0.0f);
+			for (int column = 0; column < 3; ++column)
+			{
+				worldExtent += glm::abs(glm::vec3(transform[column])) * extent[column];
+			}
+			Add(worldCenter, worldExtent);
+		}
+
+		// Size() values followed by the padding of the last batch.
+		const float* Data(Component component) const
+		{
+			return components_[component].data();
+		}
+
+		// boxes per iteration of the culling kernel.
+#if GL_CULL_AVX
+		static constexpr std::size_t BATCH = 8;
+#elif GL_CULL_SSE
+		static constexpr std::size_t BATCH = 4;
+#else
+		static constexpr std::size_t BATCH = 1;
+#endif
+
+	private:
+		std::array<std::vector<float>, COMPONENT_COUNT> components_;
+		std::size_t size_ = 0;
+	};
+
+	// Tests a whole BoxSet against a frustum, visible[i] is set to 1 when
+	// box i intersects it and 0 otherwise. Cull uses the widest kernel of
+	// the build, CullScalar is the reference the kernels must match.
+	class FrustumCuller
+	{
+	public:
+		static void Cull(const Frustum& frustum, const BoxSet& boxes, std::span<std::uint8_t> visible)
+		{
+			CheckOutput(boxes, visible);
+#if GL_CULL_AVX
+			CullAvx(frustum, boxes, visible);
+#elif GL_CULL_SSE
+			CullSse(frustum, boxes, visible);
+#else
+			CullScalar(frustum, boxes, visible);
+#endif
+		}
+
+		static void CullScalar(const Frustum& frustum, const BoxSet& boxes, std::span<std::uint8_t> visible)
+		{
+			CheckOutput(boxes, visible);
+			for (std::size_t i = 0; i < boxes.Size(); ++i)
+			{
+				const glm::vec3 center(
+					boxes.Data(BoxSet::CENTER_X)[i],
+					boxes.Data(BoxSet::CENTER_Y)[i],
+					boxes.Data(BoxSet::CENTER_Z)[i]);
+				const glm::vec3 extent(
+					boxes.Data(BoxSet::EXTENT_X)[i],
+					boxes.Data(BoxSet::EXTENT_Y)[i],
+					boxes.Data(BoxSet::EXTENT_Z)[i]);
+				visible[i] = frustum.IntersectsBox(center, extent) ? 1 : 0;
+			}
+		}
+
+		// name of the kernel Cull runs.
+		static const char* KernelName()
+		{
+#if GL_CULL_AVX
+			return "AVX";
+#elif GL_CULL_SSE
+			return "SSE";
+#else
+			return "scalar";
+#endif
+		}
+
+	private:
+		static void CheckOutput(const BoxSet& boxes, std::span<std::uint8_t> visible)
+		{
+			if (visible.size() < boxes.Size())
+			{
+				throw std::out_of_range("Culling output smaller than the box set");
+			}
+		}
+
+#if GL_CULL_SSE
+		static void CullSse(const Frustum& frustum, const BoxSet& boxes, std::span<std::uint8_t> visible)
+		{
+			// the planes broadcast once: normal, absolute normal, distance.
+			__m128 planes[6][7];
+			for (std::size_t p = 0; p < 6; ++p)
+			{
+				const glm::vec4& plane = frustum.Planes()[p];
+				planes[p][0] = _mm_set1_ps(plane.x);
+				planes[p][1] = _mm_set1_ps(plane.y);
+				planes[p][2] = _mm_set1_ps(plane.z);
+				planes[p][3] = _mm_set1_ps(std::abs(plane.x));
+				planes[p][4] = _mm_set1_ps(std::abs(plane.y));
+				planes[p][5] = _mm_set1_ps(std::abs(plane.z));
+				planes[p][6] = _mm_set1_ps(plane.w);
+			}
+			const __m128 zero = _mm_setzero_ps();
+			for (std::size_t first = 0; first < boxes.Size(); first += 4)
+			{
+				const __m128 centerX = _mm_loadu_ps(boxes.Data(BoxSet::CENTER_X) + first);
+				const __m128 centerY = _mm_loadu_ps(boxes.Data(BoxSet::CENTER_Y) + first);
+				const __m128 centerZ = _mm_loadu_ps(boxes.Data(BoxSet::CENTER_Z) + first);
+				const __m128 extentX = _mm_loadu_ps(boxes.Data(BoxSet::EXTENT_X) + first);
+				const __m128 extentY = _mm_loadu_ps(boxes.Data(BoxSet::EXTENT_Y) + first);
+				const __m128 extentZ = _mm_loadu_ps(boxes.Data(BoxSet::EXTENT_Z) + first);
+				__m128 inside = _mm_cmpeq_ps(zero, zero);
+				for (const auto& plane : planes)
+				{
+					const __m128 distance = _mm_add_ps(_mm_add_ps(_mm_add_ps(
+						_mm_mul_ps(plane[0], centerX),
+						_mm_mul_ps(plane[1], centerY)),
+						_mm_mul_ps(plane[2], centerZ)),
+						plane[6]);
+					const __m128 radius = _mm_add_ps(_mm_add_ps(
+						_mm_mul_ps(plane[3], extentX),
+						_mm_mul_ps(plane[4], extentY)),
+						_mm_mul_ps(plane[5], extentZ));
+					inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(distance, radius), zero));
+				}
+				StoreMask(_mm_movemask_ps(inside), first, boxes.Size(), visible);
+			}
+		}
+#endif
+
+#if GL_CULL_AVX
+		static void CullAvx(const Frustum& frustum, const BoxSet& boxes, std::span<std::uint8_t> visible)
+		{
+			// the planes broadcast once: normal, absolute normal, distance.
+			__m256 planes[6][7];
+			for (std::size_t p = 0; p < 6; ++p)
+			{
+				const glm::vec4& plane = frustum.Planes()[p];
+				planes[p][0] = _mm256_set1_ps(plane.x);
+				planes[p][1] = _mm256_set1_ps(plane.y);
+				planes[p][2] = _mm256_set1_ps(plane.z);
+				planes[p][3] = _mm256_set1_ps(std::abs(plane.x));
+				planes[p][4] = _mm256_set1_ps(std::abs(plane.y));
+				planes[p][5] = _mm256_set1_ps(std::abs(plane.z));
+				planes[p][6] = _mm256_set1_ps(plane.w);
+			}
+			const __m256 zero = _mm256_setzero_ps();
+			for (std::size_t first = 0; first < boxes.Size(); first += 8)
+			{
+				const __m256 centerX = _mm256_loadu_ps(boxes.Data(BoxSet::CENTER_X) + first);
+				const __m256 centerY = _mm256_loadu_ps(boxes.Data(BoxSet::CENTER_Y) + first);
+				const __m256 centerZ = _mm256_loadu_ps(boxes.Data(BoxSet::CENTER_Z) + first);
+				const __m256 extentX = _mm256_loadu_ps(boxes.Data(BoxSet::EXTENT_X) + first);
+				const __m256 extentY = _mm256_loadu_ps(boxes.Data(BoxSet::EXTENT_Y) + first);
+				const __m256 extentZ = _mm256_loadu_ps(boxes.Data(BoxSet::EXTENT_Z) + first);
+				__m256 inside = _mm256_cmp_ps(zero, zero, _CMP_EQ_OQ);
+				for (const auto& plane : planes)
+				{
+					const __m256 distance = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(
+						_mm256_mul_ps(plane[0], centerX),
+						_mm256_mul_ps(plane[1], centerY)),
+						_mm256_mul_ps(plane[2], centerZ)),
+						plane[6]);
+					const __m256 radius = _mm256_add_ps(_mm256_add_ps(
+						_mm256_mul_ps(plane[3], extentX),
+						_mm256_mul_ps(plane[4], extentY)),
+						_mm256_mul_ps(plane[5], extentZ));
+					inside = _mm256_and_ps(
+						inside,
+						_mm256_cmp_ps(_mm256_add_ps(distance, radius), zero, _CMP_GE_OQ));
+				}
+				StoreMask(_mm256_movemask_ps(inside), first, boxes.Size(), visible);
+			}
+		}
+#endif
+
+		// one bit per box of the batch, the padding is not written.
+		static void StoreMask(int mask, std::size_t first, std::size_t size, std::span<std::uint8_t> visible)
+		{
+			const std::size_t lanes = std::min(BoxSet::BATCH, size - first);
+			for (std::size_t lane = 0; lane < lanes; ++lane)
+			{
+				visible[first + lane] = static_cast<std::uint8_t>((mask >> lane) & 1);
+			}
+		}
+	};
+
+} // End namespace gl.
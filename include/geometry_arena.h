@@ -0,0 +1,295 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+#include <glad/glad.h>
+
+#include "gl_handle.h"
+#include "gl_state.h"
+#include "vertex_layout.h"
+
+namespace gl {
+
+	// Layout expected by glDrawElementsIndirect.
+	struct DrawElementsIndirectCommand
+	{
+		GLuint count = 0;
+		GLuint instanceCount = 1;
+		GLuint firstIndex = 0;
+		GLint baseVertex = 0;
+		// must be 0 without EXT_base_instance.
+		GLuint baseInstance = 0;
+
+		bool operator==(const DrawElementsIndirectCommand&) const = default;
+	};
+
+	// Part of a GeometryArena owned by one mesh.
+	struct ArenaRange
+	{
+		GLint baseVertex = 0;
+		GLuint firstIndex = 0;
+		GLsizei indexCount = 0;
+		GLsizei vertexCount = 0;
+
+		DrawElementsIndirectCommand Command() const
+		{
+			DrawElementsIndirectCommand command;
+			command.count = static_cast<GLuint>(indexCount);
+			command.firstIndex = firstIndex;
+			command.baseVertex = baseVertex;
+			return command;
+		}
+	};
+
+	// One vertex and one index buffer shared by many meshes behind a single
+	// VAO. Meshes are appended with base vertex offsets so their indices stay
+	// local and 16 bit indices keep working as long as each mesh has at most
+	// 65536 vertices. The buffers grow on demand, so several models can share
+	// one arena as long as they use the same vertex format.
+	class GeometryArena
+	{
+	public:
+		GeometryArena(
+			VertexFormat vertexFormat,
+			GLenum indexType = GL_UNSIGNED_INT,
+			std::size_t vertexCapacity = 1 << 16,
+			std::size_t indexCapacity = 1 << 18) :
+			vertexFormat_(vertexFormat),
+			indexType_(indexType)
+		{
+			assert(indexType_ == GL_UNSIGNED_SHORT || indexType_ == GL_UNSIGNED_INT);
+			VAO_ = GlVertexArray::Create();
+			Grow(
+				std::max<std::size_t>(vertexCapacity, 1) * Stride(),
+				std::max<std::size_t>(indexCapacity, 1) * IndexSize());
+		}
+
+		GeometryArena(const GeometryArena&) = delete;
+		GeometryArena& operator=(const GeometryArena&) = delete;
+
+		VertexFormat Format() const { return vertexFormat_; }
+		GLenum IndexType() const { return indexType_; }
+		GLuint VertexArray() const { return VAO_.Get(); }
+		std::size_t IndexSize() const
+		{
+			return indexType_ == GL_UNSIGNED_SHORT ? sizeof(std::uint16_t) : sizeof(std::uint32_t);
+		}
+		std::size_t Stride() const
+		{
+			return static_cast<std::size_t>(VertexStride(vertexFormat_));
+		}
+		std::size_t VertexCount() const { return vertexCount_; }
+		std::size_t IndexCount() const { return indexCount_; }
+
+		// vertices must be in the arena format, indices are local to them.
+		template<typename VertexType>
+		ArenaRange Append(
+			std::span<const VertexType> vertices,
+			std::span<const unsigned int> indices)
+		{
+			if (sizeof(VertexType) != Stride())
+			{
+				throw std::runtime_error("Vertex format does not match the geometry arena");
+			}
+			if (indexType_ == GL_UNSIGNED_SHORT && vertices.size() > 65536)
+			{
+				throw std::runtime_error(
+					"Mesh with " + std::to_string(vertices.size()) +
+					" vertices does not fit 16 bit arena indices");
+			}
+
+			const std::size_t vertexBytes = vertices.size_bytes();
+			const std::size_t indexBytes = indices.size() * IndexSize();
+			std::size_t newVertexCapacity = vertexCapacity_;
+			std::size_t newIndexCapacity = indexCapacity_;
+			while (vertexCount_ * Stride() + vertexBytes > newVertexCapacity)
+			{
+				newVertexCapacity *= 2;
+			}
+			while (indexCount_ * IndexSize() + indexBytes > newIndexCapacity)
+			{
+				newIndexCapacity *= 2;
+			}
+			if (newVertexCapacity != vertexCapacity_ || newIndexCapacity != indexCapacity_)
+			{
+				Grow(newVertexCapacity, newIndexCapacity);
+			}
+
+			ArenaRange range;
+			range.baseVertex = static_cast<GLint>(vertexCount_);
+			range.firstIndex = static_cast<GLuint>(indexCount_);
+			range.indexCount = static_cast<GLsizei>(indices.size());
+			range.vertexCount = static_cast<GLsizei>(vertices.size());
+
+			// the element buffer binding is VAO state, keep ours bound while
+			// writing to it.
+			GlState& state = GlState::Global();
+			state.BindVertexArray(VAO_.Get());
+			state.BindBuffer(GL_ARRAY_BUFFER, VBO_.Get());
+			glBufferSubData(
+				GL_ARRAY_BUFFER,
+				vertexCount_ * Stride(),
+				vertexBytes,
+				vertices.data());
+			if (indexType_ == GL_UNSIGNED_SHORT)
+			{
+				const std::vector<std::uint16_t> shortIndices(indices.begin(), indices.end());
+				glBufferSubData(
+					GL_ELEMENT_ARRAY_BUFFER,
+					indexCount_ * IndexSize(),
+					indexBytes,
+					shortIndices.data());
+			}
+			else
+			{
+				glBufferSubData(
+					GL_ELEMENT_ARRAY_BUFFER,
+					indexCount_ * IndexSize(),
+					indexBytes,
+					indices.data());
+			}
+			state.BindVertexArray(0);
+
+			vertexCount_ += vertices.size();
+			indexCount_ += indices.size();
+			return range;
+		}
+
+		void Bind() const
+		{
+			GlState::Global().BindVertexArray(VAO_.Get());
+		}
+
+		// byte offset of an index for the indices argument of glDrawElements*.
+		const void* IndexOffset(GLuint firstIndex) const
+		{
+			return reinterpret_cast<const void*>(firstIndex * IndexSize());
+		}
+
+	private:
+		// moves the content into bigger buffers and points the VAO at them.
+		void Grow(std::size_t vertexCapacity, std::size_t indexCapacity)
+		{
+			GlBuffer newVBO = GlBuffer::Create();
+			GlBuffer newEBO = GlBuffer::Create();
+
+			GlState& state = GlState::Global();
+			state.BindBuffer(GL_COPY_WRITE_BUFFER, newVBO.Get());
+			glBufferData(GL_COPY_WRITE_BUFFER, vertexCapacity, nullptr, GL_STATIC_DRAW);
+			if (VBO_)
+			{
+				state.BindBuffer(GL_COPY_READ_BUFFER, VBO_.Get());
+				glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, vertexCount_ * Stride());
+			}
+			state.BindBuffer(GL_COPY_WRITE_BUFFER, newEBO.Get());
+			glBufferData(GL_COPY_WRITE_BUFFER, indexCapacity, nullptr, GL_STATIC_DRAW);
+			if (EBO_)
+			{
+				state.BindBuffer(GL_COPY_READ_BUFFER, EBO_.Get());
+				glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, indexCount_ * IndexSize());
+			}
+
+			// the old buffers are deleted here.
+			VBO_ = std::move(newVBO);
+			EBO_ = std::move(newEBO);
+			vertexCapacity_ = vertexCapacity;
+			indexCapacity_ = indexCapacity;
+
+			state.BindVertexArray(VAO_.Get());
+			state.BindBuffer(GL_ARRAY_BUFFER, VBO_.Get());
+			ApplyVertexLayout(vertexFormat_);
+			state.BindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO_.Get());
+			state.BindVertexArray(0);
+		}
+
+		VertexFormat vertexFormat_;
+		GLenum indexType_;
+		GlVertexArray VAO_;
+		GlBuffer VBO_;
+		GlBuffer EBO_;
+		std::size_t vertexCapacity_ = 0;
+		std::size_t indexCapacity_ = 0;
+		std::size_t vertexCount_ = 0;
+		std::size_t indexCount_ = 0;
+	};
+
+	// GL_DRAW_INDIRECT_BUFFER holding the commands of a multi draw.
+	class DrawCommandBuffer
+	{
+	public:
+		DrawCommandBuffer() :
+			buffer_(GlBuffer::Create())
+		{
+		}
+
+		DrawCommandBuffer(const DrawCommandBuffer&) = delete;
+		DrawCommandBuffer& operator=(const DrawCommandBuffer&) = delete;
+
+		void Upload(std::span<const DrawElementsIndirectCommand> commands)
+		{
+			GlState::Global().BindBuffer(GL_DRAW_INDIRECT_BUFFER, buffer_.Get());
+			glBufferData(
+				GL_DRAW_INDIRECT_BUFFER,
+				commands.size_bytes(),
+				commands.data(),
+				GL_STATIC_DRAW);
+			commandCount_ = commands.size();
+		}
+
+		std::size_t CommandCount() const { return commandCount_; }
+
+		// draws commands [first, first + count) with the arena bound.
+		void Draw(const GeometryArena& arena, std::size_t first, std::size_t count) const
+		{
+			if (count == 0)
+			{
+				return;
+			}
+			arena.Bind();
+			DrawBound(arena.IndexType(), first, count);
+		}
+
+		// same as Draw, with the vertex array of the arena already bound.
+		void DrawBound(GLenum indexType, std::size_t first, std::size_t count) const
+		{
+			if (count == 0)
+			{
+				return;
+			}
+			GlState::Global().BindBuffer(GL_DRAW_INDIRECT_BUFFER, buffer_.Get());
+			const auto* offset = reinterpret_cast<const void*>(
+				first * sizeof(DrawElementsIndirectCommand));
+			if (GLAD_GL_EXT_multi_draw_indirect)
+			{
+				glMultiDrawElementsIndirectEXT(
+					GL_TRIANGLES,
+					indexType,
+					offset,
+					static_cast<GLsizei>(count),
+					sizeof(DrawElementsIndirectCommand));
+			}
+			else
+			{
+				for (std::size_t i = 0; i < count; ++i)
+				{
+					glDrawElementsIndirect(
+						GL_TRIANGLES,
+						indexType,
+						static_cast<const char*>(offset) + i * sizeof(DrawElementsIndirectCommand));
+				}
+			}
+		}
+
+	private:
+		GlBuffer buffer_;
+		std::size_t commandCount_ = 0;
+	};
+
+} // End namespace gl.
@@ -0,0 +1,159 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <iostream>
+#include <glad/glad.h>
+
+// Set by CMake from the GL_CHECKS option, 1 in checked builds.
+#ifndef GL_CHECKS_ENABLED
+#define GL_CHECKS_ENABLED 0
+#endif
+
+namespace gl {
+
+	// GL error checking. Checked builds install a KHR_debug callback: the
+	// driver reports the errors on its own, asynchronously, and GL_CHECK()
+	// only records where the code is so the report can name the last check
+	// passed before the error. Nothing ever waits on glGetError. Release
+	// builds compile all of it out.
+	class GlDebug
+	{
+	public:
+		// turns on the debug output of the current context, which should be
+		// created with the debug flag. synchronous reports each error
+		// inside the faulty call, at a cost, so the check named is exact.
+		static void Enable(bool synchronous = false)
+		{
+#if GL_CHECKS_ENABLED
+			if (!GLAD_GL_KHR_debug)
+			{
+				std::cerr << "[GL] KHR_debug is not available, GL errors are not reported\n";
+				return;
+			}
+			glEnable(GL_DEBUG_OUTPUT);
+			if (synchronous)
+			{
+				glEnable(GL_DEBUG_OUTPUT_SYNCHRONOUS);
+			}
+			else
+			{
+				glDisable(GL_DEBUG_OUTPUT_SYNCHRONOUS);
+			}
+			glDebugMessageCallback(Callback, nullptr);
+			// performance and portability notes are too chatty to keep.
+			glDebugMessageControl(
+				GL_DONT_CARE, GL_DONT_CARE, GL_DEBUG_SEVERITY_NOTIFICATION, 0, nullptr, GL_FALSE);
+#else
+			(void)synchronous;
+#endif
+		}
+
+#if GL_CHECKS_ENABLED
+		static void Mark(const char* file, int line)
+		{
+			file_.store(file, std::memory_order_relaxed);
+			line_.store(line, std::memory_order_relaxed);
+			checkCount_.fetch_add(1, std::memory_order_relaxed);
+			if (pollErrors_.load(std::memory_order_relaxed))
+			{
+				PollError(file, line);
+			}
+		}
+
+		// a uniform write, checked like any other call before the uniform
+		// setters lost their checks. Only counted and polled, the last
+		// check passed stays the one reported.
+		static void MarkUniform(const char* file, int line)
+		{
+			uniformCount_.fetch_add(1, std::memory_order_relaxed);
+			if (pollErrors_.load(std::memory_order_relaxed))
+			{
+				PollError(file, line);
+			}
+		}
+
+		// checks passed since the start, to compare against the number of
+		// glGetError round trips the same work would cost.
+		static std::uint64_t CheckCount()
+		{
+			return checkCount_.load(std::memory_order_relaxed);
+		}
+
+		static std::uint64_t UniformCount()
+		{
+			return uniformCount_.load(std::memory_order_relaxed);
+		}
+
+		// also calls glGetError at every check, the way every call used to
+		// be checked. Only meant for measuring what that costs.
+		static void SetErrorPolling(bool enabled)
+		{
+			pollErrors_.store(enabled, std::memory_order_relaxed);
+		}
+
+	private:
+		static void PollError(const char* file, int line)
+		{
+			const GLenum error = glGetError();
+			if (error != GL_NO_ERROR)
+			{
+				std::cerr << "[GL] error " << error << " at " << file << ":" << line << "\n";
+			}
+		}
+
+		static const char* SeverityName(GLenum severity)
+		{
+			switch (severity)
+			{
+			case GL_DEBUG_SEVERITY_HIGH:
+				return "high";
+			case GL_DEBUG_SEVERITY_MEDIUM:
+				return "medium";
+			case GL_DEBUG_SEVERITY_LOW:
+				return "low";
+			default:
+				return "notification";
+			}
+		}
+
+		// may run on a driver thread, it only reads the atomics.
+		static void APIENTRY Callback(
+			GLenum source,
+			GLenum type,
+			GLuint id,
+			GLenum severity,
+			GLsizei length,
+			const GLchar* message,
+			const void* userParam)
+		{
+			if (type == GL_DEBUG_TYPE_PUSH_GROUP || type == GL_DEBUG_TYPE_POP_GROUP)
+			{
+				return;
+			}
+			std::cerr << "[GL] " << (type == GL_DEBUG_TYPE_ERROR ? "error" : "message")
+				<< " (" << SeverityName(severity) << ", id " << id << "): " << message
+				<< "\n    after the check at " << file_.load(std::memory_order_relaxed)
+				<< ":" << line_.load(std::memory_order_relaxed) << "\n";
+		}
+
+		static inline std::atomic<const char*> file_ = "start";
+		static inline std::atomic<int> line_ = 0;
+		static inline std::atomic<std::uint64_t> checkCount_ = 0;
+		static inline std::atomic<std::uint64_t> uniformCount_ = 0;
+		static inline std::atomic<bool> pollErrors_ = false;
+#endif
+	};
+
+} // End namespace gl.
+
+// marks the code location for the error reports, after a GL call or a
+// group of them, GL_UNIFORM_CHECK counts a uniform write. Compile to
+// nothing without GL_CHECKS_ENABLED.
+#if GL_CHECKS_ENABLED
+#define GL_CHECK() ::gl::GlDebug::Mark(__FILE__, __LINE__)
+#define GL_UNIFORM_CHECK() ::gl::GlDebug::MarkUniform(__FILE__, __LINE__)
+#else
+#define GL_CHECK() ((void)0)
+#define GL_UNIFORM_CHECK() ((void)0)
+#endif
@@ -0,0 +1,163 @@
+#pragma once
+
+#include <utility>
+#include <glad/glad.h>
+
+#include "gl_state.h"
+
+namespace gl {
+
+	// Move-only owner of a GL object name, deleted with the handle. The
+	// traits provide Create() and Destroy(GLuint), which also drops the
+	// name from the GlState cache. Handles must be destroyed on the thread
+	// owning the GL context, while it is still alive.
+	template<typename Traits>
+	class GlHandle
+	{
+	public:
+		GlHandle() = default;
+		explicit GlHandle(GLuint id) : id_(id) {}
+		~GlHandle()
+		{
+			Reset();
+		}
+
+		GlHandle(const GlHandle&) = delete;
+		GlHandle& operator=(const GlHandle&) = delete;
+
+		GlHandle(GlHandle&& other) noexcept :
+			id_(std::exchange(other.id_, 0))
+		{
+		}
+
+		GlHandle& operator=(GlHandle&& other) noexcept
+		{
+			if (this != &other)
+			{
+				Reset(std::exchange(other.id_, 0));
+			}
+			return *this;
+		}
+
+		template<typename... Args>
+		static GlHandle Create(Args... args)
+		{
+			return GlHandle(Traits::Create(args...));
+		}
+
+		GLuint Get() const { return id_; }
+		explicit operator bool() const { return id_ != 0; }
+
+		// deletes the current object and takes ownership of id.
+		void Reset(GLuint id = 0)
+		{
+			if (id_ != 0)
+			{
+				Traits::Destroy(id_);
+			}
+			id_ = id;
+		}
+
+		// gives up ownership without deleting the object.
+		GLuint Release()
+		{
+			return std::exchange(id_, 0);
+		}
+
+	private:
+		GLuint id_ = 0;
+	};
+
+	struct BufferTraits
+	{
+		static GLuint Create()
+		{
+			GLuint id = 0;
+			glGenBuffers(1, &id);
+			return id;
+		}
+		static void Destroy(GLuint id)
+		{
+			glDeleteBuffers(1, &id);
+			GlState::Global().ForgetBuffer(id);
+		}
+	};
+
+	struct VertexArrayTraits
+	{
+		static GLuint Create()
+		{
+			GLuint id = 0;
+			glGenVertexArrays(1, &id);
+			return id;
+		}
+		static void Destroy(GLuint id)
+		{
+			glDeleteVertexArrays(1, &id);
+			GlState::Global().ForgetVertexArray(id);
+		}
+	};
+
+	struct TextureTraits
+	{
+		static GLuint Create()
+		{
+			GLuint id = 0;
+			glGenTextures(1, &id);
+			return id;
+		}
+		static void Destroy(GLuint id)
+		{
+			glDeleteTextures(1, &id);
+			GlState::Global().ForgetTexture(id);
+		}
+	};
+
+	struct FramebufferTraits
+	{
+		static GLuint Create()
+		{
+			GLuint id = 0;
+			glGenFramebuffers(1, &id);
+			return id;
+		}
+		static void Destroy(GLuint id)
+		{
+			glDeleteFramebuffers(1, &id);
+			GlState::Global().ForgetFramebuffer(id);
+		}
+	};
+
+	struct ProgramTraits
+	{
+		static GLuint Create()
+		{
+			return glCreateProgram();
+		}
+		static void Destroy(GLuint id)
+		{
+			glDeleteProgram(id);
+			GlState::Global().ForgetProgram(id);
+		}
+	};
+
+	struct ShaderTraits
+	{
+		static GLuint Create(GLenum type)
+		{
+			return glCreateShader(type);
+		}
+		static void Destroy(GLuint id)
+		{
+			glDeleteShader(id);
+		}
+	};
+
+	using GlBuffer = GlHandle<BufferTraits>;
+	using GlVertexArray = GlHandle<VertexArrayTraits>;
+	using GlTexture = GlHandle<TextureTraits>;
+	using GlFramebuffer = GlHandle<FramebufferTraits>;
+	using GlProgram = GlHandle<ProgramTraits>;
+	using GlShader = GlHandle<ShaderTraits>;
+
+} // End namespace gl.
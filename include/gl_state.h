@@ -0,0 +1,368 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <glad/glad.h>
+
+namespace gl {
+
+	// Shadow copy of the GL state the engine changes: program, vertex array,
+	// buffer, texture unit and framebuffer bindings, viewport and depth
+	// function. A call setting the value already set is dropped before it
+	// reaches the driver. Every bind of the engine goes through here, code
+	// calling GL directly has to restore what it changed, like the ImGui
+	// backend does, or call Invalidate. Lives on the thread owning the GL
+	// context.
+	class GlState
+	{
+	public:
+		enum class Call : std::uint32_t
+		{
+			PROGRAM,
+			VERTEX_ARRAY,
+			BUFFER,
+			TEXTURE,
+			FRAMEBUFFER,
+			VIEWPORT,
+			DEPTH_FUNC,
+			UNIFORM,
+			COUNT,
+		};
+
+		static constexpr const char* CALL_NAMES[] = {
+			"program",
+			"vertex array",
+			"buffer",
+			"texture",
+			"framebuffer",
+			"viewport",
+			"depth func",
+			"uniform",
+		};
+		static_assert(std::size(CALL_NAMES) == std::size_t(Call::COUNT));
+
+		struct Counter
+		{
+			std::uint64_t issued = 0;
+			std::uint64_t filtered = 0;
+		};
+
+		using Stats = std::array<Counter, std::size_t(Call::COUNT)>;
+
+		static constexpr GLuint MAX_TEXTURE_UNITS = 32;
+		static constexpr GLuint MAX_BUFFER_BINDINGS = 16;
+
+		static GlState& Global()
+		{
+			static GlState state;
+			return state;
+		}
+
+		void UseProgram(GLuint program)
+		{
+			if (Changed(Call::PROGRAM, program_, program))
+			{
+				glUseProgram(program);
+			}
+		}
+
+		// the element array binding belongs to the vertex array, it is
+		// not known anymore once another one is bound.
+		void BindVertexArray(GLuint vertexArray)
+		{
+			if (Changed(Call::VERTEX_ARRAY, vertexArray_, vertexArray))
+			{
+				glBindVertexArray(vertexArray);
+				buffers_[BufferSlot(GL_ELEMENT_ARRAY_BUFFER)] = UNKNOWN;
+			}
+		}
+
+		void BindBuffer(GLenum target, GLuint buffer)
+		{
+			const std::size_t slot = BufferSlot(target);
+			if (slot == NO_SLOT)
+			{
+				// not tracked, always made.
+				Count(Call::BUFFER, true);
+				glBindBuffer(target, buffer);
+			}
+			else if (Changed(Call::BUFFER, buffers_[slot], buffer))
+			{
+				glBindBuffer(target, buffer);
+			}
+		}
+
+		// also binds the buffer to the generic target, like GL does.
+		void BindBufferRange(GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size)
+		{
+			const std::size_t slot = BufferSlot(target);
+			if (slot != NO_SLOT && index < MAX_BUFFER_BINDINGS)
+			{
+				IndexedBuffer& binding = indexedBuffers_[slot][index];
+				const IndexedBuffer range{ buffer, offset, size };
+				if (binding == range && buffers_[slot] == buffer)
+				{
+					Count(Call::BUFFER, false);
+					return;
+				}
+				binding = range;
+				buffers_[slot] = buffer;
+			}
+			Count(Call::BUFFER, true);
+			glBindBufferRange(target, index, buffer, offset, size);
+		}
+
+		// the active texture unit is only switched when the binding of the
+		// unit changes.
+		void BindTexture(GLuint unit, GLenum target, GLuint texture)
+		{
+			const std::size_t slot = TextureSlot(target);
+			if (slot == NO_SLOT || unit >= MAX_TEXTURE_UNITS)
+			{
+				Count(Call::TEXTURE, true);
+				ActiveTexture(unit);
+				glBindTexture(target, texture);
+				return;
+			}
+			if (Changed(Call::TEXTURE, textures_[unit][slot], texture))
+			{
+				ActiveTexture(unit);
+				glBindTexture(target, texture);
+			}
+		}
+
+		// GL_FRAMEBUFFER sets both the draw and the read framebuffer.
+		void BindFramebuffer(GLenum target, GLuint framebuffer)
+		{
+			bool changed = false;
+			if (target == GL_FRAMEBUFFER || target == GL_DRAW_FRAMEBUFFER)
+			{
+				changed |= drawFramebuffer_ != framebuffer;
+				drawFramebuffer_ = framebuffer;
+			}
+			if (target == GL_FRAMEBUFFER || target == GL_READ_FRAMEBUFFER)
+			{
+				changed |= readFramebuffer_ != framebuffer;
+				readFramebuffer_ = framebuffer;
+			}
+			Count(Call::FRAMEBUFFER, changed);
+			if (changed)
+			{
+				glBindFramebuffer(target, framebuffer);
+			}
+		}
+
+		void Viewport(GLint x, GLint y, GLsizei width, GLsizei height)
+		{
+			const std::array<GLint, 4> viewport = { x, y, width, height };
+			const bool changed = viewport != viewport_ || !viewportKnown_;
+			Count(Call::VIEWPORT, changed);
+			if (changed)
+			{
+				viewport_ = viewport;
+				viewportKnown_ = true;
+				glViewport(x, y, width, height);
+			}
+		}
+
+		void DepthFunc(GLenum func)
+		{
+			if (Changed(Call::DEPTH_FUNC, depthFunc_, func))
+			{
+				glDepthFunc(func);
+			}
+		}
+
+		// counted here for the uniform writes the shaders filter.
+		void CountUniform(bool issued)
+		{
+			Count(Call::UNIFORM, issued);
+		}
+
+		// a deleted name may come back from the next glGen*, and GL drops
+		// the bindings of the objects deleted, so the cache forgets them.
+		void ForgetProgram(GLuint program)
+		{
+			Forget(program_, program);
+		}
+
+		void ForgetVertexArray(GLuint vertexArray)
+		{
+			if (vertexArray_ == vertexArray)
+			{
+				vertexArray_ = 0;
+				buffers_[BufferSlot(GL_ELEMENT_ARRAY_BUFFER)] = UNKNOWN;
+			}
+		}
+
+		void ForgetBuffer(GLuint buffer)
+		{
+			for (std::size_t slot = 0; slot < buffers_.size(); ++slot)
+			{
+				Forget(buffers_[slot], buffer);
+				for (IndexedBuffer& binding : indexedBuffers_[slot])
+				{
+					if (binding.buffer == buffer)
+					{
+						binding = {};
+					}
+				}
+			}
+		}
+
+		void ForgetTexture(GLuint texture)
+		{
+			for (auto& unit : textures_)
+			{
+				for (GLuint& binding : unit)
+				{
+					Forget(binding, texture);
+				}
+			}
+		}
+
+		void ForgetFramebuffer(GLuint framebuffer)
+		{
+			Forget(drawFramebuffer_, framebuffer);
+			Forget(readFramebuffer_, framebuffer);
+		}
+
+		// the next call of every kind reaches the driver, after code that
+		// changed the state behind the cache.
+		void Invalidate()
+		{
+			program_ = UNKNOWN;
+			vertexArray_ = UNKNOWN;
+			buffers_.fill(UNKNOWN);
+			for (auto& bindings : indexedBuffers_)
+			{
+				bindings.fill({});
+			}
+			activeTexture_ = UNKNOWN;
+			for (auto& unit : textures_)
+			{
+				unit.fill(UNKNOWN);
+			}
+			drawFramebuffer_ = UNKNOWN;
+			readFramebuffer_ = UNKNOWN;
+			viewportKnown_ = false;
+			depthFunc_ = UNKNOWN;
+		}
+
+		const Stats& GetStats() const
+		{
+			return stats_;
+		}
+
+		void ResetStats()
+		{
+			stats_ = {};
+		}
+
+	private:
+		static constexpr GLuint UNKNOWN = ~0u;
+		static constexpr std::size_t NO_SLOT = ~std::size_t(0);
+
+		struct IndexedBuffer
+		{
+			GLuint buffer = UNKNOWN;
+			GLintptr offset = 0;
+			GLsizeiptr size = 0;
+
+			bool operator==(const IndexedBuffer&) const = default;
+		};
+
+		GlState()
+		{
+			Invalidate();
+		}
+
+		static std::size_t BufferSlot(GLenum target)
+		{
+			switch (target)
+			{
+			case GL_ARRAY_BUFFER:
+				return 0;
+			case GL_ELEMENT_ARRAY_BUFFER:
+				return 1;
+			case GL_UNIFORM_BUFFER:
+				return 2;
+			case GL_DRAW_INDIRECT_BUFFER:
+				return 3;
+			case GL_COPY_READ_BUFFER:
+				return 4;
+			case GL_COPY_WRITE_BUFFER:
+				return 5;
+			case GL_SHADER_STORAGE_BUFFER:
+				return 6;
+			default:
+				return NO_SLOT;
+			}
+		}
+
+		static std::size_t TextureSlot(GLenum target)
+		{
+			switch (target)
+			{
+			case GL_TEXTURE_2D:
+				return 0;
+			case GL_TEXTURE_2D_ARRAY:
+				return 1;
+			case GL_TEXTURE_CUBE_MAP:
+				return 2;
+			default:
+				return NO_SLOT;
+			}
+		}
+
+		void ActiveTexture(GLuint unit)
+		{
+			if (activeTexture_ != unit)
+			{
+				activeTexture_ = unit;
+				glActiveTexture(GL_TEXTURE0 + unit);
+			}
+		}
+
+		void Count(Call call, bool issued)
+		{
+			Counter& counter = stats_[std::size_t(call)];
+			issued ? ++counter.issued : ++counter.filtered;
+		}
+
+		// stores value and returns true if the call has to be made.
+		template<typename T>
+		bool Changed(Call call, T& current, T value)
+		{
+			const bool changed = current != value;
+			Count(call, changed);
+			current = value;
+			return changed;
+		}
+
+		template<typename T>
+		static void Forget(T& current, T name)
+		{
+			if (current == name)
+			{
+				current = UNKNOWN;
+			}
+		}
+
+		GLuint program_;
+		GLuint vertexArray_;
+		std::array<GLuint, 7> buffers_;
+		std::array<std::array<IndexedBuffer, MAX_BUFFER_BINDINGS>, 7> indexedBuffers_;
+		GLuint activeTexture_;
+		std::array<std::array<GLuint, 3>, MAX_TEXTURE_UNITS> textures_;
+		GLuint drawFramebuffer_;
+		GLuint readFramebuffer_;
+		std::array<GLint, 4> viewport_ = {};
+		bool viewportKnown_;
+		GLenum depthFunc_;
+		Stats stats_;
+	};
+
+} // End namespace gl.
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+namespace gl {
+
+	// 64 bit FNV-1a, used to key the on-disk caches.
+	constexpr std::uint64_t FNV_OFFSET_BASIS_64 = 14695981039346656037ull;
+	constexpr std::uint64_t FNV_PRIME_64 = 1099511628211ull;
+
+	constexpr std::uint64_t Fnv1a64(
+		std::string_view string,
+		std::uint64_t hash = FNV_OFFSET_BASIS_64)
+	{
+		for (const char c : string)
+		{
+			hash ^= static_cast<std::uint8_t>(c);
+			hash *= FNV_PRIME_64;
+		}
+		return hash;
+	}
+
+	inline std::uint64_t Fnv1a64(
+		const void* data,
+		std::size_t size,
+		std::uint64_t hash = FNV_OFFSET_BASIS_64)
+	{
+		const auto* bytes = static_cast<const std::uint8_t*>(data);
+		for (std::size_t i = 0; i < size; ++i)
+		{
+			hash ^= bytes[i];
+			hash *= FNV_PRIME_64;
+		}
+		return hash;
+	}
+
+	template<typename T>
+	std::uint64_t HashValue(const T& value, std::uint64_t hash)
+	{
+		return Fnv1a64(&value, sizeof(T), hash);
+	}
+
+} // End namespace gl.
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <cstddef>
+#include <span>
+#include <utility>
+#include <vector>
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "gl_handle.h"
+#include "gl_state.h"
+
+namespace gl {
+
+	// Binding points of the shader storage blocks, the shaders declare
+	// them with layout(std430, binding = ...).
+	enum class StorageBinding : GLuint
+	{
+		INSTANCES = 0,
+	};
+
+	// Instances close to each other, drawn together with one level of
+	// detail. center and radius bound the origins of the instances,
+	// maxScale is the largest scale among them.
+	struct InstanceCell
+	{
+		std::size_t first = 0;
+		std::size_t count = 0;
+		glm::vec3 center = glm::vec3(0.0f);
+		float radius = 0.0f;
+		float maxScale = 1.0f;
+	};
+
+	// World transforms of many copies of a model in a shader storage
+	// buffer, read by the shaders compiled with ShaderFeature::INSTANCED at
+	// firstInstance + gl_InstanceID. The transforms of a cell are
+	// consecutive. They may only rotate and scale uniformly, the shaders
+	// use them as their own normal matrix.
+	class InstanceBuffer
+	{
+	public:
+		InstanceBuffer(std::span<const glm::mat4> transforms, std::vector<InstanceCell> cells) :
+			cells_(std::move(cells)),
+			instanceCount_(transforms.size())
+		{
+			if (transforms.empty())
+			{
+				return;
+			}
+			buffer_ = GlBuffer::Create();
+			GlState::Global().BindBuffer(GL_SHADER_STORAGE_BUFFER, buffer_.Get());
+			glBufferData(
+				GL_SHADER_STORAGE_BUFFER,
+				transforms.size_bytes(),
+				transforms.data(),
+				GL_STATIC_DRAW);
+		}
+
+		InstanceBuffer(const InstanceBuffer&) = delete;
+		InstanceBuffer& operator=(const InstanceBuffer&) = delete;
+
+		std::size_t InstanceCount() const { return instanceCount_; }
+		const std::vector<InstanceCell>& Cells() const { return cells_; }
+
+		// must not be called on an empty buffer.
+		void Bind() const
+		{
+			GlState::Global().BindBufferRange(
+				GL_SHADER_STORAGE_BUFFER,
+				static_cast<GLuint>(StorageBinding::INSTANCES),
+				buffer_.Get(),
+				0,
+				instanceCount_ * sizeof(glm::mat4));
+		}
+
+	private:
+		GlBuffer buffer_;
+		std::vector<InstanceCell> cells_;
+		std::size_t instanceCount_ = 0;
+	};
+
+} // End namespace gl.
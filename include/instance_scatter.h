@@ -0,0 +1,154 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <random>
+#include <stdexcept>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "instance_buffer.h"
+
+namespace gl {
+
+	struct ScatterSettings
+	{
+		// the same seed gives the same instances on every platform.
+		std::uint32_t seed = 1;
+		std::size_t count = 100000;
+		// ground area in the xz plane.
+		glm::vec2 areaMin = glm::vec2(-50.0f);
+		glm::vec2 areaMax = glm::vec2(50.0f);
+		// uniform scale of every instance, picked in [minScale, maxScale].
+		float minScale = 0.8f;
+		float maxScale = 1.2f;
+		// side of the square cells the instances are grouped by.
+		float cellSize = 10.0f;
+		// height of the ground at (x, z), flat at 0 when empty.
+		std::function<float(float, float)> height;
+	};
+
+	// transforms ordered by cell, ready for an InstanceBuffer.
+	struct ScatteredInstances
+	{
+		std::vector<glm::mat4> transforms;
+		std::vector<InstanceCell> cells;
+	};
+
+	// Places instances at random over a terrain area with a random
+	// rotation around the up axis and a random scale, then groups them by
+	// cell so each cell can be drawn with its own level of detail.
+	class InstanceScatter
+	{
+	public:
+		static ScatteredInstances Generate(const ScatterSettings& settings)
+		{
+			if (!(settings.cellSize > 0.0f))
+			{
+				throw std::runtime_error("Scatter cell size must be positive");
+			}
+			const glm::vec2 extent = glm::max(settings.areaMax - settings.areaMin, glm::vec2(0.0f));
+			const std::size_t cellsX = CellCount(extent.x, settings.cellSize);
+			const std::size_t cellsZ = CellCount(extent.y, settings.cellSize);
+
+			std::mt19937 random(settings.seed);
+			std::vector<glm::mat4> placed(settings.count);
+			std::vector<std::uint32_t> placedCells(settings.count);
+			std::vector<std::size_t> cellStarts(cellsX * cellsZ + 1, 0);
+			for (std::size_t i = 0; i < settings.count; ++i)
+			{
+				const float x = settings.areaMin.x + Unit(random) * extent.x;
+				const float z = settings.areaMin.y + Unit(random) * extent.y;
+				const float angle = Unit(random) * 6.28318530718f;
+				const float scale = settings.minScale + Unit(random) * (settings.maxScale - settings.minScale);
+				const float y = settings.height ? settings.height(x, z) : 0.0f;
+				placed[i] = Transform(glm::vec3(x, y, z), angle, scale);
+
+				const std::size_t cellX = std::min(
+					static_cast<std::size_t>((x - settings.areaMin.x) / settings.cellSize), cellsX - 1);
+				const std::size_t cellZ = std::min(
+					static_cast<std::size_t>((z - settings.areaMin.y) / settings.cellSize), cellsZ - 1);
+				placedCells[i] = static_cast<std::uint32_t>(cellZ * cellsX + cellX);
+				++cellStarts[placedCells[i] + 1];
+			}
+
+			// counting sort by cell, the instances keep their order inside
+			// a cell.
+			for (std::size_t cell = 1; cell < cellStarts.size(); ++cell)
+			{
+				cellStarts[cell] += cellStarts[cell - 1];
+			}
+			ScatteredInstances result;
+			result.transforms.resize(settings.count);
+			std::vector<std::size_t> cursors(cellStarts.begin(), cellStarts.end() - 1);
+			for (std::size_t i = 0; i < settings.count; ++i)
+			{
+				result.transforms[cursors[placedCells[i]]++] = placed[i];
+			}
+
+			for (std::size_t cell = 0; cell + 1 < cellStarts.size(); ++cell)
+			{
+				if (cellStarts[cell] == cellStarts[cell + 1])
+				{
+					continue;
+				}
+				result.cells.push_back(CellBounds(
+					result.transforms,
+					cellStarts[cell],
+					cellStarts[cell + 1] - cellStarts[cell]));
+			}
+			return result;
+		}
+
+	private:
+		static std::size_t CellCount(float extent, float cellSize)
+		{
+			return std::max<std::size_t>(static_cast<std::size_t>(std::ceil(extent / cellSize)), 1);
+		}
+
+		// in [0, 1), the standard distributions differ between the
+		// standard libraries while the engine output does not.
+		static float Unit(std::mt19937& random)
+		{
+			return static_cast<float>(random() >> 8) * (1.0f / 16777216.0f);
+		}
+
+		// translation * rotation around y * uniform scale.
+		static glm::mat4 Transform(const glm::vec3& position, float angle, float scale)
+		{
+			const float c = std::cos(angle) * scale;
+			const float s = std::sin(angle) * scale;
+			glm::mat4 transform(1.0f);
+			transform[0] = glm::vec4(c, 0.0f, -s, 0.0f);
+			transform[1] = glm::vec4(0.0f, scale, 0.0f, 0.0f);
+			transform[2] = glm::vec4(s, 0.0f, c, 0.0f);
+			transform[3] = glm::vec4(position, 1.0f);
+			return transform;
+		}
+
+		static InstanceCell CellBounds(const std::vector<glm::mat4>& transforms, std::size_t first, std::size_t count)
+		{
+			glm::vec3 minBound(std::numeric_limits<float>::max());
+			glm::vec3 maxBound(std::numeric_limits<float>::lowest());
+			InstanceCell cell;
+			cell.first = first;
+			cell.count = count;
+			cell.maxScale = 0.0f;
+			for (std::size_t i = first; i < first + count; ++i)
+			{
+				const glm::vec3 origin(transforms[i][3]);
+				minBound = glm::min(minBound, origin);
+				maxBound = glm::max(maxBound, origin);
+				cell.maxScale = std::max(cell.maxScale, glm::length(glm::vec3(transforms[i][1])));
+			}
+			cell.center = 0.5f * (minBound + maxBound);
+			cell.radius = 0.5f * glm::length(maxBound - minBound);
+			return cell;
+		}
+	};
+
+} // End namespace gl.
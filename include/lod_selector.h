@@ -0,0 +1,101 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <glm/glm.hpp>
+
+namespace gl {
+
+	// One level of detail of a mesh, a range of its index buffer. All the
+	// levels share the vertices of the full detail level.
+	struct MeshLod
+	{
+		std::uint32_t firstIndex = 0;
+		std::uint32_t indexCount = 0;
+		// largest deviation from the full detail surface, in object space
+		// units.
+		float error = 0.0f;
+	};
+
+	// Picks the coarsest level of detail whose error, projected on screen,
+	// stays under a threshold in pixels. The default selector always picks
+	// the full detail level.
+	class LodSelector
+	{
+	public:
+		LodSelector() = default;
+
+		static LodSelector Perspective(
+			glm::vec3 eye,
+			float fovY,
+			float viewportHeight,
+			float thresholdPixels)
+		{
+			LodSelector selector;
+			selector.eye_ = eye;
+			selector.pixelsPerUnit_ = viewportHeight / (2.0f * std::tan(fovY * 0.5f));
+			selector.threshold_ = thresholdPixels;
+			selector.perspective_ = true;
+			return selector;
+		}
+
+		// viewHeight is the height of the orthographic volume, so the
+		// projected error does not depend on the distance.
+		static LodSelector Orthographic(
+			float viewHeight,
+			float viewportHeight,
+			float thresholdPixels)
+		{
+			LodSelector selector;
+			selector.pixelsPerUnit_ = viewportHeight / viewHeight;
+			selector.threshold_ = thresholdPixels;
+			return selector;
+		}
+
+		// center and radius bound the mesh in world space, scale converts
+		// the object space errors to world space.
+		std::size_t Select(
+			std::span<const MeshLod> lods,
+			glm::vec3 center,
+			float radius,
+			float scale) const
+		{
+			if (threshold_ <= 0.0f || lods.size() < 2)
+			{
+				return 0;
+			}
+			float pixelsPerUnit = pixelsPerUnit_ * scale;
+			if (perspective_)
+			{
+				// closest point of the bounding sphere, full detail from
+				// inside it.
+				const float distance = glm::length(center - eye_) - radius;
+				if (distance <= MIN_DISTANCE)
+				{
+					return 0;
+				}
+				pixelsPerUnit /= distance;
+			}
+			for (std::size_t lod = lods.size() - 1; lod > 0; --lod)
+			{
+				if (lods[lod].error * pixelsPerUnit <= threshold_)
+				{
+					return lod;
+				}
+			}
+			return 0;
+		}
+
+	private:
+		static constexpr float MIN_DISTANCE = 1e-3f;
+
+		glm::vec3 eye_ = glm::vec3(0.0f);
+		float pixelsPerUnit_ = 0.0f;
+		float threshold_ = 0.0f;
+		bool perspective_ = false;
+	};
+
+} // End namespace gl.
@@ -0,0 +1,248 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <span>
+#include <string>
+#include <utility>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace gl {
+
+	// Read only view of a whole file mapped into the address space. The
+	// mapping stays valid as long as the object is alive.
+	class MappedFile
+	{
+	public:
+		MappedFile() = default;
+		explicit MappedFile(const std::string& path)
+		{
+			Open(path);
+		}
+		~MappedFile()
+		{
+			Close();
+		}
+
+		MappedFile(const MappedFile&) = delete;
+		MappedFile& operator=(const MappedFile&) = delete;
+		MappedFile(MappedFile&& other) noexcept
+		{
+			*this = std::move(other);
+		}
+		MappedFile& operator=(MappedFile&& other) noexcept
+		{
+			if (this != &other)
+			{
+				Close();
+				std::swap(data_, other.data_);
+				std::swap(size_, other.size_);
+				std::swap(isOpen_, other.isOpen_);
+#ifdef _WIN32
+				std::swap(file_, other.file_);
+				std::swap(mapping_, other.mapping_);
+#endif
+			}
+			return *this;
+		}
+
+		bool Open(const std::string& path)
+		{
+			Close();
+#ifdef _WIN32
+			file_ = CreateFileA(
+				path.c_str(),
+				GENERIC_READ,
+				FILE_SHARE_READ,
+				nullptr,
+				OPEN_EXISTING,
+				FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN,
+				nullptr);
+			if (file_ == INVALID_HANDLE_VALUE)
+			{
+				return false;
+			}
+			LARGE_INTEGER size;
+			if (!GetFileSizeEx(file_, &size))
+			{
+				Close();
+				return false;
+			}
+			size_ = static_cast<std::size_t>(size.QuadPart);
+			isOpen_ = true;
+			if (size_ == 0)
+			{
+				return true;
+			}
+			mapping_ = CreateFileMappingA(
+				file_, nullptr, PAGE_READONLY, 0, 0, nullptr);
+			if (mapping_ == nullptr)
+			{
+				Close();
+				return false;
+			}
+			data_ = static_cast<const std::byte*>(
+				MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0));
+			if (data_ == nullptr)
+			{
+				Close();
+				return false;
+			}
+#else
+			const int fd = open(path.c_str(), O_RDONLY);
+			if (fd < 0)
+			{
+				return false;
+			}
+			struct stat info;
+			if (fstat(fd, &info) != 0)
+			{
+				close(fd);
+				return false;
+			}
+			size_ = static_cast<std::size_t>(info.st_size);
+			isOpen_ = true;
+			if (size_ != 0)
+			{
+				void* data = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+				if (data == MAP_FAILED)
+				{
+					close(fd);
+					Close();
+					return false;
+				}
+				data_ = static_cast<const std::byte*>(data);
+			}
+			// the mapping keeps its own reference to the file.
+			close(fd);
+#endif
+			return true;
+		}
+
+		void Close()
+		{
+#ifdef _WIN32
+			if (data_)
+			{
+				UnmapViewOfFile(data_);
+			}
+			if (mapping_)
+			{
+				CloseHandle(mapping_);
+			}
+			if (file_ != INVALID_HANDLE_VALUE)
+			{
+				CloseHandle(file_);
+			}
+			mapping_ = nullptr;
+			file_ = INVALID_HANDLE_VALUE;
+#else
+			if (data_)
+			{
+				munmap(const_cast<std::byte*>(data_), size_);
+			}
+#endif
+			data_ = nullptr;
+			size_ = 0;
+			isOpen_ = false;
+		}
+
+		bool IsOpen() const { return isOpen_; }
+		const std::byte* Data() const { return data_; }
+		std::size_t Size() const { return size_; }
+		std::span<const std::byte> Bytes() const { return { data_, size_ }; }
+
+	private:
+		const std::byte* data_ = nullptr;
+		std::size_t size_ = 0;
+		bool isOpen_ = false;
+#ifdef _WIN32
+		HANDLE file_ = INVALID_HANDLE_VALUE;
+		HANDLE mapping_ = nullptr;
+#endif
+	};
+
+	// Sequential output of WriteFileAtomically, keeps the offset so the
+	// aligned blocks can be padded to.
+	class FileWriter
+	{
+	public:
+		explicit FileWriter(std::ofstream& out) :
+			out_(out)
+		{
+		}
+
+		void Write(const void* data, std::size_t size)
+		{
+			out_.write(static_cast<const char*>(data), static_cast<std::streamsize>(size));
+			offset_ += size;
+		}
+
+		// zeros up to the offset, which is never behind the current one.
+		void PadTo(std::uint64_t offset)
+		{
+			static constexpr char zeros[64] = {};
+			while (offset_ < offset)
+			{
+				Write(zeros, static_cast<std::size_t>(std::min<std::uint64_t>(offset - offset_, sizeof(zeros))));
+			}
+		}
+
+		std::uint64_t Offset() const { return offset_; }
+
+	private:
+		std::ofstream& out_;
+		std::uint64_t offset_ = 0;
+	};
+
+	// write(FileWriter&) fills a temporary file next to path, which then
+	// replaces path, so a crash never leaves a truncated file behind. The
+	// temporary file is removed when write returns false or the output
+	// fails.
+	template<typename WriteFunction>
+	bool WriteFileAtomically(const std::string& path, WriteFunction&& write)
+	{
+		const std::string tmpPath = path + ".tmp";
+		std::error_code error;
+		{
+			std::ofstream out(tmpPath, std::ios::binary | std::ios::trunc);
+			if (!out)
+			{
+				return false;
+			}
+			FileWriter writer(out);
+			const bool written = write(writer) && out.flush();
+			out.close();
+			if (!written || !out)
+			{
+				std::filesystem::remove(tmpPath, error);
+				return false;
+			}
+		}
+		std::filesystem::rename(tmpPath, path, error);
+		if (error)
+		{
+			std::filesystem::remove(tmpPath, error);
+			return false;
+		}
+		return true;
+	}
+
+} // End namespace gl.
@@ -0,0 +1,406 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <glad/glad.h>
+
+#include "cooked_texture.h"
+#include "gl_handle.h"
+#include "gl_state.h"
+#include "shader.h"
+#include "texture.h"
+#include "texture_cache.h"
+
+namespace gl {
+
+	// Material textures of a model packed into GL_TEXTURE_2D_ARRAYs, one
+	// array per slot and per size and format. A mesh selects its textures
+	// with layer indices read from a vertex attribute instead of binding
+	// them, so meshes whose textures share their arrays are drawn without
+	// any texture state change in between.
+	class MaterialArrays
+	{
+	public:
+		// first texture of each type of the mesh, same names as
+		// Mesh::BindTextures, sampled from the matching "_array" sampler.
+		static constexpr std::size_t SLOT_COUNT = 4;
+		static constexpr const char* SLOT_TYPES[SLOT_COUNT] = {
+			"texture_diffuse",
+			"texture_specular",
+			"texture_normal",
+			"texture_emission"
+		};
+		static constexpr UniformId SLOT_SAMPLERS[SLOT_COUNT] = {
+			"texture_diffuse_array",
+			"texture_specular_array",
+			"texture_normal_array",
+			"texture_emission_array"
+		};
+		static constexpr std::size_t NORMAL_SLOT = 2;
+		// units 0 and 1 are left to the scene textures and the shadow map.
+		static constexpr GLuint FIRST_UNIT = 2;
+		// per draw attribute holding the layer of every slot.
+		static constexpr GLuint LAYERS_LOCATION = 4;
+		static constexpr int NO_ARRAY = -1;
+
+		// array and layer of every slot for one mesh.
+		struct MeshMaterial
+		{
+			std::array<int, SLOT_COUNT> arrays;
+			std::array<std::uint16_t, SLOT_COUNT> layers{};
+
+			MeshMaterial()
+			{
+				arrays.fill(NO_ARRAY);
+			}
+
+			// the meshes are drawn with the same bindings.
+			bool SameArrays(const MeshMaterial& other) const
+			{
+				return arrays == other.arrays;
+			}
+		};
+
+		// decodes an image, lets the Model reuse the decodes it started on
+		// the worker threads.
+		using Decoder = std::function<DecodedImage(const std::string&)>;
+
+		// loads the textures referenced by every mesh and uploads them in
+		// arrays, must be called on the thread owning the GL context.
+		std::vector<MeshMaterial> Build(
+			const std::vector<const std::vector<TextureRef>*>& meshTextures,
+			const std::string& directory,
+			bool useCookedTextures,
+			const Decoder& decoder)
+		{
+			std::vector<MeshMaterial> materials(meshTextures.size());
+			std::vector<Source> sources;
+			std::unordered_map<std::string, std::size_t> sourceIndices;
+			// source of every slot of every mesh, before the grouping.
+			std::vector<std::array<std::size_t, SLOT_COUNT>> meshSources(
+				meshTextures.size());
+
+			for (std::size_t mesh = 0; mesh < meshTextures.size(); ++mesh)
+			{
+				meshSources[mesh].fill(NO_SOURCE);
+				for (std::size_t slot = 0; slot < SLOT_COUNT; ++slot)
+				{
+					const TextureRef* textureRef = SlotTexture(*meshTextures[mesh], slot);
+					if (!textureRef)
+					{
+						continue;
+					}
+					const std::string filename = directory + "/" + textureRef->path;
+					const ColourSpace colourSpace = ColourSpaceFor(textureRef->textureType);
+					const std::string key =
+						filename + (colourSpace == ColourSpace::SRGB ? "|srgb" : "|linear");
+					auto known = sourceIndices.find(key);
+					if (known == sourceIndices.end())
+					{
+						Source source;
+						if (!LoadSource(filename, colourSpace, useCookedTextures, decoder, source))
+						{
+							std::cout << "Texture failed to load at path: " << filename << std::endl;
+							sourceIndices.emplace(key, NO_SOURCE);
+							continue;
+						}
+						known = sourceIndices.emplace(key, sources.size()).first;
+						sources.push_back(std::move(source));
+					}
+					meshSources[mesh][slot] = known->second;
+				}
+			}
+
+			// one array per slot and format, the layers in first use order.
+			struct Group
+			{
+				std::size_t slot;
+				ArrayFormat format;
+				std::vector<std::size_t> sources;
+			};
+			std::vector<Group> groups;
+			for (std::size_t mesh = 0; mesh < meshTextures.size(); ++mesh)
+			{
+				for (std::size_t slot = 0; slot < SLOT_COUNT; ++slot)
+				{
+					const std::size_t source = meshSources[mesh][slot];
+					if (source == NO_SOURCE)
+					{
+						continue;
+					}
+					auto group = std::find_if(groups.begin(), groups.end(), [&](const Group& group)
+					{
+						return group.slot == slot && group.format == sources[source].format;
+					});
+					if (group == groups.end())
+					{
+						groups.push_back({ slot, sources[source].format, {} });
+						group = groups.end() - 1;
+					}
+					auto layer = std::find(group->sources.begin(), group->sources.end(), source);
+					if (layer == group->sources.end())
+					{
+						group->sources.push_back(source);
+						layer = group->sources.end() - 1;
+					}
+					materials[mesh].arrays[slot] = static_cast<int>(group - groups.begin());
+					materials[mesh].layers[slot] =
+						static_cast<std::uint16_t>(layer - group->sources.begin());
+				}
+			}
+
+			arrays_.clear();
+			for (const Group& group : groups)
+			{
+				arrays_.push_back(Upload(group.format, group.sources, sources));
+			}
+			return materials;
+		}
+
+		// the texture of a slot of a mesh, the first of its type, or
+		// nullptr. The other textures of the mesh are not used.
+		static const TextureRef* SlotTexture(const std::vector<TextureRef>& textures, std::size_t slot)
+		{
+			auto textureRef = std::find_if(textures.begin(), textures.end(), [slot](const TextureRef& textureRef)
+			{
+				return textureRef.type == SLOT_TYPES[slot];
+			});
+			return textureRef == textures.end() ? nullptr : &*textureRef;
+		}
+
+		std::size_t ArrayCount() const
+		{
+			return arrays_.size();
+		}
+
+		// binds the arrays of a mesh on FIRST_UNIT and the next units.
+		void Bind(const Shader& shader, const MeshMaterial& material) const
+		{
+			for (std::size_t slot = 0; slot < SLOT_COUNT; ++slot)
+			{
+				if (material.arrays[slot] == NO_ARRAY)
+				{
+					continue;
+				}
+				GlState::Global().BindTexture(
+					FIRST_UNIT + static_cast<GLuint>(slot),
+					GL_TEXTURE_2D_ARRAY,
+					arrays_[material.arrays[slot]].Get());
+			}
+			shader.SetBool("materialArrays", true);
+		}
+
+		// the array samplers must not share a unit with a sampler2D even
+		// when they are not used, call once after creating a shader.
+		static void SetSamplerUnits(Shader& shader)
+		{
+			shader.Use();
+			for (std::size_t slot = 0; slot < SLOT_COUNT; ++slot)
+			{
+				shader.SetInt(SLOT_SAMPLERS[slot], static_cast<int>(FIRST_UNIT + slot));
+			}
+			shader.SetBool("materialArrays", false);
+		}
+
+		// layers of a mesh drawn without the instanced attribute.
+		static void SetLayers(const MeshMaterial& material)
+		{
+			glVertexAttribI4ui(
+				LAYERS_LOCATION,
+				material.layers[0],
+				material.layers[1],
+				material.layers[2],
+				material.layers[3]);
+		}
+
+		// the layers of the meshes in indirect command order, read per draw
+		// through baseInstance.
+		static std::vector<std::uint16_t> PackLayers(
+			const std::vector<MeshMaterial>& materials,
+			const std::vector<std::size_t>& meshes)
+		{
+			std::vector<std::uint16_t> layers;
+			layers.reserve(meshes.size() * SLOT_COUNT);
+			for (const std::size_t mesh : meshes)
+			{
+				layers.insert(
+					layers.end(),
+					materials[mesh].layers.begin(),
+					materials[mesh].layers.end());
+			}
+			return layers;
+		}
+
+		// sets up the per draw layer attribute on the bound VAO, from a
+		// buffer filled by PackLayers. The divisor is larger than any
+		// instance count, every instance of a draw reads the layers at its
+		// baseInstance.
+		static void ApplyLayerAttribute(GLuint layerBuffer)
+		{
+			GlState::Global().BindBuffer(GL_ARRAY_BUFFER, layerBuffer);
+			glEnableVertexAttribArray(LAYERS_LOCATION);
+			glVertexAttribIPointer(
+				LAYERS_LOCATION,
+				SLOT_COUNT,
+				GL_UNSIGNED_SHORT,
+				SLOT_COUNT * sizeof(std::uint16_t),
+				nullptr);
+			glVertexAttribDivisor(LAYERS_LOCATION, LAYER_DIVISOR);
+		}
+
+	private:
+		static constexpr GLuint LAYER_DIVISOR = 1u << 30;
+		static constexpr std::size_t NO_SOURCE = ~std::size_t(0);
+
+		// textures can only share an array with the same size, format and
+		// number of levels.
+		struct ArrayFormat
+		{
+			GLenum internalFormat = 0;
+			GLenum format = 0;
+			int width = 0;
+			int height = 0;
+			int levels = 0;
+			bool compressed = false;
+
+			bool operator==(const ArrayFormat&) const = default;
+		};
+
+		struct Source
+		{
+			ArrayFormat format;
+			DecodedImage image;
+			CookedTexture cooked;
+		};
+
+		static int LevelCount(int width, int height)
+		{
+			int levels = 1;
+			while (width > 1 || height > 1)
+			{
+				width = std::max(width / 2, 1);
+				height = std::max(height / 2, 1);
+				++levels;
+			}
+			return levels;
+		}
+
+		static bool LoadSource(
+			const std::string& filename,
+			ColourSpace colourSpace,
+			bool useCookedTextures,
+			const Decoder& decoder,
+			Source& source)
+		{
+			if (useCookedTextures && OpenCookedTexture(filename, source.cooked))
+			{
+				source.format.internalFormat =
+					CompressedInternalFormat(source.cooked.Format(), colourSpace);
+				source.format.width = static_cast<int>(source.cooked.Width());
+				source.format.height = static_cast<int>(source.cooked.Height());
+				source.format.levels = static_cast<int>(source.cooked.LevelCount());
+				source.format.compressed = true;
+				return true;
+			}
+
+			source.image = decoder(filename);
+			if (!source.image.data)
+			{
+				return false;
+			}
+			// sized versions of the formats picked by UploadTexture.
+			const bool srgb = colourSpace == ColourSpace::SRGB;
+			switch (source.image.nbChannels)
+			{
+			case 1:
+				source.format.internalFormat = GL_R8;
+				source.format.format = GL_RED;
+				break;
+			case 2:
+				source.format.internalFormat = GL_RG8;
+				source.format.format = GL_RG;
+				break;
+			case 3:
+				source.format.internalFormat = srgb ? GL_SRGB8 : GL_RGB8;
+				source.format.format = GL_RGB;
+				break;
+			case 4:
+			default:
+				source.format.internalFormat = srgb ? GL_SRGB8_ALPHA8 : GL_RGBA8;
+				source.format.format = GL_RGBA;
+				break;
+			}
+			source.format.width = source.image.width;
+			source.format.height = source.image.height;
+			source.format.levels = LevelCount(source.image.width, source.image.height);
+			return true;
+		}
+
+		static GlTexture Upload(
+			const ArrayFormat& format,
+			const std::vector<std::size_t>& layers,
+			const std::vector<Source>& sources)
+		{
+			GlTexture texture = GlTexture::Create();
+			GlState::Global().BindTexture(0, GL_TEXTURE_2D_ARRAY, texture.Get());
+			glTexStorage3D(
+				GL_TEXTURE_2D_ARRAY,
+				format.levels,
+				format.internalFormat,
+				format.width,
+				format.height,
+				static_cast<GLsizei>(layers.size()));
+
+			for (std::size_t layer = 0; layer < layers.size(); ++layer)
+			{
+				const Source& source = sources[layers[layer]];
+				if (!format.compressed)
+				{
+					glTexSubImage3D(
+						GL_TEXTURE_2D_ARRAY,
+						0,
+						0, 0, static_cast<GLint>(layer),
+						format.width, format.height, 1,
+						format.format,
+						GL_UNSIGNED_BYTE,
+						source.image.data.get());
+					continue;
+				}
+				for (int level = 0; level < format.levels; ++level)
+				{
+					const std::span<const std::byte> data = source.cooked.LevelData(level);
+					glCompressedTexSubImage3D(
+						GL_TEXTURE_2D_ARRAY,
+						level,
+						0, 0, static_cast<GLint>(layer),
+						std::max(format.width >> level, 1),
+						std::max(format.height >> level, 1),
+						1,
+						format.internalFormat,
+						static_cast<GLsizei>(data.size()),
+						data.data());
+				}
+			}
+			if (!format.compressed)
+			{
+				glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+			}
+
+			glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+			glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+			glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+			glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+			return texture;
+		}
+
+		std::vector<GlTexture> arrays_;
+	};
+
+} // End namespace gl.
@@ -1,21 +1,35 @@
 #pragma once
 
+#include <algorithm>
+#include <cstdint>
+#include <iterator>
+#include <span>
 #include <string>
+#include <vector>
 #include <glad/glad.h>
 #include <glm/glm.hpp>
+#include "geometry_arena.h"
+#include "gl_check.h"
+#include "gl_handle.h"
+#include "gl_state.h"
+#include "lod_selector.h"
+#include "render_queue.h"
 #include "texture.h"
 #include "shader.h"
+#include "vertex_layout.h"
 
 
 namespace gl {
 
-    class Vertex
+    // CPU side geometry produced by the importer, before upload. The
+    // indices of the simplified levels follow the full detail ones, lods
+    // is empty when the mesh only has its full detail level.
+    struct MeshData
     {
-    public:
-        glm::vec3 position;
-        glm::vec3 normal;
-        glm::vec2 texture;
-        glm::vec3 tangeant;
+        std::vector<Vertex> vertices;
+        std::vector<unsigned int> indices;
+        std::vector<TextureRef> textures;
+        std::vector<MeshLod> lods;
     };
 
     class Mesh
@@ -23,150 +37,362 @@ namespace gl {
     public:        
         bool hasNormalTexture = false;
     	
-        Mesh(const std::vector<Vertex>& vertices,
-            const std::vector<unsigned int>& indices,
-            std::vector<TextureStruct>& textures) :
-            vertices_(vertices),
-    		indices_(indices),
-    		textures_(textures)
-        {
-        	
-            // VAO binding should be before VAO.
-            glGenVertexArrays(1, &VAO_);
-            IsError(__FILE__, __LINE__);
-            glBindVertexArray(VAO_);
-            IsError(__FILE__, __LINE__);
-
-            // EBO.
-            glGenBuffers(1, &EBO_);
-            IsError(__FILE__, __LINE__);
-            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO_);
-            IsError(__FILE__, __LINE__);
-            glBufferData(
-                GL_ELEMENT_ARRAY_BUFFER,
-                indices_.size() * sizeof(unsigned int),
-                indices_.data(),
-                GL_STATIC_DRAW);
-            IsError(__FILE__, __LINE__);
-           
+        // The spans can point straight into a mapped mesh cache, the GPU
+        // buffers are filled from them directly unless the vertices have to
+        // be quantized first. Nothing is kept on the CPU side unless
+        // RetainGeometry is called.
+        Mesh(std::span<const Vertex> vertices,
+            std::span<const unsigned int> indices,
+            std::vector<TextureStruct>& textures,
+            VertexFormat vertexFormat = VertexFormat::FULL,
+            std::span<const MeshLod> lods = {}) :
+            textures_(textures),
+            vertexFormat_(vertexFormat)
+        {
+            SetLods(vertices, indices, lods);
+            if (vertexFormat_ == VertexFormat::QUANTIZED)
+            {
+                quantization_ = ComputeQuantization(vertices);
+                Upload<PackedVertexLayout>(PackVertices(vertices, quantization_), indices);
+            }
+            else
+            {
+                Upload<FullVertexLayout>(vertices, indices);
+            }
+        }
+        // Suballocates the mesh in a shared arena instead of creating its
+        // own buffers. The quantization is shared by all the meshes of the
+        // model so the whole model can be drawn with one multi draw.
+        Mesh(GeometryArena& arena,
+            std::span<const Vertex> vertices,
+            std::span<const unsigned int> indices,
+            std::vector<TextureStruct>& textures,
+            const VertexQuantization& quantization,
+            std::span<const MeshLod> lods = {}) :
+            textures_(textures),
+            vertexFormat_(arena.Format()),
+            arena_(&arena)
+        {
+            SetLods(vertices, indices, lods);
+            if (vertexFormat_ == VertexFormat::QUANTIZED)
+            {
+                quantization_ = quantization;
+                const std::vector<PackedVertex> packedVertices = PackVertices(vertices, quantization_);
+                range_ = arena.Append<PackedVertex>(packedVertices, indices);
+            }
+            else
+            {
+                range_ = arena.Append<Vertex>(vertices, indices);
+            }
+            indexCount_ = range_.indexCount;
+            indexType_ = arena.IndexType();
+        }
 
-            // VBO.
-            glGenBuffers(1, &VBO_);
-            IsError(__FILE__, __LINE__);
-            glBindBuffer(GL_ARRAY_BUFFER, VBO_);
-            IsError(__FILE__, __LINE__);
-            glBufferData(
-                GL_ARRAY_BUFFER,
-                vertices_.size() * sizeof(Vertex),
-                vertices_.data(),
-                GL_STATIC_DRAW);
-            IsError(__FILE__, __LINE__);
-
-            glEnableVertexAttribArray(0);       	
-            glVertexAttribPointer(
-                0,
-                3,
-                GL_FLOAT,
-                GL_FALSE,
-                sizeof(Vertex),
-                (GLvoid*) nullptr);
-            IsError(__FILE__, __LINE__);
-
-            glEnableVertexAttribArray(1);
-            glVertexAttribPointer(
-                1,
-                3,
-                GL_FLOAT,
-                GL_FALSE,
-                sizeof(Vertex),
-                (GLvoid*)offsetof(Vertex, normal));
-            IsError(__FILE__, __LINE__);
-
-            glEnableVertexAttribArray(2);
-            glVertexAttribPointer(
-                2,
-                2,
-                GL_FLOAT,
-                GL_FALSE,
-                sizeof(Vertex),
-                (GLvoid*)offsetof(Vertex, texture));
-        	
-            glEnableVertexAttribArray(3);
-            glVertexAttribPointer(
-                3,
-                3,
-                GL_FLOAT,
-                GL_FALSE,
-                sizeof(Vertex),
-                (GLvoid*)offsetof(Vertex, tangeant));
-
-            glBindVertexArray(0);
-        }
-        void BindTextures(std::unique_ptr<Shader>& shader) const
-        {
-            unsigned int diffuseNb = 1;
-            unsigned int specularNb = 1;
-            unsigned int normalNb = 1;
-            unsigned int emissionNb = 1;
+        // the GL objects are owned by the mesh, it can only be moved.
+        Mesh(const Mesh&) = delete;
+        Mesh& operator=(const Mesh&) = delete;
+        Mesh(Mesh&&) noexcept = default;
+        Mesh& operator=(Mesh&&) noexcept = default;
+
+        // keeps a CPU copy of the full precision geometry for picking or
+        // culling, meshes only drawn do not need it.
+        void RetainGeometry(
+            std::span<const Vertex> vertices,
+            std::span<const unsigned int> indices)
+        {
+            vertices_.assign(vertices.begin(), vertices.end());
+            indices_.assign(indices.begin(), indices.end());
+        }
+
+        // empty unless RetainGeometry was called.
+        const std::vector<Vertex>& Vertices() const
+        {
+            return vertices_;
+        }
+
+        const std::vector<unsigned int>& Indices() const
+        {
+            return indices_;
+        }
+        void BindTextures(const Shader& shader) const
+        {
+            // texture_diffuse1, texture_diffuse2, ... per type, the names
+            // are hashed at compile time.
+            static constexpr UniformId DIFFUSE_SAMPLERS[] = {
+                "texture_diffuse1", "texture_diffuse2", "texture_diffuse3", "texture_diffuse4" };
+            static constexpr UniformId SPECULAR_SAMPLERS[] = {
+                "texture_specular1", "texture_specular2", "texture_specular3", "texture_specular4" };
+            static constexpr UniformId NORMAL_SAMPLERS[] = {
+                "texture_normal1", "texture_normal2", "texture_normal3", "texture_normal4" };
+            static constexpr UniformId EMISSION_SAMPLERS[] = {
+                "texture_emission1", "texture_emission2", "texture_emission3", "texture_emission4" };
+            static constexpr std::size_t MAX_PER_TYPE = std::size(DIFFUSE_SAMPLERS);
+
+            std::size_t diffuseNb = 0;
+            std::size_t specularNb = 0;
+            std::size_t normalNb = 0;
+            std::size_t emissionNb = 0;
 
         	for(unsigned int i = 0; i < textures_.size(); ++i)
         	{
-                glActiveTexture(GL_TEXTURE0 + i);
-                std::string nb;
-                std::string name = textures_[i].type;
+                const std::string& name = textures_[i].type;
+                const UniformId* samplers = nullptr;
+                std::size_t* nb = nullptr;
 
         		if(name == "texture_diffuse")
         		{
-                    nb = std::to_string(diffuseNb++);
+                    samplers = DIFFUSE_SAMPLERS;
+                    nb = &diffuseNb;
         		}
                 else if(name == "texture_specular")
                 {
-                    nb = std::to_string(specularNb++);
+                    samplers = SPECULAR_SAMPLERS;
+                    nb = &specularNb;
                 }
                 else if(name == "texture_normal")
                 {
-                    nb = std::to_string(normalNb++);
+                    samplers = NORMAL_SAMPLERS;
+                    nb = &normalNb;
                 }
                 else if(name == "texture_emission")
                 {
-                    nb = std::to_string(emissionNb++);
+                    samplers = EMISSION_SAMPLERS;
+                    nb = &emissionNb;
                 }
 
-                shader->SetInt((name + nb).c_str(), i);
-                glBindTexture(GL_TEXTURE_2D, textures_[i].id);
+                if(samplers && *nb < MAX_PER_TYPE)
+                {
+                    shader.SetInt(samplers[(*nb)++], i);
+                }
+                else if(!samplers)
+                {
+                    shader.SetInt(UniformId::FromString(name), i);
+                }
+                GlState::Global().BindTexture(i, GL_TEXTURE_2D, textures_[i].id);
         	}
 
-            glActiveTexture(GL_TEXTURE0);
+            shader.SetBool("materialArrays", false);
         }
-        void Draw(std::unique_ptr<Shader>& shader)
+        void Draw(std::unique_ptr<Shader>& shader, std::size_t lod = 0)
         {
-            BindTextures(shader);
-
-            glBindVertexArray(VAO_);
-            glDrawElements(GL_TRIANGLES, indices_.size(), GL_UNSIGNED_INT, nullptr);
-            glBindVertexArray(0);
+            BindTextures(*shader);
+            SetVertexFormat(*shader);
+            DrawGeometry(lod);
+        }
+        // draw call alone, with the textures and vertex format uniforms
+        // already set by the caller.
+        void DrawGeometry(std::size_t lod = 0, GLsizei instanceCount = 1) const
+        {
+            const MeshLod& level = lods_[lod];
+            if (arena_)
+            {
+                arena_->Bind();
+                glDrawElementsInstancedBaseVertex(
+                    GL_TRIANGLES,
+                    static_cast<GLsizei>(level.indexCount),
+                    indexType_,
+                    arena_->IndexOffset(range_.firstIndex + level.firstIndex),
+                    instanceCount,
+                    range_.baseVertex);
+            }
+            else
+            {
+                const std::size_t indexSize =
+                    indexType_ == GL_UNSIGNED_SHORT ? sizeof(std::uint16_t) : sizeof(std::uint32_t);
+                GlState::Global().BindVertexArray(VAO_.Get());
+                glDrawElementsInstanced(
+                    GL_TRIANGLES,
+                    static_cast<GLsizei>(level.indexCount),
+                    indexType_,
+                    reinterpret_cast<const void*>(level.firstIndex * indexSize),
+                    instanceCount);
+            }
         }
 
-    private:
-        unsigned int VAO_ = 0;
-        unsigned int VBO_ = 0;
-        unsigned int EBO_ = 0;
-    	
-        void IsError(const std::string& file, int line) const
+        // the draw of a level as a RenderQueue packet, the rest of the
+        // packet is left to the caller.
+        void SetPacketGeometry(DrawPacket& packet, std::size_t lod = 0) const
         {
-            auto error_code = glGetError();
-            if (error_code != GL_NO_ERROR)
+            const MeshLod& level = lods_[lod];
+            const std::size_t indexSize =
+                indexType_ == GL_UNSIGNED_SHORT ? sizeof(std::uint16_t) : sizeof(std::uint32_t);
+            packet.kind = DrawKind::ELEMENTS;
+            packet.indexType = indexType_;
+            packet.count = static_cast<GLsizei>(level.indexCount);
+            if (arena_)
+            {
+                packet.vertexArray = arena_->VertexArray();
+                packet.first = (range_.firstIndex + level.firstIndex) * indexSize;
+                packet.baseVertex = range_.baseVertex;
+            }
+            else
             {
-                throw std::runtime_error(
-                    std::to_string(error_code) +
-                    " in file: " + file +
-                    " at line: " + std::to_string(line));
+                packet.vertexArray = VAO_.Get();
+                packet.first = level.firstIndex * indexSize;
+                packet.baseVertex = 0;
             }
         }
 
+        // only meaningful for meshes living in a GeometryArena.
+        DrawElementsIndirectCommand DrawCommand(std::size_t lod = 0) const
+        {
+            DrawElementsIndirectCommand command = range_.Command();
+            command.firstIndex += lods_[lod].firstIndex;
+            command.count = lods_[lod].indexCount;
+            return command;
+        }
+
+        // level 0 is the full detail mesh, the error grows with the level.
+        const std::vector<MeshLod>& Lods() const
+        {
+            return lods_;
+        }
+
+        // object space bounding sphere, used to select the level of detail.
+        // The center is also the center of the bounding box.
+        glm::vec3 BoundingCenter() const
+        {
+            return boundingCenter_;
+        }
+
+        // half size of the object space bounding box, used for culling.
+        glm::vec3 BoundingExtent() const
+        {
+            return boundingExtent_;
+        }
+
+        float BoundingRadius() const
+        {
+            return boundingRadius_;
+        }
+
+        const std::vector<TextureStruct>& Textures() const
+        {
+            return textures_;
+        }
+
+        // uniforms decoding the vertex format in shadow.vert and
+        // depthmap.vert.
+        void SetVertexFormat(const Shader& shader) const
+        {
+            shader.SetVec3("positionScale", quantization_.scale);
+            shader.SetVec3("positionOffset", quantization_.offset);
+            shader.SetBool("octahedralNormals", vertexFormat_ == VertexFormat::QUANTIZED);
+        }
+
+    private:
+        GlVertexArray VAO_;
+        GlBuffer VBO_;
+        GlBuffer EBO_;
+
         std::vector<Vertex> vertices_;
         std::vector<TextureStruct> textures_;
         std::vector<unsigned int> indices_;
+        VertexFormat vertexFormat_ = VertexFormat::FULL;
+        VertexQuantization quantization_;
+        GLsizei indexCount_ = 0;
+        GLenum indexType_ = GL_UNSIGNED_INT;
+        std::vector<MeshLod> lods_;
+        glm::vec3 boundingCenter_ = glm::vec3(0.0f);
+        glm::vec3 boundingExtent_ = glm::vec3(0.0f);
+        float boundingRadius_ = 0.0f;
+        // set when the geometry lives in a shared arena instead of VAO_.
+        GeometryArena* arena_ = nullptr;
+        ArenaRange range_;
+
+        static constexpr std::size_t SHORT_INDEX_LIMIT = 65536;
+
+        void SetLods(
+            std::span<const Vertex> vertices,
+            std::span<const unsigned int> indices,
+            std::span<const MeshLod> lods)
+        {
+            if (lods.empty())
+            {
+                lods_.push_back({ 0, static_cast<std::uint32_t>(indices.size()), 0.0f });
+            }
+            else
+            {
+                lods_.assign(lods.begin(), lods.end());
+            }
+
+            if (vertices.empty())
+            {
+                return;
+            }
+            glm::vec3 minBound = vertices[0].position;
+            glm::vec3 maxBound = vertices[0].position;
+            for (const Vertex& vertex : vertices)
+            {
+                minBound = glm::min(minBound, vertex.position);
+                maxBound = glm::max(maxBound, vertex.position);
+            }
+            boundingCenter_ = (minBound + maxBound) * 0.5f;
+            boundingExtent_ = (maxBound - minBound) * 0.5f;
+            for (const Vertex& vertex : vertices)
+            {
+                boundingRadius_ = std::max(
+                    boundingRadius_,
+                    glm::length(vertex.position - boundingCenter_));
+            }
+        }
+
+        template<typename Layout>
+        void Upload(
+            std::span<const typename Layout::Vertex> vertices,
+            std::span<const unsigned int> indices)
+        {
+            // VAO binding should be before VAO.
+            GlState& state = GlState::Global();
+            VAO_ = GlVertexArray::Create();
+            GL_CHECK();
+            state.BindVertexArray(VAO_.Get());
+            GL_CHECK();
+
+            // EBO, 16 bit indices whenever the vertices fit.
+            EBO_ = GlBuffer::Create();
+            GL_CHECK();
+            state.BindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO_.Get());
+            GL_CHECK();
+            indexCount_ = static_cast<GLsizei>(indices.size());
+            if (vertices.size() <= SHORT_INDEX_LIMIT)
+            {
+                const std::vector<std::uint16_t> shortIndices(indices.begin(), indices.end());
+                indexType_ = GL_UNSIGNED_SHORT;
+                glBufferData(
+                    GL_ELEMENT_ARRAY_BUFFER,
+                    shortIndices.size() * sizeof(std::uint16_t),
+                    shortIndices.data(),
+                    GL_STATIC_DRAW);
+            }
+            else
+            {
+                indexType_ = GL_UNSIGNED_INT;
+                glBufferData(
+                    GL_ELEMENT_ARRAY_BUFFER,
+                    indices.size_bytes(),
+                    indices.data(),
+                    GL_STATIC_DRAW);
+            }
+            GL_CHECK();
+
+            // VBO.
+            VBO_ = GlBuffer::Create();
+            GL_CHECK();
+            state.BindBuffer(GL_ARRAY_BUFFER, VBO_.Get());
+            GL_CHECK();
+            glBufferData(
+                GL_ARRAY_BUFFER,
+                vertices.size_bytes(),
+                vertices.data(),
+                GL_STATIC_DRAW);
+            GL_CHECK();
+
+            Layout::Apply();
+            GL_CHECK();
+
+            state.BindVertexArray(0);
+        }
     };
 
 } // End namespace gl.
@@ -0,0 +1,312 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "asset_archive.h"
+#include "hash.h"
+#include "mapped_file.h"
+#include "mesh.h"
+#include "texture.h"
+
+namespace gl {
+
+	// Geometry of one mesh as stored in the cache, the spans point into the
+	// mapped file and are only valid while the MeshCache is alive.
+	struct MeshView
+	{
+		std::span<const Vertex> vertices;
+		std::span<const unsigned int> indices;
+		std::vector<TextureRef> textures;
+		std::vector<MeshLod> lods;
+	};
+
+	inline MeshView MakeMeshView(const MeshData& meshData)
+	{
+		return { meshData.vertices, meshData.indices, meshData.textures, meshData.lods };
+	}
+
+	// Binary cache of the imported meshes of a model, stored next to the
+	// source asset. The cache is keyed by a hash of the source file and of
+	// the import and processing flags so any change invalidates it.
+	//
+	// Layout:
+	//     Header
+	//     MeshRecord[meshCount]
+	//     texture references (type, name length, path length, name, path)
+	//     MeshLod records
+	//     vertex and index arrays, each aligned on DATA_ALIGNMENT
+	class MeshCache
+	{
+	public:
+		static constexpr std::uint32_t VERSION = 3;
+		static constexpr char EXTENSION[] = ".meshcache";
+
+		static std::string CachePath(const std::string& sourcePath)
+		{
+			return sourcePath + EXTENSION;
+		}
+
+		// processingKey covers whatever runs after the import and changes
+		// the stored geometry, flags as well as settings. Returns 0 if the
+		// source file could not be read.
+		static std::uint64_t ComputeKey(
+			const std::string& sourcePath,
+			unsigned int importFlags,
+			std::uint64_t processingKey = 0)
+		{
+			AssetFile source = AssetFileSystem::Global().Open(sourcePath);
+			if (!source)
+			{
+				return 0;
+			}
+			std::uint64_t key = Fnv1a64(source.Data(), source.Size());
+			key = HashValue(importFlags, key);
+			key = HashValue(processingKey, key);
+			key = HashValue(VERSION, key);
+			return key;
+		}
+
+		// maps the cache and checks it against the key, on success Meshes()
+		// gives views straight into the mapping. A stale cache packed in an
+		// archive falls back to the one Write left on the disk.
+		bool Open(const std::string& cachePath, std::uint64_t key)
+		{
+			meshes_.clear();
+			if (key == 0)
+			{
+				return false;
+			}
+			const AssetFileSystem& fileSystem = AssetFileSystem::Global();
+			file_ = fileSystem.Open(cachePath);
+			if (file_ && Parse(key))
+			{
+				return true;
+			}
+			meshes_.clear();
+			file_ = fileSystem.IsArchived(cachePath) ? fileSystem.OpenLoose(cachePath) : AssetFile();
+			if (!file_ || !Parse(key))
+			{
+				meshes_.clear();
+				file_ = AssetFile();
+				return false;
+			}
+			return true;
+		}
+
+		const std::vector<MeshView>& Meshes() const
+		{
+			return meshes_;
+		}
+
+		static bool Write(
+			const std::string& cachePath,
+			std::uint64_t key,
+			const std::vector<MeshData>& meshes)
+		{
+			if (key == 0)
+			{
+				return false;
+			}
+
+			Header header{};
+			std::memcpy(header.magic, MAGIC, sizeof(header.magic));
+			header.version = VERSION;
+			header.key = key;
+			header.meshCount = static_cast<std::uint32_t>(meshes.size());
+			header.vertexSize = sizeof(Vertex);
+
+			std::vector<MeshRecord> records(meshes.size());
+			std::vector<char> textureBlob;
+			for (std::size_t i = 0; i < meshes.size(); ++i)
+			{
+				records[i].textureCount =
+					static_cast<std::uint32_t>(meshes[i].textures.size());
+				records[i].textureOffset = textureBlob.size();
+				for (const TextureRef& texture : meshes[i].textures)
+				{
+					const std::uint32_t fields[3] = {
+						static_cast<std::uint32_t>(texture.textureType),
+						static_cast<std::uint32_t>(texture.type.size()),
+						static_cast<std::uint32_t>(texture.path.size())
+					};
+					const char* bytes = reinterpret_cast<const char*>(fields);
+					textureBlob.insert(textureBlob.end(), bytes, bytes + sizeof(fields));
+					textureBlob.insert(textureBlob.end(), texture.type.begin(), texture.type.end());
+					textureBlob.insert(textureBlob.end(), texture.path.begin(), texture.path.end());
+				}
+			}
+
+			const std::uint64_t textureStart =
+				sizeof(Header) + records.size() * sizeof(MeshRecord);
+			std::uint64_t offset = textureStart + textureBlob.size();
+			for (std::size_t i = 0; i < meshes.size(); ++i)
+			{
+				records[i].lodOffset = offset;
+				records[i].lodCount = static_cast<std::uint32_t>(meshes[i].lods.size());
+				offset += meshes[i].lods.size() * sizeof(MeshLod);
+			}
+			for (std::size_t i = 0; i < meshes.size(); ++i)
+			{
+				records[i].textureOffset += textureStart;
+				offset = Align(offset);
+				records[i].vertexOffset = offset;
+				records[i].vertexCount =
+					static_cast<std::uint32_t>(meshes[i].vertices.size());
+				offset += meshes[i].vertices.size() * sizeof(Vertex);
+				offset = Align(offset);
+				records[i].indexOffset = offset;
+				records[i].indexCount =
+					static_cast<std::uint32_t>(meshes[i].indices.size());
+				offset += meshes[i].indices.size() * sizeof(unsigned int);
+			}
+
+			return WriteFileAtomically(cachePath, [&](FileWriter& writer)
+			{
+				writer.Write(&header, sizeof(header));
+				writer.Write(records.data(), records.size() * sizeof(MeshRecord));
+				writer.Write(textureBlob.data(), textureBlob.size());
+				for (const MeshData& mesh : meshes)
+				{
+					writer.Write(mesh.lods.data(), mesh.lods.size() * sizeof(MeshLod));
+				}
+				for (std::size_t i = 0; i < meshes.size(); ++i)
+				{
+					writer.PadTo(records[i].vertexOffset);
+					writer.Write(meshes[i].vertices.data(), meshes[i].vertices.size() * sizeof(Vertex));
+					writer.PadTo(records[i].indexOffset);
+					writer.Write(meshes[i].indices.data(), meshes[i].indices.size() * sizeof(unsigned int));
+				}
+				return true;
+			});
+		}
+
+	private:
+		static constexpr char MAGIC[4] = { 'G', 'M', 'S', 'H' };
+		static constexpr std::uint64_t DATA_ALIGNMENT = 16;
+
+		struct Header
+		{
+			char magic[4];
+			std::uint32_t version;
+			std::uint64_t key;
+			std::uint32_t meshCount;
+			std::uint32_t vertexSize;
+		};
+
+		struct MeshRecord
+		{
+			std::uint64_t vertexOffset = 0;
+			std::uint64_t indexOffset = 0;
+			std::uint64_t textureOffset = 0;
+			std::uint64_t lodOffset = 0;
+			std::uint32_t vertexCount = 0;
+			std::uint32_t indexCount = 0;
+			std::uint32_t textureCount = 0;
+			std::uint32_t lodCount = 0;
+		};
+
+		static std::uint64_t Align(std::uint64_t offset)
+		{
+			return (offset + DATA_ALIGNMENT - 1) & ~(DATA_ALIGNMENT - 1);
+		}
+
+		bool InBounds(std::uint64_t offset, std::uint64_t size) const
+		{
+			return offset <= file_.Size() && size <= file_.Size() - offset;
+		}
+
+		bool Parse(std::uint64_t key)
+		{
+			if (!InBounds(0, sizeof(Header)))
+			{
+				return false;
+			}
+			Header header;
+			std::memcpy(&header, file_.Data(), sizeof(header));
+			if (std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 ||
+				header.version != VERSION ||
+				header.key != key ||
+				header.vertexSize != sizeof(Vertex))
+			{
+				return false;
+			}
+			if (!InBounds(sizeof(Header), std::uint64_t(header.meshCount) * sizeof(MeshRecord)))
+			{
+				return false;
+			}
+
+			const std::byte* base = file_.Data();
+			meshes_.resize(header.meshCount);
+			for (std::uint32_t i = 0; i < header.meshCount; ++i)
+			{
+				MeshRecord record;
+				std::memcpy(
+					&record,
+					base + sizeof(Header) + i * sizeof(MeshRecord),
+					sizeof(record));
+
+				const std::uint64_t vertexBytes =
+					std::uint64_t(record.vertexCount) * sizeof(Vertex);
+				const std::uint64_t indexBytes =
+					std::uint64_t(record.indexCount) * sizeof(unsigned int);
+				const std::uint64_t lodBytes =
+					std::uint64_t(record.lodCount) * sizeof(MeshLod);
+				if (!InBounds(record.vertexOffset, vertexBytes) ||
+					!InBounds(record.indexOffset, indexBytes) ||
+					!InBounds(record.lodOffset, lodBytes) ||
+					record.vertexOffset % DATA_ALIGNMENT != 0 ||
+					record.indexOffset % DATA_ALIGNMENT != 0)
+				{
+					return false;
+				}
+				meshes_[i].vertices = {
+					reinterpret_cast<const Vertex*>(base + record.vertexOffset),
+					record.vertexCount };
+				meshes_[i].indices = {
+					reinterpret_cast<const unsigned int*>(base + record.indexOffset),
+					record.indexCount };
+				meshes_[i].lods.resize(record.lodCount);
+				std::memcpy(meshes_[i].lods.data(), base + record.lodOffset, lodBytes);
+				for (const MeshLod& lod : meshes_[i].lods)
+				{
+					if (std::uint64_t(lod.firstIndex) + lod.indexCount > record.indexCount)
+					{
+						return false;
+					}
+				}
+
+				std::uint64_t offset = record.textureOffset;
+				for (std::uint32_t j = 0; j < record.textureCount; ++j)
+				{
+					std::uint32_t fields[3];
+					if (!InBounds(offset, sizeof(fields)))
+					{
+						return false;
+					}
+					std::memcpy(fields, base + offset, sizeof(fields));
+					offset += sizeof(fields);
+					if (!InBounds(offset, std::uint64_t(fields[1]) + fields[2]))
+					{
+						return false;
+					}
+					const char* chars = reinterpret_cast<const char*>(base + offset);
+					TextureRef texture;
+					texture.textureType = static_cast<aiTextureType>(fields[0]);
+					texture.type.assign(chars, fields[1]);
+					texture.path.assign(chars + fields[1], fields[2]);
+					offset += std::uint64_t(fields[1]) + fields[2];
+					meshes_[i].textures.push_back(std::move(texture));
+				}
+			}
+			return true;
+		}
+
+		AssetFile file_;
+		std::vector<MeshView> meshes_;
+	};
+
+} // End namespace gl.
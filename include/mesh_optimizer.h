@@ -0,0 +1,457 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <numeric>
+#include <span>
+#include <unordered_map>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "hash.h"
+#include "mesh.h"
+
+namespace gl {
+
+	struct MeshOptimizationStats
+	{
+		std::size_t verticesBefore = 0;
+		std::size_t verticesAfter = 0;
+		std::size_t triangles = 0;
+		// average cache miss ratio, transformed vertices per triangle.
+		float acmrBefore = 0.0f;
+		float acmrAfter = 0.0f;
+		// average transform to vertex ratio, 1.0 is optimal.
+		float atvrBefore = 0.0f;
+		float atvrAfter = 0.0f;
+	};
+
+	// Reorders geometry after import so the post transform cache, the depth
+	// test and the vertex fetch all work better. Everything runs once at
+	// import, the result is what ends up in the mesh cache.
+	class MeshOptimizer
+	{
+	public:
+		// size of the FIFO cache used to compute the statistics.
+		static constexpr std::size_t STATS_CACHE_SIZE = 16;
+
+		static MeshOptimizationStats Optimize(MeshData& mesh)
+		{
+			MeshOptimizationStats stats;
+			stats.triangles = mesh.indices.size() / 3;
+			stats.verticesBefore = mesh.vertices.size();
+			stats.acmrBefore = ComputeAcmr(mesh.indices, mesh.vertices.size());
+			stats.atvrBefore = ComputeAtvr(mesh.indices, mesh.vertices.size());
+
+			WeldVertices(mesh.vertices, mesh.indices);
+			OptimizeVertexCache(mesh.indices, mesh.vertices.size());
+			OptimizeOverdraw(mesh.indices, mesh.vertices);
+			OptimizeVertexFetch(mesh.vertices, mesh.indices);
+
+			stats.verticesAfter = mesh.vertices.size();
+			stats.acmrAfter = ComputeAcmr(mesh.indices, mesh.vertices.size());
+			stats.atvrAfter = ComputeAtvr(mesh.indices, mesh.vertices.size());
+			return stats;
+		}
+
+		// merges bitwise identical vertices.
+		static void WeldVertices(
+			std::vector<Vertex>& vertices,
+			std::vector<unsigned int>& indices)
+		{
+			struct VertexHash
+			{
+				std::size_t operator()(const Vertex& vertex) const
+				{
+					return static_cast<std::size_t>(Fnv1a64(&vertex, sizeof(Vertex)));
+				}
+			};
+			struct VertexEqual
+			{
+				bool operator()(const Vertex& a, const Vertex& b) const
+				{
+					return std::memcmp(&a, &b, sizeof(Vertex)) == 0;
+				}
+			};
+
+			std::unordered_map<Vertex, unsigned int, VertexHash, VertexEqual> unique;
+			unique.reserve(vertices.size());
+			std::vector<unsigned int> remap(vertices.size());
+			std::vector<Vertex> welded;
+			welded.reserve(vertices.size());
+			for (std::size_t i = 0; i < vertices.size(); ++i)
+			{
+				auto [entry, inserted] = unique.try_emplace(
+					vertices[i],
+					static_cast<unsigned int>(welded.size()));
+				if (inserted)
+				{
+					welded.push_back(vertices[i]);
+				}
+				remap[i] = entry->second;
+			}
+			for (unsigned int& index : indices)
+			{
+				index = remap[index];
+			}
+			vertices = std::move(welded);
+		}
+
+		// Tom Forsyth's linear speed vertex cache optimisation.
+		static void OptimizeVertexCache(
+			std::vector<unsigned int>& indices,
+			std::size_t vertexCount)
+		{
+			const std::size_t triangleCount = indices.size() / 3;
+			if (triangleCount == 0)
+			{
+				return;
+			}
+
+			// triangles using each vertex.
+			std::vector<unsigned int> valence(vertexCount, 0);
+			for (const unsigned int index : indices)
+			{
+				++valence[index];
+			}
+			std::vector<unsigned int> adjacencyOffset(vertexCount + 1, 0);
+			for (std::size_t i = 0; i < vertexCount; ++i)
+			{
+				adjacencyOffset[i + 1] = adjacencyOffset[i] + valence[i];
+			}
+			std::vector<unsigned int> adjacency(indices.size());
+			{
+				std::vector<unsigned int> fill(adjacencyOffset.begin(), adjacencyOffset.end() - 1);
+				for (std::size_t i = 0; i < indices.size(); ++i)
+				{
+					adjacency[fill[indices[i]]++] = static_cast<unsigned int>(i / 3);
+				}
+			}
+
+			std::vector<unsigned int> remaining = valence;
+			std::vector<int> cachePosition(vertexCount, -1);
+			std::vector<float> vertexScore(vertexCount);
+			for (std::size_t i = 0; i < vertexCount; ++i)
+			{
+				vertexScore[i] = ForsythScore(-1, remaining[i]);
+			}
+			std::vector<float> triangleScore(triangleCount);
+			std::vector<bool> emitted(triangleCount, false);
+			for (std::size_t t = 0; t < triangleCount; ++t)
+			{
+				triangleScore[t] =
+					vertexScore[indices[t * 3]] +
+					vertexScore[indices[t * 3 + 1]] +
+					vertexScore[indices[t * 3 + 2]];
+			}
+
+			std::vector<unsigned int> cache;
+			std::vector<unsigned int> newCache;
+			cache.reserve(FORSYTH_CACHE_SIZE + 3);
+			newCache.reserve(FORSYTH_CACHE_SIZE + 3);
+			std::vector<unsigned int> result;
+			result.reserve(indices.size());
+
+			std::size_t scanCursor = 0;
+			std::int64_t best = -1;
+			while (result.size() < indices.size())
+			{
+				if (best < 0)
+				{
+					// nothing left around the cache, continue with the next
+					// triangle in input order. Scanning for the best score
+					// here would be quadratic on meshes made of many small
+					// pieces such as foliage.
+					while (emitted[scanCursor])
+					{
+						++scanCursor;
+					}
+					best = static_cast<std::int64_t>(scanCursor);
+				}
+
+				const std::size_t triangle = static_cast<std::size_t>(best);
+				emitted[triangle] = true;
+				newCache.clear();
+				for (int k = 0; k < 3; ++k)
+				{
+					const unsigned int vertex = indices[triangle * 3 + k];
+					result.push_back(vertex);
+					newCache.push_back(vertex);
+
+					// remove the triangle from the vertex adjacency.
+					const unsigned int begin = adjacencyOffset[vertex];
+					const unsigned int end = begin + remaining[vertex];
+					for (unsigned int a = begin; a < end; ++a)
+					{
+						if (adjacency[a] == triangle)
+						{
+							std::swap(adjacency[a], adjacency[end - 1]);
+							break;
+						}
+					}
+					--remaining[vertex];
+				}
+				for (const unsigned int vertex : cache)
+				{
+					if (std::find(newCache.begin(), newCache.end(), vertex) == newCache.end())
+					{
+						newCache.push_back(vertex);
+					}
+				}
+				std::swap(cache, newCache);
+
+				// rescore everything that was or still is in the cache.
+				for (std::size_t c = 0; c < cache.size(); ++c)
+				{
+					const unsigned int vertex = cache[c];
+					cachePosition[vertex] = c < FORSYTH_CACHE_SIZE ? static_cast<int>(c) : -1;
+				}
+				for (const unsigned int vertex : cache)
+				{
+					const float score = ForsythScore(cachePosition[vertex], remaining[vertex]);
+					const float delta = score - vertexScore[vertex];
+					vertexScore[vertex] = score;
+					const unsigned int begin = adjacencyOffset[vertex];
+					for (unsigned int a = begin; a < begin + remaining[vertex]; ++a)
+					{
+						triangleScore[adjacency[a]] += delta;
+					}
+				}
+				// only the triangles around the cache changed score.
+				best = -1;
+				float bestScore = -1.0f;
+				for (std::size_t c = 0; c < std::min(cache.size(), FORSYTH_CACHE_SIZE); ++c)
+				{
+					const unsigned int vertex = cache[c];
+					const unsigned int begin = adjacencyOffset[vertex];
+					for (unsigned int a = begin; a < begin + remaining[vertex]; ++a)
+					{
+						const unsigned int t = adjacency[a];
+						if (triangleScore[t] > bestScore)
+						{
+							bestScore = triangleScore[t];
+							best = t;
+						}
+					}
+				}
+				if (cache.size() > FORSYTH_CACHE_SIZE)
+				{
+					cache.resize(FORSYTH_CACHE_SIZE);
+				}
+			}
+			indices = std::move(result);
+		}
+
+		// Splits the cache optimized triangle list into clusters at the
+		// points where the cache restarts anyway, then sorts the clusters
+		// so the ones facing outwards the most are drawn first. Occluders
+		// get drawn before what they hide without hurting the cache much.
+		static void OptimizeOverdraw(
+			std::vector<unsigned int>& indices,
+			const std::vector<Vertex>& vertices)
+		{
+			const std::size_t triangleCount = indices.size() / 3;
+			if (triangleCount < 2)
+			{
+				return;
+			}
+
+			std::vector<std::size_t> clusterStart;
+			{
+				std::vector<unsigned int> timestamp(vertices.size(), 0);
+				unsigned int time = STATS_CACHE_SIZE + 1;
+				for (std::size_t t = 0; t < triangleCount; ++t)
+				{
+					int misses = 0;
+					for (int k = 0; k < 3; ++k)
+					{
+						const unsigned int vertex = indices[t * 3 + k];
+						if (time - timestamp[vertex] > STATS_CACHE_SIZE)
+						{
+							timestamp[vertex] = time++;
+							++misses;
+						}
+					}
+					if (t == 0 || misses == 3)
+					{
+						clusterStart.push_back(t);
+					}
+				}
+			}
+			if (clusterStart.size() < 2)
+			{
+				return;
+			}
+			clusterStart.push_back(triangleCount);
+
+			glm::vec3 meshCentroid(0.0f);
+			for (const Vertex& vertex : vertices)
+			{
+				meshCentroid += vertex.position;
+			}
+			meshCentroid /= static_cast<float>(vertices.size());
+
+			const std::size_t clusterCount = clusterStart.size() - 1;
+			std::vector<float> sortKey(clusterCount);
+			for (std::size_t c = 0; c < clusterCount; ++c)
+			{
+				glm::vec3 centroid(0.0f);
+				glm::vec3 normal(0.0f);
+				float area = 0.0f;
+				for (std::size_t t = clusterStart[c]; t < clusterStart[c + 1]; ++t)
+				{
+					const glm::vec3 p0 = vertices[indices[t * 3]].position;
+					const glm::vec3 p1 = vertices[indices[t * 3 + 1]].position;
+					const glm::vec3 p2 = vertices[indices[t * 3 + 2]].position;
+					const glm::vec3 weightedNormal = glm::cross(p1 - p0, p2 - p0);
+					const float triangleArea = glm::length(weightedNormal);
+					centroid += (p0 + p1 + p2) * (triangleArea / 3.0f);
+					normal += weightedNormal;
+					area += triangleArea;
+				}
+				if (area > 0.0f)
+				{
+					centroid /= area;
+				}
+				const float normalLength = glm::length(normal);
+				if (normalLength > 0.0f)
+				{
+					normal /= normalLength;
+				}
+				sortKey[c] = glm::dot(centroid - meshCentroid, normal);
+			}
+
+			std::vector<std::size_t> order(clusterCount);
+			std::iota(order.begin(), order.end(), 0);
+			std::stable_sort(order.begin(), order.end(), [&sortKey](std::size_t a, std::size_t b)
+			{
+				return sortKey[a] > sortKey[b];
+			});
+
+			std::vector<unsigned int> result;
+			result.reserve(indices.size());
+			for (const std::size_t c : order)
+			{
+				result.insert(
+					result.end(),
+					indices.begin() + clusterStart[c] * 3,
+					indices.begin() + clusterStart[c + 1] * 3);
+			}
+			indices = std::move(result);
+		}
+
+		// renumbers the vertices in order of first use and drops unused
+		// ones.
+		static void OptimizeVertexFetch(
+			std::vector<Vertex>& vertices,
+			std::vector<unsigned int>& indices)
+		{
+			constexpr unsigned int UNUSED = std::numeric_limits<unsigned int>::max();
+			std::vector<unsigned int> remap(vertices.size(), UNUSED);
+			std::vector<Vertex> reordered;
+			reordered.reserve(vertices.size());
+			for (unsigned int& index : indices)
+			{
+				if (remap[index] == UNUSED)
+				{
+					remap[index] = static_cast<unsigned int>(reordered.size());
+					reordered.push_back(vertices[index]);
+				}
+				index = remap[index];
+			}
+			vertices = std::move(reordered);
+		}
+
+		static float ComputeAcmr(
+			std::span<const unsigned int> indices,
+			std::size_t vertexCount,
+			std::size_t cacheSize = STATS_CACHE_SIZE)
+		{
+			const std::size_t triangleCount = indices.size() / 3;
+			if (triangleCount == 0)
+			{
+				return 0.0f;
+			}
+			return static_cast<float>(CountCacheMisses(indices, vertexCount, cacheSize)) /
+				static_cast<float>(triangleCount);
+		}
+
+		static float ComputeAtvr(
+			std::span<const unsigned int> indices,
+			std::size_t vertexCount,
+			std::size_t cacheSize = STATS_CACHE_SIZE)
+		{
+			std::vector<bool> used(vertexCount, false);
+			std::size_t usedCount = 0;
+			for (const unsigned int index : indices)
+			{
+				if (!used[index])
+				{
+					used[index] = true;
+					++usedCount;
+				}
+			}
+			if (usedCount == 0)
+			{
+				return 0.0f;
+			}
+			return static_cast<float>(CountCacheMisses(indices, vertexCount, cacheSize)) /
+				static_cast<float>(usedCount);
+		}
+
+	private:
+		static constexpr std::size_t FORSYTH_CACHE_SIZE = 32;
+
+		static float ForsythScore(int cachePosition, unsigned int remaining)
+		{
+			if (remaining == 0)
+			{
+				return -1.0f;
+			}
+			float score = 0.0f;
+			if (cachePosition >= 0)
+			{
+				if (cachePosition < 3)
+				{
+					// the last triangle's vertices, using them again right
+					// away would leave other cache entries unused.
+					score = 0.75f;
+				}
+				else
+				{
+					const float scaler = 1.0f / (FORSYTH_CACHE_SIZE - 3);
+					score = std::pow(1.0f - (cachePosition - 3) * scaler, 1.5f);
+				}
+			}
+			// favour vertices with few triangles left to finish them off.
+			score += 2.0f / std::sqrt(static_cast<float>(remaining));
+			return score;
+		}
+
+		// FIFO post transform cache simulation.
+		static std::size_t CountCacheMisses(
+			std::span<const unsigned int> indices,
+			std::size_t vertexCount,
+			std::size_t cacheSize)
+		{
+			std::vector<std::size_t> timestamp(vertexCount, 0);
+			std::size_t time = cacheSize + 1;
+			std::size_t misses = 0;
+			for (const unsigned int index : indices)
+			{
+				if (time - timestamp[index] > cacheSize)
+				{
+					timestamp[index] = time++;
+					++misses;
+				}
+			}
+			return misses;
+		}
+	};
+
+} // End namespace gl.
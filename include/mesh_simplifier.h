@@ -0,0 +1,603 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <unordered_map>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "hash.h"
+#include "lod_selector.h"
+#include "mesh.h"
+#include "mesh_optimizer.h"
+
+namespace gl {
+
+	struct LodSettings
+	{
+		// number of levels including the full detail one, 1 disables the
+		// simplification.
+		unsigned int levels = 4;
+		// fraction of the triangles of the previous level to aim for.
+		float reduction = 0.5f;
+		// largest error allowed for the coarsest level, relative to the
+		// radius of the mesh.
+		float maxError = 0.05f;
+	};
+
+	// Quadric error metric simplification (Garland and Heckbert) using half
+	// edge collapses, so the simplified levels only need new indices and
+	// keep using the vertices of the full detail mesh.
+	//
+	// Vertices on attribute seams (several vertices at the same position)
+	// and on non manifold edges never move, vertices on open borders only
+	// slide along the border. That keeps the uvs and the silhouette of open
+	// geometry such as leaves intact at the cost of a less aggressive
+	// simplification around them.
+	class MeshSimplifier
+	{
+	public:
+		// Collapses edges cheapest first until the index count reaches
+		// targetIndexCount or the next collapse would move the surface by
+		// more than targetError. resultError receives the largest error
+		// reached, in the same units as the positions.
+		static std::vector<unsigned int> Simplify(
+			std::span<const Vertex> vertices,
+			std::span<const unsigned int> indices,
+			std::size_t targetIndexCount,
+			float targetError,
+			float* resultError = nullptr)
+		{
+			std::vector<unsigned int> result(indices.begin(), indices.end());
+			const std::vector<unsigned int> positionRemap = RemapPositions(vertices);
+			std::vector<Quadric> quadrics = ComputeQuadrics(vertices, indices, positionRemap);
+
+			const double errorLimit = double(targetError) * double(targetError);
+			double maxError = 0.0;
+			std::vector<unsigned int> collapseRemap(vertices.size());
+			std::vector<bool> touched(vertices.size());
+			while (result.size() > targetIndexCount)
+			{
+				const Topology topology = BuildTopology(result, positionRemap, vertices.size());
+
+				std::vector<Collapse> collapses;
+				collapses.reserve(result.size());
+				for (std::size_t i = 0; i < result.size(); i += 3)
+				{
+					for (int k = 0; k < 3; ++k)
+					{
+						const unsigned int a = result[i + k];
+						const unsigned int b = result[i + (k + 1) % 3];
+						AddCollapse(a, b, vertices, positionRemap, quadrics, topology, collapses);
+						AddCollapse(b, a, vertices, positionRemap, quadrics, topology, collapses);
+					}
+				}
+				std::sort(collapses.begin(), collapses.end(), [](const Collapse& a, const Collapse& b)
+				{
+					return a.cost < b.cost;
+				});
+
+				for (std::size_t i = 0; i < vertices.size(); ++i)
+				{
+					collapseRemap[i] = static_cast<unsigned int>(i);
+				}
+				std::fill(touched.begin(), touched.end(), false);
+				std::size_t triangleCount = result.size() / 3;
+				const std::size_t targetTriangles = targetIndexCount / 3;
+				std::size_t applied = 0;
+				for (const Collapse& collapse : collapses)
+				{
+					if (collapse.cost > errorLimit || triangleCount <= targetTriangles)
+					{
+						break;
+					}
+					const unsigned int from = collapse.from;
+					const unsigned int to = collapse.to;
+					if (touched[from] || touched[positionRemap[to]] ||
+						!CanCollapse(from, to, vertices, result, positionRemap, topology))
+					{
+						continue;
+					}
+
+					// a vertex only collapses when it has a single wedge so
+					// all its triangles can use the wedge of the target.
+					collapseRemap[from] = to;
+					quadrics[to] += quadrics[from];
+					maxError = std::max(maxError, collapse.cost);
+					++applied;
+					for (const unsigned int triangle : topology.Triangles(from))
+					{
+						bool removed = false;
+						for (int k = 0; k < 3; ++k)
+						{
+							const unsigned int vertex = result[triangle * 3 + k];
+							touched[positionRemap[vertex]] = true;
+							removed |= positionRemap[vertex] == positionRemap[to];
+						}
+						if (removed)
+						{
+							--triangleCount;
+						}
+					}
+				}
+				if (applied == 0)
+				{
+					break;
+				}
+
+				// drop the triangles that lost an edge.
+				std::size_t write = 0;
+				for (std::size_t i = 0; i < result.size(); i += 3)
+				{
+					const unsigned int a = collapseRemap[result[i]];
+					const unsigned int b = collapseRemap[result[i + 1]];
+					const unsigned int c = collapseRemap[result[i + 2]];
+					if (positionRemap[a] == positionRemap[b] ||
+						positionRemap[b] == positionRemap[c] ||
+						positionRemap[c] == positionRemap[a])
+					{
+						continue;
+					}
+					result[write++] = a;
+					result[write++] = b;
+					result[write++] = c;
+				}
+				result.resize(write);
+			}
+
+			if (resultError)
+			{
+				*resultError = static_cast<float>(std::sqrt(maxError));
+			}
+			return result;
+		}
+
+		// Appends the simplified levels to the index buffer of the mesh and
+		// fills mesh.lods, level 0 being the original indices. Each level is
+		// simplified from the full detail mesh and reordered for the vertex
+		// cache. The chain stops early once a level no longer gets smaller.
+		static void BuildLods(MeshData& mesh, const LodSettings& settings)
+		{
+			const std::size_t baseCount = mesh.indices.size();
+			mesh.lods.clear();
+			mesh.lods.push_back({ 0, static_cast<std::uint32_t>(baseCount), 0.0f });
+			if (settings.levels < 2 || baseCount < 3 || mesh.vertices.empty())
+			{
+				return;
+			}
+
+			glm::vec3 minBound = mesh.vertices[0].position;
+			glm::vec3 maxBound = mesh.vertices[0].position;
+			for (const Vertex& vertex : mesh.vertices)
+			{
+				minBound = glm::min(minBound, vertex.position);
+				maxBound = glm::max(maxBound, vertex.position);
+			}
+			const float radius = glm::length(maxBound - minBound) * 0.5f;
+
+			const std::vector<unsigned int> baseIndices(mesh.indices.begin(), mesh.indices.end());
+			std::size_t previousCount = baseCount;
+			float previousError = 0.0f;
+			for (unsigned int level = 1; level < settings.levels; ++level)
+			{
+				const float fraction = std::pow(settings.reduction, static_cast<float>(level));
+				const std::size_t target =
+					static_cast<std::size_t>(baseCount / 3 * fraction) * 3;
+				float error = 0.0f;
+				std::vector<unsigned int> lodIndices = Simplify(
+					mesh.vertices,
+					baseIndices,
+					target,
+					settings.maxError * radius,
+					&error);
+				if (lodIndices.empty() ||
+					lodIndices.size() > previousCount * MIN_LEVEL_REDUCTION)
+				{
+					break;
+				}
+				MeshOptimizer::OptimizeVertexCache(lodIndices, mesh.vertices.size());
+
+				MeshLod lod;
+				lod.firstIndex = static_cast<std::uint32_t>(mesh.indices.size());
+				lod.indexCount = static_cast<std::uint32_t>(lodIndices.size());
+				// levels are built independently, keep the errors growing
+				// so the selection stays monotonic.
+				lod.error = std::max(error, previousError);
+				mesh.lods.push_back(lod);
+				mesh.indices.insert(mesh.indices.end(), lodIndices.begin(), lodIndices.end());
+				previousCount = lodIndices.size();
+				previousError = lod.error;
+			}
+		}
+
+	private:
+		// a level has to drop at least 10% of the previous one's indices.
+		static constexpr float MIN_LEVEL_REDUCTION = 0.9f;
+		// weight of the planes keeping border vertices on the border.
+		static constexpr double BORDER_WEIGHT = 10.0;
+		// smallest cosine between a triangle normal before and after a
+		// collapse.
+		static constexpr float MIN_NORMAL_COSINE = 0.1f;
+
+		enum class VertexKind : std::uint8_t
+		{
+			MANIFOLD,
+			BORDER,
+			LOCKED
+		};
+
+		// symmetric 4x4 matrix of the squared plane distances and the sum
+		// of the plane weights.
+		struct Quadric
+		{
+			double a00 = 0, a01 = 0, a02 = 0, a03 = 0;
+			double a11 = 0, a12 = 0, a13 = 0;
+			double a22 = 0, a23 = 0;
+			double a33 = 0;
+			double weight = 0;
+
+			static Quadric FromPlane(glm::vec3 normal, float distance, double weight)
+			{
+				const double a = normal.x;
+				const double b = normal.y;
+				const double c = normal.z;
+				const double d = distance;
+				Quadric quadric;
+				quadric.a00 = a * a * weight;
+				quadric.a01 = a * b * weight;
+				quadric.a02 = a * c * weight;
+				quadric.a03 = a * d * weight;
+				quadric.a11 = b * b * weight;
+				quadric.a12 = b * c * weight;
+				quadric.a13 = b * d * weight;
+				quadric.a22 = c * c * weight;
+				quadric.a23 = c * d * weight;
+				quadric.a33 = d * d * weight;
+				quadric.weight = weight;
+				return quadric;
+			}
+
+			Quadric& operator+=(const Quadric& other)
+			{
+				a00 += other.a00; a01 += other.a01; a02 += other.a02; a03 += other.a03;
+				a11 += other.a11; a12 += other.a12; a13 += other.a13;
+				a22 += other.a22; a23 += other.a23;
+				a33 += other.a33;
+				weight += other.weight;
+				return *this;
+			}
+
+			// weighted mean of the squared distances to the planes.
+			double Error(glm::vec3 position) const
+			{
+				if (weight <= 0.0)
+				{
+					return 0.0;
+				}
+				const double x = position.x;
+				const double y = position.y;
+				const double z = position.z;
+				const double error =
+					a00 * x * x + 2.0 * a01 * x * y + 2.0 * a02 * x * z + 2.0 * a03 * x +
+					a11 * y * y + 2.0 * a12 * y * z + 2.0 * a13 * y +
+					a22 * z * z + 2.0 * a23 * z +
+					a33;
+				return std::max(error, 0.0) / weight;
+			}
+		};
+
+		struct Collapse
+		{
+			unsigned int from;
+			unsigned int to;
+			double cost;
+		};
+
+		// connectivity of the current triangles by position.
+		struct Topology
+		{
+			std::vector<unsigned int> offsets;
+			std::vector<unsigned int> triangles;
+			std::vector<VertexKind> kinds;
+			std::unordered_map<std::uint64_t, unsigned int> edgeCounts;
+
+			std::span<const unsigned int> Triangles(unsigned int position) const
+			{
+				return std::span<const unsigned int>(triangles).subspan(
+					offsets[position],
+					offsets[position + 1] - offsets[position]);
+			}
+
+			unsigned int EdgeCount(unsigned int a, unsigned int b) const
+			{
+				auto edge = edgeCounts.find(EdgeKey(a, b));
+				return edge == edgeCounts.end() ? 0 : edge->second;
+			}
+		};
+
+		static std::uint64_t EdgeKey(unsigned int a, unsigned int b)
+		{
+			if (a > b)
+			{
+				std::swap(a, b);
+			}
+			return (std::uint64_t(a) << 32) | b;
+		}
+
+		// first vertex with the same position, for every vertex.
+		static std::vector<unsigned int> RemapPositions(std::span<const Vertex> vertices)
+		{
+			struct PositionHash
+			{
+				std::size_t operator()(const glm::vec3& position) const
+				{
+					return static_cast<std::size_t>(Fnv1a64(&position, sizeof(position)));
+				}
+			};
+			struct PositionEqual
+			{
+				bool operator()(const glm::vec3& a, const glm::vec3& b) const
+				{
+					return std::memcmp(&a, &b, sizeof(glm::vec3)) == 0;
+				}
+			};
+
+			std::unordered_map<glm::vec3, unsigned int, PositionHash, PositionEqual> unique;
+			unique.reserve(vertices.size());
+			std::vector<unsigned int> remap(vertices.size());
+			for (std::size_t i = 0; i < vertices.size(); ++i)
+			{
+				remap[i] = unique.try_emplace(
+					vertices[i].position,
+					static_cast<unsigned int>(i)).first->second;
+			}
+			return remap;
+		}
+
+		static Topology BuildTopology(
+			const std::vector<unsigned int>& indices,
+			const std::vector<unsigned int>& positionRemap,
+			std::size_t vertexCount)
+		{
+			Topology topology;
+			topology.offsets.assign(vertexCount + 1, 0);
+			for (const unsigned int index : indices)
+			{
+				++topology.offsets[positionRemap[index] + 1];
+			}
+			for (std::size_t i = 0; i < vertexCount; ++i)
+			{
+				topology.offsets[i + 1] += topology.offsets[i];
+			}
+			topology.triangles.resize(indices.size());
+			std::vector<unsigned int> fill(topology.offsets.begin(), topology.offsets.end() - 1);
+			topology.edgeCounts.reserve(indices.size());
+			for (std::size_t i = 0; i < indices.size(); ++i)
+			{
+				const unsigned int position = positionRemap[indices[i]];
+				topology.triangles[fill[position]++] = static_cast<unsigned int>(i / 3);
+				const std::size_t next = i - i % 3 + (i + 1) % 3;
+				++topology.edgeCounts[EdgeKey(position, positionRemap[indices[next]])];
+			}
+
+			// more than one wedge at a position means an attribute seam.
+			std::vector<unsigned int> wedges(vertexCount, 0);
+			for (std::size_t i = 0; i < vertexCount; ++i)
+			{
+				++wedges[positionRemap[i]];
+			}
+			std::vector<unsigned int> borderEdges(vertexCount, 0);
+			std::vector<bool> nonManifold(vertexCount, false);
+			for (const auto& [key, count] : topology.edgeCounts)
+			{
+				const unsigned int a = static_cast<unsigned int>(key >> 32);
+				const unsigned int b = static_cast<unsigned int>(key & 0xffffffffu);
+				if (count == 1)
+				{
+					++borderEdges[a];
+					++borderEdges[b];
+				}
+				else if (count > 2)
+				{
+					nonManifold[a] = true;
+					nonManifold[b] = true;
+				}
+			}
+			topology.kinds.resize(vertexCount);
+			for (std::size_t i = 0; i < vertexCount; ++i)
+			{
+				const unsigned int position = positionRemap[i];
+				if (wedges[position] > 1 || nonManifold[position])
+				{
+					topology.kinds[i] = VertexKind::LOCKED;
+				}
+				else if (borderEdges[position] == 0)
+				{
+					topology.kinds[i] = VertexKind::MANIFOLD;
+				}
+				else if (borderEdges[position] == 2)
+				{
+					topology.kinds[i] = VertexKind::BORDER;
+				}
+				else
+				{
+					topology.kinds[i] = VertexKind::LOCKED;
+				}
+			}
+			return topology;
+		}
+
+		// area weighted triangle planes, plus planes perpendicular to the
+		// open borders so border vertices stay on them.
+		static std::vector<Quadric> ComputeQuadrics(
+			std::span<const Vertex> vertices,
+			std::span<const unsigned int> indices,
+			const std::vector<unsigned int>& positionRemap)
+		{
+			std::vector<Quadric> quadrics(vertices.size());
+			std::unordered_map<std::uint64_t, unsigned int> edgeCounts;
+			edgeCounts.reserve(indices.size());
+			for (std::size_t i = 0; i < indices.size(); ++i)
+			{
+				const std::size_t next = i - i % 3 + (i + 1) % 3;
+				++edgeCounts[EdgeKey(positionRemap[indices[i]], positionRemap[indices[next]])];
+			}
+
+			for (std::size_t i = 0; i + 2 < indices.size(); i += 3)
+			{
+				const unsigned int triangle[3] = { indices[i], indices[i + 1], indices[i + 2] };
+				const glm::vec3 p0 = vertices[triangle[0]].position;
+				const glm::vec3 p1 = vertices[triangle[1]].position;
+				const glm::vec3 p2 = vertices[triangle[2]].position;
+				glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+				const float doubleArea = glm::length(normal);
+				if (doubleArea == 0.0f)
+				{
+					continue;
+				}
+				normal /= doubleArea;
+				const Quadric plane = Quadric::FromPlane(normal, -glm::dot(normal, p0), doubleArea * 0.5);
+				for (const unsigned int vertex : triangle)
+				{
+					quadrics[vertex] += plane;
+				}
+
+				for (int k = 0; k < 3; ++k)
+				{
+					const unsigned int a = triangle[k];
+					const unsigned int b = triangle[(k + 1) % 3];
+					if (edgeCounts[EdgeKey(positionRemap[a], positionRemap[b])] != 1)
+					{
+						continue;
+					}
+					const glm::vec3 edge = vertices[b].position - vertices[a].position;
+					const float edgeLength = glm::length(edge);
+					if (edgeLength == 0.0f)
+					{
+						continue;
+					}
+					const glm::vec3 borderNormal = glm::normalize(glm::cross(edge, normal));
+					const Quadric border = Quadric::FromPlane(
+						borderNormal,
+						-glm::dot(borderNormal, vertices[a].position),
+						double(edgeLength) * edgeLength * BORDER_WEIGHT);
+					quadrics[a] += border;
+					quadrics[b] += border;
+				}
+			}
+			return quadrics;
+		}
+
+		static void AddCollapse(
+			unsigned int from,
+			unsigned int to,
+			std::span<const Vertex> vertices,
+			const std::vector<unsigned int>& positionRemap,
+			const std::vector<Quadric>& quadrics,
+			const Topology& topology,
+			std::vector<Collapse>& collapses)
+		{
+			const VertexKind kind = topology.kinds[from];
+			if (kind == VertexKind::LOCKED)
+			{
+				return;
+			}
+			// border vertices only slide along the border. from has a single
+			// wedge so it is its own position.
+			if (kind == VertexKind::BORDER && topology.EdgeCount(from, positionRemap[to]) != 1)
+			{
+				return;
+			}
+			collapses.push_back({ from, to, quadrics[from].Error(vertices[to].position) });
+		}
+
+		static bool CanCollapse(
+			unsigned int from,
+			unsigned int to,
+			std::span<const Vertex> vertices,
+			const std::vector<unsigned int>& indices,
+			const std::vector<unsigned int>& positionRemap,
+			const Topology& topology)
+		{
+			const unsigned int toPosition = positionRemap[to];
+			const glm::vec3 target = vertices[to].position;
+
+			// link condition: the only neighbours shared by both ends are
+			// the ones of the triangles on the edge, otherwise the collapse
+			// would create a non manifold edge.
+			std::vector<unsigned int> fromNeighbours;
+			unsigned int sharedTriangles = 0;
+			for (const unsigned int triangle : topology.Triangles(from))
+			{
+				bool hasTarget = false;
+				for (int k = 0; k < 3; ++k)
+				{
+					const unsigned int position = positionRemap[indices[triangle * 3 + k]];
+					hasTarget |= position == toPosition;
+					if (position != from && position != toPosition)
+					{
+						fromNeighbours.push_back(position);
+					}
+				}
+				if (hasTarget)
+				{
+					++sharedTriangles;
+					continue;
+				}
+
+				// the triangles that stay must not flip or degenerate.
+				glm::vec3 before[3];
+				glm::vec3 after[3];
+				for (int k = 0; k < 3; ++k)
+				{
+					const unsigned int vertex = indices[triangle * 3 + k];
+					before[k] = vertices[vertex].position;
+					after[k] = positionRemap[vertex] == from ? target : before[k];
+				}
+				const glm::vec3 normalBefore = glm::cross(before[1] - before[0], before[2] - before[0]);
+				const glm::vec3 normalAfter = glm::cross(after[1] - after[0], after[2] - after[0]);
+				const float lengths = glm::length(normalBefore) * glm::length(normalAfter);
+				if (lengths == 0.0f ||
+					glm::dot(normalBefore, normalAfter) < MIN_NORMAL_COSINE * lengths)
+				{
+					return false;
+				}
+			}
+			if (sharedTriangles == 0)
+			{
+				return false;
+			}
+
+			std::sort(fromNeighbours.begin(), fromNeighbours.end());
+			fromNeighbours.erase(
+				std::unique(fromNeighbours.begin(), fromNeighbours.end()),
+				fromNeighbours.end());
+			unsigned int sharedNeighbours = 0;
+			std::vector<unsigned int> seen;
+			for (const unsigned int triangle : topology.Triangles(toPosition))
+			{
+				for (int k = 0; k < 3; ++k)
+				{
+					const unsigned int position = positionRemap[indices[triangle * 3 + k]];
+					if (position == toPosition || position == from ||
+						std::find(seen.begin(), seen.end(), position) != seen.end())
+					{
+						continue;
+					}
+					seen.push_back(position);
+					if (std::binary_search(fromNeighbours.begin(), fromNeighbours.end(), position))
+					{
+						++sharedNeighbours;
+					}
+				}
+			}
+			return sharedNeighbours == sharedTriangles;
+		}
+	};
+
+} // End namespace gl.
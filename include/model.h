@@ -1,25 +1,118 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
+#include <functional>
+#include <future>
+#include <limits>
+#include <memory>
+#include <span>
+#include <unordered_map>
 #include <vector>
 #include <assimp/Importer.hpp>
 #include <assimp/scene.h>
 #include <assimp/postprocess.h>
 
+#include "aabb.h"
+#include "asset_io_system.h"
+#include "cooked_texture.h"
+#include "frustum.h"
+#include "geometry_arena.h"
+#include "gl_state.h"
+#include "hash.h"
+#include "instance_buffer.h"
+#include "lod_selector.h"
 #include "material.h"
+#include "material_arrays.h"
 #include "mesh.h"
+#include "mesh_cache.h"
+#include "mesh_optimizer.h"
+#include "mesh_simplifier.h"
+#include "render_queue.h"
+#include "shader_variants.h"
 #include "texture.h"
+#include "texture_cache.h"
+#include "thread_pool.h"
 
 namespace gl {
 
+	struct ModelOptions
+	{
+		// store the imported meshes in a binary cache next to the source
+		// file and map it on the next load instead of running Assimp.
+		bool useMeshCache = true;
+		// convert the meshes and decode the textures on the worker threads,
+		// only the GL uploads stay on the calling thread. The result is the
+		// same as the serial import.
+		bool parallelImport = true;
+		// QUANTIZED uploads 20 byte vertices (snorm16 positions, octahedral
+		// normals and tangents, half float uvs) instead of 44 bytes.
+		VertexFormat vertexFormat = VertexFormat::QUANTIZED;
+		// weld the vertices and reorder triangles and vertices for the
+		// post transform cache, overdraw and vertex fetch at import.
+		bool optimizeMeshes = true;
+		// simplified levels of detail generated at import for every mesh,
+		// picked at draw time from their projected error.
+		LodSettings lods;
+		// suballocate all the meshes in one GeometryArena and draw the model
+		// with one multi draw indirect per set of textures instead of one
+		// draw call per mesh.
+		bool sharedArena = true;
+		// arena shared with other models using the same vertex format, a
+		// new one sized for this model is created when null.
+		std::shared_ptr<GeometryArena> arena;
+		// keep a CPU copy of the geometry in every Mesh for picking or
+		// culling, by default it is released once uploaded.
+		bool retainGeometry = false;
+		// upload the block compressed mip chains written by texcook next
+		// to the images when they are up to date, skipping the decode and
+		// glGenerateMipmap.
+		bool useCookedTextures = true;
+		// pack the material textures into texture arrays by size and
+		// format, meshes pick their layer from a per draw attribute so the
+		// whole model draws without rebinding textures between meshes.
+		// The arrays are built per model and do not go through the
+		// TextureCache, models sharing a texture upload it each.
+		bool textureArrays = false;
+	};
+
 	class Model {
 	public:
         std::string directory;
 		std::string textureDirectory = "data/textures";
 		
-		Model(const std::string& filename)
+		Model(const std::string& filename, const ModelOptions& options = {}) :
+			options_(options)
 		{
+            directory = filename.substr(0, filename.find_last_of('/'));
+
+			std::uint64_t cacheKey = 0;
+			const std::string cachePath = MeshCache::CachePath(filename);
+			if(options.useMeshCache)
+			{
+				cacheKey = MeshCache::ComputeKey(filename, IMPORT_FLAGS, ProcessingKey());
+
+				MeshCache cache;
+				if(cache.Open(cachePath, cacheKey))
+				{
+					if(options.parallelImport)
+					{
+						for(const MeshView& meshView : cache.Meshes())
+						{
+							DecodeTexturesAsync(meshView.textures);
+						}
+					}
+					CreateMeshes(cache.Meshes());
+					pendingDecodes_.clear();
+					return;
+				}
+			}
+
             Assimp::Importer importer;
-            const aiScene* scene = importer.ReadFile(filename, aiProcess_Triangulate | aiProcess_FlipUVs | aiProcess_CalcTangentSpace | aiProcess_GenNormals);
+			// the importer owns the handler, the model and its materials
+			// are read from the mounted archives first.
+			importer.SetIOHandler(new AssetIOSystem());
+            const aiScene* scene = importer.ReadFile(filename, IMPORT_FLAGS);
 
 			if(!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode)
 			{
@@ -27,43 +120,398 @@ namespace gl {
                 return;
 			}
 
-            directory = filename.substr(0, filename.find_last_of('/'));
+			std::vector<MeshData> meshData;
+			if(options.parallelImport)
+			{
+				ProcessSceneParallel(scene, meshData);
+			}
+			else
+			{
+				ProcessNode(scene->mRootNode, scene, meshData);
+			}
+
+			if(options_.optimizeMeshes)
+			{
+				OptimizeMeshes(meshData);
+				ReportOptimization(filename);
+			}
+			if(options_.lods.levels > 1)
+			{
+				ForEachMesh(meshData.size(), [this, &meshData](std::size_t i)
+				{
+					MeshSimplifier::BuildLods(meshData[i], options_.lods);
+				});
+			}
 
-			ProcessNode(scene->mRootNode, scene);
+			if(options.useMeshCache && !MeshCache::Write(cachePath, cacheKey, meshData))
+			{
+				std::cout << "Could not write mesh cache " << cachePath << "\n";
+			}
+
+			std::vector<MeshView> meshViews;
+			meshViews.reserve(meshData.size());
+			for(const MeshData& data : meshData)
+			{
+				meshViews.push_back(MakeMeshView(data));
+			}
+			CreateMeshes(meshViews);
+			// decodes nothing picked up, they are never needed again.
+			pendingDecodes_.clear();
 		}
 
+		// draws the full detail meshes.
 		void Draw(std::unique_ptr<Shader>& shader)
 		{
+			Draw(shader, glm::mat4(1.0f), LodSelector());
+		}
+
+		// picks the level of detail of every mesh placed with the model
+		// matrix and returns the number of triangles drawn.
+		std::size_t Draw(
+			std::unique_ptr<Shader>& shader,
+			const glm::mat4& model,
+			const LodSelector& selector)
+		{
+			const std::size_t triangles = SelectLods(model, selector, selectedLods_);
+			if(arena_)
+			{
+				drawCommands_.Upload(BuildCommands(selectedLods_));
+				DrawArena(shader);
+				return triangles;
+			}
+			if(materialArrays_)
+			{
+				DrawWithArrays(shader);
+				return triangles;
+			}
 			for(unsigned int i = 0; i < meshes.size(); ++i)
 			{
-				meshes[i].Draw(shader);
+				meshes[i].Draw(shader, selectedLods_[i]);
+			}
+			return triangles;
+		}
+
+		// records the draws of the model placed with the model matrix for a
+		// pass of a RenderQueue instead of drawing right away, and returns
+		// the number of triangles. normalMatrix is the one of the model
+		// matrix, see TransformStore. The packets are ordered by their
+		// distance to viewPos, the meshes outside the frustum are left out.
+		// Every material draws with the variant of shaders for its
+		// MaterialFeatures, which must have been compiled already.
+		// No GL call is made, the indirect commands are uploaded when the
+		// list is merged, so the passes can be recorded on different
+		// threads. A model is submitted once per pass and frame.
+		std::size_t Submit(
+			DrawList& list,
+			std::uint32_t pass,
+			const ShaderVariants& shaders,
+			ShaderFeatures features,
+			const glm::mat4& model,
+			const glm::mat3& normalMatrix,
+			const LodSelector& selector,
+			const glm::vec3& viewPos,
+			const Frustum& frustum = {})
+		{
+			if(pass >= passes_.size())
+			{
+				throw std::out_of_range("Model pass " + std::to_string(pass));
+			}
+			PassState& state = passes_[pass];
+			CullMeshes(model, frustum, state.meshBoxes, state.visibleMeshes);
+			state.selectedLods.resize(meshes.size());
+			const std::size_t triangles = SelectLods(model, selector, state.selectedLods, state.visibleMeshes);
+			DrawPacket packet;
+			packet.pass = pass;
+			packet.transform = list.AddTransform(model, normalMatrix);
+			packet.material.bind = BindPacketMaterial;
+			packet.material.object = this;
+			if(arena_)
+			{
+				state.pending = BuildCommands(state.selectedLods, state.visibleMeshes);
+				list.Upload({ UploadPassCommands, this, pass });
+				packet.vertexArray = arena_->VertexArray();
+				packet.kind = DrawKind::INDIRECT;
+				packet.indexType = arena_->IndexType();
+				packet.commands = state.commands.buffer.get();
+				for(std::size_t group = 0; group < drawGroups_.size(); ++group)
+				{
+					const DrawGroup& drawGroup = drawGroups_[group];
+					packet.shader = &shaders.Find(MaterialFeatures(group, features));
+					packet.material.index = static_cast<std::uint32_t>(group);
+					packet.first = drawGroup.firstCommand;
+					packet.count = static_cast<GLsizei>(drawGroup.commandCount);
+					packet.depth = std::numeric_limits<float>::max();
+					bool visible = false;
+					for(std::size_t command = 0; command < drawGroup.commandCount; ++command)
+					{
+						const std::size_t mesh = commandMeshes_[drawGroup.firstCommand + command];
+						if(state.visibleMeshes[mesh])
+						{
+							visible = true;
+							packet.depth = std::min(packet.depth, MeshDepth(mesh, model, viewPos));
+						}
+					}
+					if(visible)
+					{
+						list.Submit(packet);
+					}
+				}
+				return triangles;
+			}
+			for(std::size_t i = 0; i < meshes.size(); ++i)
+			{
+				if(!state.visibleMeshes[i])
+				{
+					continue;
+				}
+				packet.shader = &shaders.Find(MaterialFeatures(i, features));
+				packet.material.index = static_cast<std::uint32_t>(i);
+				meshes[i].SetPacketGeometry(packet, state.selectedLods[i]);
+				packet.depth = MeshDepth(i, model, viewPos);
+				list.Submit(packet);
 			}
+			return triangles;
 		}
+
+		// draws a copy of the model at every instance of the buffer, with
+		// a shader compiled with ShaderFeature::INSTANCED. The cells outside
+		// the frustum are skipped and the levels of detail are picked per
+		// cell, every cell is one instanced draw per draw group, or per
+		// mesh without the arena. Returns the number of triangles drawn.
+		std::size_t DrawInstanced(
+			std::unique_ptr<Shader>& shader,
+			const InstanceBuffer& instances,
+			const LodSelector& selector,
+			const Frustum& frustum = {})
+		{
+			return DrawInstancedWith(
+				[&shader](std::size_t) -> Shader& { return *shader; },
+				instances,
+				selector,
+				frustum);
+		}
+
+		// same with the variant of shaders for the MaterialFeatures of
+		// every draw group or mesh, compiled when first used.
+		std::size_t DrawInstanced(
+			ShaderVariants& shaders,
+			ShaderFeatures features,
+			const InstanceBuffer& instances,
+			const LodSelector& selector,
+			const Frustum& frustum = {})
+		{
+			return DrawInstancedWith(
+				[this, &shaders, features](std::size_t material) -> Shader&
+				{
+					Shader& shader = *shaders.Get(MaterialFeatures(material, features));
+					shader.Use();
+					return shader;
+				},
+				instances,
+				selector,
+				frustum);
+		}
+
+		// the features a material is drawn with out of the allowed ones,
+		// normal mapping only when it has a normal map. A material is a
+		// draw group with the arena, a mesh otherwise.
+		ShaderFeatures MaterialFeatures(std::size_t material, ShaderFeatures allowed) const
+		{
+			return allowed.Set(
+				ShaderFeature::NORMAL_MAPPING,
+				allowed.Has(ShaderFeature::NORMAL_MAPPING) && normalMapped_[material]);
+		}
+
+		// world box around every mesh placed with the model matrix.
+		Aabb Bounds(const glm::mat4& model) const
+		{
+			Aabb bounds;
+			for(const Mesh& mesh : meshes)
+			{
+				bounds.Grow(Aabb::FromCenterExtent(mesh.BoundingCenter(), mesh.BoundingExtent()).Transformed(model));
+			}
+			return bounds;
+		}
+
 		std::vector<Mesh> meshes;
 		std::vector<Material> materials;
+		// one entry per mesh, only filled when the meshes were imported and
+		// not loaded from the mesh cache.
+		std::vector<MeshOptimizationStats> optimizationStats;
 
 	private:
 
-		void ProcessNode(aiNode* node, const aiScene* scene)
+		static constexpr unsigned int IMPORT_FLAGS =
+			aiProcess_Triangulate |
+			aiProcess_FlipUVs |
+			aiProcess_CalcTangentSpace |
+			aiProcess_GenNormals;
+
+		static constexpr std::uint32_t PROCESS_OPTIMIZE = 1u << 0;
+		static constexpr std::uint32_t PROCESS_LODS = 1u << 1;
+
+		std::uint64_t ProcessingKey() const
+		{
+			std::uint32_t flags = 0;
+			if(options_.optimizeMeshes)
+			{
+				flags |= PROCESS_OPTIMIZE;
+			}
+			std::uint64_t key = HashValue(flags, FNV_OFFSET_BASIS_64);
+			if(options_.lods.levels > 1)
+			{
+				key = HashValue(PROCESS_LODS, key);
+				key = HashValue(options_.lods.levels, key);
+				key = HashValue(options_.lods.reduction, key);
+				key = HashValue(options_.lods.maxError, key);
+			}
+			return key;
+		}
+
+		// runs task(i) for every mesh, on the worker threads when the
+		// import is parallel.
+		void ForEachMesh(std::size_t meshCount, const std::function<void(std::size_t)>& task)
+		{
+			if(!options_.parallelImport)
+			{
+				for(std::size_t i = 0; i < meshCount; ++i)
+				{
+					task(i);
+				}
+				return;
+			}
+
+			ThreadPool& pool = ThreadPool::Global();
+			std::vector<std::future<void>> futures;
+			futures.reserve(meshCount);
+			for(std::size_t i = 0; i < meshCount; ++i)
+			{
+				futures.push_back(pool.Submit([&task, i]()
+				{
+					task(i);
+				}));
+			}
+			for(std::future<void>& future : futures)
+			{
+				future.wait();
+			}
+			for(std::future<void>& future : futures)
+			{
+				future.get();
+			}
+		}
+
+		void OptimizeMeshes(std::vector<MeshData>& meshData)
+		{
+			optimizationStats.resize(meshData.size());
+			ForEachMesh(meshData.size(), [this, &meshData](std::size_t i)
+			{
+				optimizationStats[i] = MeshOptimizer::Optimize(meshData[i]);
+			});
+		}
+
+		void ReportOptimization(const std::string& filename) const
+		{
+			MeshOptimizationStats total;
+			float acmrBefore = 0.0f;
+			float acmrAfter = 0.0f;
+			float transformedBefore = 0.0f;
+			float transformedAfter = 0.0f;
+			for(const MeshOptimizationStats& stats : optimizationStats)
+			{
+				total.verticesBefore += stats.verticesBefore;
+				total.verticesAfter += stats.verticesAfter;
+				total.triangles += stats.triangles;
+				acmrBefore += stats.acmrBefore * stats.triangles;
+				acmrAfter += stats.acmrAfter * stats.triangles;
+				transformedBefore += stats.atvrBefore * stats.verticesBefore;
+				transformedAfter += stats.atvrAfter * stats.verticesAfter;
+			}
+			if(total.triangles == 0 || total.verticesAfter == 0)
+			{
+				return;
+			}
+			std::cout << "Optimized " << filename << ": "
+				<< total.verticesBefore << " -> " << total.verticesAfter << " vertices, "
+				<< "ACMR " << acmrBefore / total.triangles << " -> " << acmrAfter / total.triangles << ", "
+				<< "ATVR " << transformedBefore / total.verticesBefore << " -> " << transformedAfter / total.verticesAfter << "\n";
+		}
+
+		void ProcessNode(aiNode* node, const aiScene* scene, std::vector<MeshData>& meshData)
 		{
 			for(unsigned int i = 0; i < node->mNumMeshes; ++i)
 			{
 				aiMesh* mesh = scene->mMeshes[node->mMeshes[i]];
-				meshes.push_back(ProcessMesh(mesh, scene));
+				meshData.push_back(ProcessMesh(mesh, scene));
 			}
 
 			for(unsigned int i = 0; i < node->mNumChildren; ++i)
 			{
-				ProcessNode(node->mChildren[i], scene);
+				ProcessNode(node->mChildren[i], scene, meshData);
 			}
 		}
 
-		Mesh ProcessMesh(aiMesh* mesh, const aiScene* scene)
+		void CollectNodeMeshes(aiNode* node, const aiScene* scene, std::vector<aiMesh*>& sceneMeshes) const
 		{
-			std::vector<Vertex> vertices;
-			std::vector<unsigned int> indices;
-			std::vector<TextureStruct> textures;
+			for(unsigned int i = 0; i < node->mNumMeshes; ++i)
+			{
+				sceneMeshes.push_back(scene->mMeshes[node->mMeshes[i]]);
+			}
+
+			for(unsigned int i = 0; i < node->mNumChildren; ++i)
+			{
+				CollectNodeMeshes(node->mChildren[i], scene, sceneMeshes);
+			}
+		}
+
+		// same traversal order as ProcessNode so the meshes end up in the
+		// same order.
+		void ProcessSceneParallel(const aiScene* scene, std::vector<MeshData>& meshData)
+		{
+			std::vector<aiMesh*> sceneMeshes;
+			CollectNodeMeshes(scene->mRootNode, scene, sceneMeshes);
+
+			// reading the material references is cheap, start decoding the
+			// textures while the meshes get converted.
+			for(aiMesh* mesh : sceneMeshes)
+			{
+				std::vector<TextureRef> textureRefs;
+				CollectMeshTextures(mesh, scene, textureRefs);
+				DecodeTexturesAsync(textureRefs);
+			}
+
+			ThreadPool& pool = ThreadPool::Global();
+			std::vector<std::future<MeshData>> futures;
+			futures.reserve(sceneMeshes.size());
+			for(aiMesh* mesh : sceneMeshes)
+			{
+				futures.push_back(pool.Submit([this, mesh, scene]()
+				{
+					return ProcessMesh(mesh, scene);
+				}));
+			}
+
+			// the tasks read the scene, let them all finish before a failure
+			// can unwind past the importer.
+			for(std::future<MeshData>& future : futures)
+			{
+				future.wait();
+			}
+			meshData.reserve(meshData.size() + futures.size());
+			for(std::future<MeshData>& future : futures)
+			{
+				meshData.push_back(future.get());
+			}
+		}
 
+		MeshData ProcessMesh(aiMesh* mesh, const aiScene* scene) const
+		{
+			MeshData meshData;
+			std::vector<Vertex>& vertices = meshData.vertices;
+			std::vector<unsigned int>& indices = meshData.indices;
+			std::vector<TextureRef>& textures = meshData.textures;
+
+			vertices.reserve(mesh->mNumVertices);
 			for(unsigned int i = 0; i < mesh->mNumVertices; ++i)
 			{
 				Vertex vertex;
@@ -105,26 +553,29 @@ namespace gl {
 				}
 			}
 
+			CollectMeshTextures(mesh, scene, textures);
+
+			return meshData;
+		}
+
+		void CollectMeshTextures(aiMesh* mesh, const aiScene* scene, std::vector<TextureRef>& textures) const
+		{
 			if(mesh->mMaterialIndex >= 0)
 			{
 				aiMaterial* material = scene->mMaterials[mesh->mMaterialIndex];
 
-				std::vector<TextureStruct> diffuseTextures = LoadMaterialTextures(material, aiTextureType_DIFFUSE, "texture_diffuse");
-				textures.insert(textures.end(), diffuseTextures.begin(), diffuseTextures.end());
-
-				std::vector<TextureStruct> specularTextures = LoadMaterialTextures(material, aiTextureType_SPECULAR, "texture_specular");
-				textures.insert(textures.end(), specularTextures.begin(), specularTextures.end());
-
-				std::vector<TextureStruct> normalmap = LoadMaterialTextures(material, aiTextureType_HEIGHT, "texture_normal");
-				textures.insert(textures.end(), normalmap.begin(), normalmap.end());
+				CollectMaterialTextures(material, aiTextureType_DIFFUSE, "texture_diffuse", textures);
+				CollectMaterialTextures(material, aiTextureType_SPECULAR, "texture_specular", textures);
+				CollectMaterialTextures(material, aiTextureType_HEIGHT, "texture_normal", textures);
 			}
-
-			return Mesh(vertices, indices, textures);
 		}
 
-		std::vector<TextureStruct> LoadMaterialTextures(aiMaterial* material, aiTextureType textureType, std::string typeName)
+		void CollectMaterialTextures(
+			aiMaterial* material,
+			aiTextureType textureType,
+			const std::string& typeName,
+			std::vector<TextureRef>& textures) const
 		{
-			std::vector<TextureStruct> textures;
 			const std::size_t textureCount = material->GetTextureCount(textureType);
 
 			for(unsigned int i = 0; i < textureCount; ++i)
@@ -133,37 +584,703 @@ namespace gl {
 
 				material->GetTexture(textureType, i, &string);
 
-				bool skip = false;
-				const std::size_t sizeOfTextureLoaded = texturesLoaded_.size();
+				textures.push_back({ typeName, string.C_Str(), textureType });
+			}
+		}
+
+		void CreateMeshes(const std::vector<MeshView>& meshViews)
+		{
+			if(options_.textureArrays)
+			{
+				BuildMaterialArrays(meshViews);
+			}
+			if(!options_.sharedArena)
+			{
+				for(const MeshView& meshView : meshViews)
+				{
+					std::vector<TextureStruct> textures = LoadMeshTextures(meshView);
+					meshes.emplace_back(
+						meshView.vertices,
+						meshView.indices,
+						textures,
+						options_.vertexFormat,
+						meshView.lods);
+					RetainGeometry(meshView);
+				}
+				selectedLods_.assign(meshes.size(), 0);
+				FindNormalMaps();
+				return;
+			}
 
-				for(unsigned int j = 0; j < texturesLoaded_.size(); ++j)
+			std::size_t vertexCount = 0;
+			std::size_t indexCount = 0;
+			std::size_t largestMesh = 0;
+			glm::vec3 minBound(std::numeric_limits<float>::max());
+			glm::vec3 maxBound(std::numeric_limits<float>::lowest());
+			for(const MeshView& meshView : meshViews)
+			{
+				vertexCount += meshView.vertices.size();
+				indexCount += meshView.indices.size();
+				largestMesh = std::max(largestMesh, meshView.vertices.size());
+				for(const Vertex& vertex : meshView.vertices)
 				{
-					if(std::strcmp(texturesLoaded_[j].path.data(), string.C_Str()) == 0)
+					minBound = glm::min(minBound, vertex.position);
+					maxBound = glm::max(maxBound, vertex.position);
+				}
+			}
+			if(vertexCount == 0)
+			{
+				return;
+			}
+
+			arena_ = options_.arena;
+			if(!arena_)
+			{
+				arena_ = std::make_shared<GeometryArena>(
+					options_.vertexFormat,
+					largestMesh <= 65536 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT,
+					vertexCount,
+					indexCount);
+			}
+			const VertexQuantization quantization = QuantizationFromBounds(minBound, maxBound);
+			for(const MeshView& meshView : meshViews)
+			{
+				std::vector<TextureStruct> textures = LoadMeshTextures(meshView);
+				meshes.emplace_back(
+					*arena_,
+					meshView.vertices,
+					meshView.indices,
+					textures,
+					quantization,
+					meshView.lods);
+				RetainGeometry(meshView);
+			}
+			selectedLods_.assign(meshes.size(), 0);
+			BuildDrawGroups();
+			FindNormalMaps();
+		}
+
+		// whether every material of MaterialFeatures has a normal map, the
+		// meshes of a draw group share theirs.
+		void FindNormalMaps()
+		{
+			const std::size_t materialCount = arena_ ? drawGroups_.size() : meshes.size();
+			normalMapped_.assign(materialCount, 0);
+			for(std::size_t material = 0; material < materialCount; ++material)
+			{
+				const std::size_t mesh = arena_ ? drawGroups_[material].textureMesh : material;
+				if(materialArrays_)
+				{
+					normalMapped_[material] =
+						meshMaterials_[mesh].arrays[MaterialArrays::NORMAL_SLOT] != MaterialArrays::NO_ARRAY;
+					continue;
+				}
+				for(const TextureStruct& texture : meshes[mesh].Textures())
+				{
+					if(texture.type == "texture_normal")
+					{
+						normalMapped_[material] = 1;
+					}
+				}
+			}
+		}
+
+		void BuildMaterialArrays(const std::vector<MeshView>& meshViews)
+		{
+			std::vector<const std::vector<TextureRef>*> meshTextures;
+			meshTextures.reserve(meshViews.size());
+			for(const MeshView& meshView : meshViews)
+			{
+				meshTextures.push_back(&meshView.textures);
+			}
+			materialArrays_ = std::make_unique<MaterialArrays>();
+			meshMaterials_ = materialArrays_->Build(
+				meshTextures,
+				textureDirectory,
+				options_.useCookedTextures,
+				[this](const std::string& filename)
+				{
+					return TakeDecodedImage(filename);
+				});
+		}
+
+		// the textures are in the material arrays when they are used.
+		std::vector<TextureStruct> LoadMeshTextures(const MeshView& meshView)
+		{
+			if(materialArrays_)
+			{
+				return {};
+			}
+			return LoadMaterialTextures(meshView.textures);
+		}
+
+		void RetainGeometry(const MeshView& meshView)
+		{
+			if(options_.retainGeometry)
+			{
+				meshes.back().RetainGeometry(meshView.vertices, meshView.indices);
+			}
+		}
+
+		// Orders the indirect commands so meshes sharing their textures are
+		// consecutive, each group is then a single multi draw. With the
+		// material arrays the meshes only have to share their arrays.
+		void BuildDrawGroups()
+		{
+			drawGroups_.clear();
+			std::vector<std::vector<std::size_t>> groupMeshes;
+			for(std::size_t i = 0; i < meshes.size(); ++i)
+			{
+				std::size_t group = 0;
+				for(; group < drawGroups_.size(); ++group)
+				{
+					const std::size_t textureMesh = drawGroups_[group].textureMesh;
+					if(materialArrays_ ?
+						meshMaterials_[textureMesh].SameArrays(meshMaterials_[i]) :
+						SameTextures(meshes[textureMesh], meshes[i]))
 					{
-						textures.push_back(texturesLoaded_[j]);
-						skip = true;
 						break;
 					}
-					assert(j < sizeOfTextureLoaded);
 				}
+				if(group == drawGroups_.size())
+				{
+					drawGroups_.push_back({ i, 0, 0 });
+					groupMeshes.emplace_back();
+				}
+				groupMeshes[group].push_back(i);
+			}
+
+			commandMeshes_.clear();
+			commandMeshes_.reserve(meshes.size());
+			for(std::size_t group = 0; group < drawGroups_.size(); ++group)
+			{
+				drawGroups_[group].firstCommand = commandMeshes_.size();
+				drawGroups_[group].commandCount = groupMeshes[group].size();
+				commandMeshes_.insert(
+					commandMeshes_.end(),
+					groupMeshes[group].begin(),
+					groupMeshes[group].end());
+			}
+			if(materialArrays_)
+			{
+				const std::vector<std::uint16_t> layers =
+					MaterialArrays::PackLayers(meshMaterials_, commandMeshes_);
+				layerBuffer_ = GlBuffer::Create();
+				GlState::Global().BindBuffer(GL_ARRAY_BUFFER, layerBuffer_.Get());
+				glBufferData(
+					GL_ARRAY_BUFFER,
+					layers.size() * sizeof(std::uint16_t),
+					layers.data(),
+					GL_STATIC_DRAW);
+			}
+			drawCommands_.Upload(BuildCommands(selectedLods_));
+			// Submit fills them off the GL thread.
+			for(PassState& state : passes_)
+			{
+				state.commands.buffer = std::make_unique<DrawCommandBuffer>();
+			}
+		}
+
+		// the indirect commands drawing the meshes with the levels of
+		// lods, the hidden meshes draw no instance. Each pass of a queue has
+		// its own buffer, the packets of all the passes are drawn after
+		// they were all submitted.
+		std::vector<DrawElementsIndirectCommand> BuildCommands(
+			std::span<const std::size_t> lods,
+			std::span<const std::uint8_t> visible = {}) const
+		{
+			std::vector<DrawElementsIndirectCommand> commands;
+			commands.reserve(commandMeshes_.size());
+			for(const std::size_t mesh : commandMeshes_)
+			{
+				commands.push_back(meshes[mesh].DrawCommand(lods[mesh]));
+				if(!visible.empty() && !visible[mesh])
+				{
+					commands.back().instanceCount = 0;
+				}
+				if(materialArrays_)
+				{
+					// selects the layers of the mesh in the layer buffer.
+					commands.back().baseInstance = static_cast<GLuint>(commands.size() - 1);
+				}
+			}
+			return commands;
+		}
+
+		// DrawUpload of Submit, once the list is merged on the GL thread.
+		static void UploadPassCommands(void* object, std::uint32_t pass)
+		{
+			PassState& state = static_cast<Model*>(object)->passes_[pass];
+			state.commands.Upload(std::move(state.pending));
+		}
+
+		// the commands of the model once per cell, cell after cell, with
+		// the levels picked for the cell and its instance count.
+		void UploadInstanceCommands(const std::vector<InstanceCell>& cells)
+		{
+			std::vector<DrawElementsIndirectCommand> commands;
+			commands.reserve(cells.size() * commandMeshes_.size());
+			for(std::size_t cell = 0; cell < cells.size(); ++cell)
+			{
+				for(std::size_t command = 0; command < commandMeshes_.size(); ++command)
+				{
+					const std::size_t mesh = commandMeshes_[command];
+					commands.push_back(meshes[mesh].DrawCommand(cellLods_[cell * meshes.size() + mesh]));
+					commands.back().instanceCount = static_cast<GLuint>(cells[cell].count);
+					if(materialArrays_)
+					{
+						commands.back().baseInstance = static_cast<GLuint>(command);
+					}
+				}
+			}
+			instanceCommands_.Upload(std::move(commands));
+		}
+
+		// distance from the model origin to the farthest point of the
+		// bounding sphere of a mesh.
+		static float MeshReach(const Mesh& mesh)
+		{
+			return glm::length(mesh.BoundingCenter()) + mesh.BoundingRadius();
+		}
+
+		// world boxes of the meshes placed with model against the frustum,
+		// into visible.
+		void CullMeshes(
+			const glm::mat4& model,
+			const Frustum& frustum,
+			BoxSet& boxes,
+			std::vector<std::uint8_t>& visible) const
+		{
+			boxes.Clear();
+			for(const Mesh& mesh : meshes)
+			{
+				boxes.AddTransformed(model, mesh.BoundingCenter(), mesh.BoundingExtent());
+			}
+			visible.resize(meshes.size());
+			FrustumCuller::Cull(frustum, boxes, visible);
+		}
+
+		// boxes around every instance of the cells against the frustum,
+		// into visibleCells_.
+		void CullCells(const std::vector<InstanceCell>& cells, const Frustum& frustum)
+		{
+			float reach = 0.0f;
+			for(const Mesh& mesh : meshes)
+			{
+				reach = std::max(reach, MeshReach(mesh));
+			}
+			cellBoxes_.Clear();
+			for(const InstanceCell& cell : cells)
+			{
+				cellBoxes_.Add(cell.center, glm::vec3(cell.radius + reach * cell.maxScale));
+			}
+			visibleCells_.resize(cells.size());
+			FrustumCuller::Cull(frustum, cellBoxes_, visibleCells_);
+		}
+
+		// levels of the meshes for all the instances of a cell, picked for
+		// the closest point of the cell. Returns the triangles of the cell.
+		std::size_t SelectCellLods(
+			const InstanceCell& cell,
+			const LodSelector& selector,
+			std::span<std::size_t> lods) const
+		{
+			std::size_t triangles = 0;
+			for(std::size_t i = 0; i < meshes.size(); ++i)
+			{
+				const Mesh& mesh = meshes[i];
+				const float radius = cell.radius + MeshReach(mesh) * cell.maxScale;
+				lods[i] = selector.Select(mesh.Lods(), cell.center, radius, cell.maxScale);
+				triangles += mesh.Lods()[lods[i]].indexCount / 3;
+			}
+			return triangles * cell.count;
+		}
+
+		// the largest axis scale keeps the errors and the distances
+		// conservative under non uniform scaling.
+		static float MaxScale(const glm::mat4& model)
+		{
+			return std::max({
+				glm::length(glm::vec3(model[0])),
+				glm::length(glm::vec3(model[1])),
+				glm::length(glm::vec3(model[2])) });
+		}
+
+		// distance from viewPos to the bounding sphere of a mesh.
+		float MeshDepth(std::size_t mesh, const glm::mat4& model, const glm::vec3& viewPos) const
+		{
+			const glm::vec3 center(model * glm::vec4(meshes[mesh].BoundingCenter(), 1.0f));
+			return std::max(
+				glm::length(center - viewPos) - meshes[mesh].BoundingRadius() * MaxScale(model),
+				0.0f);
+		}
+
+		// the level of every mesh into lods, returns the triangles of the
+		// visible meshes, all of them when visible is empty.
+		std::size_t SelectLods(
+			const glm::mat4& model,
+			const LodSelector& selector,
+			std::span<std::size_t> lods,
+			std::span<const std::uint8_t> visible = {}) const
+		{
+			const float scale = MaxScale(model);
+			std::size_t triangles = 0;
+			for(std::size_t i = 0; i < meshes.size(); ++i)
+			{
+				const Mesh& mesh = meshes[i];
+				const glm::vec3 center(model * glm::vec4(mesh.BoundingCenter(), 1.0f));
+				lods[i] = selector.Select(
+					mesh.Lods(),
+					center,
+					mesh.BoundingRadius() * scale,
+					scale);
+				if(visible.empty() || visible[i])
+				{
+					triangles += mesh.Lods()[lods[i]].indexCount / 3;
+				}
+			}
+			return triangles;
+		}
+
+		static bool SameTextures(const Mesh& a, const Mesh& b)
+		{
+			const std::vector<TextureStruct>& texturesA = a.Textures();
+			const std::vector<TextureStruct>& texturesB = b.Textures();
+			if(texturesA.size() != texturesB.size())
+			{
+				return false;
+			}
+			for(std::size_t i = 0; i < texturesA.size(); ++i)
+			{
+				if(texturesA[i].id != texturesB[i].id || texturesA[i].type != texturesB[i].type)
+				{
+					return false;
+				}
+			}
+			return true;
+		}
+
+		// DrawInstanced with shaderFor(material) giving the program in use
+		// for a draw group or a mesh.
+		template<typename ShaderFor>
+		std::size_t DrawInstancedWith(
+			ShaderFor&& shaderFor,
+			const InstanceBuffer& instances,
+			const LodSelector& selector,
+			const Frustum& frustum)
+		{
+			if(meshes.empty() || instances.InstanceCount() == 0)
+			{
+				return 0;
+			}
+			const std::vector<InstanceCell>& cells = instances.Cells();
+			CullCells(cells, frustum);
+			cellLods_.assign(cells.size() * meshes.size(), 0);
+			std::size_t triangles = 0;
+			for(std::size_t cell = 0; cell < cells.size(); ++cell)
+			{
+				if(!visibleCells_[cell])
+				{
+					continue;
+				}
+				triangles += SelectCellLods(
+					cells[cell],
+					selector,
+					std::span(cellLods_).subspan(cell * meshes.size(), meshes.size()));
+			}
+			instances.Bind();
+
+			if(arena_)
+			{
+				UploadInstanceCommands(cells);
+				arena_->Bind();
+				for(std::size_t group = 0; group < drawGroups_.size(); ++group)
+				{
+					const DrawGroup& drawGroup = drawGroups_[group];
+					Shader& shader = shaderFor(group);
+					BindMaterial(group, shader);
+					for(std::size_t cell = 0; cell < cells.size(); ++cell)
+					{
+						if(!visibleCells_[cell])
+						{
+							continue;
+						}
+						shader.SetInt("firstInstance", static_cast<int>(cells[cell].first));
+						instanceCommands_.buffer->DrawBound(
+							arena_->IndexType(),
+							cell * commandMeshes_.size() + drawGroup.firstCommand,
+							drawGroup.commandCount);
+					}
+				}
+				return triangles;
+			}
+			for(std::size_t i = 0; i < meshes.size(); ++i)
+			{
+				Shader& shader = shaderFor(i);
+				BindMaterial(i, shader);
+				for(std::size_t cell = 0; cell < cells.size(); ++cell)
+				{
+					if(!visibleCells_[cell])
+					{
+						continue;
+					}
+					shader.SetInt("firstInstance", static_cast<int>(cells[cell].first));
+					meshes[i].DrawGeometry(
+						cellLods_[cell * meshes.size() + i],
+						static_cast<GLsizei>(cells[cell].count));
+				}
+			}
+			return triangles;
+		}
+
+		// material of the packets of Submit: a draw group with the arena,
+		// a mesh otherwise.
+		static void BindPacketMaterial(const void* object, std::uint32_t index, const Shader& shader)
+		{
+			static_cast<const Model*>(object)->BindMaterial(index, shader);
+		}
+
+		void BindMaterial(std::size_t index, const Shader& shader) const
+		{
+			if(arena_)
+			{
+				const DrawGroup& group = drawGroups_[index];
+				meshes.front().SetVertexFormat(shader);
+				if(materialArrays_)
+				{
+					MaterialArrays::ApplyLayerAttribute(layerBuffer_.Get());
+					materialArrays_->Bind(shader, meshMaterials_[group.textureMesh]);
+				}
+				else
+				{
+					glDisableVertexAttribArray(MaterialArrays::LAYERS_LOCATION);
+					meshes[group.textureMesh].BindTextures(shader);
+				}
+				return;
+			}
+			meshes[index].SetVertexFormat(shader);
+			if(materialArrays_)
+			{
+				materialArrays_->Bind(shader, meshMaterials_[index]);
+				MaterialArrays::SetLayers(meshMaterials_[index]);
+			}
+			else
+			{
+				meshes[index].BindTextures(shader);
+			}
+		}
 
-				if(!skip)
+		void DrawArena(std::unique_ptr<Shader>& shader)
+		{
+			if(drawGroups_.empty())
+			{
+				return;
+			}
+			// the quantization is the same for every mesh of the model.
+			meshes.front().SetVertexFormat(*shader);
+			// the arena may be shared with models drawn without the arrays.
+			arena_->Bind();
+			if(materialArrays_)
+			{
+				MaterialArrays::ApplyLayerAttribute(layerBuffer_.Get());
+			}
+			else
+			{
+				glDisableVertexAttribArray(MaterialArrays::LAYERS_LOCATION);
+			}
+			for(const DrawGroup& group : drawGroups_)
+			{
+				if(materialArrays_)
 				{
-					TextureStruct texture;
+					materialArrays_->Bind(*shader, meshMaterials_[group.textureMesh]);
+				}
+				else
+				{
+					meshes[group.textureMesh].BindTextures(*shader);
+				}
+				drawCommands_.buffer->Draw(*arena_, group.firstCommand, group.commandCount);
+			}
+		}
 
-					texture.id = LoadTextureFromFile(string.C_Str(), textureDirectory, textureType);
-					texture.type = typeName;
-					texture.path = string.C_Str();
-					
-					textures.push_back(texture);
-					texturesLoaded_.push_back(texture);
+		// one draw per mesh, the arrays are only bound again when the
+		// next mesh uses other ones.
+		void DrawWithArrays(std::unique_ptr<Shader>& shader)
+		{
+			for(std::size_t i = 0; i < meshes.size(); ++i)
+			{
+				if(i == 0 || !meshMaterials_[i].SameArrays(meshMaterials_[i - 1]))
+				{
+					materialArrays_->Bind(*shader, meshMaterials_[i]);
 				}
+				meshes[i].SetVertexFormat(*shader);
+				MaterialArrays::SetLayers(meshMaterials_[i]);
+				meshes[i].DrawGeometry(selectedLods_[i]);
+			}
+		}
+
+		std::vector<TextureStruct> LoadMaterialTextures(const std::vector<TextureRef>& textureRefs)
+		{
+			TextureCache& textureCache = TextureCache::Global();
+			std::vector<TextureStruct> textures;
+
+			for(const TextureRef& textureRef : textureRefs)
+			{
+				const std::string filename = textureDirectory + "/" + textureRef.path;
+				const ColourSpace colourSpace = ColourSpaceFor(textureRef.textureType);
+
+				TextureHandle handle = textureCache.Find(filename, colourSpace);
+				CookedTexture cooked;
+				if(!handle && options_.useCookedTextures && OpenCookedTexture(filename, cooked))
+				{
+					handle = textureCache.Insert(
+						filename,
+						colourSpace,
+						UploadCookedTexture(cooked, colourSpace),
+						cooked.ByteSize());
+				}
+				if(!handle)
+				{
+					DecodedImage image = TakeDecodedImage(filename);
+					handle = textureCache.Insert(
+						filename,
+						colourSpace,
+						UploadTexture(image, textureRef.textureType),
+						TextureByteSize(image));
+				}
+
+				TextureStruct texture;
+				texture.id = handle->id;
+				texture.type = textureRef.type;
+				texture.path = textureRef.path;
+				texture.handle = std::move(handle);
+				textures.push_back(std::move(texture));
 			}
 
 			return textures;
 		}
 
-		std::vector<TextureStruct> texturesLoaded_;
+		// result of DecodeTexturesAsync, or a decode on the calling thread.
+		DecodedImage TakeDecodedImage(const std::string& filename)
+		{
+			auto pending = pendingDecodes_.find(filename);
+			if(pending == pendingDecodes_.end())
+			{
+				return DecodeTextureFile(filename);
+			}
+			DecodedImage image = pending->second.get();
+			pendingDecodes_.erase(pending);
+			return image;
+		}
+
+		// decodes textures on the worker threads, LoadMaterialTextures
+		// picks the result up and uploads it on first use so the textures
+		// are created in the same order as in the serial path. The arrays
+		// only decode the textures of their slots, never from the cache.
+		void DecodeTexturesAsync(const std::vector<TextureRef>& textureRefs)
+		{
+			std::vector<const TextureRef*> used;
+			if(options_.textureArrays)
+			{
+				for(std::size_t slot = 0; slot < MaterialArrays::SLOT_COUNT; ++slot)
+				{
+					if(const TextureRef* textureRef = MaterialArrays::SlotTexture(textureRefs, slot))
+					{
+						used.push_back(textureRef);
+					}
+				}
+			}
+			else
+			{
+				for(const TextureRef& textureRef : textureRefs)
+				{
+					used.push_back(&textureRef);
+				}
+			}
+
+			TextureCache& textureCache = TextureCache::Global();
+			for(const TextureRef* textureRef : used)
+			{
+				const std::string filename = textureDirectory + "/" + textureRef->path;
+				if(pendingDecodes_.contains(filename) ||
+					(!options_.textureArrays &&
+						textureCache.Contains(filename, ColourSpaceFor(textureRef->textureType))) ||
+					(options_.useCookedTextures && HasCookedTexture(filename)))
+				{
+					continue;
+				}
+				pendingDecodes_.emplace(
+					filename,
+					ThreadPool::Global().Submit([filename]()
+					{
+						return DecodeTextureFile(filename);
+					}));
+			}
+		}
+
+		ModelOptions options_;
+
+		struct DrawGroup
+		{
+			// mesh whose textures are bound for the group.
+			std::size_t textureMesh = 0;
+			std::size_t firstCommand = 0;
+			std::size_t commandCount = 0;
+		};
+		std::shared_ptr<GeometryArena> arena_;
+		std::vector<DrawGroup> drawGroups_;
+		// per draw group with the arena, per mesh otherwise.
+		std::vector<std::uint8_t> normalMapped_;
+		// mesh drawn by each indirect command, in group order.
+		std::vector<std::size_t> commandMeshes_;
+		struct PassCommands
+		{
+			std::unique_ptr<DrawCommandBuffer> buffer;
+			std::vector<DrawElementsIndirectCommand> uploaded;
+
+			// only reaches the buffer when the commands changed.
+			void Upload(std::vector<DrawElementsIndirectCommand> commands)
+			{
+				if(!buffer)
+				{
+					buffer = std::make_unique<DrawCommandBuffer>();
+				}
+				if(commands != uploaded)
+				{
+					buffer->Upload(commands);
+					uploaded = std::move(commands);
+				}
+			}
+		};
+		// commands of Draw.
+		PassCommands drawCommands_;
+		// what Submit keeps for a pass of a queue, apart from the other
+		// passes so they can be recorded at the same time.
+		struct PassState
+		{
+			PassCommands commands;
+			// recorded by Submit, uploaded when its list is merged.
+			std::vector<DrawElementsIndirectCommand> pending;
+			BoxSet meshBoxes;
+			std::vector<std::uint8_t> visibleMeshes;
+			std::vector<std::size_t> selectedLods;
+		};
+		std::array<PassState, RenderQueue::MAX_PASSES> passes_;
+		// commands of DrawInstanced, and the level of every mesh in every
+		// cell, cell after cell.
+		PassCommands instanceCommands_;
+		std::vector<std::size_t> cellLods_;
+		// culling of the last DrawInstanced.
+		BoxSet cellBoxes_;
+		std::vector<std::uint8_t> visibleCells_;
+		std::unique_ptr<MaterialArrays> materialArrays_;
+		// array layers of every mesh, and in command order for the
+		// instanced attribute.
+		std::vector<MaterialArrays::MeshMaterial> meshMaterials_;
+		GlBuffer layerBuffer_;
+		// level of detail of every mesh for the current draw.
+		std::vector<std::size_t> selectedLods_;
+		// keyed by file name, the decode does not depend on the colour space.
+		std::unordered_map<std::string, std::future<DecodedImage>> pendingDecodes_;
 	};
 
 }//End namepsace gl
@@ -0,0 +1,221 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <initializer_list>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <glad/glad.h>
+
+#include "hash.h"
+#include "mapped_file.h"
+
+namespace gl {
+
+	// Linked programs saved with glGetProgramBinary and restored with
+	// glProgramBinary on the next launch, one file per program in the cache
+	// directory. The key covers the sources of every stage, the defines and
+	// the driver, a driver update or any edit of a shader gives a new key
+	// and the stale files are simply never read again.
+	//
+	// Layout:
+	//     Header
+	//     binary, in the driver format
+	class ProgramBinaryCache
+	{
+	public:
+		static constexpr std::uint32_t VERSION = 1;
+		static constexpr char EXTENSION[] = ".glprog";
+
+		struct Stats
+		{
+			std::uint64_t hits = 0;
+			std::uint64_t misses = 0;
+			// binaries the driver refused, counted as misses as well.
+			std::uint64_t rejected = 0;
+		};
+
+		static ProgramBinaryCache& Global()
+		{
+			static ProgramBinaryCache cache;
+			return cache;
+		}
+
+		void SetDirectory(const std::string& directory)
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			directory_ = directory;
+		}
+
+		// false when the driver has no binary format, nothing is read or
+		// written then. Needs a current context.
+		bool IsSupported()
+		{
+			std::call_once(driverOnce_, [this] { QueryDriver(); });
+			return supported_;
+		}
+
+		// sources in stage order, each one hashed with its length so moving
+		// text from one stage to the next changes the key.
+		std::uint64_t ComputeKey(
+			std::initializer_list<std::string_view> sources,
+			std::string_view defines = {})
+		{
+			std::call_once(driverOnce_, [this] { QueryDriver(); });
+			std::uint64_t hash = HashValue(VERSION, FNV_OFFSET_BASIS_64);
+			for (const std::string_view source : sources)
+			{
+				hash = HashValue(source.size(), hash);
+				hash = Fnv1a64(source, hash);
+			}
+			hash = HashValue(defines.size(), hash);
+			hash = Fnv1a64(defines, hash);
+			return Fnv1a64(driver_, hash);
+		}
+
+		// restores the program from the cache, false on a miss or when the
+		// driver rejects the binary, the program has to be linked from
+		// source then.
+		bool Load(std::uint64_t key, GLuint program)
+		{
+			if (!IsSupported())
+			{
+				Count(&Stats::misses);
+				return false;
+			}
+			const std::string path = CachePath(key);
+			bool loaded = false;
+			bool rejected = false;
+			{
+				MappedFile file(path);
+				Header header;
+				if (file.IsOpen() && file.Size() >= sizeof(Header))
+				{
+					std::memcpy(&header, file.Data(), sizeof(header));
+					if (std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) == 0 &&
+						header.version == VERSION &&
+						header.key == key &&
+						header.size == file.Size() - sizeof(Header))
+					{
+						glProgramBinary(
+							program,
+							header.binaryFormat,
+							file.Data() + sizeof(Header),
+							static_cast<GLsizei>(header.size));
+						GLint linked = GL_FALSE;
+						glGetProgramiv(program, GL_LINK_STATUS, &linked);
+						loaded = linked == GL_TRUE;
+					}
+					rejected = !loaded;
+				}
+			}
+			if (rejected)
+			{
+				// the file is closed, drop it so the next launch does not
+				// try it again before it gets rewritten.
+				std::error_code error;
+				std::filesystem::remove(path, error);
+				Count(&Stats::rejected);
+			}
+			Count(loaded ? &Stats::hits : &Stats::misses);
+			return loaded;
+		}
+
+		// the program has to be linked with GL_PROGRAM_BINARY_RETRIEVABLE_HINT
+		// set. Failing to write only costs a compile on the next launch.
+		void Store(std::uint64_t key, GLuint program)
+		{
+			if (!IsSupported())
+			{
+				return;
+			}
+			GLint length = 0;
+			glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+			if (length <= 0)
+			{
+				return;
+			}
+			std::vector<char> binary(length);
+			Header header{};
+			std::memcpy(header.magic, MAGIC, sizeof(header.magic));
+			header.version = VERSION;
+			header.key = key;
+			GLsizei written = 0;
+			glGetProgramBinary(program, length, &written, &header.binaryFormat, binary.data());
+			if (written <= 0)
+			{
+				return;
+			}
+			header.size = static_cast<std::uint32_t>(written);
+
+			const std::string path = CachePath(key);
+			std::error_code error;
+			std::filesystem::create_directories(std::filesystem::path(path).parent_path(), error);
+			WriteFileAtomically(path, [&](FileWriter& writer)
+			{
+				writer.Write(&header, sizeof(header));
+				writer.Write(binary.data(), static_cast<std::size_t>(written));
+				return true;
+			});
+		}
+
+		Stats GetStats() const
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			return stats_;
+		}
+
+	private:
+		static constexpr char MAGIC[4] = { 'G', 'P', 'R', 'G' };
+
+		struct Header
+		{
+			char magic[4];
+			std::uint32_t version;
+			std::uint64_t key;
+			GLenum binaryFormat;
+			std::uint32_t size;
+		};
+
+		ProgramBinaryCache() = default;
+
+		void QueryDriver()
+		{
+			GLint formats = 0;
+			glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+			supported_ = formats > 0;
+			for (const GLenum name : { GL_VENDOR, GL_RENDERER, GL_VERSION })
+			{
+				const GLubyte* string = glGetString(name);
+				driver_ += string ? reinterpret_cast<const char*>(string) : "";
+				driver_ += '\n';
+			}
+		}
+
+		std::string CachePath(std::uint64_t key) const
+		{
+			char name[17];
+			std::snprintf(name, sizeof(name), "%016llx", static_cast<unsigned long long>(key));
+			std::lock_guard<std::mutex> lock(mutex_);
+			return (std::filesystem::path(directory_) / (name + std::string(EXTENSION))).string();
+		}
+
+		void Count(std::uint64_t Stats::* counter)
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			++(stats_.*counter);
+		}
+
+		mutable std::mutex mutex_;
+		std::string directory_ = "shader_cache";
+		Stats stats_;
+		std::once_flag driverOnce_;
+		std::string driver_;
+		bool supported_ = false;
+	};
+
+} // End namespace gl.
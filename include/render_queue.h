@@ -0,0 +1,599 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <future>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "geometry_arena.h"
+#include "gl_check.h"
+#include "gl_state.h"
+#include "shader.h"
+#include "thread_pool.h"
+#include "transform_store.h"
+
+namespace gl {
+
+	// Binds the textures and the per material uniforms of a draw on the
+	// program in use. Plain data: a material is the function with the
+	// object and the index it is given, two packets with the same three
+	// share the material.
+	struct DrawMaterial
+	{
+		using BindFunction = void (*)(const void* object, std::uint32_t index, const Shader& shader);
+
+		BindFunction bind = nullptr;
+		const void* object = nullptr;
+		std::uint32_t index = 0;
+
+		bool operator==(const DrawMaterial&) const = default;
+	};
+
+	enum class DrawKind : std::uint8_t
+	{
+		// glDrawArrays from first.
+		ARRAYS,
+		// glDrawElementsBaseVertex, first is the byte offset of the first
+		// index.
+		ELEMENTS,
+		// commands [first, first + count) of a DrawCommandBuffer.
+		INDIRECT,
+	};
+
+	// One draw call with the state it needs, submitted to a RenderQueue.
+	struct DrawPacket
+	{
+		std::uint32_t pass = 0;
+		Shader* shader = nullptr;
+		DrawMaterial material;
+		GLuint vertexArray = 0;
+		// from DrawList::AddTransform, set as the "model" and the
+		// "normalMatrix" uniforms.
+		std::uint32_t transform = 0;
+		// distance from the viewer of the pass to the closest point of
+		// the geometry.
+		float depth = 0.0f;
+		DrawKind kind = DrawKind::ELEMENTS;
+		GLenum indexType = GL_UNSIGNED_INT;
+		GLsizei count = 0;
+		std::size_t first = 0;
+		GLint baseVertex = 0;
+		const DrawCommandBuffer* commands = nullptr;
+	};
+
+	// GL work a DrawList needs before its packets are drawn, recorded off
+	// the GL thread and run on it when the list is merged. Plain data like
+	// DrawMaterial: run(object, index).
+	struct DrawUpload
+	{
+		using RunFunction = void (*)(void* object, std::uint32_t index);
+
+		RunFunction run = nullptr;
+		void* object = nullptr;
+		std::uint32_t index = 0;
+	};
+
+	// Packets recorded for a RenderQueue by one thread, with the transforms
+	// they index and the uploads they wait for. Recording makes no GL call,
+	// so every thread can fill its own list.
+	class DrawList
+	{
+	public:
+		void Clear()
+		{
+			packets_.clear();
+			transforms_.clear();
+			normalMatrices_.clear();
+			uploads_.clear();
+		}
+
+		// normalMatrix comes from a TransformStore, it is computed here
+		// when not given.
+		std::uint32_t AddTransform(const glm::mat4& transform, const glm::mat3& normalMatrix)
+		{
+			transforms_.push_back(transform);
+			normalMatrices_.push_back(normalMatrix);
+			return static_cast<std::uint32_t>(transforms_.size() - 1);
+		}
+
+		std::uint32_t AddTransform(const glm::mat4& transform)
+		{
+			return AddTransform(transform, NormalMatrix(transform));
+		}
+
+		void Submit(const DrawPacket& packet);
+
+		void Upload(const DrawUpload& upload)
+		{
+			uploads_.push_back(upload);
+		}
+
+		std::size_t PacketCount() const
+		{
+			return packets_.size();
+		}
+
+	private:
+		friend class RenderQueue;
+
+		std::vector<DrawPacket> packets_;
+		std::vector<glm::mat4> transforms_;
+		std::vector<glm::mat3> normalMatrices_;
+		std::vector<DrawUpload> uploads_;
+	};
+
+	// Draws of a frame, collected from every pass and sorted once on a 64
+	// bit key before any of them is made:
+	//
+	//   pass (4) | program (12) | material (16) | depth (16) | vertex array (16)
+	//
+	// so a pass changes program as few times as possible, then material,
+	// and the draws sharing both go front to back to let the depth test
+	// reject the hidden fragments early. Only meant for opaque geometry.
+	// The packets are recorded in DrawLists, by one thread with Record or
+	// by the workers of a pool with RecordParallel, and merged in the order
+	// of their lists so the frame does not depend on the scheduling.
+	// Execute walks the packets of a pass, only changing the state that
+	// differs from the previous packet, and merges the packets drawing with
+	// the same state into one multi draw.
+	class RenderQueue
+	{
+	public:
+		static constexpr std::uint32_t MAX_PASSES = 16;
+
+		struct Stats
+		{
+			std::size_t packets = 0;
+			// GL draw calls made, fewer than the packets when some merged.
+			std::size_t drawCalls = 0;
+			std::size_t programChanges = 0;
+			std::size_t materialChanges = 0;
+			std::size_t vertexArrayChanges = 0;
+		};
+
+		RenderQueue()
+		{
+			SetDepthRange(0.1f, 1000.0f);
+		}
+
+		// the depths are bucketed on a log scale between the two, the
+		// closer buckets are the finer. Sets the range of every pass.
+		void SetDepthRange(float nearDepth, float farDepth)
+		{
+			for (std::uint32_t pass = 0; pass < MAX_PASSES; ++pass)
+			{
+				SetDepthRange(pass, nearDepth, farDepth);
+			}
+		}
+
+		// the range of one pass, the ones drawn from different views have
+		// their own.
+		void SetDepthRange(std::uint32_t pass, float nearDepth, float farDepth)
+		{
+			if (pass >= MAX_PASSES)
+			{
+				throw std::out_of_range("Render queue pass " + std::to_string(pass));
+			}
+			nearDepths_[pass] = std::max(nearDepth, 1e-4f);
+			logDepthRanges_[pass] = std::log(std::max(farDepth, nearDepths_[pass] * 2.0f) / nearDepths_[pass]);
+		}
+
+		// forgets the packets and transforms of the previous frame.
+		void Clear()
+		{
+			packets_.clear();
+			transforms_.clear();
+			normalMatrices_.clear();
+			sorted_.clear();
+			stats_ = {};
+		}
+
+		// record(list, job) for every job in [0, jobCount), one list per
+		// job, then merges the lists. On the GL thread.
+		template<typename Function>
+		void Record(std::size_t jobCount, Function&& record)
+		{
+			ResetLists(jobCount);
+			for (std::size_t job = 0; job < jobCount; ++job)
+			{
+				record(lists_[job], job);
+			}
+			Merge();
+		}
+
+		// same as Record with the jobs spread over the pool and the calling
+		// thread, record must not touch the GL context. Two jobs may only
+		// share state they read.
+		template<typename Function>
+		void RecordParallel(ThreadPool& pool, std::size_t jobCount, Function&& record)
+		{
+			ResetLists(jobCount);
+			std::vector<std::future<void>> futures;
+			futures.reserve(jobCount);
+			for (std::size_t job = 1; job < jobCount; ++job)
+			{
+				futures.push_back(pool.Submit([this, &record, job]()
+				{
+					record(lists_[job], job);
+				}));
+			}
+			// the lists are still being written until every job ended, the
+			// first error is thrown after that.
+			std::exception_ptr error;
+			if (jobCount > 0)
+			{
+				try
+				{
+					record(lists_[0], std::size_t(0));
+				}
+				catch (...)
+				{
+					error = std::current_exception();
+				}
+			}
+			for (std::future<void>& future : futures)
+			{
+				try
+				{
+					future.get();
+				}
+				catch (...)
+				{
+					if (!error)
+					{
+						error = std::current_exception();
+					}
+				}
+			}
+			if (error)
+			{
+				std::rethrow_exception(error);
+			}
+			Merge();
+		}
+
+		// after the last Submit of the frame, before the first Execute.
+		void Sort()
+		{
+			sorted_.resize(packets_.size());
+			for (std::size_t i = 0; i < packets_.size(); ++i)
+			{
+				sorted_[i] = { Key(packets_[i]), static_cast<std::uint32_t>(i) };
+			}
+			RadixSort(sorted_, scratch_);
+			stats_.packets = packets_.size();
+		}
+
+		void Execute(std::uint32_t pass)
+		{
+			const auto passOf = [](const SortEntry& entry)
+			{
+				return static_cast<std::uint32_t>(entry.key >> PASS_SHIFT);
+			};
+			auto begin = std::partition_point(sorted_.begin(), sorted_.end(),
+				[&](const SortEntry& entry) { return passOf(entry) < pass; });
+			auto end = std::partition_point(begin, sorted_.end(),
+				[&](const SortEntry& entry) { return passOf(entry) <= pass; });
+
+			GlState& state = GlState::Global();
+			const DrawPacket* previous = nullptr;
+			for (auto entry = begin; entry != end;)
+			{
+				const DrawPacket& packet = packets_[entry->index];
+				const bool programChanged = !previous || previous->shader != packet.shader;
+				if (programChanged)
+				{
+					packet.shader->Use();
+					++stats_.programChanges;
+				}
+				if (!previous || previous->vertexArray != packet.vertexArray)
+				{
+					state.BindVertexArray(packet.vertexArray);
+					++stats_.vertexArrayChanges;
+				}
+				// the uniforms belong to the program, they are set again
+				// on a new one.
+				if (packet.material.bind && (programChanged || !(previous->material == packet.material)))
+				{
+					packet.material.bind(packet.material.object, packet.material.index, *packet.shader);
+					++stats_.materialChanges;
+				}
+				if (programChanged || previous->transform != packet.transform)
+				{
+					packet.shader->SetMat4("model", transforms_[packet.transform]);
+					packet.shader->SetMat3("normalMatrix", normalMatrices_[packet.transform]);
+				}
+
+				auto last = entry + 1;
+				while (last != end && CanMerge(packet, packets_[last->index]))
+				{
+					++last;
+				}
+				Draw(entry, last);
+				previous = &packet;
+				entry = last;
+			}
+			GL_CHECK();
+		}
+
+		const Stats& GetStats() const
+		{
+			return stats_;
+		}
+
+	private:
+		static constexpr std::uint32_t PASS_SHIFT = 60;
+		static constexpr std::uint32_t PROGRAM_SHIFT = 48;
+		static constexpr std::uint32_t MATERIAL_SHIFT = 32;
+		static constexpr std::uint32_t DEPTH_SHIFT = 16;
+
+		struct SortEntry
+		{
+			std::uint64_t key;
+			std::uint32_t index;
+		};
+
+		std::uint64_t Key(const DrawPacket& packet) const
+		{
+			// the GL names are small, a collision only costs a state change.
+			const std::uint64_t program = packet.shader->Id() & 0xFFF;
+			const std::uint64_t material = MaterialBits(packet.material);
+			const std::uint64_t depth = DepthBucket(packet.pass, packet.depth);
+			const std::uint64_t vertexArray = packet.vertexArray & 0xFFFF;
+			return std::uint64_t(packet.pass) << PASS_SHIFT |
+				program << PROGRAM_SHIFT |
+				material << MATERIAL_SHIFT |
+				depth << DEPTH_SHIFT |
+				vertexArray;
+		}
+
+		static std::uint64_t MaterialBits(const DrawMaterial& material)
+		{
+			std::uint64_t hash = reinterpret_cast<std::uintptr_t>(material.bind);
+			hash = hash * 0x9E3779B97F4A7C15ull ^ reinterpret_cast<std::uintptr_t>(material.object);
+			hash = hash * 0x9E3779B97F4A7C15ull ^ material.index;
+			hash *= 0x9E3779B97F4A7C15ull;
+			return hash >> 48;
+		}
+
+		std::uint64_t DepthBucket(std::uint32_t pass, float depth) const
+		{
+			const float nearDepth = nearDepths_[pass];
+			const float t = std::log(std::max(depth, nearDepth) / nearDepth) / logDepthRanges_[pass];
+			return static_cast<std::uint64_t>(std::clamp(t, 0.0f, 1.0f) * 65535.0f);
+		}
+
+		// least significant byte first, the passes over a byte every key
+		// shares are skipped.
+		static void RadixSort(std::vector<SortEntry>& entries, std::vector<SortEntry>& scratch)
+		{
+			scratch.resize(entries.size());
+			for (std::uint32_t shift = 0; shift < 64; shift += 8)
+			{
+				std::array<std::size_t, 256> counts = {};
+				for (const SortEntry& entry : entries)
+				{
+					++counts[(entry.key >> shift) & 0xFF];
+				}
+				if (entries.empty() || counts[(entries.front().key >> shift) & 0xFF] == entries.size())
+				{
+					continue;
+				}
+				std::size_t offset = 0;
+				for (std::size_t& count : counts)
+				{
+					offset += std::exchange(count, offset);
+				}
+				for (const SortEntry& entry : entries)
+				{
+					scratch[counts[(entry.key >> shift) & 0xFF]++] = entry;
+				}
+				entries.swap(scratch);
+			}
+		}
+
+		// same state and a draw call able to take both.
+		static bool CanMerge(const DrawPacket& a, const DrawPacket& b)
+		{
+			if (a.shader != b.shader ||
+				a.vertexArray != b.vertexArray ||
+				!(a.material == b.material) ||
+				a.transform != b.transform ||
+				a.kind != b.kind)
+			{
+				return false;
+			}
+			switch (a.kind)
+			{
+			case DrawKind::ELEMENTS:
+				return a.indexType == b.indexType;
+			case DrawKind::INDIRECT:
+				return a.commands == b.commands && a.indexType == b.indexType;
+			default:
+				return true;
+			}
+		}
+
+		// packets [begin, end) can all be merged with the first.
+		void Draw(std::vector<SortEntry>::const_iterator begin, std::vector<SortEntry>::const_iterator end)
+		{
+			const DrawPacket& packet = packets_[begin->index];
+			const std::size_t drawCount = end - begin;
+			switch (packet.kind)
+			{
+			case DrawKind::ARRAYS:
+				DrawArrays(begin, end);
+				break;
+			case DrawKind::ELEMENTS:
+				DrawElements(begin, end);
+				break;
+			case DrawKind::INDIRECT:
+				// consecutive command ranges go in one multi draw.
+				for (auto entry = begin; entry != end;)
+				{
+					const DrawPacket& first = packets_[entry->index];
+					std::size_t count = first.count;
+					for (++entry; entry != end; ++entry)
+					{
+						const DrawPacket& next = packets_[entry->index];
+						if (next.first != first.first + count)
+						{
+							break;
+						}
+						count += next.count;
+					}
+					first.commands->DrawBound(first.indexType, first.first, count);
+					++stats_.drawCalls;
+				}
+				return;
+			}
+			stats_.drawCalls += drawCount == 1 || HasMultiDraw(packet.kind) ? 1 : drawCount;
+		}
+
+		static bool HasMultiDraw(DrawKind kind)
+		{
+			return kind == DrawKind::ARRAYS ?
+				GLAD_GL_EXT_multi_draw_arrays :
+				GLAD_GL_EXT_multi_draw_arrays && GLAD_GL_EXT_draw_elements_base_vertex;
+		}
+
+		void DrawArrays(std::vector<SortEntry>::const_iterator begin, std::vector<SortEntry>::const_iterator end)
+		{
+			if (end - begin == 1 || !HasMultiDraw(DrawKind::ARRAYS))
+			{
+				for (auto entry = begin; entry != end; ++entry)
+				{
+					const DrawPacket& packet = packets_[entry->index];
+					glDrawArrays(GL_TRIANGLES, static_cast<GLint>(packet.first), packet.count);
+				}
+				return;
+			}
+			firsts_.clear();
+			counts_.clear();
+			for (auto entry = begin; entry != end; ++entry)
+			{
+				const DrawPacket& packet = packets_[entry->index];
+				firsts_.push_back(static_cast<GLint>(packet.first));
+				counts_.push_back(packet.count);
+			}
+			glMultiDrawArraysEXT(
+				GL_TRIANGLES, firsts_.data(), counts_.data(), static_cast<GLsizei>(counts_.size()));
+		}
+
+		void DrawElements(std::vector<SortEntry>::const_iterator begin, std::vector<SortEntry>::const_iterator end)
+		{
+			const GLenum indexType = packets_[begin->index].indexType;
+			if (end - begin == 1 || !HasMultiDraw(DrawKind::ELEMENTS))
+			{
+				for (auto entry = begin; entry != end; ++entry)
+				{
+					const DrawPacket& packet = packets_[entry->index];
+					glDrawElementsBaseVertex(
+						GL_TRIANGLES,
+						packet.count,
+						indexType,
+						reinterpret_cast<const void*>(packet.first),
+						packet.baseVertex);
+				}
+				return;
+			}
+			counts_.clear();
+			offsets_.clear();
+			baseVertices_.clear();
+			for (auto entry = begin; entry != end; ++entry)
+			{
+				const DrawPacket& packet = packets_[entry->index];
+				counts_.push_back(packet.count);
+				offsets_.push_back(reinterpret_cast<const void*>(packet.first));
+				baseVertices_.push_back(packet.baseVertex);
+			}
+			glMultiDrawElementsBaseVertexEXT(
+				GL_TRIANGLES,
+				counts_.data(),
+				indexType,
+				offsets_.data(),
+				static_cast<GLsizei>(counts_.size()),
+				baseVertices_.data());
+		}
+
+		void ResetLists(std::size_t count)
+		{
+			if (lists_.size() < count)
+			{
+				lists_.resize(count);
+			}
+			for (std::size_t i = 0; i < count; ++i)
+			{
+				lists_[i].Clear();
+			}
+			listCount_ = count;
+		}
+
+		// runs the uploads and appends the packets of the lists, list after
+		// list, their transforms moved past the ones already merged.
+		void Merge()
+		{
+			for (std::size_t i = 0; i < listCount_; ++i)
+			{
+				DrawList& list = lists_[i];
+				for (const DrawUpload& upload : list.uploads_)
+				{
+					upload.run(upload.object, upload.index);
+				}
+				const std::uint32_t offset = static_cast<std::uint32_t>(transforms_.size());
+				transforms_.insert(transforms_.end(), list.transforms_.begin(), list.transforms_.end());
+				normalMatrices_.insert(
+					normalMatrices_.end(),
+					list.normalMatrices_.begin(),
+					list.normalMatrices_.end());
+				for (DrawPacket packet : list.packets_)
+				{
+					packet.transform += offset;
+					packets_.push_back(packet);
+				}
+			}
+		}
+
+		std::vector<DrawPacket> packets_;
+		std::vector<glm::mat4> transforms_;
+		std::vector<glm::mat3> normalMatrices_;
+		// one per job of the last Record, kept to reuse their storage.
+		std::vector<DrawList> lists_;
+		std::size_t listCount_ = 0;
+		std::vector<SortEntry> sorted_;
+		std::vector<SortEntry> scratch_;
+		std::array<float, MAX_PASSES> nearDepths_;
+		std::array<float, MAX_PASSES> logDepthRanges_;
+		Stats stats_;
+
+		// arguments of the multi draws, kept to reuse their storage.
+		std::vector<GLint> firsts_;
+		std::vector<GLsizei> counts_;
+		std::vector<const void*> offsets_;
+		std::vector<GLint> baseVertices_;
+	};
+
+	inline void DrawList::Submit(const DrawPacket& packet)
+	{
+		if (packet.pass >= RenderQueue::MAX_PASSES)
+		{
+			throw std::out_of_range("Render queue pass " + std::to_string(packet.pass));
+		}
+		if (packet.transform >= transforms_.size())
+		{
+			throw std::out_of_range("Render queue transform " + std::to_string(packet.transform));
+		}
+		packets_.push_back(packet);
+	}
+
+} // End namespace gl.
@@ -3,210 +3,651 @@
 #include <glad/glad.h>
 #include <glm/glm.hpp>
 
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <initializer_list>
+#include <iterator>
 #include <string>
-#include <fstream>
-#include <sstream>
+#include <string_view>
 #include <iostream>
+#include <optional>
+#include <utility>
+#include <vector>
+
+#include "asset_archive.h"
+#include "gl_check.h"
+#include "gl_handle.h"
+#include "gl_state.h"
+#include "hash.h"
+#include "mapped_file.h"
+#include "program_cache.h"
 
 namespace gl {
 
+	// Uniform name hashed at compile time: string literals convert to it
+	// implicitly, so Set*("model", ...) costs no allocation, no hashing and
+	// no glGetUniformLocation.
+	class UniformId
+	{
+	public:
+		template<std::size_t N>
+		consteval UniformId(const char (&name)[N]) :
+			hash_(Fnv1a64(std::string_view(name, N - 1)))
+		{
+		}
+
+		// for names only known at runtime, hashed on every call.
+		static constexpr UniformId FromString(std::string_view name)
+		{
+			return UniformId(Fnv1a64(name));
+		}
+
+		constexpr std::uint64_t Hash() const
+		{
+			return hash_;
+		}
+
+	private:
+		explicit constexpr UniformId(std::uint64_t hash) :
+			hash_(hash)
+		{
+		}
+
+		std::uint64_t hash_;
+	};
+
+	// Optional parts of the shaders, compiled in with a #define of the same
+	// name so a program only pays for the features it uses.
+	enum class ShaderFeature : std::uint32_t
+	{
+		SOFT_SHADOWS,
+		NORMAL_MAPPING,
+		// the model matrix comes from the instance buffer, see
+		// instance_buffer.h.
+		INSTANCED,
+		COUNT,
+	};
+
+	constexpr const char* SHADER_FEATURE_NAMES[] = {
+		"SOFT_SHADOWS",
+		"NORMAL_MAPPING",
+		"INSTANCED",
+	};
+	static_assert(std::size(SHADER_FEATURE_NAMES) == std::size_t(ShaderFeature::COUNT));
+
+	// Set of ShaderFeature, one bit each.
+	class ShaderFeatures
+	{
+	public:
+		constexpr ShaderFeatures() = default;
+		constexpr ShaderFeatures(std::initializer_list<ShaderFeature> features)
+		{
+			for (const ShaderFeature feature : features)
+			{
+				Set(feature);
+			}
+		}
+
+		constexpr ShaderFeatures& Set(ShaderFeature feature, bool enabled = true)
+		{
+			const std::uint32_t bit = 1u << static_cast<std::uint32_t>(feature);
+			bits_ = enabled ? bits_ | bit : bits_ & ~bit;
+			return *this;
+		}
+
+		constexpr bool Has(ShaderFeature feature) const
+		{
+			return (bits_ >> static_cast<std::uint32_t>(feature)) & 1u;
+		}
+
+		constexpr std::uint32_t Bits() const
+		{
+			return bits_;
+		}
+
+		constexpr bool operator==(const ShaderFeatures&) const = default;
+
+		// one #define line per feature.
+		std::string Defines() const
+		{
+			std::string defines;
+			for (std::uint32_t i = 0; i < std::uint32_t(ShaderFeature::COUNT); ++i)
+			{
+				if (Has(ShaderFeature(i)))
+				{
+					defines += "#define ";
+					defines += SHADER_FEATURE_NAMES[i];
+					defines += "\n";
+				}
+			}
+			return defines;
+		}
+
+	private:
+		std::uint32_t bits_ = 0;
+	};
+
 	class Shader
 	{
 	public:
-		unsigned int id;
 		// constructor generates the shader on the fly
 		Shader(
 			const std::string& vertexPath,
 			const std::string& fragmentPath,
-			const std::string& geometryPath = "")
-		{
-			// 1. retrieve the vertex/fragment source code from filePath
-			std::string vertexCode;
-			std::string fragmentCode;
-			std::string geometryCode;
-			std::ifstream vShaderFile;
-			std::ifstream fShaderFile;
-			std::ifstream gShaderFile;
-			// ensure ifstream objects can throw exceptions:
-			vShaderFile.exceptions(
-				std::ifstream::failbit | std::ifstream::badbit);
-			fShaderFile.exceptions(
-				std::ifstream::failbit | std::ifstream::badbit);
-			gShaderFile.exceptions(
-				std::ifstream::failbit | std::ifstream::badbit);
-			try
-			{
-				// open files
-				vShaderFile.open(vertexPath);
-				fShaderFile.open(fragmentPath);
-				std::stringstream vShaderStream, fShaderStream;
-				// read file's buffer contents into streams
-				vShaderStream << vShaderFile.rdbuf();
-				fShaderStream << fShaderFile.rdbuf();
-				// close file handlers
-				vShaderFile.close();
-				fShaderFile.close();
-				// convert stream into string
-				vertexCode = vShaderStream.str();
-				fragmentCode = fShaderStream.str();
-				// if geometry shader path is present, also load a geometry
-				// shader
-				if (!geometryPath.empty())
+			const std::string& geometryPath = "",
+			ShaderFeatures features = {}) :
+			paths_{ vertexPath, fragmentPath, geometryPath },
+			features_(features),
+			defines_(features.Defines())
+		{
+			// 1. retrieve the vertex/fragment source code through the asset
+			// file system, the sources are passed to GL straight from the
+			// mapping with their length
+			AssetFile vertexFile = OpenSource(vertexPath);
+			AssetFile fragmentFile = OpenSource(fragmentPath);
+			AssetFile geometryFile;
+			if (!geometryPath.empty())
+			{
+				geometryFile = OpenSource(geometryPath);
+			}
+			// 2. restore the program linked by a previous run when nothing
+			// changed, or build it from source and keep the binary
+			ProgramBinaryCache& cache = ProgramBinaryCache::Global();
+			const std::uint64_t key = cache.ComputeKey(
+				{ vertexFile.Text(), fragmentFile.Text(), geometryFile.Text() },
+				defines_);
+			program_ = GlProgram::Create();
+			GL_CHECK();
+			if (!cache.Load(key, program_.Get()))
+			{
+				// a rejected binary leaves the program in an undefined
+				// state, start over from a new one.
+				program_ = GlProgram::Create();
+				GL_CHECK();
+				Link(vertexFile.Text(), fragmentFile.Text(), geometryFile.Text());
+				cache.Store(key, program_.Get());
+			}
+			ReflectUniforms();
+		}
+
+		Shader(const Shader&) = delete;
+		Shader& operator=(const Shader&) = delete;
+
+		GLuint Id() const
+		{
+			return program_.Get();
+		}
+
+		// starts rebuilding the program from the source files on disk,
+		// bypassing the mounted archives since those are the files being
+		// edited. Nothing waits on the driver: the current program stays in
+		// use until PollReload swaps the new one in. A reload already in
+		// flight is dropped. Returns false if a source could not be read.
+		bool BeginReload()
+		{
+			std::array<MappedFile, 3> files;
+			std::array<std::string_view, 3> sources;
+			for (std::size_t i = 0; i < paths_.size(); ++i)
+			{
+				if (paths_[i].empty())
 				{
-					gShaderFile.open(geometryPath);
-					std::stringstream gShaderStream;
-					gShaderStream << gShaderFile.rdbuf();
-					gShaderFile.close();
-					geometryCode = gShaderStream.str();
+					continue;
 				}
+				if (!files[i].Open(paths_[i]))
+				{
+					std::cout << "Could not reload shader file: " << paths_[i] << std::endl;
+					return false;
+				}
+				sources[i] = {
+					reinterpret_cast<const char*>(files[i].Data()),
+					files[i].Size() };
 			}
-			catch (std::ifstream::failure& e)
-			{
-				throw std::runtime_error(e.what());
-			}
-			const char* vShaderCode = vertexCode.c_str();
-			const char* fShaderCode = fragmentCode.c_str();
-			// 2. compile shaders
-			unsigned int vertex, fragment;
-			// vertex shader
-			vertex = glCreateShader(GL_VERTEX_SHADER);
-			IsError(__FILE__, __LINE__);
-			glShaderSource(vertex, 1, &vShaderCode, NULL);
-			IsError(__FILE__, __LINE__);
-			glCompileShader(vertex);
-			IsError(__FILE__, __LINE__);
-			CheckCompileErrors(vertex, "VERTEX");
-			// fragment Shader
-			fragment = glCreateShader(GL_FRAGMENT_SHADER);
-			IsError(__FILE__, __LINE__);
-			glShaderSource(fragment, 1, &fShaderCode, NULL);
-			IsError(__FILE__, __LINE__);
-			glCompileShader(fragment);
-			IsError(__FILE__, __LINE__);
-			CheckCompileErrors(fragment, "FRAGMENT");
-			// if geometry shader is given, compile geometry shader
-			unsigned int geometry;
-			if (!geometryPath.empty())
+
+			pending_.emplace();
+			ProgramBinaryCache& cache = ProgramBinaryCache::Global();
+			pending_->key = cache.ComputeKey({ sources[0], sources[1], sources[2] }, defines_);
+			pending_->program = GlProgram::Create();
+			GL_CHECK();
+			// going back to a version seen before is only a binary upload.
+			pending_->cached = cache.Load(pending_->key, pending_->program.Get());
+			if (pending_->cached)
 			{
-				const char* gShaderCode = geometryCode.c_str();
-				geometry = glCreateShader(GL_GEOMETRY_SHADER);
-				IsError(__FILE__, __LINE__);
-				glShaderSource(geometry, 1, &gShaderCode, NULL);
-				IsError(__FILE__, __LINE__);
-				glCompileShader(geometry);
-				IsError(__FILE__, __LINE__);
-				CheckCompileErrors(geometry, "GEOMETRY");
-			}
-			// shader Program
-			id = glCreateProgram();
-			IsError(__FILE__, __LINE__);
-			glAttachShader(id, vertex);
-			IsError(__FILE__, __LINE__);
-			glAttachShader(id, fragment);
-			IsError(__FILE__, __LINE__);
-			if (!geometryPath.empty())
+				return true;
+			}
+			pending_->program = GlProgram::Create();
+			GL_CHECK();
+			for (std::size_t i = 0; i < STAGES.size(); ++i)
 			{
-				glAttachShader(id, geometry);
-				IsError(__FILE__, __LINE__);
-			}
-			glLinkProgram(id);
-			IsError(__FILE__, __LINE__);
-			CheckCompileErrors(id, "PROGRAM");
-			// delete the shaders as they're linked into our program now and no
-			// longer necessary
-			glDeleteShader(vertex);
-			IsError(__FILE__, __LINE__);
-			glDeleteShader(fragment);
-			IsError(__FILE__, __LINE__);
-			if (!geometryPath.empty())
+				if (paths_[i].empty())
+				{
+					continue;
+				}
+				pending_->stages[i] = IssueCompile(STAGES[i], sources[i]);
+				glAttachShader(pending_->program.Get(), pending_->stages[i].Get());
+				GL_CHECK();
+			}
+			glProgramParameteri(pending_->program.Get(), GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+			glLinkProgram(pending_->program.Get());
+			GL_CHECK();
+			return true;
+		}
+
+		// true on the frame the reloaded program replaces the current one.
+		// With GL_KHR_parallel_shader_compile the driver is only asked
+		// whether it finished, otherwise the status is read on the first
+		// poll, a frame after the compile was issued. A program that fails
+		// to build is logged and dropped, the current one stays.
+		bool PollReload()
+		{
+			if (!pending_)
+			{
+				return false;
+			}
+			const GLuint program = pending_->program.Get();
+			if (GLAD_GL_KHR_parallel_shader_compile)
+			{
+				GLint completed = GL_FALSE;
+				glGetProgramiv(program, GL_COMPLETION_STATUS_KHR, &completed);
+				if (completed == GL_FALSE)
+				{
+					return false;
+				}
+			}
+			GLint linked = GL_FALSE;
+			glGetProgramiv(program, GL_LINK_STATUS, &linked);
+			if (linked == GL_FALSE)
+			{
+				std::cout << "Shader reload failed: " << paths_[0] << ", " << paths_[1] << std::endl;
+				std::cout << BuildLog() << std::endl;
+				pending_.reset();
+				return false;
+			}
+			if (!pending_->cached)
 			{
-				glDeleteShader(geometry);
-				IsError(__FILE__, __LINE__);
+				ProgramBinaryCache::Global().Store(pending_->key, program);
 			}
+			program_ = std::move(pending_->program);
+			pending_.reset();
+			ReflectUniforms();
+			return true;
 		}
+
+		bool IsReloading() const
+		{
+			return pending_.has_value();
+		}
+
+		// vertex, fragment and geometry source paths, the geometry one is
+		// empty when the program has no geometry stage.
+		const std::array<std::string, 3>& SourcePaths() const
+		{
+			return paths_;
+		}
+
+		ShaderFeatures Features() const
+		{
+			return features_;
+		}
+
 		// activate the shader
 		void Use()
 		{
-			glUseProgram(id);
-			IsError(__FILE__, __LINE__);
+			GlState::Global().UseProgram(program_.Get());
+			GL_CHECK();
+		}
+		// utility uniform functions, the locations come from the table
+		// built at link time. Uniforms the program does not use are
+		// ignored like with glGetUniformLocation, and writing the value a
+		// uniform already holds is skipped. The program has to be in use.
+		// GL_UNIFORM_CHECK only counts the writes for the frame bench.
+		void SetBool(UniformId id, bool value) const
+		{
+			SetInt(id, (int)value);
 		}
-		// utility uniform functions
-		void SetBool(const std::string& name, bool value) const
+		void SetInt(UniformId id, int value) const
 		{
-			glUniform1i(glGetUniformLocation(id, name.c_str()), (int)value);
-			IsError(__FILE__, __LINE__);
+			GL_UNIFORM_CHECK();
+			const GLint location = Location(id);
+			if (Changed(location, &value, sizeof(value)))
+			{
+				glUniform1i(location, value);
+			}
 		}
-		void SetInt(const std::string& name, int value) const
+		void SetFloat(UniformId id, float value) const
 		{
-			glUniform1i(glGetUniformLocation(id, name.c_str()), value);
-			IsError(__FILE__, __LINE__);
+			GL_UNIFORM_CHECK();
+			const GLint location = Location(id);
+			if (Changed(location, &value, sizeof(value)))
+			{
+				glUniform1f(location, value);
+			}
 		}
-		void SetFloat(const std::string& name, float value) const
+		void SetVec2(UniformId id, const glm::vec2& value) const
 		{
-			glUniform1f(glGetUniformLocation(id, name.c_str()), value);
-			IsError(__FILE__, __LINE__);
+			GL_UNIFORM_CHECK();
+			const GLint location = Location(id);
+			if (Changed(location, &value[0], sizeof(value)))
+			{
+				glUniform2fv(location, 1, &value[0]);
+			}
 		}
-		void SetVec2(const std::string& name, const glm::vec2& value) const
+		void SetVec2(UniformId id, float x, float y) const
 		{
-			glUniform2fv(glGetUniformLocation(id, name.c_str()), 1, &value[0]);
-			IsError(__FILE__, __LINE__);
+			SetVec2(id, glm::vec2(x, y));
 		}
-		void SetVec2(const std::string& name, float x, float y) const
+		void SetVec3(UniformId id, const glm::vec3& value) const
 		{
-			glUniform2f(glGetUniformLocation(id, name.c_str()), x, y);
-			IsError(__FILE__, __LINE__);
+			GL_UNIFORM_CHECK();
+			const GLint location = Location(id);
+			if (Changed(location, &value[0], sizeof(value)))
+			{
+				glUniform3fv(location, 1, &value[0]);
+			}
 		}
-		void SetVec3(const std::string& name, const glm::vec3& value) const
+		void SetVec3(UniformId id, float x, float y, float z) const
 		{
-			glUniform3fv(glGetUniformLocation(id, name.c_str()), 1, &value[0]);
-			IsError(__FILE__, __LINE__);
+			SetVec3(id, glm::vec3(x, y, z));
 		}
-		void SetVec3(const std::string& name, float x, float y, float z) const
+		void SetVec4(UniformId id, const glm::vec4& value) const
 		{
-			glUniform3f(glGetUniformLocation(id, name.c_str()), x, y, z);
-			IsError(__FILE__, __LINE__);
+			GL_UNIFORM_CHECK();
+			const GLint location = Location(id);
+			if (Changed(location, &value[0], sizeof(value)))
+			{
+				glUniform4fv(location, 1, &value[0]);
+			}
 		}
-		void SetVec4(const std::string& name, const glm::vec4& value) const
+		void SetVec4(UniformId id, float x, float y, float z, float w) const
 		{
-			glUniform4fv(glGetUniformLocation(id, name.c_str()), 1, &value[0]);
-			IsError(__FILE__, __LINE__);
+			SetVec4(id, glm::vec4(x, y, z, w));
 		}
-		void SetVec4(
-			const std::string& name,
-			float x, float y, float z, float w)
+		void SetMat2(UniformId id, const glm::mat2& mat) const
 		{
-			glUniform4f(glGetUniformLocation(id, name.c_str()), x, y, z, w);
-			IsError(__FILE__, __LINE__);
+			GL_UNIFORM_CHECK();
+			const GLint location = Location(id);
+			if (Changed(location, &mat[0][0], sizeof(mat)))
+			{
+				glUniformMatrix2fv(location, 1, GL_FALSE, &mat[0][0]);
+			}
 		}
-		void SetMat2(const std::string& name, const glm::mat2& mat) const
+		void SetMat3(UniformId id, const glm::mat3& mat) const
 		{
-			glUniformMatrix2fv(
-				glGetUniformLocation(id, name.c_str()),
-				1,
-				GL_FALSE,
-				&mat[0][0]);
-			IsError(__FILE__, __LINE__);
+			GL_UNIFORM_CHECK();
+			const GLint location = Location(id);
+			if (Changed(location, &mat[0][0], sizeof(mat)))
+			{
+				glUniformMatrix3fv(location, 1, GL_FALSE, &mat[0][0]);
+			}
 		}
-		void SetMat3(const std::string& name, const glm::mat3& mat) const
+		void SetMat4(UniformId id, const glm::mat4& mat) const
 		{
-			glUniformMatrix3fv(
-				glGetUniformLocation(id, name.c_str()),
-				1,
-				GL_FALSE,
-				&mat[0][0]);
-			IsError(__FILE__, __LINE__);
+			GL_UNIFORM_CHECK();
+			const GLint location = Location(id);
+			if (Changed(location, &mat[0][0], sizeof(mat)))
+			{
+				glUniformMatrix4fv(location, 1, GL_FALSE, &mat[0][0]);
+			}
 		}
-		void SetMat4(const std::string& name, const glm::mat4& mat) const
+
+		// -1 when the program has no such active uniform.
+		GLint Location(UniformId id) const
 		{
-			glUniformMatrix4fv(
-				glGetUniformLocation(id, name.c_str()),
-				1,
-				GL_FALSE,
-				&mat[0][0]);
-			IsError(__FILE__, __LINE__);
+			const std::size_t mask = uniforms_.size() - 1;
+			for (std::size_t i = id.Hash() & mask;; i = (i + 1) & mask)
+			{
+				const UniformSlot& slot = uniforms_[i];
+				if (slot.hash == id.Hash())
+				{
+					return slot.location;
+				}
+				if (slot.hash == 0)
+				{
+					return -1;
+				}
+			}
 		}
 
 	private:
+		static constexpr std::array<GLenum, 3> STAGES = {
+			GL_VERTEX_SHADER, GL_FRAGMENT_SHADER, GL_GEOMETRY_SHADER };
+
+		// program being rebuilt by the driver, the stages are kept until
+		// the link is done so their logs can be read.
+		struct PendingProgram
+		{
+			GlProgram program;
+			std::array<GlShader, 3> stages;
+			std::uint64_t key = 0;
+			bool cached = false;
+		};
+
+		GlProgram program_;
+		std::array<std::string, 3> paths_;
+		ShaderFeatures features_;
+		std::string defines_;
+		std::optional<PendingProgram> pending_;
+
+		// open addressing table of the active uniforms keyed by the hash
+		// of their name, at most half full so the probes stay short and
+		// always reach an empty slot.
+		struct UniformSlot
+		{
+			std::uint64_t hash = 0;
+			GLint location = -1;
+		};
+		std::vector<UniformSlot> uniforms_;
+
+		// last value written at each location of the program, the names
+		// of an array and of its first element share theirs.
+		struct UniformValue
+		{
+			std::array<std::byte, sizeof(glm::mat4)> bytes;
+			std::uint8_t size = 0;
+		};
+		mutable std::vector<UniformValue> values_;
+
+		// true if the uniform at location has to be written, value is kept
+		// as the one it holds from now on.
+		bool Changed(GLint location, const void* value, std::size_t size) const
+		{
+			if (location < 0)
+			{
+				return false;
+			}
+			UniformValue& current = values_[location];
+			const bool changed =
+				current.size != size || std::memcmp(current.bytes.data(), value, size) != 0;
+			GlState::Global().CountUniform(changed);
+			if (changed)
+			{
+				std::memcpy(current.bytes.data(), value, size);
+				current.size = static_cast<std::uint8_t>(size);
+			}
+			return changed;
+		}
+
+		void ReflectUniforms()
+		{
+			GLint uniformCount = 0;
+			glGetProgramInterfaceiv(program_.Get(), GL_UNIFORM, GL_ACTIVE_RESOURCES, &uniformCount);
+
+			// every element of the arrays can be set on its own.
+			std::vector<std::pair<std::string, GLint>> names;
+			for (GLint i = 0; i < uniformCount; ++i)
+			{
+				const GLenum properties[3] = { GL_NAME_LENGTH, GL_LOCATION, GL_ARRAY_SIZE };
+				GLint values[3] = {};
+				glGetProgramResourceiv(
+					program_.Get(), GL_UNIFORM, i, 3, properties, 3, nullptr, values);
+				// uniforms of a block have no location.
+				if (values[1] < 0)
+				{
+					continue;
+				}
+				std::string name(std::max(values[0], 1), '\0');
+				glGetProgramResourceName(
+					program_.Get(), GL_UNIFORM, i, values[0], nullptr, name.data());
+				name.resize(std::strlen(name.c_str()));
+				names.emplace_back(name, values[1]);
+
+				const std::size_t bracket = name.rfind("[0]");
+				if (bracket != std::string::npos && bracket + 3 == name.size())
+				{
+					const std::string base = name.substr(0, bracket);
+					names.emplace_back(base, values[1]);
+					for (GLint element = 1; element < values[2]; ++element)
+					{
+						names.emplace_back(
+							base + "[" + std::to_string(element) + "]",
+							values[1] + element);
+					}
+				}
+			}
+
+			std::size_t tableSize = 8;
+			while (tableSize < names.size() * 2)
+			{
+				tableSize *= 2;
+			}
+			uniforms_.assign(tableSize, {});
+			// a new program starts from the default values.
+			GLint maxLocation = -1;
+			for (const auto& [name, location] : names)
+			{
+				maxLocation = std::max(maxLocation, location);
+			}
+			values_.assign(maxLocation + 1, {});
+			std::vector<const std::string*> slotNames(tableSize, nullptr);
+			for (const auto& [name, location] : names)
+			{
+				const std::uint64_t hash = UniformId::FromString(name).Hash();
+				if (hash == 0)
+				{
+					throw std::runtime_error("Uniform name hashes to the empty key: " + name);
+				}
+				std::size_t i = hash & (tableSize - 1);
+				for (; uniforms_[i].hash != 0; i = (i + 1) & (tableSize - 1))
+				{
+					if (uniforms_[i].hash == hash)
+					{
+						throw std::runtime_error(
+							"Uniform hash collision: " + name + " and " + *slotNames[i]);
+					}
+				}
+				uniforms_[i] = { hash, location };
+				slotNames[i] = &name;
+			}
+		}
+
+		// compiles the stages into program_ and links it, the shaders are
+		// deleted by their handles once linked.
+		void Link(std::string_view vertexSource, std::string_view fragmentSource, std::string_view geometrySource)
+		{
+			GlShader vertex = Compile(GL_VERTEX_SHADER, vertexSource, "VERTEX");
+			GlShader fragment = Compile(GL_FRAGMENT_SHADER, fragmentSource, "FRAGMENT");
+			GlShader geometry;
+			if (!geometrySource.empty())
+			{
+				geometry = Compile(GL_GEOMETRY_SHADER, geometrySource, "GEOMETRY");
+			}
+			glAttachShader(program_.Get(), vertex.Get());
+			GL_CHECK();
+			glAttachShader(program_.Get(), fragment.Get());
+			GL_CHECK();
+			if (geometry)
+			{
+				glAttachShader(program_.Get(), geometry.Get());
+				GL_CHECK();
+			}
+			glProgramParameteri(program_.Get(), GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+			GL_CHECK();
+			glLinkProgram(program_.Get());
+			GL_CHECK();
+			CheckCompileErrors(program_.Get(), "PROGRAM");
+		}
+
+		GlShader Compile(GLenum stage, std::string_view source, const std::string& type)
+		{
+			GlShader shader = IssueCompile(stage, source);
+			CheckCompileErrors(shader.Get(), type);
+			return shader;
+		}
+
+		// hands the source to the driver without reading the status back.
+		// The defines go right after the #version line, which has to stay
+		// first, followed by a #line so the compile errors keep the line
+		// numbers of the file. The source itself is not copied.
+		GlShader IssueCompile(GLenum stage, std::string_view source)
+		{
+			std::size_t versionEnd = 0;
+			const std::size_t first = source.find_first_not_of(" \t\r\n");
+			if (first != std::string_view::npos && source.substr(first).starts_with("#version"))
+			{
+				versionEnd = source.find('\n', first);
+				versionEnd = versionEnd == std::string_view::npos ? source.size() : versionEnd + 1;
+			}
+			std::string defines;
+			if (!defines_.empty())
+			{
+				const auto nextLine = std::count(source.begin(), source.begin() + versionEnd, '\n') + 1;
+				defines = defines_ + "#line " + std::to_string(nextLine) + "\n";
+			}
+			const char* code[3] = {
+				source.data(),
+				defines.data(),
+				source.data() + versionEnd };
+			const GLint length[3] = {
+				static_cast<GLint>(versionEnd),
+				static_cast<GLint>(defines.size()),
+				static_cast<GLint>(source.size() - versionEnd) };
+			GlShader shader = GlShader::Create(stage);
+			GL_CHECK();
+			glShaderSource(shader.Get(), 3, code, length);
+			GL_CHECK();
+			glCompileShader(shader.Get());
+			GL_CHECK();
+			return shader;
+		}
+
+		// logs of the stages that failed to compile, or the link log.
+		std::string BuildLog() const
+		{
+			GLchar infoLog[1024];
+			std::string log;
+			for (const GlShader& stage : pending_->stages)
+			{
+				GLint compiled = GL_TRUE;
+				if (stage)
+				{
+					glGetShaderiv(stage.Get(), GL_COMPILE_STATUS, &compiled);
+				}
+				if (compiled == GL_FALSE)
+				{
+					glGetShaderInfoLog(stage.Get(), 1024, NULL, infoLog);
+					log += infoLog;
+				}
+			}
+			if (log.empty())
+			{
+				glGetProgramInfoLog(pending_->program.Get(), 1024, NULL, infoLog);
+				log = infoLog;
+			}
+			return log;
+		}
+
+		static AssetFile OpenSource(const std::string& path)
+		{
+			AssetFile file = AssetFileSystem::Global().Open(path);
+			if (!file)
+			{
+				throw std::runtime_error("Could not open shader file: " + path);
+			}
+			return file;
+		}
+
 		// utility function for checking shader compilation/linking errors.
 		void CheckCompileErrors(GLuint shader, std::string type)
 		{
@@ -233,16 +674,6 @@ namespace gl {
 				}
 			}
 		}
-		void IsError(const char* file, int line) const {
-			auto error_code = glGetError();
-			if (error_code != GL_NO_ERROR)
-			{
-				throw std::runtime_error(
-					std::to_string(error_code) +
-					" in file: " + file +
-					" at line: " + std::to_string(line));
-			}
-		}
 	};
 
 } // End namespace gl.
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <cstdint>
+#include <initializer_list>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+#include "shader.h"
+#include "shader_watcher.h"
+
+namespace gl {
+
+	// Every permutation of one vertex/fragment/geometry program, keyed by
+	// its ShaderFeatures. A variant is compiled the first time it is asked
+	// for, or up front with Precompile for the ones known at load time.
+	// Each variant goes through the program binary cache on its own.
+	class ShaderVariants
+	{
+	public:
+		// setup sets the uniforms that are only set once, on every new
+		// variant and again after a hot reload when a watcher is given.
+		ShaderVariants(
+			std::string vertexPath,
+			std::string fragmentPath,
+			std::string geometryPath = "",
+			ShaderWatcher::ReloadCallback setup = {},
+			ShaderWatcher* watcher = nullptr) :
+			vertexPath_(std::move(vertexPath)),
+			fragmentPath_(std::move(fragmentPath)),
+			geometryPath_(std::move(geometryPath)),
+			setup_(std::move(setup)),
+			watcher_(watcher)
+		{
+		}
+
+		// the reference stays valid as long as the ShaderVariants.
+		std::unique_ptr<Shader>& Get(ShaderFeatures features)
+		{
+			std::unique_ptr<Shader>& shader = variants_[features.Bits()];
+			if (!shader)
+			{
+				shader = std::make_unique<Shader>(
+					vertexPath_, fragmentPath_, geometryPath_, features);
+				if (setup_)
+				{
+					setup_(*shader);
+				}
+				if (watcher_)
+				{
+					watcher_->Watch(*shader, setup_);
+				}
+			}
+			return shader;
+		}
+
+		// a variant Get already compiled, never compiles one so it can be
+		// called from the worker threads while no Get runs.
+		Shader& Find(ShaderFeatures features) const
+		{
+			const auto variant = variants_.find(features.Bits());
+			if (variant == variants_.end() || !variant->second)
+			{
+				throw std::out_of_range("Shader variant not compiled: " + std::to_string(features.Bits()));
+			}
+			return *variant->second;
+		}
+
+		void Precompile(std::initializer_list<ShaderFeatures> variants)
+		{
+			for (const ShaderFeatures features : variants)
+			{
+				Get(features);
+			}
+		}
+
+		std::size_t VariantCount() const
+		{
+			return variants_.size();
+		}
+
+	private:
+		std::string vertexPath_;
+		std::string fragmentPath_;
+		std::string geometryPath_;
+		ShaderWatcher::ReloadCallback setup_;
+		ShaderWatcher* watcher_;
+		std::unordered_map<std::uint32_t, std::unique_ptr<Shader>> variants_;
+	};
+
+} // End namespace gl.
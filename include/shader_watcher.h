@@ -0,0 +1,136 @@
+#pragma once
+
+#include <chrono>
+#include <filesystem>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+#include <glad/glad.h>
+
+#include "shader.h"
+
+namespace gl {
+
+	// Hot reload of the shaders: the modification times of the sources of
+	// every watched program are polled, and only the programs using a file
+	// that changed are rebuilt, in the background through
+	// Shader::BeginReload. Lives on the thread owning the GL context, Update
+	// is called once per frame and never waits on the driver.
+	class ShaderWatcher
+	{
+	public:
+		// called after a reloaded program replaced the old one, to set the
+		// uniforms that are only set once.
+		using ReloadCallback = std::function<void(Shader&)>;
+
+		explicit ShaderWatcher(
+			std::chrono::milliseconds interval = std::chrono::milliseconds(250)) :
+			interval_(interval)
+		{
+			// let the driver compile on as many threads as it wants.
+			if (GLAD_GL_KHR_parallel_shader_compile)
+			{
+				glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);
+			}
+		}
+
+		// the shader has to outlive the watcher.
+		void Watch(Shader& shader, ReloadCallback onReload = {})
+		{
+			Entry entry;
+			entry.shader = &shader;
+			entry.onReload = std::move(onReload);
+			for (const std::string& path : shader.SourcePaths())
+			{
+				if (!path.empty())
+				{
+					entry.files.push_back({ path, WriteTime(path) });
+				}
+			}
+			entries_.push_back(std::move(entry));
+		}
+
+		// returns the number of programs swapped this frame.
+		std::size_t Update()
+		{
+			const auto now = std::chrono::steady_clock::now();
+			if (now - lastPoll_ >= interval_)
+			{
+				lastPoll_ = now;
+				for (Entry& entry : entries_)
+				{
+					if (Changed(entry))
+					{
+						std::cout << "Reloading shader: " << entry.files.front().path << std::endl;
+						entry.shader->BeginReload();
+					}
+				}
+			}
+
+			std::size_t swapped = 0;
+			for (Entry& entry : entries_)
+			{
+				if (entry.shader->PollReload())
+				{
+					if (entry.onReload)
+					{
+						entry.onReload(*entry.shader);
+					}
+					++swapped;
+				}
+			}
+			reloadCount_ += swapped;
+			return swapped;
+		}
+
+		std::size_t ReloadCount() const
+		{
+			return reloadCount_;
+		}
+
+	private:
+		struct WatchedFile
+		{
+			std::string path;
+			std::filesystem::file_time_type writeTime;
+		};
+
+		struct Entry
+		{
+			Shader* shader = nullptr;
+			ReloadCallback onReload;
+			std::vector<WatchedFile> files;
+		};
+
+		// files only found in an archive never change.
+		static std::filesystem::file_time_type WriteTime(const std::string& path)
+		{
+			std::error_code error;
+			const auto writeTime = std::filesystem::last_write_time(path, error);
+			return error ? std::filesystem::file_time_type::min() : writeTime;
+		}
+
+		static bool Changed(Entry& entry)
+		{
+			bool changed = false;
+			for (WatchedFile& file : entry.files)
+			{
+				const auto writeTime = WriteTime(file.path);
+				if (writeTime != file.writeTime)
+				{
+					file.writeTime = writeTime;
+					changed = true;
+				}
+			}
+			return changed;
+		}
+
+		std::vector<Entry> entries_;
+		std::chrono::milliseconds interval_;
+		std::chrono::steady_clock::time_point lastPoll_ = std::chrono::steady_clock::now();
+		std::size_t reloadCount_ = 0;
+	};
+
+} // End namespace gl.
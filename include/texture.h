@@ -1,26 +1,57 @@
 #pragma once
 
+#include <cassert>
+#include <memory>
 #include <string>
+#include <vector>
 #include <iostream>
 #include <fstream>
 #include <glad/glad.h>
 #include "stb_image.h"
 #include <assimp/material.h>
 
+#include "asset_archive.h"
+#include "gl_check.h"
+#include "gl_state.h"
+
 namespace gl {
 
-	unsigned int LoadCubeMap(std::vector<std::string> faces)
+	// stbi_load through the asset file system, the image is decoded
+	// straight from the archive mapping. Free the result with
+	// stbi_image_free.
+	inline unsigned char* LoadAssetImage(
+		const std::string& path,
+		int* width,
+		int* height,
+		int* nbChannels,
+		int desiredChannels)
+	{
+		AssetFile file = AssetFileSystem::Global().Open(path);
+		if (!file)
+		{
+			return nullptr;
+		}
+		return stbi_load_from_memory(
+			reinterpret_cast<const stbi_uc*>(file.Data()),
+			static_cast<int>(file.Size()),
+			width,
+			height,
+			nbChannels,
+			desiredChannels);
+	}
+
+	inline unsigned int LoadCubeMap(std::vector<std::string> faces)
 	{
 		unsigned int textureID;
 
 		glGenTextures(1, &textureID);
-		glBindTexture(GL_TEXTURE_CUBE_MAP, textureID);
+		GlState::Global().BindTexture(0, GL_TEXTURE_CUBE_MAP, textureID);
 
 		int width, height, nbChannels;
 
 		for(unsigned int i = 0; i < faces.size(); ++i)
 		{
-			unsigned char* data = stbi_load(faces[i].c_str(), &width, &height, &nbChannels, 0);
+			unsigned char* data = LoadAssetImage(faces[i], &width, &height, &nbChannels, 0);
 
 			if(data)
 			{
@@ -57,23 +88,43 @@ namespace gl {
 		return textureID;
 	}
 	
-	unsigned int LoadTextureFromFile(const char* path, const std::string& directory, aiTextureType textureType)
+	// Image decoded on the CPU, ready to be uploaded. Decoding does not
+	// touch GL so it can run on a worker thread.
+	struct DecodedImage
 	{
-		std::string filename = directory + "/" + std::string(path);
+		int width = 0;
+		int height = 0;
+		int nbChannels = 0;
+		std::unique_ptr<unsigned char, void(*)(void*)> data{ nullptr, stbi_image_free };
+	};
 
-		unsigned int textureID;
-		glGenTextures(1, &textureID);
+	inline DecodedImage DecodeTextureFile(const std::string& filename)
+	{
+		DecodedImage image;
+		image.data.reset(LoadAssetImage(filename, &image.width, &image.height, &image.nbChannels, 0));
+		return image;
+	}
 
-		int width, height, nbChannels;
+	// size of the uploaded texture including its mip chain.
+	inline std::size_t TextureByteSize(const DecodedImage& image)
+	{
+		const std::size_t baseLevel =
+			std::size_t(image.width) * image.height * image.nbChannels;
+		return baseLevel + baseLevel / 3;
+	}
 
-		unsigned char* data = stbi_load(filename.c_str(), &width, &height, &nbChannels, 0);
+	// must be called on the thread owning the GL context.
+	inline unsigned int UploadTexture(const DecodedImage& image, aiTextureType textureType)
+	{
+		assert(image.data);
+
+		unsigned int textureID;
+		glGenTextures(1, &textureID);
 
-		assert(data);
-		
 		GLenum format;
 		GLenum format2;
 
-		switch (nbChannels)
+		switch (image.nbChannels)
 		{
 		case 1:
 			format = GL_RED;
@@ -100,6 +151,7 @@ namespace gl {
 			break;
 
 		case 4:
+		default:
 
 			if (textureType == aiTextureType_DIFFUSE)
 			{
@@ -111,23 +163,27 @@ namespace gl {
 			}
 
 			format2 = GL_RGBA;
-		
-
-			glBindTexture(GL_TEXTURE_2D, textureID);
-			glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format2, GL_UNSIGNED_BYTE, data);
-			glGenerateMipmap(GL_TEXTURE_2D);
+			break;
+		}
 
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		GlState::Global().BindTexture(0, GL_TEXTURE_2D, textureID);
+		glTexImage2D(GL_TEXTURE_2D, 0, format, image.width, image.height, 0, format2, GL_UNSIGNED_BYTE, image.data.get());
+		glGenerateMipmap(GL_TEXTURE_2D);
 
-			stbi_image_free(data);
-		}
-		
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
 		return textureID;
 	}
+
+	inline unsigned int LoadTextureFromFile(const char* path, const std::string& directory, aiTextureType textureType)
+	{
+		std::string filename = directory + "/" + std::string(path);
+
+		return UploadTexture(DecodeTextureFile(filename), textureType);
+	}
 	
 	class Texture {
 	public:
@@ -137,33 +193,33 @@ namespace gl {
 		
 		void Bind(unsigned int i = 0) const
 		{
-			glActiveTexture(GL_TEXTURE0 + i);
-			IsError(__FILE__, __LINE__);
-			glBindTexture(GL_TEXTURE_2D, id);
-			IsError(__FILE__, __LINE__);
+			GlState::Global().BindTexture(i, GL_TEXTURE_2D, id);
+			GL_CHECK();
 		}
-		void UnBind() const
+		void UnBind(unsigned int i = 0) const
 		{
-			glBindTexture(GL_TEXTURE_2D, 0);
-		}
-	protected:
-		void IsError(const char* file, int line) const {
-			auto error_code = glGetError();
-			if (error_code != GL_NO_ERROR)
-			{
-				throw std::runtime_error(
-					std::to_string(error_code) +
-					" in file: " + file +
-					" at line: " + std::to_string(line));
-			}
+			GlState::Global().BindTexture(i, GL_TEXTURE_2D, 0);
 		}
 	};
 
+	struct CachedTexture;
+	using TextureHandle = std::shared_ptr<CachedTexture>;
+
 	struct TextureStruct
 	{
 		unsigned int id = 0;
 		std::string type;
 		std::string path;
+		// keeps the texture alive in the TextureCache.
+		TextureHandle handle;
+	};
+
+	// Texture referenced by a material, before it is loaded.
+	struct TextureRef
+	{
+		std::string type;
+		std::string path;
+		aiTextureType textureType = aiTextureType_NONE;
 	};
 
 } // End namespace gl.
@@ -0,0 +1,172 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include <glad/glad.h>
+#include <assimp/material.h>
+
+#include "gl_state.h"
+#include "texture.h"
+
+namespace gl {
+
+	enum class ColourSpace : std::uint8_t
+	{
+		LINEAR,
+		SRGB
+	};
+
+	// matches the internal format choice made in UploadTexture.
+	inline ColourSpace ColourSpaceFor(aiTextureType textureType)
+	{
+		return textureType == aiTextureType_DIFFUSE ?
+			ColourSpace::SRGB :
+			ColourSpace::LINEAR;
+	}
+
+	// GL texture shared through the cache, deleted with the last handle.
+	struct CachedTexture
+	{
+		unsigned int id = 0;
+		std::size_t bytes = 0;
+	};
+
+	// Process wide texture cache keyed by normalized path and colour space.
+	// Entries are only weakly referenced by the cache so a texture is freed
+	// as soon as the last TextureHandle goes away. Handles must be released
+	// on the thread owning the GL context.
+	class TextureCache
+	{
+	public:
+		struct Stats
+		{
+			std::uint64_t hits = 0;
+			std::uint64_t misses = 0;
+			std::uint64_t uploadedBytes = 0;
+			std::size_t residentBytes = 0;
+			std::size_t residentTextures = 0;
+		};
+
+		static TextureCache& Global()
+		{
+			static TextureCache cache;
+			return cache;
+		}
+
+		static std::string NormalizePath(const std::string& path)
+		{
+			return std::filesystem::path(path).lexically_normal().generic_string();
+		}
+
+		// returns the resident texture or nullptr, counts as a hit or a miss.
+		TextureHandle Find(const std::string& path, ColourSpace colourSpace)
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			TextureHandle handle = Lookup({ NormalizePath(path), colourSpace });
+			if (handle)
+			{
+				++stats_.hits;
+			}
+			else
+			{
+				++stats_.misses;
+			}
+			return handle;
+		}
+
+		// same as Find without touching the statistics.
+		bool Contains(const std::string& path, ColourSpace colourSpace)
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			return Lookup({ NormalizePath(path), colourSpace }) != nullptr;
+		}
+
+		// takes ownership of the GL texture.
+		TextureHandle Insert(
+			const std::string& path,
+			ColourSpace colourSpace,
+			unsigned int id,
+			std::size_t bytes)
+		{
+			Key key{ NormalizePath(path), colourSpace };
+			auto* texture = new CachedTexture{ id, bytes };
+			TextureHandle handle(texture, [this, key](CachedTexture* texture)
+			{
+				Release(key, texture);
+			});
+
+			std::lock_guard<std::mutex> lock(mutex_);
+			entries_[std::move(key)] = handle;
+			stats_.uploadedBytes += bytes;
+			stats_.residentBytes += bytes;
+			++stats_.residentTextures;
+			return handle;
+		}
+
+		Stats GetStats() const
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			return stats_;
+		}
+
+	private:
+		struct Key
+		{
+			std::string path;
+			ColourSpace colourSpace;
+
+			bool operator==(const Key& other) const = default;
+		};
+
+		struct KeyHash
+		{
+			std::size_t operator()(const Key& key) const
+			{
+				return std::hash<std::string>()(key.path) ^
+					static_cast<std::size_t>(key.colourSpace);
+			}
+		};
+
+		TextureCache() = default;
+
+		TextureHandle Lookup(const Key& key) const
+		{
+			auto entry = entries_.find(key);
+			if (entry == entries_.end())
+			{
+				return nullptr;
+			}
+			return entry->second.lock();
+		}
+
+		void Release(const Key& key, CachedTexture* texture)
+		{
+			glDeleteTextures(1, &texture->id);
+			GlState::Global().ForgetTexture(texture->id);
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+				// the key may already point to a newer upload of the same file.
+				auto entry = entries_.find(key);
+				if (entry != entries_.end() && entry->second.expired())
+				{
+					entries_.erase(entry);
+				}
+				stats_.residentBytes -= texture->bytes;
+				--stats_.residentTextures;
+			}
+			delete texture;
+		}
+
+		mutable std::mutex mutex_;
+		std::unordered_map<Key, std::weak_ptr<CachedTexture>, KeyHash> entries_;
+		Stats stats_;
+	};
+
+} // End namespace gl.
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace gl {
+
+	// Fixed size pool of worker threads executing tasks in submission order.
+	// Tasks must not touch the GL context, it is only current on the main
+	// thread.
+	class ThreadPool
+	{
+	public:
+		explicit ThreadPool(std::size_t threadCount = DefaultThreadCount())
+		{
+			threadCount = std::max<std::size_t>(threadCount, 1);
+			workers_.reserve(threadCount);
+			for (std::size_t i = 0; i < threadCount; ++i)
+			{
+				workers_.emplace_back([this]() { WorkerLoop(); });
+			}
+		}
+
+		~ThreadPool()
+		{
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+				stop_ = true;
+			}
+			condition_.notify_all();
+			for (std::thread& worker : workers_)
+			{
+				worker.join();
+			}
+		}
+
+		ThreadPool(const ThreadPool&) = delete;
+		ThreadPool& operator=(const ThreadPool&) = delete;
+
+		template<typename Function>
+		auto Submit(Function&& function)
+			-> std::future<std::invoke_result_t<std::decay_t<Function>>>
+		{
+			using Result = std::invoke_result_t<std::decay_t<Function>>;
+			auto task = std::make_shared<std::packaged_task<Result()>>(
+				std::forward<Function>(function));
+			std::future<Result> result = task->get_future();
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+				tasks_.emplace([task]() { (*task)(); });
+			}
+			condition_.notify_one();
+			return result;
+		}
+
+		std::size_t Size() const
+		{
+			return workers_.size();
+		}
+
+		// pool shared by the loaders, sized to the machine minus the main
+		// thread.
+		static ThreadPool& Global()
+		{
+			static ThreadPool pool;
+			return pool;
+		}
+
+		static std::size_t DefaultThreadCount()
+		{
+			const unsigned int hardwareThreads = std::thread::hardware_concurrency();
+			return hardwareThreads > 1 ? hardwareThreads - 1 : 1;
+		}
+
+	private:
+		void WorkerLoop()
+		{
+			for (;;)
+			{
+				std::function<void()> task;
+				{
+					std::unique_lock<std::mutex> lock(mutex_);
+					condition_.wait(lock, [this]() { return stop_ || !tasks_.empty(); });
+					if (stop_ && tasks_.empty())
+					{
+						return;
+					}
+					task = std::move(tasks_.front());
+					tasks_.pop();
+				}
+				task();
+			}
+		}
+
+		std::vector<std::thread> workers_;
+		std::queue<std::function<void()>> tasks_;
+		std::mutex mutex_;
+		std::condition_variable condition_;
+		bool stop_ = false;
+	};
+
+} // End namespace gl.
@@ -0,0 +1,242 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+
+// the matrices are computed one column per SSE register, which every
+// x86-64 target has, other targets run the scalar reference.
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define GL_TRANSFORM_SSE 1
+#endif
+
+namespace gl {
+
+	// transpose(inverse(mat3(world))), takes the normals of the object to
+	// world space under any scale. Its columns are the cross products of
+	// the columns of the world matrix over its determinant.
+	inline glm::mat3 NormalMatrix(const glm::mat4& world)
+	{
+		const glm::vec3 x(world[0]);
+		const glm::vec3 y(world[1]);
+		const glm::vec3 z(world[2]);
+		const glm::vec3 yz = glm::cross(y, z);
+		const glm::vec3 zx = glm::cross(z, x);
+		const glm::vec3 xy = glm::cross(x, y);
+		const float inverseDeterminant = 1.0f / glm::dot(x, yz);
+		return glm::mat3(yz * inverseDeterminant, zx * inverseDeterminant, xy * inverseDeterminant);
+	}
+
+	// Computes the world and normal matrices of a list of transforms, the
+	// parent of every transform has to come before it in the list or not
+	// be in it. Compute runs the SSE kernel when the build has it, which
+	// makes the normal matrix from the world one while it is still in
+	// registers. ComputeScalar is the reference, the kernel matches it up
+	// to rounding: glm may group the sums differently or fuse them.
+	class TransformKernel
+	{
+	public:
+		static constexpr std::uint32_t NO_PARENT = ~0u;
+
+		// worlds[e] = worlds[parents[e]] * locals[e], locals[e] for roots,
+		// and normals[e] = NormalMatrix(worlds[e]).
+		static void Compute(
+			std::span<const std::uint32_t> entities,
+			std::span<const std::uint32_t> parents,
+			std::span<const glm::mat4> locals,
+			std::span<glm::mat4> worlds,
+			std::span<glm::mat3> normals)
+		{
+#if GL_TRANSFORM_SSE
+			for (std::uint32_t entity : entities)
+			{
+				const std::uint32_t parent = parents[entity];
+				ComputeSse(
+					parent == NO_PARENT ? Identity() : worlds[parent],
+					locals[entity],
+					worlds[entity],
+					normals[entity]);
+			}
+#else
+			ComputeScalar(entities, parents, locals, worlds, normals);
+#endif
+		}
+
+		static void ComputeScalar(
+			std::span<const std::uint32_t> entities,
+			std::span<const std::uint32_t> parents,
+			std::span<const glm::mat4> locals,
+			std::span<glm::mat4> worlds,
+			std::span<glm::mat3> normals)
+		{
+			for (std::uint32_t entity : entities)
+			{
+				const std::uint32_t parent = parents[entity];
+				worlds[entity] = parent == NO_PARENT ? locals[entity] : worlds[parent] * locals[entity];
+				normals[entity] = NormalMatrix(worlds[entity]);
+			}
+		}
+
+		// name of the kernel Compute runs.
+		static const char* KernelName()
+		{
+#if GL_TRANSFORM_SSE
+			return "SSE";
+#else
+			return "scalar";
+#endif
+		}
+
+	private:
+		static const glm::mat4& Identity()
+		{
+			static const glm::mat4 identity(1.0f);
+			return identity;
+		}
+
+#if GL_TRANSFORM_SSE
+		// the kernel reads and writes the matrices as their packed floats,
+		// column after column.
+		static void ComputeSse(const glm::mat4& parent, const glm::mat4& local, glm::mat4& world, glm::mat3& normal)
+		{
+			// a column of the world matrix is the columns of the parent
+			// weighted by a column of the local one.
+			const __m128 p0 = _mm_loadu_ps(&parent[0][0]);
+			const __m128 p1 = _mm_loadu_ps(&parent[1][0]);
+			const __m128 p2 = _mm_loadu_ps(&parent[2][0]);
+			const __m128 p3 = _mm_loadu_ps(&parent[3][0]);
+			__m128 columns[4];
+			for (int column = 0; column < 4; ++column)
+			{
+				const float* weights = &local[column][0];
+				columns[column] = _mm_add_ps(_mm_add_ps(_mm_add_ps(
+					_mm_mul_ps(p0, _mm_set1_ps(weights[0])),
+					_mm_mul_ps(p1, _mm_set1_ps(weights[1]))),
+					_mm_mul_ps(p2, _mm_set1_ps(weights[2]))),
+					_mm_mul_ps(p3, _mm_set1_ps(weights[3])));
+				_mm_storeu_ps(&world[column][0], columns[column]);
+			}
+
+			const __m128 yz = Cross(columns[1], columns[2]);
+			const __m128 zx = Cross(columns[2], columns[0]);
+			const __m128 xy = Cross(columns[0], columns[1]);
+			const __m128 products = _mm_mul_ps(columns[0], yz);
+			const __m128 determinant = _mm_add_ss(_mm_add_ss(
+				products,
+				_mm_shuffle_ps(products, products, _MM_SHUFFLE(1, 1, 1, 1))),
+				_mm_movehl_ps(products, products));
+			const __m128 inverseDeterminant = _mm_div_ps(
+				_mm_set1_ps(1.0f),
+				_mm_shuffle_ps(determinant, determinant, _MM_SHUFFLE(0, 0, 0, 0)));
+
+			// the 9 floats of the mat3, the last column is written in two
+			// parts to stay inside it.
+			float* elements = &normal[0][0];
+			const __m128 last = _mm_mul_ps(xy, inverseDeterminant);
+			_mm_storeu_ps(elements, _mm_mul_ps(yz, inverseDeterminant));
+			_mm_storeu_ps(elements + 3, _mm_mul_ps(zx, inverseDeterminant));
+			_mm_storel_pi(reinterpret_cast<__m64*>(elements + 6), last);
+			_mm_store_ss(elements + 8, _mm_movehl_ps(last, last));
+		}
+
+		// a.yzx * b.zxy - a.zxy * b.yzx, from the product in zxy order.
+		static __m128 Cross(__m128 a, __m128 b)
+		{
+			const __m128 aYzx = _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 0, 2, 1));
+			const __m128 bYzx = _mm_shuffle_ps(b, b, _MM_SHUFFLE(3, 0, 2, 1));
+			const __m128 zxy = _mm_sub_ps(_mm_mul_ps(a, bYzx), _mm_mul_ps(aYzx, b));
+			return _mm_shuffle_ps(zxy, zxy, _MM_SHUFFLE(3, 0, 2, 1));
+		}
+#endif
+	};
+
+	// Local, world and normal matrices of the entities of a scene, one
+	// array per component and the entity as the index in all of them.
+	// Setting a local matrix flags the entity, Update recomputes the world
+	// and normal matrices of the flagged entities and of their
+	// descendants only. A parent is always created before its children,
+	// so one pass in creation order sees every parent updated first.
+	class TransformStore
+	{
+	public:
+		using Entity = std::uint32_t;
+		static constexpr Entity NO_PARENT = TransformKernel::NO_PARENT;
+
+		Entity Create(const glm::mat4& local = glm::mat4(1.0f), Entity parent = NO_PARENT)
+		{
+			if (parent != NO_PARENT)
+			{
+				Check(parent);
+			}
+			const Entity entity = static_cast<Entity>(locals_.size());
+			locals_.push_back(local);
+			worlds_.push_back(local);
+			normals_.push_back(glm::mat3(1.0f));
+			parents_.push_back(parent);
+			dirty_.push_back(1);
+			return entity;
+		}
+
+		void SetLocal(Entity entity, const glm::mat4& local)
+		{
+			Check(entity);
+			locals_[entity] = local;
+			dirty_[entity] = 1;
+		}
+
+		// the entities updated, in creation order. Valid until the next
+		// call.
+		std::span<const Entity> Update()
+		{
+			updated_.clear();
+			for (Entity entity = 0; entity < locals_.size(); ++entity)
+			{
+				const Entity parent = parents_[entity];
+				if (parent != NO_PARENT && dirty_[parent])
+				{
+					dirty_[entity] = 1;
+				}
+				if (dirty_[entity])
+				{
+					updated_.push_back(entity);
+				}
+			}
+			TransformKernel::Compute(updated_, parents_, locals_, worlds_, normals_);
+			for (Entity entity : updated_)
+			{
+				dirty_[entity] = 0;
+			}
+			return updated_;
+		}
+
+		std::size_t Size() const { return locals_.size(); }
+		const glm::mat4& Local(Entity entity) const { return locals_[entity]; }
+		// as of the last Update.
+		const glm::mat4& World(Entity entity) const { return worlds_[entity]; }
+		const glm::mat3& Normal(Entity entity) const { return normals_[entity]; }
+		Entity Parent(Entity entity) const { return parents_[entity]; }
+
+	private:
+		void Check(Entity entity) const
+		{
+			if (entity >= locals_.size())
+			{
+				throw std::out_of_range("No transform entity " + std::to_string(entity));
+			}
+		}
+
+		std::vector<glm::mat4> locals_;
+		std::vector<glm::mat4> worlds_;
+		std::vector<glm::mat3> normals_;
+		std::vector<Entity> parents_;
+		// set until the next Update.
+		std::vector<std::uint8_t> dirty_;
+		std::vector<Entity> updated_;
+	};
+
+} // End namespace gl.
@@ -0,0 +1,149 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "gl_handle.h"
+#include "gl_state.h"
+
+namespace gl {
+
+	// Binding points of the uniform blocks shared by every program, the
+	// shaders declare them with layout(std140, binding = ...).
+	enum class UniformBinding : GLuint
+	{
+		FRAME = 0,
+		LIGHT = 1,
+		PASS = 2,
+	};
+
+	// std140 mirrors of the blocks in data/shaders, vec3 are stored as vec4.
+	struct FrameUniforms
+	{
+		glm::mat4 view = glm::mat4(1.0f);
+		glm::mat4 projection = glm::mat4(1.0f);
+		glm::vec4 viewPos = glm::vec4(0.0f);
+	};
+	static_assert(sizeof(FrameUniforms) == 144);
+
+	struct LightUniforms
+	{
+		glm::mat4 lightSpaceMatrix = glm::mat4(1.0f);
+		glm::vec4 lightDir = glm::vec4(0.0f);
+	};
+	static_assert(sizeof(LightUniforms) == 80);
+
+	// camera of one pass, the light for the shadow map, the view for the
+	// main pass.
+	struct PassUniforms
+	{
+		glm::mat4 viewProjection = glm::mat4(1.0f);
+	};
+	static_assert(sizeof(PassUniforms) == 64);
+
+	// One buffer holding the frame, the light and every pass block, each at
+	// an offset aligned on GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT. The blocks are
+	// filled on the CPU and uploaded with a single write per frame, the
+	// frame and light ranges stay bound for the lifetime of the buffer and
+	// only the pass range moves between passes.
+	class UniformBlocks
+	{
+	public:
+		explicit UniformBlocks(std::size_t passCount)
+		{
+			GLint alignment = 0;
+			glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+			alignment_ = std::max<std::size_t>(alignment, 16);
+
+			frameOffset_ = 0;
+			lightOffset_ = Align(frameOffset_ + sizeof(FrameUniforms));
+			passOffset_ = Align(lightOffset_ + sizeof(LightUniforms));
+			passStride_ = Align(sizeof(PassUniforms));
+			passCount_ = passCount;
+			staging_.resize(passOffset_ + passStride_ * passCount_);
+
+			Frame() = {};
+			Light() = {};
+			for (std::size_t i = 0; i < passCount_; ++i)
+			{
+				Pass(i) = {};
+			}
+
+			buffer_ = GlBuffer::Create();
+			GlState::Global().BindBuffer(GL_UNIFORM_BUFFER, buffer_.Get());
+			glBufferData(GL_UNIFORM_BUFFER, staging_.size(), nullptr, GL_DYNAMIC_DRAW);
+
+			BindRange(UniformBinding::FRAME, frameOffset_, sizeof(FrameUniforms));
+			BindRange(UniformBinding::LIGHT, lightOffset_, sizeof(LightUniforms));
+			if (passCount_ > 0)
+			{
+				BindPass(0);
+			}
+		}
+
+		FrameUniforms& Frame()
+		{
+			return *reinterpret_cast<FrameUniforms*>(staging_.data() + frameOffset_);
+		}
+
+		LightUniforms& Light()
+		{
+			return *reinterpret_cast<LightUniforms*>(staging_.data() + lightOffset_);
+		}
+
+		PassUniforms& Pass(std::size_t pass)
+		{
+			if (pass >= passCount_)
+			{
+				throw std::out_of_range("No uniform block for pass " + std::to_string(pass));
+			}
+			return *reinterpret_cast<PassUniforms*>(staging_.data() + passOffset_ + passStride_ * pass);
+		}
+
+		// sends every block to the GPU, once per frame before the first pass.
+		void Upload() const
+		{
+			GlState::Global().BindBuffer(GL_UNIFORM_BUFFER, buffer_.Get());
+			glBufferSubData(GL_UNIFORM_BUFFER, 0, staging_.size(), staging_.data());
+		}
+
+		// points the PASS binding to the block of pass.
+		void BindPass(std::size_t pass) const
+		{
+			BindRange(UniformBinding::PASS, passOffset_ + passStride_ * pass, sizeof(PassUniforms));
+		}
+
+	private:
+		std::size_t Align(std::size_t offset) const
+		{
+			return (offset + alignment_ - 1) / alignment_ * alignment_;
+		}
+
+		void BindRange(UniformBinding binding, std::size_t offset, std::size_t size) const
+		{
+			GlState::Global().BindBufferRange(
+				GL_UNIFORM_BUFFER,
+				static_cast<GLuint>(binding),
+				buffer_.Get(),
+				offset,
+				size);
+		}
+
+		GlBuffer buffer_;
+		// the blocks live directly in the bytes uploaded, the glm types only
+		// need 4 byte alignment, which the vector storage always satisfies.
+		std::vector<std::byte> staging_;
+		std::size_t alignment_ = 16;
+		std::size_t frameOffset_ = 0;
+		std::size_t lightOffset_ = 0;
+		std::size_t passOffset_ = 0;
+		std::size_t passStride_ = 0;
+		std::size_t passCount_ = 0;
+	};
+
+} // End namespace gl.
@@ -0,0 +1,261 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <vector>
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+namespace gl {
+
+	// One vertex attribute of a vertex format, described at compile time.
+	template<
+		GLuint Location,
+		GLint Components,
+		GLenum Type,
+		GLboolean Normalized,
+		std::size_t Offset>
+	struct VertexAttribute
+	{
+		static constexpr GLuint LOCATION = Location;
+
+		static void Enable(GLsizei stride)
+		{
+			glEnableVertexAttribArray(Location);
+			glVertexAttribPointer(
+				Location,
+				Components,
+				Type,
+				Normalized,
+				stride,
+				reinterpret_cast<const GLvoid*>(Offset));
+		}
+	};
+
+	// Vertex format descriptor, Apply() sets up the currently bound VAO for
+	// the currently bound GL_ARRAY_BUFFER.
+	template<typename VertexType, typename... Attributes>
+	struct VertexLayout
+	{
+		using Vertex = VertexType;
+		static constexpr GLsizei STRIDE = sizeof(VertexType);
+
+		static void Apply()
+		{
+			(Attributes::Enable(STRIDE), ...);
+		}
+	};
+
+	// Quantized vertex: positions are snorm16 inside the mesh bounds,
+	// normals and tangents are octahedral snorm16 and the texture
+	// coordinates are half floats. 20 bytes instead of 44.
+	struct PackedVertex
+	{
+		std::int16_t position[4];
+		std::int16_t normal[2];
+		std::int16_t tangeant[2];
+		std::uint16_t texture[2];
+	};
+	static_assert(sizeof(PackedVertex) == 20);
+
+	using PackedVertexLayout = VertexLayout<
+		PackedVertex,
+		VertexAttribute<0, 3, GL_SHORT, GL_TRUE, offsetof(PackedVertex, position)>,
+		VertexAttribute<1, 2, GL_SHORT, GL_TRUE, offsetof(PackedVertex, normal)>,
+		VertexAttribute<2, 2, GL_HALF_FLOAT, GL_FALSE, offsetof(PackedVertex, texture)>,
+		VertexAttribute<3, 2, GL_SHORT, GL_TRUE, offsetof(PackedVertex, tangeant)>>;
+
+	// Maps the snorm16 positions back to object space in the vertex shader:
+	// position = aPos * scale + offset.
+	struct VertexQuantization
+	{
+		glm::vec3 scale = glm::vec3(1.0f);
+		glm::vec3 offset = glm::vec3(0.0f);
+	};
+
+	inline std::int16_t QuantizeSnorm16(float value)
+	{
+		value = std::clamp(value, -1.0f, 1.0f);
+		return static_cast<std::int16_t>(std::lround(value * 32767.0f));
+	}
+
+	// octahedral mapping of a unit vector to [-1, 1]^2.
+	inline glm::vec2 OctahedralEncode(glm::vec3 n)
+	{
+		const float sum = std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+		if (sum == 0.0f)
+		{
+			return glm::vec2(0.0f, 0.0f);
+		}
+		n /= sum;
+		glm::vec2 encoded(n.x, n.y);
+		if (n.z < 0.0f)
+		{
+			encoded = glm::vec2(
+				(1.0f - std::abs(n.y)) * (n.x >= 0.0f ? 1.0f : -1.0f),
+				(1.0f - std::abs(n.x)) * (n.y >= 0.0f ? 1.0f : -1.0f));
+		}
+		return encoded;
+	}
+
+	// IEEE 754 binary16 with round to nearest even, as read by
+	// GL_HALF_FLOAT.
+	inline std::uint16_t FloatToHalf(float value)
+	{
+		const std::uint32_t bits = std::bit_cast<std::uint32_t>(value);
+		const std::uint32_t sign = (bits >> 16) & 0x8000u;
+		const std::uint32_t exponent = (bits >> 23) & 0xffu;
+		std::uint32_t mantissa = bits & 0x7fffffu;
+
+		if (exponent == 0xffu)
+		{
+			// inf or nan.
+			return static_cast<std::uint16_t>(sign | 0x7c00u | (mantissa ? 0x200u : 0u));
+		}
+		const int halfExponent = int(exponent) - 127 + 15;
+		if (halfExponent >= 0x1f)
+		{
+			return static_cast<std::uint16_t>(sign | 0x7c00u);
+		}
+		if (halfExponent <= 0)
+		{
+			// subnormal or zero.
+			if (halfExponent < -10)
+			{
+				return static_cast<std::uint16_t>(sign);
+			}
+			mantissa |= 0x800000u;
+			const int shift = 14 - halfExponent;
+			std::uint32_t half = mantissa >> shift;
+			const std::uint32_t rest = mantissa & ((1u << shift) - 1u);
+			const std::uint32_t halfway = 1u << (shift - 1);
+			if (rest > halfway || (rest == halfway && (half & 1u)))
+			{
+				++half;
+			}
+			return static_cast<std::uint16_t>(sign | half);
+		}
+		std::uint32_t half = (std::uint32_t(halfExponent) << 10) | (mantissa >> 13);
+		const std::uint32_t rest = mantissa & 0x1fffu;
+		if (rest > 0x1000u || (rest == 0x1000u && (half & 1u)))
+		{
+			// may carry into the exponent, which is still correct.
+			++half;
+		}
+		return static_cast<std::uint16_t>(sign | half);
+	}
+
+	// Full precision vertex as produced by the importer and stored in the
+	// mesh cache.
+	class Vertex
+	{
+	public:
+		glm::vec3 position;
+		glm::vec3 normal;
+		glm::vec2 texture;
+		glm::vec3 tangeant;
+	};
+
+	using FullVertexLayout = VertexLayout<
+		Vertex,
+		VertexAttribute<0, 3, GL_FLOAT, GL_FALSE, offsetof(Vertex, position)>,
+		VertexAttribute<1, 3, GL_FLOAT, GL_FALSE, offsetof(Vertex, normal)>,
+		VertexAttribute<2, 2, GL_FLOAT, GL_FALSE, offsetof(Vertex, texture)>,
+		VertexAttribute<3, 3, GL_FLOAT, GL_FALSE, offsetof(Vertex, tangeant)>>;
+
+	enum class VertexFormat
+	{
+		FULL,
+		QUANTIZED
+	};
+
+	// scale and offset mapping the bounds to [-1, 1]^3.
+	inline VertexQuantization QuantizationFromBounds(glm::vec3 minBound, glm::vec3 maxBound)
+	{
+		VertexQuantization quantization;
+		quantization.offset = (minBound + maxBound) * 0.5f;
+		quantization.scale = glm::max(
+			(maxBound - minBound) * 0.5f,
+			glm::vec3(1e-6f));
+		return quantization;
+	}
+
+	inline VertexQuantization ComputeQuantization(std::span<const Vertex> vertices)
+	{
+		VertexQuantization quantization;
+		if (vertices.empty())
+		{
+			return quantization;
+		}
+		glm::vec3 minBound = vertices[0].position;
+		glm::vec3 maxBound = vertices[0].position;
+		for (const Vertex& vertex : vertices)
+		{
+			minBound = glm::min(minBound, vertex.position);
+			maxBound = glm::max(maxBound, vertex.position);
+		}
+		return QuantizationFromBounds(minBound, maxBound);
+	}
+
+	inline PackedVertex PackVertex(const Vertex& vertex, const VertexQuantization& quantization)
+	{
+		PackedVertex packed;
+		const glm::vec3 position =
+			(vertex.position - quantization.offset) / quantization.scale;
+		packed.position[0] = QuantizeSnorm16(position.x);
+		packed.position[1] = QuantizeSnorm16(position.y);
+		packed.position[2] = QuantizeSnorm16(position.z);
+		packed.position[3] = 0;
+
+		const glm::vec2 normal = OctahedralEncode(vertex.normal);
+		packed.normal[0] = QuantizeSnorm16(normal.x);
+		packed.normal[1] = QuantizeSnorm16(normal.y);
+
+		const glm::vec2 tangeant = OctahedralEncode(vertex.tangeant);
+		packed.tangeant[0] = QuantizeSnorm16(tangeant.x);
+		packed.tangeant[1] = QuantizeSnorm16(tangeant.y);
+
+		packed.texture[0] = FloatToHalf(vertex.texture.x);
+		packed.texture[1] = FloatToHalf(vertex.texture.y);
+		return packed;
+	}
+
+	inline std::vector<PackedVertex> PackVertices(
+		std::span<const Vertex> vertices,
+		const VertexQuantization& quantization)
+	{
+		std::vector<PackedVertex> packedVertices;
+		packedVertices.reserve(vertices.size());
+		for (const Vertex& vertex : vertices)
+		{
+			packedVertices.push_back(PackVertex(vertex, quantization));
+		}
+		return packedVertices;
+	}
+
+	// runtime dispatch to the layouts above, for buffers shared by meshes
+	// of a format chosen at load time.
+	inline GLsizei VertexStride(VertexFormat vertexFormat)
+	{
+		return vertexFormat == VertexFormat::QUANTIZED ?
+			PackedVertexLayout::STRIDE :
+			FullVertexLayout::STRIDE;
+	}
+
+	inline void ApplyVertexLayout(VertexFormat vertexFormat)
+	{
+		if (vertexFormat == VertexFormat::QUANTIZED)
+		{
+			PackedVertexLayout::Apply();
+		}
+		else
+		{
+			FullVertexLayout::Apply();
+		}
+	}
+
+} // End namespace gl.
@@ -0,0 +1,171 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "aabb.h"
+#include "bench.h"
+#include "bvh.h"
+#include "frustum.h"
+
+namespace gl {
+
+	// Builds a BVH over random boxes and times the build, the refit of
+	// moving boxes, the rebuild and the frustum and ray queries. The
+	// queries are checked against a linear pass over every box, the
+	// FrustumCuller for the frustum ones.
+	class BvhBench
+	{
+	public:
+		BvhBench(std::size_t boxCount, int iterations) :
+			random_(1),
+			timer_(iterations)
+		{
+			for (std::size_t i = 0; i < boxCount; ++i)
+			{
+				bounds_.push_back(RandomBox());
+			}
+		}
+
+		// returns false when a query result differs from the reference.
+		bool Run(const Frustum& camera, const Frustum& light)
+		{
+			const double buildTime = timer_.Time([&]() { bvh_.Build(bounds_); });
+			std::cout << bounds_.size() << " boxes, " << bvh_.NodeCount() << " nodes, cost "
+				<< bvh_.Cost() << "\n  build " << buildTime << " ms\n";
+			bool matches = Queries("camera frustum", camera) && Queries("light frustum", light);
+
+			// a tenth of the boxes travel, each refit moves them again.
+			std::uniform_int_distribution<std::size_t> pick(0, bounds_.size() - 1);
+			std::vector<std::uint32_t> moving(bounds_.size() / 10);
+			for (std::uint32_t& object : moving)
+			{
+				object = static_cast<std::uint32_t>(pick(random_));
+			}
+			const double refitTime = timer_.Time([&]()
+			{
+				for (std::uint32_t object : moving)
+				{
+					bounds_[object] = RandomBox();
+					bvh_.Update(object, bounds_[object]);
+				}
+			});
+			std::cout << "  refit of " << moving.size() << " boxes " << refitTime << " ms, cost "
+				<< bvh_.Cost() << (bvh_.NeedsRebuild() ? ", needs a rebuild\n" : "\n");
+			matches = Queries("refit camera frustum", camera) && matches;
+
+			const double rebuildTime = timer_.Time([&]() { bvh_.Rebuild(); });
+			std::cout << "  rebuild " << rebuildTime << " ms, cost " << bvh_.Cost() << "\n";
+			return Queries("rebuilt camera frustum", camera) && matches;
+		}
+
+	private:
+		static constexpr float AREA = 1000.0f;
+		static constexpr std::size_t RAY_COUNT = 1000;
+
+		Aabb RandomBox()
+		{
+			std::uniform_real_distribution<float> position(-0.5f * AREA, 0.5f * AREA);
+			std::uniform_real_distribution<float> size(0.1f, 10.0f);
+			return Aabb::FromCenterExtent(
+				glm::vec3(position(random_), 0.1f * position(random_), position(random_)),
+				glm::vec3(size(random_), size(random_), size(random_)));
+		}
+
+		bool Queries(const std::string& name, const Frustum& frustum)
+		{
+			// the culler reports the boxes crossing the frustum planes too,
+			// exactly like the leaves of the BVH.
+			BoxSet boxes;
+			for (const Aabb& bounds : bounds_)
+			{
+				boxes.Add(bounds.Center(), bounds.Extent());
+			}
+			std::vector<std::uint8_t> reference(bounds_.size());
+			std::vector<std::uint8_t> visible(bounds_.size());
+			const double linearTime = timer_.Time([&]()
+			{
+				FrustumCuller::Cull(frustum, boxes, reference);
+			});
+			const double bvhTime = timer_.Time([&]()
+			{
+				std::fill(visible.begin(), visible.end(), std::uint8_t(0));
+				bvh_.QueryFrustum(frustum, [&](std::uint32_t object) { visible[object] = 1; });
+			});
+			std::size_t mismatches = 0;
+			std::size_t visibleCount = 0;
+			for (std::size_t i = 0; i < bounds_.size(); ++i)
+			{
+				mismatches += reference[i] != visible[i];
+				visibleCount += reference[i];
+			}
+			std::cout << "  " << name << ": " << visibleCount << " visible, "
+				<< FrustumCuller::KernelName() << " " << linearTime << " ms, bvh "
+				<< bvhTime << " ms\n";
+
+			// rays from above the boxes, down and to the side.
+			std::mt19937 rays(2);
+			std::uniform_real_distribution<float> position(-0.5f * AREA, 0.5f * AREA);
+			std::uniform_real_distribution<float> slope(-1.0f, 1.0f);
+			std::vector<glm::vec3> origins(RAY_COUNT);
+			std::vector<glm::vec3> directions(RAY_COUNT);
+			for (std::size_t i = 0; i < RAY_COUNT; ++i)
+			{
+				origins[i] = glm::vec3(position(rays), 100.0f, position(rays));
+				directions[i] = glm::normalize(glm::vec3(slope(rays), -1.0f, slope(rays)));
+			}
+			std::vector<Bvh::RayHit> hits(RAY_COUNT);
+			const double rayTime = timer_.Time([&]()
+			{
+				for (std::size_t i = 0; i < RAY_COUNT; ++i)
+				{
+					hits[i] = bvh_.Raycast(origins[i], directions[i], 2.0f * AREA);
+				}
+			});
+			std::size_t rayMismatches = 0;
+			for (std::size_t i = 0; i < RAY_COUNT; ++i)
+			{
+				// the closest box entry, any box at that distance is a hit.
+				const glm::vec3 inverseDirection = 1.0f / directions[i];
+				float closest = 2.0f * AREA;
+				bool hit = false;
+				for (const Aabb& bounds : bounds_)
+				{
+					float distance = 0.0f;
+					if (bounds.IntersectsRay(origins[i], inverseDirection, closest, distance))
+					{
+						closest = distance;
+						hit = true;
+					}
+				}
+				rayMismatches += hit != static_cast<bool>(hits[i]) || (hit && hits[i].distance != closest);
+			}
+			std::cout << "  " << RAY_COUNT << " rays " << rayTime << " ms\n";
+
+			if (mismatches > 0 || rayMismatches > 0)
+			{
+				std::cout << "  " << mismatches << " boxes and " << rayMismatches
+					<< " rays differ from the linear reference\n";
+			}
+			return mismatches == 0 && rayMismatches == 0;
+		}
+
+		std::mt19937 random_;
+		std::vector<Aabb> bounds_;
+		Bvh bvh_;
+		BenchTimer timer_;
+	};
+
+} // End namespace gl.
+
+int main(int argc, char** argv)
+{
+	const std::size_t boxCount = std::max<std::size_t>(argc > 1 ? std::stoul(argv[1]) : 100000, 1);
+	const int iterations = argc > 2 ? std::stoi(argv[2]) : 10;
+	gl::BvhBench bench(boxCount, iterations);
+	return bench.Run(gl::BenchCameraFrustum(), gl::BenchLightFrustum()) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
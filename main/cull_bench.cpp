@@ -0,0 +1,82 @@
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "bench.h"
+#include "frustum.h"
+
+namespace gl {
+
+	// Culls random boxes against a camera and a light frustum with the
+	// kernel of the build and with the scalar reference. Every result
+	// has to match, the time of both is reported.
+	class CullBench
+	{
+	public:
+		CullBench(std::size_t boxCount, int iterations) :
+			timer_(iterations)
+		{
+			std::mt19937 random(1);
+			std::uniform_real_distribution<float> position(-500.0f, 500.0f);
+			std::uniform_real_distribution<float> size(0.1f, 10.0f);
+			for (std::size_t i = 0; i < boxCount; ++i)
+			{
+				boxes_.Add(
+					glm::vec3(position(random), 0.1f * position(random), position(random)),
+					glm::vec3(size(random), size(random), size(random)));
+			}
+		}
+
+		// returns false when a kernel result differs from the reference.
+		bool Run(const std::string& name, const Frustum& frustum) const
+		{
+			std::vector<std::uint8_t> reference(boxes_.Size());
+			std::vector<std::uint8_t> visible(boxes_.Size());
+			const double scalarTime = timer_.Time([&]()
+			{
+				FrustumCuller::CullScalar(frustum, boxes_, reference);
+			});
+			const double kernelTime = timer_.Time([&]()
+			{
+				FrustumCuller::Cull(frustum, boxes_, visible);
+			});
+
+			std::size_t mismatches = 0;
+			std::size_t visibleCount = 0;
+			for (std::size_t i = 0; i < boxes_.Size(); ++i)
+			{
+				mismatches += reference[i] != visible[i];
+				visibleCount += reference[i];
+			}
+			std::cout << name << ": " << visibleCount << " / " << boxes_.Size() << " visible\n"
+				<< "  scalar " << scalarTime << " ms, "
+				<< FrustumCuller::KernelName() << " " << kernelTime << " ms, x"
+				<< scalarTime / kernelTime << "\n";
+			if (mismatches > 0)
+			{
+				std::cout << "  " << mismatches << " boxes differ from the scalar reference\n";
+			}
+			return mismatches == 0;
+		}
+
+	private:
+		BoxSet boxes_;
+		BenchTimer timer_;
+	};
+
+} // End namespace gl.
+
+int main(int argc, char** argv)
+{
+	const std::size_t boxCount = argc > 1 ? std::stoul(argv[1]) : 1000000;
+	const int iterations = argc > 2 ? std::stoi(argv[2]) : 20;
+	const gl::CullBench bench(boxCount, iterations);
+
+	bool matches = bench.Run("camera frustum", gl::BenchCameraFrustum());
+	matches = bench.Run("light frustum", gl::BenchLightFrustum()) && matches;
+	return matches ? EXIT_SUCCESS : EXIT_FAILURE;
+}
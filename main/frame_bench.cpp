@@ -0,0 +1,211 @@
+#include <SDL_main.h>
+#include <glad/glad.h>
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "engine.h"
+#include "gl_check.h"
+#include "lod_selector.h"
+#include "material_arrays.h"
+#include "model.h"
+#include "shader.h"
+#include "transform_store.h"
+#include "uniform_blocks.h"
+
+namespace gl {
+
+	// Times the CPU side of drawing a grid of models, from the first GL
+	// call of the frame to the last one before the swap, then quits. In a
+	// build with GL checks the same frames are run again with a glGetError
+	// at every check and every uniform write, the way each call used to be
+	// checked, and the difference is reported.
+	class FrameBench : public Program
+	{
+	public:
+		FrameBench(std::string modelPath, int frames, int gridSize) :
+			modelPath_(std::move(modelPath)),
+			frames_(frames),
+			gridSize_(gridSize)
+		{
+		}
+
+		void Init() override;
+		void Update(seconds dt, SDL_Window* window) override;
+		void Destroy() override;
+		void OnEvent(SDL_Event&) override {}
+		void DrawImGui() override {}
+
+	protected:
+		using clock = std::chrono::high_resolution_clock;
+
+		double DrawFrame();
+		static double Mean(const std::vector<double>& timings);
+		void Report(const std::string& name, std::vector<double> timings) const;
+
+		std::string modelPath_;
+		int frames_;
+		int gridSize_;
+		int frame_ = 0;
+		std::unique_ptr<Model> model_;
+		std::unique_ptr<Shader> shader_;
+		std::unique_ptr<UniformBlocks> uniformBlocks_;
+		std::vector<double> timings_;
+		std::vector<double> pollingTimings_;
+		std::uint64_t checksPerFrame_ = 0;
+		std::uint64_t uniformsPerFrame_ = 0;
+	};
+
+	void FrameBench::Init()
+	{
+		glEnable(GL_DEPTH_TEST);
+		model_ = std::make_unique<Model>(modelPath_);
+		shader_ = std::make_unique<Shader>(
+			"data/shaders/shadow.vert",
+			"data/shaders/shadow.frag",
+			"",
+			ShaderFeatures{ ShaderFeature::SOFT_SHADOWS });
+		MaterialArrays::SetSamplerUnits(*shader_);
+		uniformBlocks_ = std::make_unique<UniformBlocks>(1);
+
+		const glm::vec3 eye(0.0f, 20.0f, 20.0f * gridSize_);
+		FrameUniforms& frame = uniformBlocks_->Frame();
+		frame.view = glm::lookAt(eye, glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+		frame.projection = glm::perspective(glm::radians(45.0f), 4.0f / 3.0f, 0.1f, 1000.0f);
+		frame.viewPos = glm::vec4(eye, 1.0f);
+		uniformBlocks_->Light().lightDir = glm::vec4(glm::normalize(glm::vec3(-1.0f, -1.0f, 1.0f)), 0.0f);
+		uniformBlocks_->Pass(0).viewProjection = frame.projection * frame.view;
+	}
+
+	double FrameBench::DrawFrame()
+	{
+		const auto start = clock::now();
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+		uniformBlocks_->Upload();
+		uniformBlocks_->BindPass(0);
+		shader_->Use();
+		const LodSelector lodSelector;
+		const float half = 0.5f * (gridSize_ - 1);
+		for (int x = 0; x < gridSize_; ++x)
+		{
+			for (int z = 0; z < gridSize_; ++z)
+			{
+				const glm::mat4 model = glm::translate(
+					glm::mat4(1.0f),
+					glm::vec3((x - half) * 10.0f, 0.0f, (z - half) * 10.0f));
+				shader_->SetMat4("model", model);
+				shader_->SetMat3("normalMatrix", NormalMatrix(model));
+				model_->Draw(shader_, model, lodSelector);
+			}
+		}
+		const auto end = clock::now();
+		return std::chrono::duration<double, std::milli>(end - start).count();
+	}
+
+	void FrameBench::Update(seconds, SDL_Window*)
+	{
+		// the first frames warm up the driver and are not counted.
+		const int warmup = 10;
+#if GL_CHECKS_ENABLED
+		const int runs = 2;
+#else
+		const int runs = 1;
+#endif
+		const int run = frame_ / (warmup + frames_);
+		const int index = frame_ % (warmup + frames_);
+		++frame_;
+		if (run >= runs)
+		{
+			SDL_Event quit;
+			quit.type = SDL_QUIT;
+			SDL_PushEvent(&quit);
+			return;
+		}
+
+#if GL_CHECKS_ENABLED
+		GlDebug::SetErrorPolling(run == 1);
+		const std::uint64_t checks = GlDebug::CheckCount();
+		const std::uint64_t uniforms = GlDebug::UniformCount();
+#endif
+		const double timing = DrawFrame();
+#if GL_CHECKS_ENABLED
+		checksPerFrame_ = GlDebug::CheckCount() - checks;
+		uniformsPerFrame_ = GlDebug::UniformCount() - uniforms;
+#endif
+		if (index >= warmup)
+		{
+			(run == 0 ? timings_ : pollingTimings_).push_back(timing);
+		}
+	}
+
+	double FrameBench::Mean(const std::vector<double>& timings)
+	{
+		double total = 0.0;
+		for (const double timing : timings)
+		{
+			total += timing;
+		}
+		return total / timings.size();
+	}
+
+	void FrameBench::Report(const std::string& name, std::vector<double> timings) const
+	{
+		std::sort(timings.begin(), timings.end());
+		std::cout << name << ": mean " << Mean(timings)
+			<< " ms, median " << timings[timings.size() / 2] << " ms\n";
+	}
+
+	void FrameBench::Destroy()
+	{
+		model_.reset();
+		shader_.reset();
+		uniformBlocks_.reset();
+#if GL_CHECKS_ENABLED
+		GlDebug::SetErrorPolling(false);
+		if (pollingTimings_.empty())
+#else
+		if (timings_.empty())
+#endif
+		{
+			return;
+		}
+
+		std::cout << "CPU time per frame drawing " << gridSize_ * gridSize_
+			<< " x " << modelPath_ << " over " << frames_ << " frames\n";
+#if GL_CHECKS_ENABLED
+		std::cout << "GL checks: debug callback, " << checksPerFrame_ << " checks and "
+			<< uniformsPerFrame_ << " uniform writes per frame\n";
+		Report("debug callback      ", timings_);
+		Report("glGetError per call ", pollingTimings_);
+		std::cout << "saving per frame    : "
+			<< Mean(pollingTimings_) - Mean(timings_) << " ms\n";
+#else
+		std::cout << "GL checks: compiled out, build with -DGL_CHECKS=ON to compare\n";
+		Report("no checks           ", timings_);
+#endif
+	}
+
+} // End namespace gl.
+
+int main(int argc, char** argv)
+{
+	const std::string modelPath = argc > 1 ? argv[1] : "data/meshes/tree.obj";
+	const int frames = std::max(argc > 2 ? std::stoi(argv[2]) : 200, 1);
+	const int gridSize = std::max(argc > 3 ? std::stoi(argv[3]) : 8, 1);
+	gl::FrameBench program(modelPath, frames, gridSize);
+	gl::Engine engine(program);
+	try
+	{
+		engine.Run();
+	}
+	catch (std::exception& ex)
+	{
+		std::cerr << ex.what() << std::endl;
+	}
+	return EXIT_SUCCESS;
+}
@@ -2,20 +2,42 @@
 #include <glad/glad.h>
 #include <array>
 #include <memory>
+#include <span>
 #include <string>
 #include <iostream>
 #include <fstream>
 #include <sstream>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
+#include "imgui.h"
+#include "imgui_impl_opengl3.h"
 
 #include "engine.h"
+#include "aabb.h"
+#include "asset_archive.h"
+#include "bvh.h"
 #include "camera.h"
+#include "cooked_texture.h"
 #include "texture.h"
 #include "shader.h"
+#include "shader_variants.h"
+#include "shader_watcher.h"
 #include "mesh.h"
+#include "program_cache.h"
 #include "model.h"
 #include "cubemap.h"
+#include "frame_graph.h"
+#include "frustum.h"
+#include "gl_handle.h"
+#include "gl_state.h"
+#include "instance_buffer.h"
+#include "instance_scatter.h"
+#include "lod_selector.h"
+#include "material_arrays.h"
+#include "render_queue.h"
+#include "texture_cache.h"
+#include "transform_store.h"
+#include "uniform_blocks.h"
 
 namespace gl {
 
@@ -27,38 +49,97 @@ namespace gl {
 		void Destroy() override;
 		void OnEvent(SDL_Event& event) override;
 		void DrawImGui() override;
+		// the ImGui pass is part of the frame graph.
+		bool RendersImGui() const override { return true; }
 
 	protected:
-		void SetModelMatrix(seconds dt);
 		void SetViewMatrix();
 		void SetProjectionMatrix();
-		void IsError(const std::string& file, int line) const;
-		void SetUniformMatrix() const;
 		unsigned int LoadBasicTexture(char const* path);
-		void RenderScene(std::unique_ptr<Shader>& shader);
+		// uniforms set once per program, again after a hot reload.
+		static void SetupMainShader(Shader& shader);
+		static void SetupSkyboxShader(Shader& shader);
+		// records the draws of a pass with the variants of shaders for
+		// features, which must be compiled. The plane has no tangents nor
+		// normal map, it never gets the normal mapping. Makes no GL call,
+		// the passes are recorded on different threads.
+		std::size_t SubmitScene(
+			DrawList& list,
+			std::uint32_t pass,
+			const ShaderVariants& shaders,
+			ShaderFeatures features,
+			const LodSelector& lodSelector,
+			const glm::vec3& viewPos,
+			const Frustum& frustum);
+		static void BindPlaneMaterial(const void* object, std::uint32_t index, const Shader& shader);
+		// the closest object under a window position, into pickedObject_.
+		void PickObject(int x, int y);
 
 	protected:
-		unsigned int skyboxVAO_;
-		unsigned int skyboxVBO_;
-		unsigned int skyboxTexture_;
+		// blocks of UniformBlocks, one per pass.
+		enum Pass : std::size_t
+		{
+			SHADOW_PASS,
+			MAIN_PASS,
+			PASS_COUNT,
+		};
+
+		// objects of sceneBvh_ and entities of transforms_.
+		enum SceneObject : std::uint32_t
+		{
+			PLANE_OBJECT,
+			TREE_OBJECT,
+			SCENE_OBJECT_COUNT,
+		};
+		static constexpr std::array<const char*, SCENE_OBJECT_COUNT> SCENE_OBJECT_NAMES = {
+			"plane",
+			"tree",
+		};
+
+		static constexpr float CAMERA_NEAR = 0.1f;
+		static constexpr float CAMERA_FAR = 100.0f;
 		const unsigned int SHADOW_WIDTH = 1024;
 		const unsigned int SHADOW_HEIGHT = 1024;
-		unsigned int depthMapFBO;
-		unsigned int depthMap;
-		unsigned int woodTexture;
-		unsigned int planeVBO;
-		unsigned int planeVAO;
+		GlTexture woodTexture;
+		GlBuffer planeVBO;
+		GlVertexArray planeVAO;
 
 		float time_ = 0.0f;
 		float delta_time_ = 0.0f;
 
 		std::unique_ptr<Model> tree_ = nullptr;
+		// scattered over the plane, drawn with one instanced draw per cell.
+		std::unique_ptr<Model> grass_;
+		std::unique_ptr<InstanceBuffer> grassInstances_;
 		std::unique_ptr<Camera> camera_ = nullptr;
-		std::unique_ptr<Shader> mainShaders_ = nullptr;
-		std::unique_ptr<Shader> depthShaders_ = nullptr;
+		// one program per combination of the features below.
+		std::unique_ptr<ShaderVariants> mainShaders_;
+		bool softShadows_ = true;
+		// lets the materials with a normal map use it, see
+		// Model::MaterialFeatures.
+		bool normalMapping_ = false;
+		std::unique_ptr<ShaderVariants> depthShaders_;
 		std::unique_ptr<Cubemap> skybox_;
 
 		std::unique_ptr<Shader> skyboxShaders_ = nullptr;
+		std::unique_ptr<UniformBlocks> uniformBlocks_;
+		std::unique_ptr<ShaderWatcher> shaderWatcher_;
+		std::unique_ptr<FrameGraph> frameGraph_;
+		// the draws of every pass, sorted once per frame.
+		RenderQueue renderQueue_;
+		// one job per pass on the ThreadPool, off for comparing with the
+		// serial recording.
+		bool parallelRecording_ = true;
+		// world boxes of the scene objects, queried with the frustum of
+		// every pass and for picking.
+		Bvh sceneBvh_;
+		std::uint32_t pickedObject_ = Bvh::NO_OBJECT;
+		// the boxes of the objects around their origin.
+		std::array<Aabb, SCENE_OBJECT_COUNT> localBounds_;
+		// placement of the scene objects, the world and normal matrices
+		// are only recomputed for the ones that moved.
+		TransformStore transforms_;
+		std::size_t transformUpdates_ = 0;
 
 		std::vector<std::string> texturesFaces_;
 
@@ -68,38 +149,57 @@ namespace gl {
 		glm::vec3 lightPosition_ = glm::vec3(0.0, 20.0, 30.0);
 		glm::vec3 lightDir_ = glm::normalize(glm::vec3(-1.0, -1.0, 1.0));
 
-		glm::mat4 model_ = glm::mat4(1.0f);
 		glm::mat4 view_ = glm::mat4(1.0f);
 		glm::mat4 projection_ = glm::mat4(1.0f);
-		glm::mat4 inv_model_ = glm::mat4(1.0f);
+
+		// largest projected simplification error allowed, in pixels.
+		float lodThreshold_ = 1.0f;
+		float shadowLodThreshold_ = 4.0f;
+		std::size_t sceneTriangles_ = 0;
+		std::size_t shadowTriangles_ = 0;
+		// state calls of the previous frame.
+		GlState::Stats glStats_ = {};
 
 		std::string path_ = "";
 	};
 
-	void HelloScene::IsError(const std::string& file, int line) const
-	{
-		auto error_code = glGetError();
-		if (error_code != GL_NO_ERROR)
-		{
-			throw std::runtime_error(
-				std::to_string(error_code) +
-				" in file: " + file +
-				" at line: " + std::to_string(line));
-		}
-	}
-
 	void HelloScene::Init()
 	{
+		// built by assetpack, the loose files under data/ are used when
+		// there is no archive.
+		AssetFileSystem::Global().Mount(path_ + "data.pak");
+		// linked programs of the previous run.
+		ProgramBinaryCache::Global().SetDirectory(path_ + "shader_cache");
+
 		glEnable(GL_DEPTH_TEST);
 
 		camera_ = std::make_unique<Camera>(glm::vec3(0.0f, 10.0f, 50.0f));
 
-		mainShaders_ = std::make_unique<Shader>(
+		// edits of data/shaders are picked up while running.
+		shaderWatcher_ = std::make_unique<ShaderWatcher>();
+
+		mainShaders_ = std::make_unique<ShaderVariants>(
 			path_ + "data/shaders/shadow.vert",
-			path_ + "data/shaders/shadow.frag");
-		depthShaders_ = std::make_unique<Shader>(
+			path_ + "data/shaders/shadow.frag",
+			"",
+			SetupMainShader,
+			shaderWatcher_.get());
+		// the variants the settings window can switch to, the others would
+		// be compiled on first use.
+		mainShaders_->Precompile({
+			{},
+			{ ShaderFeature::SOFT_SHADOWS },
+			{ ShaderFeature::NORMAL_MAPPING },
+			{ ShaderFeature::SOFT_SHADOWS, ShaderFeature::NORMAL_MAPPING },
+			{ ShaderFeature::SOFT_SHADOWS, ShaderFeature::INSTANCED } });
+		depthShaders_ = std::make_unique<ShaderVariants>(
 			path_ + "data/shaders/depthmap.vert",
-			path_ +"data/shaders/depthmap.frag");
+			path_ + "data/shaders/depthmap.frag",
+			"",
+			ShaderWatcher::ReloadCallback(),
+			shaderWatcher_.get());
+		depthShaders_->Precompile({ {}, { ShaderFeature::INSTANCED } });
+		uniformBlocks_ = std::make_unique<UniformBlocks>(PASS_COUNT);
 		
 		//plane
 		float planeVertices[] = {
@@ -113,10 +213,10 @@ namespace gl {
 			 25.0f, -0.5f, -25.0f,  0.0f, 1.0f, 0.0f,  1.0f, 1.0f
 		};
 
-		glGenVertexArrays(1, &planeVAO);
-		glGenBuffers(1, &planeVBO);
-		glBindVertexArray(planeVAO);
-		glBindBuffer(GL_ARRAY_BUFFER, planeVBO);
+		planeVAO = GlVertexArray::Create();
+		planeVBO = GlBuffer::Create();
+		GlState::Global().BindVertexArray(planeVAO.Get());
+		GlState::Global().BindBuffer(GL_ARRAY_BUFFER, planeVBO.Get());
 		glBufferData(GL_ARRAY_BUFFER, sizeof(planeVertices), planeVertices, GL_STATIC_DRAW);
 		glEnableVertexAttribArray(0);
 		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)0);
@@ -124,19 +224,47 @@ namespace gl {
 		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(3 * sizeof(float)));
 		glEnableVertexAttribArray(2);
 		glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(6 * sizeof(float)));
-		glBindVertexArray(0);
+		GlState::Global().BindVertexArray(0);
 
 		//tree
 		tree_ = std::make_unique<Model>(path_ + "data/meshes/tree.obj");
+
+		glm::mat4 treeMatrix = glm::mat4(1.0f);
+		treeMatrix = glm::translate(treeMatrix, glm::vec3(0.0f, -2.0f, 0.0f));
+		treeMatrix = glm::rotate(treeMatrix, glm::radians(90.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+		treeMatrix = glm::scale(treeMatrix, glm::vec3(1.5f, 1.5f, 1.5f));
+		// created in SceneObject order.
+		transforms_.Create();
+		transforms_.Create(treeMatrix);
+		transforms_.Update();
+		localBounds_[PLANE_OBJECT] = Aabb::FromCenterExtent(glm::vec3(0.0f, -0.5f, 0.0f), glm::vec3(25.0f, 0.0f, 25.0f));
+		localBounds_[TREE_OBJECT] = tree_->Bounds(glm::mat4(1.0f));
+		std::array<Aabb, SCENE_OBJECT_COUNT> sceneBounds;
+		for (std::uint32_t object = 0; object < SCENE_OBJECT_COUNT; ++object)
+		{
+			sceneBounds[object] = localBounds_[object].Transformed(transforms_.World(object));
+		}
+		sceneBvh_.Build(sceneBounds);
+
+		//grass
+		grass_ = std::make_unique<Model>(path_ + "data/meshes/grass_low_poly.obj");
+		ScatterSettings grassScatter;
+		grassScatter.count = 20000;
+		grassScatter.areaMin = glm::vec2(-25.0f);
+		grassScatter.areaMax = glm::vec2(25.0f);
+		grassScatter.cellSize = 5.0f;
+		grassScatter.height = [](float, float) { return -0.5f; };
+		const ScatteredInstances grass = InstanceScatter::Generate(grassScatter);
+		grassInstances_ = std::make_unique<InstanceBuffer>(grass.transforms, grass.cells);
 		
-		woodTexture = LoadBasicTexture((path_ + "data/textures/wood.png").c_str());
+		woodTexture.Reset(LoadBasicTexture((path_ + "data/textures/wood.png").c_str()));
 		
 		//skybox
 		skyboxShaders_ = std::make_unique<Shader>(
 			path_ + "data/shaders/skyboxShader.vert",
 			path_ + "data/shaders/skyboxShader.frag");
-		skyboxShaders_->Use();
-		skyboxShaders_->SetInt("skybox", 0);
+		SetupSkyboxShader(*skyboxShaders_);
+		shaderWatcher_->Watch(*skyboxShaders_, SetupSkyboxShader);
 		
 		
 		texturesFaces_ = {
@@ -150,33 +278,20 @@ namespace gl {
 
 		skybox_ = std::make_unique<Cubemap>(texturesFaces_);
 
-		//depthmap
-		glGenFramebuffers(1, &depthMapFBO);
-		// create depth texture
-		glGenTextures(1, &depthMap);
-		glBindTexture(GL_TEXTURE_2D, depthMap);
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT, SHADOW_WIDTH, SHADOW_HEIGHT, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
-		float borderColor[] = { 1.0, 1.0, 1.0, 1.0 };
-		glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, borderColor);
-		// attach depth texture as FBO's depth buffer
-		glBindFramebuffer(GL_FRAMEBUFFER, depthMapFBO);
-		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depthMap, 0);
-		GLenum drawBuffer = GL_NONE;
-		glDrawBuffers(0, &drawBuffer);
-		glReadBuffer(GL_NONE);
-		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		// the shadow map is a transient target of the frame graph.
+		frameGraph_ = std::make_unique<FrameGraph>();
+	}
 
-		
+	void HelloScene::SetupMainShader(Shader& shader)
+	{
+		MaterialArrays::SetSamplerUnits(shader);
+		shader.SetInt("shadowMap", 1);
 	}
 
-	void HelloScene::SetModelMatrix(seconds dt)
+	void HelloScene::SetupSkyboxShader(Shader& shader)
 	{
-		model_ = glm::rotate(glm::mat4(1.0f), time_, glm::vec3(0.f, 1.f, 0.f));
-		inv_model_ = glm::transpose(glm::inverse(model_));
+		shader.Use();
+		shader.SetInt("skybox", 0);
 	}
 
 	void HelloScene::SetViewMatrix()
@@ -189,18 +304,8 @@ namespace gl {
 		projection_ = glm::perspective(
 			glm::radians(45.0f),
 			4.0f / 3.0f,
-			0.1f,
-			100.f);
-	}
-
-	void HelloScene::SetUniformMatrix() const
-	{
-		mainShaders_->Use();
-		mainShaders_->SetMat4("model", model_);
-		mainShaders_->SetMat4("view", view_);
-		mainShaders_->SetMat4("projection", projection_);
-		mainShaders_->SetMat4("inv_model", inv_model_);
-		mainShaders_->SetVec3("camera_position", camera_->position);
+			CAMERA_NEAR,
+			CAMERA_FAR);
 	}
 
 	void HelloScene::Update(seconds dt, SDL_Window* window)
@@ -211,57 +316,207 @@ namespace gl {
 		windowSize_ = glm::vec2(x, y);
 		
 		delta_time_ = dt.count();
+		glStats_ = GlState::Global().GetStats();
+		GlState::Global().ResetStats();
+		shaderWatcher_->Update();
 		time_ += delta_time_;
 
 		camera_->SetState(glm::vec3(50.0f * cos(time_), 6.0f, 50.0f * sin(time_)), glm::normalize(-glm::vec3(cos(time_), 0.0f, sin(time_))));
 
-		glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
-		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-		
 		glm::mat4 lightProjection, lightView;
 		glm::mat4 lightSpaceMatrix;
 		float nearPlane = 1.0f;
 		float farPlane = 100.0f;
 
+		const glm::vec3 lightEye = glm::vec3(-1.0f, 12.0f, -15.0f) - (50.0f * lightDir_);
 		lightProjection = glm::ortho(-50.0f, 50.0f, -50.0f, 50.0f, nearPlane, farPlane);
-		lightView = glm::lookAt(glm::vec3(-1.0f, 12.0f, -15.0f) - (50.0f * lightDir_),glm::vec3(-1.0f, 12.0f, -15.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+		lightView = glm::lookAt(lightEye, glm::vec3(-1.0f, 12.0f, -15.0f), glm::vec3(0.0f, 1.0f, 0.0f));
 		lightSpaceMatrix = lightProjection * lightView;
 
+		SetProjectionMatrix();
+		SetViewMatrix();
+		// the objects that moved refit the tree, it is rebuilt once the
+		// refits made it too loose.
+		const std::span<const TransformStore::Entity> moved = transforms_.Update();
+		transformUpdates_ = moved.size();
+		for (TransformStore::Entity object : moved)
+		{
+			sceneBvh_.Update(object, localBounds_[object].Transformed(transforms_.World(object)));
+		}
+		if (!moved.empty() && sceneBvh_.NeedsRebuild())
+		{
+			sceneBvh_.Rebuild();
+		}
+
+		// every block of every program in a single write.
+		FrameUniforms& frame = uniformBlocks_->Frame();
+		frame.view = view_;
+		frame.projection = projection_;
+		frame.viewPos = glm::vec4(camera_->position, 1.0f);
+		LightUniforms& light = uniformBlocks_->Light();
+		light.lightSpaceMatrix = lightSpaceMatrix;
+		light.lightDir = glm::vec4(lightDir_, 0.0f);
+		uniformBlocks_->Pass(SHADOW_PASS).viewProjection = lightSpaceMatrix;
+		uniformBlocks_->Pass(MAIN_PASS).viewProjection = projection_ * view_;
+		uniformBlocks_->Upload();
+
+		ShaderFeatures features;
+		features.Set(ShaderFeature::SOFT_SHADOWS, softShadows_);
+		ShaderFeatures modelFeatures = features;
+		modelFeatures.Set(ShaderFeature::NORMAL_MAPPING, normalMapping_);
+		ShaderFeatures grassFeatures = modelFeatures;
+		grassFeatures.Set(ShaderFeature::INSTANCED);
+		const LodSelector shadowLods =
+			LodSelector::Orthographic(100.0f, SHADOW_HEIGHT, shadowLodThreshold_);
+		const LodSelector sceneLods = LodSelector::Perspective(
+			camera_->position,
+			glm::radians(45.0f),
+			windowSize_.y,
+			lodThreshold_);
+		// what is fully outside them is neither submitted nor drawn, the
+		// objects in the light frustum are the shadow casters.
+		const Frustum shadowFrustum(lightSpaceMatrix);
+		const Frustum sceneFrustum(projection_ * view_);
+
+		// the draws of both passes, sorted by state and front to back. The
+		// variants the materials may pick are compiled here, the recording
+		// only finds them.
+		mainShaders_->Get(features);
+		mainShaders_->Get(modelFeatures);
+		depthShaders_->Get({});
+		struct PassRecording
+		{
+			const ShaderVariants* shaders;
+			ShaderFeatures features;
+			const LodSelector* lodSelector;
+			glm::vec3 viewPos;
+			const Frustum* frustum;
+			std::size_t triangles = 0;
+		};
+		std::array<PassRecording, PASS_COUNT> recordings = {{
+			{ depthShaders_.get(), {}, &shadowLods, lightEye, &shadowFrustum },
+			{ mainShaders_.get(), modelFeatures, &sceneLods, camera_->position, &sceneFrustum },
+		}};
+		const auto recordPass = [this, &recordings](DrawList& list, std::size_t pass)
+		{
+			PassRecording& recording = recordings[pass];
+			recording.triangles = SubmitScene(
+				list,
+				static_cast<std::uint32_t>(pass),
+				*recording.shaders,
+				recording.features,
+				*recording.lodSelector,
+				recording.viewPos,
+				*recording.frustum);
+		};
+		renderQueue_.Clear();
+		renderQueue_.SetDepthRange(SHADOW_PASS, nearPlane, farPlane);
+		renderQueue_.SetDepthRange(MAIN_PASS, CAMERA_NEAR, CAMERA_FAR);
+		if (parallelRecording_)
+		{
+			renderQueue_.RecordParallel(ThreadPool::Global(), PASS_COUNT, recordPass);
+		}
+		else
+		{
+			renderQueue_.Record(PASS_COUNT, recordPass);
+		}
+		shadowTriangles_ = recordings[SHADOW_PASS].triangles;
+		sceneTriangles_ = recordings[MAIN_PASS].triangles;
+		renderQueue_.Sort();
+
+		// the passes of the frame, the graph orders them from what they
+		// read and write, binds their targets and clears them.
+		frameGraph_->Reset();
+		FrameGraphResource backbuffer = frameGraph_->ImportBackbuffer(
+			"backbuffer",
+			static_cast<GLsizei>(windowSize_.x),
+			static_cast<GLsizei>(windowSize_.y),
+			true,
+			glm::vec4(0.1f, 0.1f, 0.1f, 1.0f));
+		FrameGraphResource shadowMap;
+
 		//render from light's pov
-		depthShaders_->Use();
-		depthShaders_->SetMat4("lightSpaceMatrix", lightSpaceMatrix);
-
-		glViewport(0, 0, SHADOW_WIDTH, SHADOW_HEIGHT);
-		glBindFramebuffer(GL_FRAMEBUFFER, depthMapFBO);
-		glClear(GL_DEPTH_BUFFER_BIT);
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, woodTexture);
-		RenderScene(depthShaders_);
-		glBindFramebuffer(GL_FRAMEBUFFER, 0);
-		glViewport(0, 0, windowSize_.x, windowSize_.y);
-		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+		frameGraph_->AddPass("shadow", [&](FrameGraph::Builder& builder)
+		{
+			RenderTargetDesc desc;
+			desc.width = SHADOW_WIDTH;
+			desc.height = SHADOW_HEIGHT;
+			desc.internalFormat = GL_DEPTH_COMPONENT24;
+			desc.filter = GL_NEAREST;
+			desc.wrap = GL_CLAMP_TO_BORDER;
+			desc.borderColor = glm::vec4(1.0f);
+			desc.clearValue = glm::vec4(1.0f);
+			shadowMap = builder.Write(builder.Create("shadow map", desc));
+		},
+		[this, shadowLods, shadowFrustum](const FrameGraph::Resources&)
+		{
+			uniformBlocks_->BindPass(SHADOW_PASS);
+			renderQueue_.Execute(SHADOW_PASS);
+			std::unique_ptr<Shader>& grassShader = depthShaders_->Get({ ShaderFeature::INSTANCED });
+			grassShader->Use();
+			shadowTriangles_ += grass_->DrawInstanced(grassShader, *grassInstances_, shadowLods, shadowFrustum);
+		});
 
 		//render scene as normal
-		mainShaders_->Use();
-		SetProjectionMatrix();
-		SetViewMatrix();
-		mainShaders_->SetMat4("projection", projection_);
-		mainShaders_->SetMat4("view", view_);
-		mainShaders_->SetVec3("viewPos", camera_->position);
-		mainShaders_->SetVec3("lightDir", lightDir_);
-		mainShaders_->SetMat4("lightSpaceMatrix", lightSpaceMatrix);
-		mainShaders_->SetInt("shadowMap", 1);
-
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, woodTexture);
-		glActiveTexture(GL_TEXTURE1);
-		glBindTexture(GL_TEXTURE_2D, depthMap);
-		RenderScene(mainShaders_);
-
-		skybox_->Draw(skyboxShaders_, view_, projection_, camera_);
+		frameGraph_->AddPass("main", [&](FrameGraph::Builder& builder)
+		{
+			builder.Read(shadowMap);
+			backbuffer = builder.Write(backbuffer);
+		},
+		[this, shadowMap, grassFeatures, sceneLods, sceneFrustum](const FrameGraph::Resources& resources)
+		{
+			uniformBlocks_->BindPass(MAIN_PASS);
+			GlState::Global().BindTexture(1, GL_TEXTURE_2D, resources.Texture(shadowMap));
+			renderQueue_.Execute(MAIN_PASS);
+			// the grass gets the normal mapping from its own materials.
+			sceneTriangles_ += grass_->DrawInstanced(
+				*mainShaders_,
+				grassFeatures,
+				*grassInstances_,
+				sceneLods,
+				sceneFrustum);
+		});
+
+		frameGraph_->AddPass("skybox", [&](FrameGraph::Builder& builder)
+		{
+			backbuffer = builder.Write(backbuffer);
+		},
+		[this](const FrameGraph::Resources&)
+		{
+			skybox_->Draw(skyboxShaders_);
+		});
+
+		// ImGui::Render ran before Update, only its draw data is left.
+		frameGraph_->AddPass("imgui", [&](FrameGraph::Builder& builder)
+		{
+			backbuffer = builder.Write(backbuffer);
+		},
+		[](const FrameGraph::Resources&)
+		{
+			ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+		});
+
+		frameGraph_->Compile();
+		frameGraph_->Execute();
 	}
 
-	void HelloScene::Destroy() {}
+	// the GL objects have to go while the context is still alive.
+	void HelloScene::Destroy()
+	{
+		shaderWatcher_.reset();
+		tree_.reset();
+		grass_.reset();
+		grassInstances_.reset();
+		skybox_.reset();
+		mainShaders_.reset();
+		depthShaders_.reset();
+		skyboxShaders_.reset();
+		uniformBlocks_.reset();
+		frameGraph_.reset();
+		woodTexture.Reset();
+		planeVBO.Reset();
+		planeVAO.Reset();
+	}
 
 	void HelloScene::OnEvent(SDL_Event& event)
 	{
@@ -294,17 +549,96 @@ namespace gl {
 					delta_time_);
 			}
 		}
+		if (event.type == SDL_MOUSEBUTTONDOWN &&
+			event.button.button == SDL_BUTTON_LEFT &&
+			!ImGui::GetIO().WantCaptureMouse)
+		{
+			PickObject(event.button.x, event.button.y);
+		}
 	}
 
-	void HelloScene::DrawImGui() {}
+	void HelloScene::DrawImGui()
+	{
+		const TextureCache::Stats textureStats = TextureCache::Global().GetStats();
+		const ProgramBinaryCache::Stats programStats = ProgramBinaryCache::Global().GetStats();
+
+		ImGui::Begin("Scene");
+		ImGui::Text("Textures: %zu resident, %.1f MB",
+			textureStats.residentTextures,
+			textureStats.residentBytes / (1024.0f * 1024.0f));
+		ImGui::Text("Texture cache: %llu hits, %llu misses, %.1f MB uploaded",
+			static_cast<unsigned long long>(textureStats.hits),
+			static_cast<unsigned long long>(textureStats.misses),
+			textureStats.uploadedBytes / (1024.0f * 1024.0f));
+		ImGui::Text("Program binaries: %llu hits, %llu misses, %llu rejected",
+			static_cast<unsigned long long>(programStats.hits),
+			static_cast<unsigned long long>(programStats.misses),
+			static_cast<unsigned long long>(programStats.rejected));
+		ImGui::Text("Shader reloads: %zu", shaderWatcher_->ReloadCount());
+		const FrameGraph::Stats& graphStats = frameGraph_->GetStats();
+		ImGui::Text("Frame graph: %zu passes, %zu culled, %zu targets in %zu textures, %.1f MB",
+			graphStats.passes,
+			graphStats.culledPasses,
+			graphStats.transientTargets,
+			graphStats.textures,
+			graphStats.textureBytes / (1024.0f * 1024.0f));
+		ImGui::Checkbox("Soft shadows", &softShadows_);
+		ImGui::Checkbox("Normal mapping", &normalMapping_);
+		ImGui::SliderFloat("LOD error (px)", &lodThreshold_, 0.0f, 16.0f);
+		ImGui::SliderFloat("Shadow LOD error (px)", &shadowLodThreshold_, 0.0f, 16.0f);
+		ImGui::Text("Triangles: %zu scene, %zu shadow", sceneTriangles_, shadowTriangles_);
+		ImGui::Text("Grass: %zu instances in %zu cells",
+			grassInstances_->InstanceCount(),
+			grassInstances_->Cells().size());
+		ImGui::Text("Scene BVH: %zu objects, %zu nodes, cost %.2f",
+			sceneBvh_.ObjectCount(),
+			sceneBvh_.NodeCount(),
+			sceneBvh_.Cost());
+		ImGui::Text("Transforms: %zu entities, %zu updated",
+			transforms_.Size(),
+			transformUpdates_);
+		ImGui::Text("Picked: %s",
+			pickedObject_ == Bvh::NO_OBJECT ? "nothing" : SCENE_OBJECT_NAMES[pickedObject_]);
+		ImGui::Checkbox("Record passes in parallel", &parallelRecording_);
+		const RenderQueue::Stats& queueStats = renderQueue_.GetStats();
+		ImGui::Text("Render queue: %zu packets, %zu draw calls, %zu program and %zu material changes",
+			queueStats.packets,
+			queueStats.drawCalls,
+			queueStats.programChanges,
+			queueStats.materialChanges);
+		if (ImGui::TreeNode("GL state calls"))
+		{
+			for (std::size_t i = 0; i < glStats_.size(); ++i)
+			{
+				ImGui::Text("%-12s %6llu issued, %6llu filtered",
+					GlState::CALL_NAMES[i],
+					static_cast<unsigned long long>(glStats_[i].issued),
+					static_cast<unsigned long long>(glStats_[i].filtered));
+			}
+			ImGui::TreePop();
+		}
+		ImGui::End();
+	}
 
 	unsigned HelloScene::LoadBasicTexture(char const* path)
 	{
+		CookedTexture cooked;
+		if (OpenCookedTexture(path, cooked))
+		{
+			const unsigned int textureID = UploadCookedTexture(cooked, ColourSpace::LINEAR);
+			if (cooked.HasAlpha())
+			{
+				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+			}
+			return textureID;
+		}
+
 		unsigned int textureID;
 		glGenTextures(1, &textureID);
 
 		int width, height, nrComponents;
-		unsigned char* data = stbi_load(path, &width, &height, &nrComponents, 0);
+		unsigned char* data = LoadAssetImage(path, &width, &height, &nrComponents, 0);
 		if (data)
 		{
 			GLenum format;
@@ -315,7 +649,7 @@ namespace gl {
 			else if (nrComponents == 4)
 				format = GL_RGBA;
 
-			glBindTexture(GL_TEXTURE_2D, textureID);
+			GlState::Global().BindTexture(0, GL_TEXTURE_2D, textureID);
 			glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
 			glGenerateMipmap(GL_TEXTURE_2D);
 
@@ -335,24 +669,80 @@ namespace gl {
 		return textureID;
 	}
 
-	void HelloScene::RenderScene(std::unique_ptr<Shader>& shader)
+	std::size_t HelloScene::SubmitScene(
+		DrawList& list,
+		std::uint32_t pass,
+		const ShaderVariants& shaders,
+		ShaderFeatures features,
+		const LodSelector& lodSelector,
+		const glm::vec3& viewPos,
+		const Frustum& frustum)
 	{
+		std::array<bool, SCENE_OBJECT_COUNT> visible = {};
+		sceneBvh_.QueryFrustum(frustum, [&](std::uint32_t object)
+		{
+			visible[object] = true;
+		});
+
 		//plane
-		glm::mat4 model = glm::mat4(1.0f);
-		shader->SetMat4("model", model);
-		glBindVertexArray(planeVAO);
-		glDrawArrays(GL_TRIANGLES, 0, 6);
+		std::size_t triangles = 0;
+		if (visible[PLANE_OBJECT])
+		{
+			DrawPacket plane;
+			plane.pass = pass;
+			plane.shader = &shaders.Find(ShaderFeatures(features).Set(ShaderFeature::NORMAL_MAPPING, false));
+			plane.material = { BindPlaneMaterial, this, 0 };
+			plane.vertexArray = planeVAO.Get();
+			plane.transform = list.AddTransform(
+				transforms_.World(PLANE_OBJECT),
+				transforms_.Normal(PLANE_OBJECT));
+			plane.depth = 0.0f;
+			plane.kind = DrawKind::ARRAYS;
+			plane.count = 6;
+			list.Submit(plane);
+			triangles += 2;
+		}
 
 		//tree
-		model_ = glm::mat4(1.0f);
-		model_ = glm::translate(model_, glm::vec3(0.0f, -2.0f, 0.0f));
-		model_ = glm::rotate(model_, glm::radians(90.0f), glm::vec3(0.0f, 1.0f, 0.0f));
-		model_ = glm::scale(model_, glm::vec3(1.5f, 1.5f, 1.5f));
+		if (visible[TREE_OBJECT])
+		{
+			triangles += tree_->Submit(
+				list,
+				pass,
+				shaders,
+				features,
+				transforms_.World(TREE_OBJECT),
+				transforms_.Normal(TREE_OBJECT),
+				lodSelector,
+				viewPos,
+				frustum);
+		}
+		return triangles;
+	}
 
-		shader->SetMat4("model", model_);
-		tree_->Draw(shader);
+	// the wood texture and the vertex format of the plane, which is not
+	// quantized.
+	void HelloScene::BindPlaneMaterial(const void* object, std::uint32_t, const Shader& shader)
+	{
+		const HelloScene& scene = *static_cast<const HelloScene*>(object);
+		GlState::Global().BindTexture(0, GL_TEXTURE_2D, scene.woodTexture.Get());
+		shader.SetVec3("positionScale", glm::vec3(1.0f));
+		shader.SetVec3("positionOffset", glm::vec3(0.0f));
+		shader.SetBool("octahedralNormals", false);
+		shader.SetBool("materialArrays", false);
 	}
 
+	void HelloScene::PickObject(int x, int y)
+	{
+		// the pixel on the near and the far plane.
+		const glm::vec2 ndc(2.0f * x / windowSize_.x - 1.0f, 1.0f - 2.0f * y / windowSize_.y);
+		const glm::mat4 inverseViewProjection = glm::inverse(projection_ * view_);
+		const glm::vec4 nearPoint = inverseViewProjection * glm::vec4(ndc, -1.0f, 1.0f);
+		const glm::vec4 farPoint = inverseViewProjection * glm::vec4(ndc, 1.0f, 1.0f);
+		const glm::vec3 origin = glm::vec3(nearPoint) / nearPoint.w;
+		const glm::vec3 ray = glm::vec3(farPoint) / farPoint.w - origin;
+		pickedObject_ = sceneBvh_.Raycast(origin, glm::normalize(ray), glm::length(ray)).object;
+	}
 
 } // End namespace gl.
 
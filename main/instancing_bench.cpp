@@ -0,0 +1,195 @@
+#include <SDL_main.h>
+#include <glad/glad.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "engine.h"
+#include "frustum.h"
+#include "instance_buffer.h"
+#include "instance_scatter.h"
+#include "lod_selector.h"
+#include "material_arrays.h"
+#include "model.h"
+#include "shader.h"
+#include "uniform_blocks.h"
+
+namespace gl {
+
+	// Scatters grass and trees over a hilly terrain, draws them with
+	// Model::DrawInstanced and reports the scatter time and the instances
+	// processed per millisecond of frame, culling and GPU included, then
+	// quits.
+	class InstancingBench : public Program
+	{
+	public:
+		InstancingBench(std::size_t grassCount, std::size_t treeCount, int frames) :
+			grassCount_(grassCount),
+			treeCount_(treeCount),
+			frames_(frames)
+		{
+		}
+
+		void Init() override;
+		void Update(seconds dt, SDL_Window* window) override;
+		void Destroy() override;
+		void OnEvent(SDL_Event&) override {}
+		void DrawImGui() override {}
+
+	protected:
+		using clock = std::chrono::high_resolution_clock;
+
+		static constexpr float AREA = 500.0f;
+
+		static float Milliseconds(clock::time_point start, clock::time_point end)
+		{
+			return std::chrono::duration<float, std::milli>(end - start).count();
+		}
+
+		std::unique_ptr<InstanceBuffer> Scatter(std::size_t count, std::uint32_t seed, float cellSize);
+
+		std::size_t grassCount_;
+		std::size_t treeCount_;
+		int frames_;
+		int frame_ = 0;
+		std::unique_ptr<Model> grass_;
+		std::unique_ptr<Model> tree_;
+		std::unique_ptr<InstanceBuffer> grassInstances_;
+		std::unique_ptr<InstanceBuffer> treeInstances_;
+		std::unique_ptr<Shader> shader_;
+		std::unique_ptr<UniformBlocks> uniformBlocks_;
+		LodSelector lodSelector_;
+		Frustum frustum_;
+		float scatterTime_ = 0.0f;
+		float uploadTime_ = 0.0f;
+		std::size_t triangles_ = 0;
+		std::vector<float> timings_;
+	};
+
+	std::unique_ptr<InstanceBuffer> InstancingBench::Scatter(std::size_t count, std::uint32_t seed, float cellSize)
+	{
+		ScatterSettings settings;
+		settings.seed = seed;
+		settings.count = count;
+		settings.areaMin = glm::vec2(-0.5f * AREA);
+		settings.areaMax = glm::vec2(0.5f * AREA);
+		settings.cellSize = cellSize;
+		settings.height = [](float x, float z)
+		{
+			return 4.0f * std::sin(x * 0.03f) * std::cos(z * 0.02f);
+		};
+
+		const auto start = clock::now();
+		ScatteredInstances instances = InstanceScatter::Generate(settings);
+		const auto scattered = clock::now();
+		auto buffer = std::make_unique<InstanceBuffer>(instances.transforms, std::move(instances.cells));
+		glFinish();
+		scatterTime_ += Milliseconds(start, scattered);
+		uploadTime_ += Milliseconds(scattered, clock::now());
+		return buffer;
+	}
+
+	void InstancingBench::Init()
+	{
+		glEnable(GL_DEPTH_TEST);
+		grass_ = std::make_unique<Model>("data/meshes/grass_low_poly.obj");
+		tree_ = std::make_unique<Model>("data/meshes/tree.obj");
+		shader_ = std::make_unique<Shader>(
+			"data/shaders/shadow.vert",
+			"data/shaders/shadow.frag",
+			"",
+			ShaderFeatures{ ShaderFeature::INSTANCED });
+		MaterialArrays::SetSamplerUnits(*shader_);
+		uniformBlocks_ = std::make_unique<UniformBlocks>(1);
+
+		grassInstances_ = Scatter(grassCount_, 1, 10.0f);
+		treeInstances_ = Scatter(treeCount_, 2, 50.0f);
+
+		const glm::vec3 eye(0.0f, 60.0f, 0.6f * AREA);
+		FrameUniforms& frame = uniformBlocks_->Frame();
+		frame.view = glm::lookAt(eye, glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+		frame.projection = glm::perspective(glm::radians(45.0f), 4.0f / 3.0f, 0.1f, 2000.0f);
+		frame.viewPos = glm::vec4(eye, 1.0f);
+		uniformBlocks_->Light().lightDir = glm::vec4(glm::normalize(glm::vec3(-1.0f, -1.0f, 1.0f)), 0.0f);
+		uniformBlocks_->Pass(0).viewProjection = frame.projection * frame.view;
+		frustum_ = Frustum(frame.projection * frame.view);
+		lodSelector_ = LodSelector::Perspective(eye, glm::radians(45.0f), 768.0f, 1.0f);
+	}
+
+	void InstancingBench::Update(seconds, SDL_Window*)
+	{
+		// the first frames warm up the driver and are not counted.
+		const int warmup = 10;
+		if (frame_ >= warmup + frames_)
+		{
+			SDL_Event quit;
+			quit.type = SDL_QUIT;
+			SDL_PushEvent(&quit);
+			return;
+		}
+
+		const auto start = clock::now();
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+		uniformBlocks_->Upload();
+		uniformBlocks_->BindPass(0);
+		shader_->Use();
+		triangles_ = grass_->DrawInstanced(shader_, *grassInstances_, lodSelector_, frustum_);
+		triangles_ += tree_->DrawInstanced(shader_, *treeInstances_, lodSelector_, frustum_);
+		glFinish();
+		if (frame_ >= warmup)
+		{
+			timings_.push_back(Milliseconds(start, clock::now()));
+		}
+		++frame_;
+	}
+
+	void InstancingBench::Destroy()
+	{
+		const std::size_t cells = grassInstances_->Cells().size() + treeInstances_->Cells().size();
+		grass_.reset();
+		tree_.reset();
+		grassInstances_.reset();
+		treeInstances_.reset();
+		shader_.reset();
+		uniformBlocks_.reset();
+		if (timings_.empty())
+		{
+			return;
+		}
+
+		std::sort(timings_.begin(), timings_.end());
+		const float median = timings_[timings_.size() / 2];
+		const std::size_t instances = grassCount_ + treeCount_;
+		std::cout << grassCount_ << " grass and " << treeCount_ << " trees in "
+			<< cells << " cells over " << AREA << " x " << AREA << "\n";
+		std::cout << "scatter: " << scatterTime_ << " ms, upload: " << uploadTime_ << " ms\n";
+		std::cout << "frame: median " << median << " ms over " << frames_ << " frames, "
+			<< triangles_ << " triangles\n";
+		std::cout << "instances per ms: " << instances / median << "\n";
+	}
+
+} // End namespace gl.
+
+int main(int argc, char** argv)
+{
+	const std::size_t grassCount = argc > 1 ? std::stoul(argv[1]) : 300000;
+	const std::size_t treeCount = argc > 2 ? std::stoul(argv[2]) : 2000;
+	const int frames = std::max(argc > 3 ? std::stoi(argv[3]) : 200, 1);
+	gl::InstancingBench program(grassCount, treeCount, frames);
+	gl::Engine engine(program);
+	try
+	{
+		engine.Run();
+	}
+	catch (std::exception& ex)
+	{
+		std::cerr << ex.what() << std::endl;
+	}
+	return EXIT_SUCCESS;
+}
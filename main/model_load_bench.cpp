@@ -0,0 +1,122 @@
+#include <SDL_main.h>
+#include <glad/glad.h>
+#include <chrono>
+#include <filesystem>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "engine.h"
+#include "model.h"
+
+namespace gl {
+
+	// Times Model construction serial, parallel, and with a cold and warm mesh
+	// cache, then quits.
+	class ModelLoadBench : public Program
+	{
+	public:
+		ModelLoadBench(std::string modelPath, int iterations) :
+			modelPath_(std::move(modelPath)),
+			iterations_(iterations)
+		{
+		}
+
+		void Init() override;
+		void Update(seconds dt, SDL_Window* window) override;
+		void Destroy() override {}
+		void OnEvent(SDL_Event&) override {}
+		void DrawImGui() override {}
+
+	protected:
+		using clock = std::chrono::high_resolution_clock;
+
+		double TimeLoad(const ModelOptions& options, bool removeCache) const;
+		void Report(const std::string& name, const std::vector<double>& timings) const;
+
+		std::string modelPath_;
+		int iterations_;
+	};
+
+	double ModelLoadBench::TimeLoad(const ModelOptions& options, bool removeCache) const
+	{
+		if (removeCache)
+		{
+			std::filesystem::remove(MeshCache::CachePath(modelPath_));
+		}
+		const auto start = clock::now();
+		auto model = std::make_unique<Model>(modelPath_, options);
+		glFinish();
+		const auto end = clock::now();
+		return std::chrono::duration<double, std::milli>(end - start).count();
+	}
+
+	void ModelLoadBench::Report(const std::string& name, const std::vector<double>& timings) const
+	{
+		double total = 0.0;
+		double best = timings.front();
+		for (const double timing : timings)
+		{
+			total += timing;
+			best = std::min(best, timing);
+		}
+		std::cout << name << ": mean " << total / timings.size()
+			<< " ms, best " << best << " ms\n";
+	}
+
+	void ModelLoadBench::Init()
+	{
+		ModelOptions serial;
+		serial.useMeshCache = false;
+		serial.parallelImport = false;
+		ModelOptions noCache;
+		noCache.useMeshCache = false;
+		ModelOptions withCache;
+
+		std::vector<double> serialImport, import, cold, warm;
+		for (int i = 0; i < iterations_; ++i)
+		{
+			serialImport.push_back(TimeLoad(serial, false));
+			import.push_back(TimeLoad(noCache, false));
+			cold.push_back(TimeLoad(withCache, true));
+			warm.push_back(TimeLoad(withCache, false));
+		}
+
+		std::cout << "Model construction of " << modelPath_
+			<< " over " << iterations_ << " iterations, "
+			<< ThreadPool::Global().Size() << " worker threads\n";
+		Report("serial import (no cache)   ", serialImport);
+		Report("parallel import (no cache) ", import);
+		Report("cold (import + cache write)", cold);
+		Report("warm (mapped cache)        ", warm);
+		// every model was destroyed, nothing should be left on the GPU.
+		std::cout << "Textures resident after unloading: "
+			<< TextureCache::Global().GetStats().residentTextures << "\n";
+	}
+
+	void ModelLoadBench::Update(seconds, SDL_Window*)
+	{
+		SDL_Event quit;
+		quit.type = SDL_QUIT;
+		SDL_PushEvent(&quit);
+	}
+
+} // End namespace gl.
+
+int main(int argc, char** argv)
+{
+	const std::string modelPath = argc > 1 ? argv[1] : "data/meshes/tree.obj";
+	const int iterations = argc > 2 ? std::stoi(argv[2]) : 5;
+	gl::ModelLoadBench program(modelPath, iterations);
+	gl::Engine engine(program);
+	try
+	{
+		engine.Run();
+	}
+	catch (std::exception& ex)
+	{
+		std::cerr << ex.what() << std::endl;
+	}
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,152 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "bench.h"
+#include "transform_store.h"
+
+namespace gl {
+
+	// Builds a forest of transforms, moves a share of them and times the
+	// TransformStore update against recomputing every matrix. The matrices
+	// of the kernel of the build are checked against the scalar reference,
+	// up to rounding.
+	class TransformBench
+	{
+	public:
+		TransformBench(std::size_t entityCount, int iterations) :
+			random_(1),
+			timer_(iterations)
+		{
+			// a root every 16 entities, the others below a random earlier
+			// entity.
+			for (std::size_t i = 0; i < entityCount; ++i)
+			{
+				const TransformStore::Entity parent = i % 16 == 0 ?
+					TransformStore::NO_PARENT :
+					static_cast<TransformStore::Entity>(std::uniform_int_distribution<std::size_t>(0, i - 1)(random_));
+				store_.Create(RandomLocal(), parent);
+			}
+			store_.Update();
+		}
+
+		// returns false when a kernel result differs from the reference.
+		bool Run(float movedShare)
+		{
+			std::vector<TransformStore::Entity> all(store_.Size());
+			for (std::size_t i = 0; i < all.size(); ++i)
+			{
+				all[i] = static_cast<TransformStore::Entity>(i);
+			}
+			std::vector<TransformStore::Entity> parents(store_.Size());
+			std::vector<glm::mat4> locals(store_.Size());
+			for (TransformStore::Entity entity : all)
+			{
+				parents[entity] = store_.Parent(entity);
+				locals[entity] = store_.Local(entity);
+			}
+			std::vector<glm::mat4> worlds(store_.Size());
+			std::vector<glm::mat3> normals(store_.Size());
+			const double scalarTime = timer_.Time([&]()
+			{
+				TransformKernel::ComputeScalar(all, parents, locals, worlds, normals);
+			});
+			const double kernelTime = timer_.Time([&]()
+			{
+				TransformKernel::Compute(all, parents, locals, worlds, normals);
+			});
+			std::cout << store_.Size() << " entities, every matrix:\n"
+				<< "  scalar " << scalarTime << " ms, "
+				<< TransformKernel::KernelName() << " " << kernelTime << " ms, x"
+				<< scalarTime / kernelTime << "\n";
+
+			// the same entities move on every iteration.
+			std::uniform_int_distribution<std::size_t> pick(0, store_.Size() - 1);
+			std::vector<TransformStore::Entity> moving(static_cast<std::size_t>(movedShare * store_.Size()));
+			for (TransformStore::Entity& entity : moving)
+			{
+				entity = static_cast<TransformStore::Entity>(pick(random_));
+			}
+			std::size_t updated = 0;
+			const double updateTime = timer_.Time([&]()
+			{
+				for (TransformStore::Entity entity : moving)
+				{
+					store_.SetLocal(entity, RandomLocal());
+				}
+				updated = store_.Update().size();
+			});
+			std::cout << "  " << moving.size() << " moved, " << updated << " updated with their children: "
+				<< updateTime << " ms\n";
+
+			// the reference from the final local matrices.
+			for (TransformStore::Entity entity : all)
+			{
+				locals[entity] = store_.Local(entity);
+			}
+			TransformKernel::ComputeScalar(all, parents, locals, worlds, normals);
+			std::size_t mismatches = 0;
+			for (TransformStore::Entity entity : all)
+			{
+				mismatches += !Close(store_.World(entity), worlds[entity]) ||
+					!Close(glm::mat4(store_.Normal(entity)), glm::mat4(normals[entity]));
+			}
+			if (mismatches > 0)
+			{
+				std::cout << "  " << mismatches << " entities differ from the scalar reference\n";
+			}
+			return mismatches == 0;
+		}
+
+	private:
+		glm::mat4 RandomLocal()
+		{
+			std::uniform_real_distribution<float> position(-10.0f, 10.0f);
+			std::uniform_real_distribution<float> angle(0.0f, 6.2831853f);
+			std::uniform_real_distribution<float> scale(0.8f, 1.25f);
+			glm::mat4 local = glm::translate(
+				glm::mat4(1.0f),
+				glm::vec3(position(random_), position(random_), position(random_)));
+			local = glm::rotate(local, angle(random_), glm::normalize(glm::vec3(
+				position(random_), position(random_), position(random_) + 0.1f)));
+			return glm::scale(local, glm::vec3(scale(random_), scale(random_), scale(random_)));
+		}
+
+		// relative to the largest element, see TransformKernel.
+		static bool Close(const glm::mat4& a, const glm::mat4& b)
+		{
+			float largest = 1.0f;
+			float difference = 0.0f;
+			for (int column = 0; column < 4; ++column)
+			{
+				for (int row = 0; row < 4; ++row)
+				{
+					largest = std::max(largest, std::abs(b[column][row]));
+					difference = std::max(difference, std::abs(a[column][row] - b[column][row]));
+				}
+			}
+			return difference <= 1e-5f * largest;
+		}
+
+		std::mt19937 random_;
+		TransformStore store_;
+		BenchTimer timer_;
+	};
+
+} // End namespace gl.
+
+int main(int argc, char** argv)
+{
+	const std::size_t entityCount = std::max<std::size_t>(argc > 1 ? std::stoul(argv[1]) : 100000, 1);
+	const float movedShare = std::clamp(argc > 2 ? std::stof(argv[2]) : 0.01f, 0.0f, 1.0f);
+	const int iterations = argc > 3 ? std::stoi(argv[3]) : 20;
+	gl::TransformBench bench(entityCount, iterations);
+	return bench.Run(movedShare) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
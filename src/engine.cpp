@@ -2,6 +2,8 @@
 #include <iostream>
 #include <glad/glad.h>
 
+#include "gl_check.h"
+
 #include "imgui.h"
 #include "imgui_impl_opengl3.h"
 #include "imgui_impl_sdl.h"
@@ -18,7 +20,13 @@ void Engine::Init()
 	SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK, SDL_GL_CONTEXT_PROFILE_CORE);
 	SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 4);
 	SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 5);
+#if GL_CHECKS_ENABLED
+	SDL_GL_SetAttribute(
+		SDL_GL_CONTEXT_FLAGS,
+		SDL_GL_CONTEXT_FORWARD_COMPATIBLE_FLAG | SDL_GL_CONTEXT_DEBUG_FLAG);
+#else
 	SDL_GL_SetAttribute(SDL_GL_CONTEXT_FLAGS, SDL_GL_CONTEXT_FORWARD_COMPATIBLE_FLAG);
+#endif
 	SDL_GL_SetAttribute(SDL_GL_ACCELERATED_VISUAL, 1);
 
 
@@ -60,6 +68,7 @@ void Engine::Init()
 		std::cerr << "Failed to initialize OpenGL context\n";
 		assert(false);
 	}
+	GlDebug::Enable();
 	IMGUI_CHECKVERSION();
 	ImGui::CreateContext();
 	ImGuiIO& io = ImGui::GetIO();
@@ -118,7 +127,10 @@ void Engine::Run()
 			DrawImGui();
 			ImGui::Render();
 			program_.Update(dt, window_);
-			ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+			if (!program_.RendersImGui())
+			{
+				ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+			}
 			SDL_GL_SwapWindow(window_);
 		}
 
@@ -0,0 +1,48 @@
+#include <chrono>
+#include <filesystem>
+#include <iostream>
+#include <string>
+
+#include "asset_archive.h"
+
+// Packs a directory into one archive read by AssetFileSystem, run from the
+// repository root after texcook so the cooked textures and mesh caches are
+// packed too.
+//
+// usage: assetpack [directory] [archive]
+//     directory  defaults to data
+//     archive    defaults to data.pak, paths are stored relative to its
+//                directory
+
+int main(int argc, char** argv)
+{
+	const std::string directory = argc > 1 ? argv[1] : "data";
+	const std::string archivePath = argc > 2 ? argv[2] : "data.pak";
+
+	std::error_code error;
+	if (!std::filesystem::is_directory(directory, error))
+	{
+		std::cerr << directory << " is not a directory\n";
+		return EXIT_FAILURE;
+	}
+
+	const auto start = std::chrono::steady_clock::now();
+	if (!gl::AssetArchive::Build(directory, archivePath))
+	{
+		std::cerr << "Could not write " << archivePath << "\n";
+		return EXIT_FAILURE;
+	}
+	const auto end = std::chrono::steady_clock::now();
+
+	gl::AssetArchive archive;
+	if (!archive.Open(archivePath))
+	{
+		std::cerr << archivePath << " is not a valid archive\n";
+		return EXIT_FAILURE;
+	}
+	std::cout << "Packed " << archive.FileCount() << " files from " << directory
+		<< " into " << archivePath << " ("
+		<< std::filesystem::file_size(archivePath) / 1024 << " KiB) in "
+		<< std::chrono::duration<double>(end - start).count() << " s\n";
+	return EXIT_SUCCESS;
+}
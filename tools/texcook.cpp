@@ -0,0 +1,488 @@
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <filesystem>
+#include <future>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+#include <assimp/Importer.hpp>
+#include <assimp/scene.h>
+
+#include "block_compression.h"
+#include "cooked_texture.h"
+#include "texture_cache.h"
+#include "thread_pool.h"
+
+// Offline texture cooker: converts every image under a directory into a
+// .gtex file next to it, holding BC1/BC3/BC5/BC7 blocks for the full mip
+// chain. The runtime loaders pick the cooked file up when it is newer than
+// the image.
+//
+// usage: texcook [--bc7] [--force] [--model file]... [directory]
+//     --bc7      use BC7 instead of BC1/BC3 for the colour textures
+//     --force    cook again even if the .gtex is up to date
+//     --model    read the texture slots from the materials of a model,
+//                every model Assimp can open in data/meshes by default
+//     directory  defaults to data/textures, the textureDirectory of Model
+
+namespace gl {
+
+	struct CookSettings
+	{
+		bool bc7 = false;
+		bool force = false;
+	};
+
+	struct CookResult
+	{
+		std::string path;
+		std::string error;
+		BlockFormat format = BlockFormat::BC1;
+		std::size_t sourceBytes = 0;
+		// uncompressed RGBA8 with mips, what the runtime upload used to cost.
+		std::size_t uncompressedBytes = 0;
+		std::size_t cookedBytes = 0;
+		bool skipped = false;
+	};
+
+	// RGBA image in float, linear for sRGB sources.
+	struct FloatImage
+	{
+		int width = 0;
+		int height = 0;
+		std::vector<std::array<float, 4>> texels;
+
+		std::array<float, 4>& At(int x, int y)
+		{
+			return texels[std::size_t(y) * width + x];
+		}
+		const std::array<float, 4>& At(int x, int y) const
+		{
+			return texels[std::size_t(y) * width + x];
+		}
+	};
+
+	float SrgbToLinear(float value)
+	{
+		return value <= 0.04045f ?
+			value / 12.92f :
+			std::pow((value + 0.055f) / 1.055f, 2.4f);
+	}
+
+	float LinearToSrgb(float value)
+	{
+		return value <= 0.0031308f ?
+			value * 12.92f :
+			1.055f * std::pow(value, 1.0f / 2.4f) - 0.055f;
+	}
+
+	// slot a file is used in by the materials of the models, keyed by the
+	// path relative to the texture directory.
+	using TextureSlots = std::map<std::string, aiTextureType>;
+
+	void CollectModelSlots(const std::string& modelPath, TextureSlots& slots)
+	{
+		Assimp::Importer importer;
+		const aiScene* scene = importer.ReadFile(modelPath, 0);
+		if (!scene)
+		{
+			std::cout << "Could not read " << modelPath << ": " << importer.GetErrorString() << "\n";
+			return;
+		}
+		// the slots Model::CollectMeshTextures loads, plus the normal and
+		// opacity slots some exporters use instead.
+		constexpr aiTextureType textureTypes[] = {
+			aiTextureType_DIFFUSE,
+			aiTextureType_SPECULAR,
+			aiTextureType_HEIGHT,
+			aiTextureType_NORMALS,
+			aiTextureType_OPACITY
+		};
+		for (unsigned int i = 0; i < scene->mNumMaterials; ++i)
+		{
+			aiMaterial* material = scene->mMaterials[i];
+			for (const aiTextureType textureType : textureTypes)
+			{
+				for (unsigned int j = 0; j < material->GetTextureCount(textureType); ++j)
+				{
+					aiString path;
+					material->GetTexture(textureType, j, &path);
+					slots.emplace(
+						std::filesystem::path(path.C_Str()).lexically_normal().generic_string(),
+						textureType);
+				}
+			}
+		}
+	}
+
+	// fallback for images no model references, from the naming used in
+	// data/textures.
+	aiTextureType GuessTextureType(const std::filesystem::path& path)
+	{
+		std::string name = path.stem().string();
+		std::transform(name.begin(), name.end(), name.begin(), [](unsigned char c)
+		{
+			return static_cast<char>(std::tolower(c));
+		});
+		if (name.find("normal") != std::string::npos || name.find("nrm") != std::string::npos)
+		{
+			return aiTextureType_NORMALS;
+		}
+		if (name.find("bump") != std::string::npos || name.find("height") != std::string::npos)
+		{
+			return aiTextureType_HEIGHT;
+		}
+		if (name.find("spec") != std::string::npos)
+		{
+			return aiTextureType_SPECULAR;
+		}
+		if (name.find("opacity") != std::string::npos || name.find("alpha") != std::string::npos)
+		{
+			return aiTextureType_OPACITY;
+		}
+		return aiTextureType_DIFFUSE;
+	}
+
+	bool IsImage(const std::filesystem::path& path)
+	{
+		std::string extension = path.extension().string();
+		std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c)
+		{
+			return static_cast<char>(std::tolower(c));
+		});
+		return extension == ".png" || extension == ".jpg" || extension == ".jpeg" ||
+			extension == ".tga" || extension == ".bmp";
+	}
+
+	// 2x2 box filter, the last row or column is repeated for odd sizes.
+	FloatImage Downsample(const FloatImage& source, bool normalMap)
+	{
+		FloatImage result;
+		result.width = std::max(source.width / 2, 1);
+		result.height = std::max(source.height / 2, 1);
+		result.texels.resize(std::size_t(result.width) * result.height);
+		for (int y = 0; y < result.height; ++y)
+		{
+			const int y0 = std::min(2 * y, source.height - 1);
+			const int y1 = std::min(2 * y + 1, source.height - 1);
+			for (int x = 0; x < result.width; ++x)
+			{
+				const int x0 = std::min(2 * x, source.width - 1);
+				const int x1 = std::min(2 * x + 1, source.width - 1);
+				std::array<float, 4>& texel = result.At(x, y);
+				for (int c = 0; c < 4; ++c)
+				{
+					texel[c] = 0.25f * (
+						source.At(x0, y0)[c] + source.At(x1, y0)[c] +
+						source.At(x0, y1)[c] + source.At(x1, y1)[c]);
+				}
+				if (normalMap)
+				{
+					// averaged normals get shorter, keep them unit length.
+					float n[3];
+					for (int c = 0; c < 3; ++c)
+					{
+						n[c] = texel[c] * 2.0f - 1.0f;
+					}
+					const float length = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+					if (length > 1e-6f)
+					{
+						for (int c = 0; c < 3; ++c)
+						{
+							texel[c] = n[c] / length * 0.5f + 0.5f;
+						}
+					}
+				}
+			}
+		}
+		return result;
+	}
+
+	std::vector<std::uint8_t> EncodeLevel(const FloatImage& image, BlockFormat format, bool srgb)
+	{
+		const int blocksX = (image.width + 3) / 4;
+		const int blocksY = (image.height + 3) / 4;
+		const std::size_t blockBytes = BlockBytes(format);
+		std::vector<std::uint8_t> blocks(std::size_t(blocksX) * blocksY * blockBytes);
+
+		auto toByte = [](float value)
+		{
+			return static_cast<std::uint8_t>(std::lround(std::clamp(value, 0.0f, 1.0f) * 255.0f));
+		};
+		for (int by = 0; by < blocksY; ++by)
+		{
+			for (int bx = 0; bx < blocksX; ++bx)
+			{
+				// texels past the edge repeat the last row or column.
+				bc::Block block;
+				for (int i = 0; i < 16; ++i)
+				{
+					const int x = std::min(bx * 4 + i % 4, image.width - 1);
+					const int y = std::min(by * 4 + i / 4, image.height - 1);
+					const std::array<float, 4>& texel = image.At(x, y);
+					for (int c = 0; c < 3; ++c)
+					{
+						block[i][c] = toByte(srgb ? LinearToSrgb(texel[c]) : texel[c]);
+					}
+					block[i][3] = toByte(texel[3]);
+				}
+
+				std::uint8_t* out = blocks.data() + (std::size_t(by) * blocksX + bx) * blockBytes;
+				switch (format)
+				{
+				case BlockFormat::BC1:
+					bc::EncodeBc1(block, out);
+					break;
+				case BlockFormat::BC3:
+					bc::EncodeBc3(block, out);
+					break;
+				case BlockFormat::BC5:
+					bc::EncodeBc5(block, out);
+					break;
+				case BlockFormat::BC7:
+					bc::EncodeBc7(block, out);
+					break;
+				}
+			}
+		}
+		return blocks;
+	}
+
+	CookResult CookTexture(
+		const std::filesystem::path& source,
+		aiTextureType textureType,
+		const CookSettings& settings)
+	{
+		CookResult result;
+		result.path = source.generic_string();
+		result.sourceBytes = static_cast<std::size_t>(std::filesystem::file_size(source));
+		if (!settings.force && HasCookedTexture(result.path))
+		{
+			result.skipped = true;
+			return result;
+		}
+
+		int width, height, nbChannels;
+		std::unique_ptr<unsigned char, void(*)(void*)> data(
+			stbi_load(result.path.c_str(), &width, &height, &nbChannels, 4),
+			stbi_image_free);
+		if (!data)
+		{
+			result.error = stbi_failure_reason();
+			return result;
+		}
+
+		const std::size_t texelCount = std::size_t(width) * height;
+		bool alpha = false;
+		bool grey = true;
+		for (std::size_t i = 0; i < texelCount; ++i)
+		{
+			const unsigned char* texel = data.get() + i * 4;
+			alpha |= texel[3] != 255;
+			grey &= texel[0] == texel[1] && texel[1] == texel[2];
+		}
+
+		// Model loads bump maps as texture_normal, only the coloured ones
+		// are tangent space normals, grey ones are height maps.
+		const bool normalMap =
+			(textureType == aiTextureType_NORMALS || textureType == aiTextureType_HEIGHT) &&
+			!grey;
+		// same choice as UploadTexture so the mips are filtered in the
+		// space the shader samples in.
+		const bool srgb = ColourSpaceFor(textureType) == ColourSpace::SRGB;
+		if (normalMap)
+		{
+			result.format = BlockFormat::BC5;
+		}
+		else if (settings.bc7)
+		{
+			result.format = BlockFormat::BC7;
+		}
+		else
+		{
+			result.format = alpha ? BlockFormat::BC3 : BlockFormat::BC1;
+		}
+
+		FloatImage image;
+		image.width = width;
+		image.height = height;
+		image.texels.resize(texelCount);
+		for (std::size_t i = 0; i < texelCount; ++i)
+		{
+			const unsigned char* texel = data.get() + i * 4;
+			for (int c = 0; c < 4; ++c)
+			{
+				const float value = texel[c] / 255.0f;
+				image.texels[i][c] = srgb && c < 3 ? SrgbToLinear(value) : value;
+			}
+		}
+		data.reset();
+
+		std::vector<std::vector<std::uint8_t>> levels;
+		while (true)
+		{
+			levels.push_back(EncodeLevel(image, result.format, srgb));
+			result.cookedBytes += levels.back().size();
+			result.uncompressedBytes += std::size_t(image.width) * image.height * 4;
+			if (image.width == 1 && image.height == 1)
+			{
+				break;
+			}
+			image = Downsample(image, normalMap);
+		}
+
+		if (!CookedTexture::Write(
+			CookedTexture::CookedPath(result.path),
+			result.format,
+			srgb,
+			alpha,
+			static_cast<std::uint32_t>(width),
+			static_cast<std::uint32_t>(height),
+			levels))
+		{
+			result.error = "could not write " + CookedTexture::CookedPath(result.path);
+		}
+		return result;
+	}
+
+	const char* FormatName(BlockFormat format)
+	{
+		switch (format)
+		{
+		case BlockFormat::BC1:
+			return "BC1";
+		case BlockFormat::BC3:
+			return "BC3";
+		case BlockFormat::BC5:
+			return "BC5";
+		case BlockFormat::BC7:
+		default:
+			return "BC7";
+		}
+	}
+
+} // End namespace gl.
+
+int main(int argc, char** argv)
+{
+	using namespace gl;
+
+	CookSettings settings;
+	std::vector<std::string> models;
+	std::filesystem::path directory = "data/textures";
+	for (int i = 1; i < argc; ++i)
+	{
+		const std::string argument = argv[i];
+		if (argument == "--bc7")
+		{
+			settings.bc7 = true;
+		}
+		else if (argument == "--force")
+		{
+			settings.force = true;
+		}
+		else if (argument == "--model" && i + 1 < argc)
+		{
+			models.push_back(argv[++i]);
+		}
+		else if (!argument.empty() && argument[0] != '-')
+		{
+			directory = argument;
+		}
+		else
+		{
+			std::cerr << "usage: texcook [--bc7] [--force] [--model file]... [directory]\n";
+			return EXIT_FAILURE;
+		}
+	}
+
+	std::error_code error;
+	if (!std::filesystem::is_directory(directory, error))
+	{
+		std::cerr << directory.generic_string() << " is not a directory\n";
+		return EXIT_FAILURE;
+	}
+
+	if (models.empty())
+	{
+		Assimp::Importer importer;
+		const std::filesystem::path meshDirectory = directory.parent_path() / "meshes";
+		if (std::filesystem::is_directory(meshDirectory, error))
+		{
+			for (const auto& entry : std::filesystem::directory_iterator(meshDirectory))
+			{
+				if (entry.is_regular_file() &&
+					importer.IsExtensionSupported(entry.path().extension().string()))
+				{
+					models.push_back(entry.path().generic_string());
+				}
+			}
+		}
+	}
+	TextureSlots slots;
+	for (const std::string& model : models)
+	{
+		CollectModelSlots(model, slots);
+	}
+
+	const auto start = std::chrono::steady_clock::now();
+	std::vector<std::future<CookResult>> results;
+	for (const auto& entry : std::filesystem::recursive_directory_iterator(directory))
+	{
+		if (!entry.is_regular_file() || !IsImage(entry.path()))
+		{
+			continue;
+		}
+		const std::string relative =
+			entry.path().lexically_relative(directory).lexically_normal().generic_string();
+		auto slot = slots.find(relative);
+		const aiTextureType textureType =
+			slot != slots.end() ? slot->second : GuessTextureType(entry.path());
+		results.push_back(ThreadPool::Global().Submit(
+			[path = entry.path(), textureType, settings]()
+			{
+				return CookTexture(path, textureType, settings);
+			}));
+	}
+
+	std::size_t sourceBytes = 0;
+	std::size_t uncompressedBytes = 0;
+	std::size_t cookedBytes = 0;
+	int failures = 0;
+	for (std::future<CookResult>& future : results)
+	{
+		const CookResult result = future.get();
+		if (!result.error.empty())
+		{
+			std::cout << result.path << ": " << result.error << "\n";
+			++failures;
+			continue;
+		}
+		if (result.skipped)
+		{
+			std::cout << result.path << ": up to date\n";
+			continue;
+		}
+		sourceBytes += result.sourceBytes;
+		uncompressedBytes += result.uncompressedBytes;
+		cookedBytes += result.cookedBytes;
+		std::cout << result.path << ": " << FormatName(result.format) << ", "
+			<< result.cookedBytes / 1024 << " KiB in VRAM instead of "
+			<< result.uncompressedBytes / 1024 << " KiB\n";
+	}
+
+	const auto end = std::chrono::steady_clock::now();
+	if (cookedBytes > 0)
+	{
+		std::cout << "Cooked " << sourceBytes / 1024 << " KiB of images into "
+			<< cookedBytes / 1024 << " KiB of blocks ("
+			<< double(uncompressedBytes) / cookedBytes << "x smaller than RGBA8) in "
+			<< std::chrono::duration<double>(end - start).count() << " s\n";
+	}
+	return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}